@@ -620,6 +620,7 @@ void* animateVoxels(void* args) {
         if (::voxelEditPacketSender) {
             ::voxelEditPacketSender->flushQueue();
         }
+        NodeList::doneWithNodes();
         
         uint64_t end = usecTimestampNow();
         uint64_t elapsedSeconds = (end - ::start) / 1000000;
@@ -740,6 +741,7 @@ int main(int argc, const char * argv[])
             }
             NodeList::getInstance()->processNodeData(&nodePublicAddress, packetData, receivedBytes);
         }
+        NodeList::doneWithNodes();
     }
     
     pthread_join(animateVoxelThread, NULL);
@@ -32,6 +32,7 @@
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/vector_angle.hpp>
 
+#include <EventLoop.h>
 #include <Logstash.h>
 #include <NodeList.h>
 #include <Node.h>
@@ -39,6 +40,8 @@
 #include <PacketHeaders.h>
 #include <SharedUtil.h>
 #include <StdDev.h>
+#include <UDPReceiveBatch.h>
+#include <UDPSendBatch.h>
 
 #include <AudioRingBuffer.h>
 
@@ -67,39 +70,36 @@ void attachNewBufferToNode(Node *newNode) {
 
 bool wantLocalDomain = false;
 
-int main(int argc, const char* argv[]) {
-    setvbuf(stdout, NULL, _IOLBF, 0);
-    
-    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AUDIO_MIXER, MIXER_LISTEN_PORT);
-    
-    // Handle Local Domain testing with the --local command line
-    const char* local = "--local";
-    ::wantLocalDomain = cmdOptionExists(argc, argv,local);
-    if (::wantLocalDomain) {
-        printf("Local Domain MODE!\n");
-        nodeList->setDomainIPToLocalhost();
-    }    
+UDPReceiveBatch* receiveBatch = NULL;
 
-    const char* domainIP = getCmdOption(argc, argv, "--domain");
-    if (domainIP) {
-        NodeList::getInstance()->setDomainHostname(domainIP);
-    }
-    
-    ssize_t receivedBytes = 0;
-    
-    nodeList->linkedDataCreateCallback = attachNewBufferToNode;
-    
-    nodeList->startSilentNodeRemovalThread();
+// every listener's mix for a frame goes out in the same few sendmmsg() calls
+UDPSendBatch* mixSendBatch = NULL;
 
-    unsigned char* packetData = new unsigned char[MAX_PACKET_SIZE];
+float sumFrameTimePercentages = 0.0f;
+int numStatCollections = 0;
 
-    sockaddr* nodeAddress = new sockaddr;
+void checkInWithDomainServer(void* context) {
+    NodeList::getInstance()->sendDomainServerCheckIn();
+    
+    if (Logstash::shouldSendStats() && numStatCollections > 0) {
+        // if we should be sending stats to Logstash send the appropriate average now
+        const char MIXER_LOGSTASH_METRIC_NAME[] = "audio-mixer-frame-time-usage";
+        
+        float averageFrameTimePercentage = sumFrameTimePercentages / numStatCollections;
+        Logstash::stashValue(STAT_TYPE_TIMER, MIXER_LOGSTASH_METRIC_NAME, averageFrameTimePercentage);
+        
+        sumFrameTimePercentages = 0.0f;
+        numStatCollections = 0;
+    }
+}
 
-    // make sure our node socket is non-blocking
-    nodeList->getNodeSocket()->setBlocking(false);
+void mixAudioFrame(void* context) {
+    NodeList* nodeList = NodeList::getInstance();
     
-    int nextFrame = 0;
-    timeval startTime;
+    timeval beginSendTime, endSendTime;
+    if (Logstash::shouldSendStats()) {
+        gettimeofday(&beginSendTime, NULL);
+    }
     
     int numBytesPacketHeader = numBytesForPacketHeader((unsigned char*) &PACKET_TYPE_MIXED_AUDIO);
     unsigned char clientPacket[BUFFER_LENGTH_BYTES_STEREO + numBytesPacketHeader];
@@ -107,253 +107,239 @@ int main(int argc, const char* argv[]) {
     
     int16_t clientSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2] = {};
     
-    gettimeofday(&startTime, NULL);
-    
-    timeval lastDomainServerCheckIn = {};
-    
-    timeval beginSendTime, endSendTime;
-    float sumFrameTimePercentages = 0.0f;
-    int numStatCollections = 0;
-    
-    stk::StkFrames stkFrameBuffer(BUFFER_LENGTH_SAMPLES_PER_CHANNEL, 1);
+    static stk::StkFrames stkFrameBuffer(BUFFER_LENGTH_SAMPLES_PER_CHANNEL, 1);
     
-    // if we'll be sending stats, call the Logstash::socket() method to make it load the logstash IP outside the loop
-    if (Logstash::shouldSendStats()) {
-        Logstash::socket();
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        PositionalAudioRingBuffer* positionalRingBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
+        if (positionalRingBuffer && positionalRingBuffer->shouldBeAddedToMix(JITTER_BUFFER_SAMPLES)) {
+            // this is a ring buffer that is ready to go
+            // set its flag so we know to push its buffer when all is said and done
+            positionalRingBuffer->setWillBeAddedToMix(true);
+        }
     }
     
-    while (true) {
-        if (Logstash::shouldSendStats()) {
-            gettimeofday(&beginSendTime, NULL);
-        }
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
         
-        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
-        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
-            gettimeofday(&lastDomainServerCheckIn, NULL);
-            NodeList::getInstance()->sendDomainServerCheckIn();
-            
-            if (Logstash::shouldSendStats() && numStatCollections > 0) {
-                // if we should be sending stats to Logstash send the appropriate average now
-                const char MIXER_LOGSTASH_METRIC_NAME[] = "audio-mixer-frame-time-usage";
-                
-                float averageFrameTimePercentage = sumFrameTimePercentages / numStatCollections;
-                Logstash::stashValue(STAT_TYPE_TIMER, MIXER_LOGSTASH_METRIC_NAME, averageFrameTimePercentage);
-                
-                sumFrameTimePercentages = 0.0f;
-                numStatCollections = 0;
-            }
-        }
+        const int PHASE_DELAY_AT_90 = 20;
         
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            PositionalAudioRingBuffer* positionalRingBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
-            if (positionalRingBuffer && positionalRingBuffer->shouldBeAddedToMix(JITTER_BUFFER_SAMPLES)) {
-                // this is a ring buffer that is ready to go
-                // set its flag so we know to push its buffer when all is said and done
-                positionalRingBuffer->setWillBeAddedToMix(true);
-            }
-        }
-        
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->getType() == NODE_TYPE_AGENT) {
+            AvatarAudioRingBuffer* nodeRingBuffer = (AvatarAudioRingBuffer*) node->getLinkedData();
             
-            const int PHASE_DELAY_AT_90 = 20;
+            // zero out the client mix for this node
+            memset(clientSamples, 0, sizeof(clientSamples));
             
-            if (node->getType() == NODE_TYPE_AGENT) {
-                AvatarAudioRingBuffer* nodeRingBuffer = (AvatarAudioRingBuffer*) node->getLinkedData();
-                
-                // zero out the client mix for this node
-                memset(clientSamples, 0, sizeof(clientSamples));
-                
-                // loop through all other nodes that have sufficient audio to mix
-                for (NodeList::iterator otherNode = nodeList->begin(); otherNode != nodeList->end(); otherNode++) {
-                    if (((PositionalAudioRingBuffer*) otherNode->getLinkedData())->willBeAddedToMix()
-                        && (otherNode != node || (otherNode == node && nodeRingBuffer->shouldLoopbackForNode()))) {
-                        PositionalAudioRingBuffer* otherNodeBuffer = (PositionalAudioRingBuffer*) otherNode->getLinkedData();
-                        // based on our listen mode we will do this mixing...
-                        if (nodeRingBuffer->isListeningToNode(*otherNode)) {
-                            float bearingRelativeAngleToSource = 0.0f;
-                            float attenuationCoefficient = 1.0f;
-                            int numSamplesDelay = 0;
-                            float weakChannelAmplitudeRatio = 1.0f;
+            // loop through all other nodes that have sufficient audio to mix
+            for (NodeList::iterator otherNode = nodeList->begin(); otherNode != nodeList->end(); otherNode++) {
+                if (((PositionalAudioRingBuffer*) otherNode->getLinkedData())->willBeAddedToMix()
+                    && (otherNode != node || (otherNode == node && nodeRingBuffer->shouldLoopbackForNode()))) {
+                    PositionalAudioRingBuffer* otherNodeBuffer = (PositionalAudioRingBuffer*) otherNode->getLinkedData();
+                    // based on our listen mode we will do this mixing...
+                    if (nodeRingBuffer->isListeningToNode(*otherNode)) {
+                        float bearingRelativeAngleToSource = 0.0f;
+                        float attenuationCoefficient = 1.0f;
+                        int numSamplesDelay = 0;
+                        float weakChannelAmplitudeRatio = 1.0f;
+                    
+                        stk::TwoPole* otherNodeTwoPole = NULL;
+                    
+                        // only do axis/distance attenuation when in normal mode
+                        if (otherNode != node && nodeRingBuffer->getListeningMode() == AudioRingBuffer::NORMAL) {
                         
-                            stk::TwoPole* otherNodeTwoPole = NULL;
+                            glm::vec3 listenerPosition = nodeRingBuffer->getPosition();
+                            glm::vec3 relativePosition = otherNodeBuffer->getPosition() - nodeRingBuffer->getPosition();
+                            glm::quat inverseOrientation = glm::inverse(nodeRingBuffer->getOrientation());
                         
-                            // only do axis/distance attenuation when in normal mode
-                            if (otherNode != node && nodeRingBuffer->getListeningMode() == AudioRingBuffer::NORMAL) {
-                            
-                                glm::vec3 listenerPosition = nodeRingBuffer->getPosition();
-                                glm::vec3 relativePosition = otherNodeBuffer->getPosition() - nodeRingBuffer->getPosition();
-                                glm::quat inverseOrientation = glm::inverse(nodeRingBuffer->getOrientation());
-                            
-                                float distanceSquareToSource = glm::dot(relativePosition, relativePosition);
-                                float radius = 0.0f;
-                            
-                                if (otherNode->getType() == NODE_TYPE_AUDIO_INJECTOR) {
-                                    InjectedAudioRingBuffer* injectedBuffer = (InjectedAudioRingBuffer*) otherNodeBuffer;
-                                    radius = injectedBuffer->getRadius();
-                                    attenuationCoefficient *= injectedBuffer->getAttenuationRatio();
-                                }
+                            float distanceSquareToSource = glm::dot(relativePosition, relativePosition);
+                            float radius = 0.0f;
+                        
+                            if (otherNode->getType() == NODE_TYPE_AUDIO_INJECTOR) {
+                                InjectedAudioRingBuffer* injectedBuffer = (InjectedAudioRingBuffer*) otherNodeBuffer;
+                                radius = injectedBuffer->getRadius();
+                                attenuationCoefficient *= injectedBuffer->getAttenuationRatio();
+                            }
+                        
+                            if (radius == 0 || (distanceSquareToSource > radius * radius)) {
+                                // this is either not a spherical source, or the listener is outside the sphere
                             
-                                if (radius == 0 || (distanceSquareToSource > radius * radius)) {
-                                    // this is either not a spherical source, or the listener is outside the sphere
-                                
-                                    if (radius > 0) {
-                                        // this is a spherical source - the distance used for the coefficient
-                                        // needs to be the closest point on the boundary to the source
-                                                             
-                                        // ovveride the distance to the node with the distance to the point on the
-                                        // boundary of the sphere
-                                        distanceSquareToSource -= (radius * radius);
-                                    
-                                    } else {
-                                        // calculate the angle delivery for off-axis attenuation
-                                        glm::vec3 rotatedListenerPosition = glm::inverse(otherNodeBuffer->getOrientation())
-                                            * relativePosition;
-                                    
-                                        float angleOfDelivery = glm::angle(glm::vec3(0.0f, 0.0f, -1.0f),
-                                                                           glm::normalize(rotatedListenerPosition));
-                                    
-                                        const float MAX_OFF_AXIS_ATTENUATION = 0.2f;
-                                        const float OFF_AXIS_ATTENUATION_FORMULA_STEP = (1 - MAX_OFF_AXIS_ATTENUATION) / 2.0f;
-                                    
-                                        float offAxisCoefficient = MAX_OFF_AXIS_ATTENUATION +
-                                            (OFF_AXIS_ATTENUATION_FORMULA_STEP * (angleOfDelivery / 90.0f));
-                                    
-                                        // multiply the current attenuation coefficient by the calculated off axis coefficient
-                                        attenuationCoefficient *= offAxisCoefficient;
-                                    }
-                                
-                                    glm::vec3 rotatedSourcePosition = inverseOrientation * relativePosition;
-                                
-                                    const float DISTANCE_SCALE = 2.5f;
-                                    const float GEOMETRIC_AMPLITUDE_SCALAR = 0.3f;
-                                    const float DISTANCE_LOG_BASE = 2.5f;
-                                    const float DISTANCE_SCALE_LOG = logf(DISTANCE_SCALE) / logf(DISTANCE_LOG_BASE);
-                                
-                                    // calculate the distance coefficient using the distance to this node
-                                    float distanceCoefficient = powf(GEOMETRIC_AMPLITUDE_SCALAR,
-                                                               DISTANCE_SCALE_LOG +
-                                                               (0.5f * logf(distanceSquareToSource) / logf(DISTANCE_LOG_BASE)) - 1);
-                                    distanceCoefficient = std::min(1.0f, distanceCoefficient);
-                                
-                                    // multiply the current attenuation coefficient by the distance coefficient
-                                    attenuationCoefficient *= distanceCoefficient;
-                                
-                                    // project the rotated source position vector onto the XZ plane
-                                    rotatedSourcePosition.y = 0.0f;
-                                
-                                    // produce an oriented angle about the y-axis
-                                    bearingRelativeAngleToSource = glm::orientedAngle(glm::vec3(0.0f, 0.0f, -1.0f),
-                                                                                      glm::normalize(rotatedSourcePosition),
-                                                                                      glm::vec3(0.0f, 1.0f, 0.0f));
-                                
-                                    const float PHASE_AMPLITUDE_RATIO_AT_90 = 0.5;
+                                if (radius > 0) {
+                                    // this is a spherical source - the distance used for the coefficient
+                                    // needs to be the closest point on the boundary to the source
+                                                         
+                                    // ovveride the distance to the node with the distance to the point on the
+                                    // boundary of the sphere
+                                    distanceSquareToSource -= (radius * radius);
                                 
-                                    // figure out the number of samples of delay and the ratio of the amplitude
-                                    // in the weak channel for audio spatialization
-                                    float sinRatio = fabsf(sinf(glm::radians(bearingRelativeAngleToSource)));
-                                    numSamplesDelay = PHASE_DELAY_AT_90 * sinRatio;
-                                    weakChannelAmplitudeRatio = 1 - (PHASE_AMPLITUDE_RATIO_AT_90 * sinRatio);
+                                } else {
+                                    // calculate the angle delivery for off-axis attenuation
+                                    glm::vec3 rotatedListenerPosition = glm::inverse(otherNodeBuffer->getOrientation())
+                                        * relativePosition;
                                 
-                                    // grab the TwoPole object for this source, add it if it doesn't exist
-                                    TwoPoleNodeMap& nodeTwoPoles = nodeRingBuffer->getTwoPoles();
-                                    TwoPoleNodeMap::iterator twoPoleIterator = nodeTwoPoles.find(otherNode->getNodeID());
+                                    float angleOfDelivery = glm::angle(glm::vec3(0.0f, 0.0f, -1.0f),
+                                                                       glm::normalize(rotatedListenerPosition));
                                 
-                                    if (twoPoleIterator == nodeTwoPoles.end()) {
-                                        // setup the freeVerb effect for this source for this client
-                                        otherNodeTwoPole = nodeTwoPoles[otherNode->getNodeID()] = new stk::TwoPole;
-                                    } else {
-                                        otherNodeTwoPole = twoPoleIterator->second;
-                                    }
+                                    const float MAX_OFF_AXIS_ATTENUATION = 0.2f;
+                                    const float OFF_AXIS_ATTENUATION_FORMULA_STEP = (1 - MAX_OFF_AXIS_ATTENUATION) / 2.0f;
                                 
-                                    // calculate the reasonance for this TwoPole based on angle to source
-                                    float TWO_POLE_CUT_OFF_FREQUENCY = 800.0f;
-                                    float TWO_POLE_MAX_FILTER_STRENGTH = 0.4f;
+                                    float offAxisCoefficient = MAX_OFF_AXIS_ATTENUATION +
+                                        (OFF_AXIS_ATTENUATION_FORMULA_STEP * (angleOfDelivery / 90.0f));
                                 
-                                    otherNodeTwoPole->setResonance(TWO_POLE_CUT_OFF_FREQUENCY,
-                                                                    TWO_POLE_MAX_FILTER_STRENGTH
-                                                                    * fabsf(bearingRelativeAngleToSource) / 180.0f,
-                                                                    true);
+                                    // multiply the current attenuation coefficient by the calculated off axis coefficient
+                                    attenuationCoefficient *= offAxisCoefficient;
                                 }
+                            
+                                glm::vec3 rotatedSourcePosition = inverseOrientation * relativePosition;
+                            
+                                const float DISTANCE_SCALE = 2.5f;
+                                const float GEOMETRIC_AMPLITUDE_SCALAR = 0.3f;
+                                const float DISTANCE_LOG_BASE = 2.5f;
+                                const float DISTANCE_SCALE_LOG = logf(DISTANCE_SCALE) / logf(DISTANCE_LOG_BASE);
+                            
+                                // calculate the distance coefficient using the distance to this node
+                                float distanceCoefficient = powf(GEOMETRIC_AMPLITUDE_SCALAR,
+                                                           DISTANCE_SCALE_LOG +
+                                                           (0.5f * logf(distanceSquareToSource) / logf(DISTANCE_LOG_BASE)) - 1);
+                                distanceCoefficient = std::min(1.0f, distanceCoefficient);
+                            
+                                // multiply the current attenuation coefficient by the distance coefficient
+                                attenuationCoefficient *= distanceCoefficient;
+                            
+                                // project the rotated source position vector onto the XZ plane
+                                rotatedSourcePosition.y = 0.0f;
+                            
+                                // produce an oriented angle about the y-axis
+                                bearingRelativeAngleToSource = glm::orientedAngle(glm::vec3(0.0f, 0.0f, -1.0f),
+                                                                                  glm::normalize(rotatedSourcePosition),
+                                                                                  glm::vec3(0.0f, 1.0f, 0.0f));
+                            
+                                const float PHASE_AMPLITUDE_RATIO_AT_90 = 0.5;
+                            
+                                // figure out the number of samples of delay and the ratio of the amplitude
+                                // in the weak channel for audio spatialization
+                                float sinRatio = fabsf(sinf(glm::radians(bearingRelativeAngleToSource)));
+                                numSamplesDelay = PHASE_DELAY_AT_90 * sinRatio;
+                                weakChannelAmplitudeRatio = 1 - (PHASE_AMPLITUDE_RATIO_AT_90 * sinRatio);
+                            
+                                // grab the TwoPole object for this source, add it if it doesn't exist
+                                TwoPoleNodeMap& nodeTwoPoles = nodeRingBuffer->getTwoPoles();
+                                TwoPoleNodeMap::iterator twoPoleIterator = nodeTwoPoles.find(otherNode->getNodeID());
+                            
+                                if (twoPoleIterator == nodeTwoPoles.end()) {
+                                    // setup the freeVerb effect for this source for this client
+                                    otherNodeTwoPole = nodeTwoPoles[otherNode->getNodeID()] = new stk::TwoPole;
+                                } else {
+                                    otherNodeTwoPole = twoPoleIterator->second;
+                                }
+                            
+                                // calculate the reasonance for this TwoPole based on angle to source
+                                float TWO_POLE_CUT_OFF_FREQUENCY = 800.0f;
+                                float TWO_POLE_MAX_FILTER_STRENGTH = 0.4f;
+                            
+                                otherNodeTwoPole->setResonance(TWO_POLE_CUT_OFF_FREQUENCY,
+                                                                TWO_POLE_MAX_FILTER_STRENGTH
+                                                                * fabsf(bearingRelativeAngleToSource) / 180.0f,
+                                                                true);
+                            }
+                        }
+                    
+                        int16_t* sourceBuffer = otherNodeBuffer->getNextOutput();
+                    
+                        int16_t* goodChannel = (bearingRelativeAngleToSource > 0.0f)
+                            ? clientSamples
+                            : clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
+                        int16_t* delayedChannel = (bearingRelativeAngleToSource > 0.0f)
+                            ? clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL
+                            : clientSamples;
+                    
+                        int16_t* delaySamplePointer = otherNodeBuffer->getNextOutput() == otherNodeBuffer->getBuffer()
+                            ? otherNodeBuffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES - numSamplesDelay
+                            : otherNodeBuffer->getNextOutput() - numSamplesDelay;
+                    
+                        for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
+                            // load up the stkFrameBuffer with this source's samples
+                            stkFrameBuffer[s] = (stk::StkFloat) sourceBuffer[s];
+                        }
+                    
+                        // perform the TwoPole effect on the stkFrameBuffer
+                        if (otherNodeTwoPole) {
+                            otherNodeTwoPole->tick(stkFrameBuffer);
+                        }
+                    
+                        for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
+                            if (s < numSamplesDelay) {
+                                // pull the earlier sample for the delayed channel
+                                int earlierSample = delaySamplePointer[s] * attenuationCoefficient * weakChannelAmplitudeRatio;
+                            
+                                delayedChannel[s] = glm::clamp(delayedChannel[s] + earlierSample,
+                                                               MIN_SAMPLE_VALUE,
+                                                               MAX_SAMPLE_VALUE);
                             }
                         
-                            int16_t* sourceBuffer = otherNodeBuffer->getNextOutput();
-                        
-                            int16_t* goodChannel = (bearingRelativeAngleToSource > 0.0f)
-                                ? clientSamples
-                                : clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
-                            int16_t* delayedChannel = (bearingRelativeAngleToSource > 0.0f)
-                                ? clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL
-                                : clientSamples;
-                        
-                            int16_t* delaySamplePointer = otherNodeBuffer->getNextOutput() == otherNodeBuffer->getBuffer()
-                                ? otherNodeBuffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES - numSamplesDelay
-                                : otherNodeBuffer->getNextOutput() - numSamplesDelay;
+                            int16_t currentSample = stkFrameBuffer[s] * attenuationCoefficient;
                         
-                            for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
-                                // load up the stkFrameBuffer with this source's samples
-                                stkFrameBuffer[s] = (stk::StkFloat) sourceBuffer[s];
-                            }
+                            goodChannel[s] = glm::clamp(goodChannel[s] + currentSample,
+                                                        MIN_SAMPLE_VALUE,
+                                                        MAX_SAMPLE_VALUE);
                         
-                            // perform the TwoPole effect on the stkFrameBuffer
-                            if (otherNodeTwoPole) {
-                                otherNodeTwoPole->tick(stkFrameBuffer);
+                            if (s + numSamplesDelay < BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
+                                int sumSample = delayedChannel[s + numSamplesDelay]
+                                    + (currentSample * weakChannelAmplitudeRatio);
+                                delayedChannel[s + numSamplesDelay] = glm::clamp(sumSample,
+                                                                                 MIN_SAMPLE_VALUE,
+                                                                                 MAX_SAMPLE_VALUE);
                             }
                         
-                            for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
-                                if (s < numSamplesDelay) {
-                                    // pull the earlier sample for the delayed channel
-                                    int earlierSample = delaySamplePointer[s] * attenuationCoefficient * weakChannelAmplitudeRatio;
-                                
-                                    delayedChannel[s] = glm::clamp(delayedChannel[s] + earlierSample,
-                                                                   MIN_SAMPLE_VALUE,
-                                                                   MAX_SAMPLE_VALUE);
-                                }
-                            
-                                int16_t currentSample = stkFrameBuffer[s] * attenuationCoefficient;
-                            
-                                goodChannel[s] = glm::clamp(goodChannel[s] + currentSample,
-                                                            MIN_SAMPLE_VALUE,
-                                                            MAX_SAMPLE_VALUE);
-                            
-                                if (s + numSamplesDelay < BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
-                                    int sumSample = delayedChannel[s + numSamplesDelay]
-                                        + (currentSample * weakChannelAmplitudeRatio);
-                                    delayedChannel[s + numSamplesDelay] = glm::clamp(sumSample,
-                                                                                     MIN_SAMPLE_VALUE,
-                                                                                     MAX_SAMPLE_VALUE);
-                                }
-                            
-                                if (s >= BUFFER_LENGTH_SAMPLES_PER_CHANNEL - PHASE_DELAY_AT_90) {
-                                    // this could be a delayed sample on the next pass
-                                    // so store the affected back in the ARB
-                                    otherNodeBuffer->getNextOutput()[s] = (int16_t) stkFrameBuffer[s];
-                                }
+                            if (s >= BUFFER_LENGTH_SAMPLES_PER_CHANNEL - PHASE_DELAY_AT_90) {
+                                // this could be a delayed sample on the next pass
+                                // so store the affected back in the ARB
+                                otherNodeBuffer->getNextOutput()[s] = (int16_t) stkFrameBuffer[s];
                             }
                         }
                     }
                 }
-                
-                memcpy(clientPacket + numBytesPacketHeader, clientSamples, sizeof(clientSamples));
-                nodeList->getNodeSocket()->send(node->getPublicSocket(), clientPacket, sizeof(clientPacket));
             }
+            
+            memcpy(clientPacket + numBytesPacketHeader, clientSamples, sizeof(clientSamples));
+            mixSendBatch->queue(node->getPublicSocket(), clientPacket, sizeof(clientPacket));
         }
-        
-        // push forward the next output pointers for any audio buffers we used
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            PositionalAudioRingBuffer* nodeBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
-            if (nodeBuffer && nodeBuffer->willBeAddedToMix()) {
-                nodeBuffer->setNextOutput(nodeBuffer->getNextOutput() + BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
-                
-                if (nodeBuffer->getNextOutput() >= nodeBuffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES) {
-                    nodeBuffer->setNextOutput(nodeBuffer->getBuffer());
-                }
-                nodeBuffer->setWillBeAddedToMix(false);
+    }
+    mixSendBatch->flush();
+    
+    // push forward the next output pointers for any audio buffers we used
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        PositionalAudioRingBuffer* nodeBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
+        if (nodeBuffer && nodeBuffer->willBeAddedToMix()) {
+            nodeBuffer->setNextOutput(nodeBuffer->getNextOutput() + BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+            
+            if (nodeBuffer->getNextOutput() >= nodeBuffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES) {
+                nodeBuffer->setNextOutput(nodeBuffer->getBuffer());
             }
+            nodeBuffer->setWillBeAddedToMix(false);
         }
+    }
+    
+    if (Logstash::shouldSendStats()) {
+        // calculate the percentage value for time elapsed for this send (of the max allowable time)
+        gettimeofday(&endSendTime, NULL);
+        
+        float percentageOfMaxElapsed = ((float) (usecTimestamp(&endSendTime) - usecTimestamp(&beginSendTime))
+            / BUFFER_SEND_INTERVAL_USECS) * 100.0f;
+        
+        sumFrameTimePercentages += percentageOfMaxElapsed;
         
-        // pull any new audio data from nodes off of the network stack
-        while (nodeList->getNodeSocket()->receive(nodeAddress, packetData, &receivedBytes) &&
-               packetVersionMatch(packetData)) {
+        numStatCollections++;
+    }
+}
+
+// pull any new audio data from nodes off of the network stack
+void processReceivedPackets(void* context) {
+    NodeList* nodeList = NodeList::getInstance();
+    
+    int packetCount = nodeList->getNodeSocket()->receiveBatch(*receiveBatch);
+    for (int i = 0; i < packetCount; i++) {
+        unsigned char* packetData = receiveBatch->getPacketData(i);
+        ssize_t receivedBytes = receiveBatch->getPacketLength(i);
+        sockaddr* nodeAddress = receiveBatch->getSenderAddress(i);
+        if (packetVersionMatch(packetData)) {
             if (packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO ||
                 packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO) {
 
@@ -365,19 +351,23 @@ int main(int argc, const char* argv[]) {
                                                              nodeAddress,
                                                              NODE_TYPE_AGENT,
                                                              sourceID);
-                
+                if (!avatarNode) {
+                    // the node list is full, drop the packet
+                    continue;
+                }
+        
                 nodeList->updateNodeWithData(nodeAddress, packetData, receivedBytes);
-                
+        
                 if (std::isnan(((PositionalAudioRingBuffer *)avatarNode->getLinkedData())->getOrientation().x)) {
                     // kill off this node - temporary solution to mixer crash on mac sleep
                     avatarNode->setAlive(false);
                 }
             } else if (packetData[0] == PACKET_TYPE_INJECT_AUDIO) {
                 Node* matchingInjector = NULL;
-                
+        
                 for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
                     if (node->getLinkedData()) {
-                       
+               
                         InjectedAudioRingBuffer* ringBuffer = (InjectedAudioRingBuffer*) node->getLinkedData();
                         if (memcmp(ringBuffer->getStreamIdentifier(),
                                    packetData + numBytesForPacketHeader(packetData),
@@ -388,16 +378,20 @@ int main(int argc, const char* argv[]) {
                         }
                     }
                 }
-                
+        
                 if (!matchingInjector) {
                     matchingInjector = nodeList->addOrUpdateNode(NULL,
                                                                  NULL,
                                                                  NODE_TYPE_AUDIO_INJECTOR,
                                                                  nodeList->getLastNodeID());
+                    if (!matchingInjector) {
+                        // the node list is full, drop the packet
+                        continue;
+                    }
                     nodeList->increaseNodeID();
-                    
+            
                 }
-                
+        
                 // give the new audio data to the matching injector node
                 nodeList->updateNodeWithData(matchingInjector, packetData, receivedBytes);
             } else if (packetData[0] == PACKET_TYPE_PING) {
@@ -406,29 +400,51 @@ int main(int argc, const char* argv[]) {
                 nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
             }
         }
-        
-        if (Logstash::shouldSendStats()) {
-            // send a packet to our logstash instance
-            
-            // calculate the percentage value for time elapsed for this send (of the max allowable time)
-            gettimeofday(&endSendTime, NULL);
-            
-            float percentageOfMaxElapsed = ((float) (usecTimestamp(&endSendTime) - usecTimestamp(&beginSendTime))
-                / BUFFER_SEND_INTERVAL_USECS) * 100.0f;
-            
-            sumFrameTimePercentages += percentageOfMaxElapsed;
-            
-            numStatCollections++;
-        }
-        
-        int usecToSleep = usecTimestamp(&startTime) + (++nextFrame * BUFFER_SEND_INTERVAL_USECS) - usecTimestampNow();
-        
-        if (usecToSleep > 0) {
-            usleep(usecToSleep);
-        } else {
-            std::cout << "Took too much time, not sleeping!\n";
-        }
     }
+}
+
+int main(int argc, const char* argv[]) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    
+    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AUDIO_MIXER, MIXER_LISTEN_PORT);
+    
+    // Handle Local Domain testing with the --local command line
+    const char* local = "--local";
+    ::wantLocalDomain = cmdOptionExists(argc, argv,local);
+    if (::wantLocalDomain) {
+        printf("Local Domain MODE!\n");
+        nodeList->setDomainIPToLocalhost();
+    }    
+
+    const char* domainIP = getCmdOption(argc, argv, "--domain");
+    if (domainIP) {
+        NodeList::getInstance()->setDomainHostname(domainIP);
+    }
+    
+    nodeList->linkedDataCreateCallback = attachNewBufferToNode;
+    
+    nodeList->startSilentNodeRemovalThread();
+
+    // make room for a frame's worth of bursts to queue up
+    nodeList->getNodeSocket()->setServerReceiveBufferSize(argc, argv);
+    
+    receiveBatch = new UDPReceiveBatch();
+    mixSendBatch = new UDPSendBatch(nodeList->getNodeSocket());
+    
+    // if we'll be sending stats, call the Logstash::socket() method to make it load the logstash IP outside the loop
+    if (Logstash::shouldSendStats()) {
+        Logstash::socket();
+    }
+    
+    // frames are mixed on a fixed schedule, and packets that arrive in between are read as soon as they do
+    EventLoop eventLoop;
+    eventLoop.addTimer(DOMAIN_SERVER_CHECK_IN_USECS, checkInWithDomainServer, NULL, true);
+    eventLoop.addTimer(BUFFER_SEND_INTERVAL_USECS, mixAudioFrame, NULL, true);
+    eventLoop.watchSocket(nodeList->getNodeSocket(), processReceivedPackets, NULL);
+    eventLoop.run();
+    
+    delete mixSendBatch;
+    delete receiveBatch;
     
     return 0;
 }
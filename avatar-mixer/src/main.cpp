@@ -25,12 +25,16 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <EventLoop.h>
 #include <NodeList.h>
 #include <SharedUtil.h>
 #include <PacketHeaders.h>
 #include <NodeTypes.h>
+#include <PacketBuffer.h>
 #include <StdDev.h>
 #include <UDPSocket.h>
+#include <UDPReceiveBatch.h>
+#include <UDPSendBatch.h>
 
 #include "AvatarData.h"
 
@@ -58,7 +62,7 @@ void attachAvatarDataToNode(Node* newNode) {
 //    3) if we need to rate limit the amount of data we send, we can use a distance weighted "semi-random" function to 
 //       determine which avatars are included in the packet stream
 //    4) we should optimize the avatar data format to be more compact (100 bytes is pretty wasteful).
-void broadcastAvatarData(NodeList* nodeList, sockaddr* nodeAddress) {
+void broadcastAvatarData(NodeList* nodeList, sockaddr* nodeAddress, UDPSendBatch& sendBatch) {
     static unsigned char broadcastPacketBuffer[MAX_PACKET_SIZE];
     static unsigned char avatarDataBuffer[MAX_PACKET_SIZE];
     unsigned char* broadcastPacket = (unsigned char*)&broadcastPacketBuffer[0];
@@ -80,7 +84,7 @@ void broadcastAvatarData(NodeList* nodeList, sockaddr* nodeAddress) {
             } else {
                 packetsSent++;
                 //printf("packetsSent=%d packetLength=%d\n", packetsSent, packetLength);
-                nodeList->getNodeSocket()->send(nodeAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
+                sendBatch.queue(nodeAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
                 
                 // reset the packet
                 currentBufferPosition = broadcastPacket + numHeaderBytes;
@@ -95,73 +99,60 @@ void broadcastAvatarData(NodeList* nodeList, sockaddr* nodeAddress) {
     }
     packetsSent++;
     //printf("packetsSent=%d packetLength=%d\n", packetsSent, packetLength);
-    nodeList->getNodeSocket()->send(nodeAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
+    sendBatch.queue(nodeAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
 }
 
-int main(int argc, const char* argv[]) {
+void checkInWithDomainServer(void* context) {
+    NodeList::getInstance()->sendDomainServerCheckIn();
+}
 
-    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AVATAR_MIXER, AVATAR_LISTEN_PORT);
-    setvbuf(stdout, NULL, _IOLBF, 0);
-    
-    // Handle Local Domain testing with the --local command line
-    const char* local = "--local";
-    if (cmdOptionExists(argc, argv, local)) {
-        printf("Local Domain MODE!\n");
-        nodeList->setDomainIPToLocalhost();
-    }
-    
-    nodeList->linkedDataCreateCallback = attachAvatarDataToNode;
-    
-    nodeList->startSilentNodeRemovalThread();
-    
-    sockaddr* nodeAddress = new sockaddr;
-    ssize_t receivedBytes = 0;
-    
-    unsigned char* packetData = new unsigned char[MAX_PACKET_SIZE];
-    
-    
+UDPReceiveBatch* receiveBatch = NULL;
+UDPSendBatch* sendBatch = NULL;
+
+// whatever a batch of received packets sets off is sent together once they have all been handled
+void processReceivedPackets(void* context) {
+    NodeList* nodeList = NodeList::getInstance();
     uint16_t nodeID = 0;
     Node* avatarNode = NULL;
     
-    timeval lastDomainServerCheckIn = {};
-    // we only need to hear back about avatar nodes from the DS
-    NodeList::getInstance()->setNodeTypesOfInterest(&NODE_TYPE_AGENT, 1);
-    
-    while (true) {
-        
-        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
-        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
-            gettimeofday(&lastDomainServerCheckIn, NULL);
-            NodeList::getInstance()->sendDomainServerCheckIn();
-        }
-        
-        if (nodeList->getNodeSocket()->receive(nodeAddress, packetData, &receivedBytes) &&
-            packetVersionMatch(packetData)) {
+    int packetCount = nodeList->getNodeSocket()->receiveBatch(*receiveBatch);
+    for (int i = 0; i < packetCount; i++) {
+        unsigned char* packetData = receiveBatch->getPacketData(i);
+        ssize_t receivedBytes = receiveBatch->getPacketLength(i);
+        sockaddr* nodeAddress = receiveBatch->getSenderAddress(i);
+        if (packetVersionMatch(packetData)) {
             switch (packetData[0]) {
                 case PACKET_TYPE_HEAD_DATA:
                     // grab the node ID from the packet
                     unpackNodeId(packetData + numBytesForPacketHeader(packetData), &nodeID);
-                    
+                
                     // add or update the node in our list
                     avatarNode = nodeList->addOrUpdateNode(nodeAddress, nodeAddress, NODE_TYPE_AGENT, nodeID);
-                    
+                    if (!avatarNode) {
+                        // the node list is full, drop the packet
+                        break;
+                    }
+                
                     // parse positional data from an node
                     nodeList->updateNodeWithData(avatarNode, packetData, receivedBytes);
                 case PACKET_TYPE_INJECT_AUDIO:
-                    broadcastAvatarData(nodeList, nodeAddress);
+                    broadcastAvatarData(nodeList, nodeAddress, *sendBatch);
                     break;
                 case PACKET_TYPE_AVATAR_VOXEL_URL:
-                case PACKET_TYPE_AVATAR_FACE_VIDEO:
+                case PACKET_TYPE_AVATAR_FACE_VIDEO: {
                     // grab the node ID from the packet
                     unpackNodeId(packetData + numBytesForPacketHeader(packetData), &nodeID);
-                    
-                    // let everyone else know about the update
+                
+                    // let everyone else know about the update, every one of them sent the buffer it arrived in
+                    PacketBuffer* packet = receiveBatch->takePacket(i);
                     for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
                         if (node->getActiveSocket() && node->getNodeID() != nodeID) {
-                            nodeList->getNodeSocket()->send(node->getActiveSocket(), packetData, receivedBytes);
+                            sendBatch->queue(node->getActiveSocket(), packet);
                         }
                     }
+                    packet->release();
                     break;
+                }
                 case PACKET_TYPE_DOMAIN:
                     // ignore the DS packet, for now nodes are added only when they communicate directly with us
                     break;
@@ -172,6 +163,41 @@ int main(int argc, const char* argv[]) {
             }
         }
     }
+    sendBatch->flush();
+}
+
+int main(int argc, const char* argv[]) {
+
+    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AVATAR_MIXER, AVATAR_LISTEN_PORT);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    
+    // Handle Local Domain testing with the --local command line
+    const char* local = "--local";
+    if (cmdOptionExists(argc, argv, local)) {
+        printf("Local Domain MODE!\n");
+        nodeList->setDomainIPToLocalhost();
+    }
+    
+    nodeList->linkedDataCreateCallback = attachAvatarDataToNode;
+    
+    nodeList->startSilentNodeRemovalThread();
+    
+    // make room for bursts to queue up between batches
+    nodeList->getNodeSocket()->setServerReceiveBufferSize(argc, argv);
+    
+    receiveBatch = new UDPReceiveBatch();
+    sendBatch = new UDPSendBatch(nodeList->getNodeSocket());
+    
+    // we only need to hear back about avatar nodes from the DS
+    NodeList::getInstance()->setNodeTypesOfInterest(&NODE_TYPE_AGENT, 1);
+    
+    EventLoop eventLoop;
+    eventLoop.addTimer(DOMAIN_SERVER_CHECK_IN_USECS, checkInWithDomainServer, NULL, true);
+    eventLoop.watchSocket(nodeList->getNodeSocket(), processReceivedPackets, NULL);
+    eventLoop.run();
+    
+    delete sendBatch;
+    delete receiveBatch;
     
     nodeList->stopSilentNodeRemovalThread();
     
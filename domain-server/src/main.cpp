@@ -26,12 +26,13 @@
 
 #include "NodeList.h"
 #include "NodeTypes.h"
+#include "EventLoop.h"
 #include "Logstash.h"
 #include "PacketHeaders.h"
 #include "SharedUtil.h"
+#include "UDPReceiveBatch.h"
 
 const int DOMAIN_LISTEN_PORT = 40102;
-unsigned char packetData[MAX_PACKET_SIZE];
 
 const int NODE_COUNT_STAT_INTERVAL_MSECS = 5000;
 
@@ -46,59 +47,41 @@ unsigned char* addNodeToBroadcastPacket(unsigned char* currentPosition, Node* no
     return currentPosition;
 }
 
-int main(int argc, const char * argv[])
-{
-    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_DOMAIN, DOMAIN_LISTEN_PORT);
-	// If user asks to run in "local" mode then we do NOT replace the IP
-	// with the EC2 IP. Otherwise, we will replace the IP like we used to
-	// this allows developers to run a local domain without recompiling the
-	// domain server
-	bool isLocalMode = cmdOptionExists(argc, argv, "--local");
-	if (isLocalMode) {
-		printf("NOTE: Running in local mode!\n");
-	} else {
-		printf("--------------------------------------------------\n");
-		printf("NOTE: Not running in local mode. \n");
-		printf("If you're a developer testing a local system, you\n");
-		printf("probably want to include --local on command line.\n");
-		printf("--------------------------------------------------\n");
-	}
+// what the event loop's callbacks share
+bool isLocalMode = false;
+in_addr_t serverLocalAddress = 0;
+UDPReceiveBatch receiveBatch;
+unsigned char broadcastPacket[MAX_PACKET_SIZE];
+int numHeaderBytes = 0;
 
-    setvbuf(stdout, NULL, _IOLBF, 0);
-    
-    ssize_t receivedBytes = 0;
+void processDomainServerPackets(void* context) {
+    NodeList* nodeList = NodeList::getInstance();
     char nodeType = '\0';
     
-    unsigned char broadcastPacket[MAX_PACKET_SIZE];
-    int numHeaderBytes = populateTypeAndVersion(broadcastPacket, PACKET_TYPE_DOMAIN);
-    
     unsigned char* currentBufferPos;
     unsigned char* startPointer;
     
     sockaddr_in nodePublicAddress, nodeLocalAddress;
     nodeLocalAddress.sin_family = AF_INET;
     
-    in_addr_t serverLocalAddress = getLocalAddress();
-    
-    nodeList->startSilentNodeRemovalThread();
-    
-    timeval lastStatSendTime = {};
-    
-    while (true) {
-        if (nodeList->getNodeSocket()->receive((sockaddr *)&nodePublicAddress, packetData, &receivedBytes) &&
-            (packetData[0] == PACKET_TYPE_DOMAIN_REPORT_FOR_DUTY || packetData[0] == PACKET_TYPE_DOMAIN_LIST_REQUEST) &&
+    int packetCount = nodeList->getNodeSocket()->receiveBatch(receiveBatch);
+    for (int i = 0; i < packetCount; i++) {
+        unsigned char* packetData = receiveBatch.getPacketData(i);
+        memcpy(&nodePublicAddress, receiveBatch.getSenderAddress(i), sizeof(nodePublicAddress));
+        
+        if ((packetData[0] == PACKET_TYPE_DOMAIN_REPORT_FOR_DUTY || packetData[0] == PACKET_TYPE_DOMAIN_LIST_REQUEST) &&
             packetVersionMatch(packetData)) {
             // this is an RFD or domain list request packet, and there is a version match
             std::map<char, Node *> newestSoloNodes;
-            
+        
             int numBytesSenderHeader = numBytesForPacketHeader(packetData);
-            
+        
             nodeType = *(packetData + numBytesSenderHeader);
             int numBytesSocket = unpackSocket(packetData + numBytesSenderHeader + sizeof(NODE_TYPE),
                                               (sockaddr*) &nodeLocalAddress);
-            
+        
             sockaddr* destinationSocket = (sockaddr*) &nodePublicAddress;
-            
+        
             // check the node public address
             // if it matches our local address we're on the same box
             // so hardcode the EC2 public address for now
@@ -111,23 +94,28 @@ int main(int argc, const char * argv[])
                     destinationSocket = (sockaddr*) &nodeLocalAddress;
 	            }
             }
-            
+        
             Node* newNode = nodeList->addOrUpdateNode((sockaddr*) &nodePublicAddress,
                                                       (sockaddr*) &nodeLocalAddress,
                                                       nodeType,
                                                       nodeList->getLastNodeID());
-            
+        
+            if (!newNode) {
+                // the node list is full, so there's nothing to tell this node until silent ones are cleared out
+                continue;
+            }
+        
             if (newNode->getNodeID() == nodeList->getLastNodeID()) {
                 nodeList->increaseNodeID();
             }
-            
+        
             currentBufferPos = broadcastPacket + numHeaderBytes;
             startPointer = currentBufferPos;
-            
+        
             unsigned char* nodeTypesOfInterest = packetData + numBytesSenderHeader + sizeof(NODE_TYPE)
                 + numBytesSocket + sizeof(unsigned char);
             int numInterestTypes = *(nodeTypesOfInterest - 1);
-            
+        
             if (numInterestTypes > 0) {
                 // if the node has sent no types of interest, assume they want nothing but their own ID back
                 for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
@@ -143,7 +131,7 @@ int main(int argc, const char * argv[])
                             if (nodeType != NODE_TYPE_AGENT || node->getType() != NODE_TYPE_AGENT) {
                                 currentBufferPos = addNodeToBroadcastPacket(currentBufferPos, &(*node));
                             }
-                        
+                    
                         } else {
                             // solo node, we need to only send newest
                             if (newestSoloNodes[node->getType()] == NULL ||
@@ -154,7 +142,7 @@ int main(int argc, const char * argv[])
                         }
                     }
                 }
-                
+            
                 for (std::map<char, Node *>::iterator soloNode = newestSoloNodes.begin();
                      soloNode != newestSoloNodes.end();
                      soloNode++) {
@@ -162,37 +150,69 @@ int main(int argc, const char * argv[])
                     currentBufferPos = addNodeToBroadcastPacket(currentBufferPos, soloNode->second);
                 }
             }
-                        
+                    
             // update last receive to now
             uint64_t timeNow = usecTimestampNow();
             newNode->setLastHeardMicrostamp(timeNow);
-            
+        
             if (packetData[0] == PACKET_TYPE_DOMAIN_REPORT_FOR_DUTY
                 && memchr(SOLO_NODE_TYPES, nodeType, sizeof(SOLO_NODE_TYPES))) {
                 newNode->setWakeMicrostamp(timeNow);
             }
-            
+        
             // add the node ID to the end of the pointer
             currentBufferPos += packNodeId(currentBufferPos, newNode->getNodeID());
-            
+        
             // send the constructed list back to this node
             nodeList->getNodeSocket()->send(destinationSocket,
                                             broadcastPacket,
                                             (currentBufferPos - startPointer) + numHeaderBytes);
         }
-        
-        if (Logstash::shouldSendStats()) {
-            if (usecTimestampNow() - usecTimestamp(&lastStatSendTime) >= (NODE_COUNT_STAT_INTERVAL_MSECS * 1000)) {
-                // time to send our count of nodes and servers to logstash
-                const char NODE_COUNT_LOGSTASH_KEY[] = "ds-node-count";
-                
-                Logstash::stashValue(STAT_TYPE_TIMER, NODE_COUNT_LOGSTASH_KEY, nodeList->getNumAliveNodes());
-                
-                gettimeofday(&lastStatSendTime, NULL);
-            }
-        }
     }
+}
 
-    return 0;
+void sendNodeCountStat(void* context) {
+    // time to send our count of nodes and servers to logstash
+    const char NODE_COUNT_LOGSTASH_KEY[] = "ds-node-count";
+    
+    Logstash::stashValue(STAT_TYPE_TIMER, NODE_COUNT_LOGSTASH_KEY, NodeList::getInstance()->getNumAliveNodes());
 }
 
+int main(int argc, const char * argv[])
+{
+    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_DOMAIN, DOMAIN_LISTEN_PORT);
+	// If user asks to run in "local" mode then we do NOT replace the IP
+	// with the EC2 IP. Otherwise, we will replace the IP like we used to
+	// this allows developers to run a local domain without recompiling the
+	// domain server
+	isLocalMode = cmdOptionExists(argc, argv, "--local");
+	if (isLocalMode) {
+		printf("NOTE: Running in local mode!\n");
+	} else {
+		printf("--------------------------------------------------\n");
+		printf("NOTE: Not running in local mode. \n");
+		printf("If you're a developer testing a local system, you\n");
+		printf("probably want to include --local on command line.\n");
+		printf("--------------------------------------------------\n");
+	}
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    
+    // make room for bursts to queue up between batches
+    nodeList->getNodeSocket()->setServerReceiveBufferSize(argc, argv);
+    
+    numHeaderBytes = populateTypeAndVersion(broadcastPacket, PACKET_TYPE_DOMAIN);
+    
+    serverLocalAddress = getLocalAddress();
+    
+    nodeList->startSilentNodeRemovalThread();
+    
+    EventLoop eventLoop;
+    eventLoop.watchSocket(nodeList->getNodeSocket(), processDomainServerPackets, NULL);
+    if (Logstash::shouldSendStats()) {
+        eventLoop.addTimer(NODE_COUNT_STAT_INTERVAL_MSECS * 1000, sendNodeCountStat, NULL);
+    }
+    eventLoop.run();
+
+    return 0;
+}
@@ -64,6 +64,8 @@ void *receiveNodeData(void *args) {
                     break;
             }
         }
+        
+        NodeList::doneWithNodes();
     }
     
     pthread_exit(0);
@@ -197,6 +199,8 @@ int main(int argc, const char* argv[]) {
             handStateTimer = 0;
         }
         
+        NodeList::doneWithNodes();
+        
         // sleep for the correct amount of time to have data send be consistently timed
         if ((numMicrosecondsSleep = (DATA_SEND_INTERVAL_MSECS * 1000) - (usecTimestampNow() - usecTimestamp(&thisSend))) > 0) {
             usleep(numMicrosecondsSleep);
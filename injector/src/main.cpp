@@ -234,6 +234,8 @@ int main(int argc, char* argv[]) {
                         ::hasInjectedAudioOnce = true;
                     }
                 }
+                
+                NodeList::doneWithNodes();
             }
             
             // stop the node list's threads
@@ -279,6 +279,7 @@ void Application::initializeGL() {
     // create thread for parsing of voxel data independent of the main network and rendering threads
     _voxelProcessor.initialize(_enableProcessVoxelsThread);
     _voxelEditSender.initialize(_enableProcessVoxelsThread);
+    _voxels.getSubtreeCache().initialize(_enableProcessVoxelsThread);
     if (_enableProcessVoxelsThread) {
         qDebug("Voxel parsing thread created.\n");
     }
@@ -1034,6 +1035,9 @@ void Application::idle() {
         // After finishing all of the above work, restart the idle timer, allowing 2ms to process events.
         idleTimer->start(2);
     }
+    
+    // the main thread holds no node between its events
+    NodeList::doneWithNodes();
 }
 void Application::terminate() {
     // Close serial port
@@ -1051,6 +1055,7 @@ void Application::terminate() {
 
     _voxelProcessor.terminate();
     _voxelEditSender.terminate();
+    _voxels.getSubtreeCache().terminate();
 }
 
 static Avatar* processAvatarMessageHeader(unsigned char*& packetData, size_t& dataBytes) {
@@ -1691,6 +1696,7 @@ void Application::update(float deltaTime) {
     if (!_enableProcessVoxelsThread) {
         _voxelProcessor.threadRoutine();
         _voxelEditSender.threadRoutine();
+        _voxels.getSubtreeCache().threadRoutine();
     }
     
     //loop through all the other avatars and simulate them...
@@ -2571,6 +2577,24 @@ void Application::displayStats() {
     }
     
     drawtext(10, statsVerticalOffset + 330, 0.10f, 0, 1.0, 0, avatarMixerStats);
+
+    if (Menu::getInstance()->isOptionChecked(MenuOption::CompressVoxelPackets)) {
+        VoxelPacketCompressor& packetCompressor = _voxels.getPacketCompressor();
+        char compressionStats[200];
+        sprintf(compressionStats, "Voxel Packet Compression: %.2f:1, %lu packets, %.f usecs to decompress",
+                packetCompressor.getCompressionRatio(), packetCompressor.getPacketsDecompressed(),
+                packetCompressor.getAverageDecompressUsecs());
+        drawtext(10, statsVerticalOffset + 350, 0.10f, 0, 1.0, 0, compressionStats);
+    }
+
+    if (Menu::getInstance()->isOptionChecked(MenuOption::VoxelCache)) {
+        VoxelSubtreeCache& subtreeCache = _voxels.getSubtreeCache();
+        char cacheStats[200];
+        sprintf(cacheStats, "Voxel Cache: %d subtrees, %lu restored (%lu KB), %lu added",
+                subtreeCache.getCachedSubtreeCount(), subtreeCache.getSubtreesRestored(),
+                subtreeCache.getBytesRestored() / 1024, subtreeCache.getSubtreesAdded());
+        drawtext(10, statsVerticalOffset + 370, 0.10f, 0, 1.0, 0, cacheStats);
+    }
     drawtext(10, statsVerticalOffset + 450, 0.10f, 0, 1.0, 0, (char *)LeapManager::statusString().c_str());
     
     if (_perfStatsOn) {
@@ -3190,6 +3214,9 @@ void* Application::networkReceive(void* args) {
                         break;
                     case PACKET_TYPE_VOXEL_DATA:
                     case PACKET_TYPE_VOXEL_DATA_MONOCHROME:
+                    case PACKET_TYPE_VOXEL_DATA_COMPRESSED:
+                    case PACKET_TYPE_VOXEL_DATA_CODED_COLORS:
+                    case PACKET_TYPE_VOXEL_SUBTREE_VERSIONS:
                     case PACKET_TYPE_Z_COMMAND:
                     case PACKET_TYPE_ERASE_VOXEL:
                     case PACKET_TYPE_VOXEL_STATS:
@@ -3218,6 +3245,7 @@ void* Application::networkReceive(void* args) {
         } else if (!app->_enableNetworkThread) {
             break;
         }
+        NodeList::doneWithNodes();
     }
     
     if (app->_enableNetworkThread) {
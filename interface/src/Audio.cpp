@@ -320,6 +320,7 @@ int Audio::audioCallback (const void* inputBuffer,
     int16_t* outputRight = static_cast<int16_t**>(outputBuffer)[1];
 
     static_cast<Audio*>(userData)->performIO(inputLeft, outputLeft, outputRight);
+    NodeList::doneWithNodes();
     return paContinue;
 }
 
@@ -389,6 +389,27 @@ Menu::Menu() :
                                            true,
                                            appInstance->getAvatar(),
                                            SLOT(setWantOcclusionCulling(bool)));
+
+    addCheckableActionToQMenuAndActionHash(developerMenu,
+                                           MenuOption::CompressVoxelPackets,
+                                           0,
+                                           false,
+                                           appInstance->getAvatar(),
+                                           SLOT(setWantCompression(bool)));
+
+    addCheckableActionToQMenuAndActionHash(developerMenu,
+                                           MenuOption::CodeVoxelColors,
+                                           0,
+                                           false,
+                                           appInstance->getAvatar(),
+                                           SLOT(setWantColorCoding(bool)));
+
+    addCheckableActionToQMenuAndActionHash(developerMenu,
+                                           MenuOption::VoxelCache,
+                                           0,
+                                           false,
+                                           appInstance->getAvatar(),
+                                           SLOT(setWantVoxelCache(bool)));
     
     addCheckableActionToQMenuAndActionHash(developerMenu, MenuOption::CoverageMap, Qt::SHIFT | Qt::CTRL | Qt::Key_O);
     addCheckableActionToQMenuAndActionHash(developerMenu, MenuOption::CoverageMapV2, Qt::SHIFT | Qt::CTRL | Qt::Key_P);
@@ -118,7 +118,9 @@ namespace MenuOption {
     const QString BandwidthDetails = "Bandwidth Details";
     const QString CheckForUpdates = "Check for Updates...";
     const QString Collisions = "Collisions";
+    const QString CompressVoxelPackets = "Compressed Voxel Packets";
     const QString CopyVoxels = "Copy";
+    const QString CodeVoxelColors = "Coded Voxel Colors";
     const QString CoverageMap = "Render Coverage Map";
     const QString CoverageMapV2 = "Render Coverage Map V2";
     const QString CutVoxels = "Cut";
@@ -188,6 +190,7 @@ namespace MenuOption {
     const QString WebcamTexture = "Webcam Texture";
     const QString Voxels = "Voxels";
     const QString VoxelAddMode = "Add Voxel Mode";
+    const QString VoxelCache = "Voxel Cache";
     const QString VoxelColorMode = "Color Voxel Mode";
     const QString VoxelDeleteMode = "Delete Voxel Mode";
     const QString VoxelGetColorMode = "Get Color Mode";
@@ -0,0 +1,390 @@
+//
+//  VoxelSubtreeCache.cpp
+//  interface
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <vector>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QtCore/QDebug>
+
+#include <NodeList.h>
+#include <OctalCode.h>
+#include <SharedUtil.h>
+#include <VoxelNodeBag.h>
+#include <VoxelTree.h>
+
+#include "VoxelSubtreeCache.h"
+
+const QString SUBTREE_FILE_EXTENSION = ".svo";
+const int HEX_NUMBER_BASE = 16;
+
+VoxelSubtreeCache::VoxelSubtreeCache(int maxCachedSubtrees) :
+    _tree(NULL),
+    _treeLock(NULL),
+    _maxCachedSubtrees(maxCachedSubtrees),
+    _isOpen(false),
+    _checkTree(NULL),
+    _subtreesRestored(0),
+    _bytesRestored(0),
+    _subtreesAdded(0)
+{
+    pthread_mutex_init(&_cacheLock, NULL);
+}
+
+VoxelSubtreeCache::~VoxelSubtreeCache() {
+    terminate();
+    delete _checkTree;
+    pthread_mutex_destroy(&_cacheLock);
+}
+
+void VoxelSubtreeCache::setTree(VoxelTree* tree, pthread_mutex_t* treeLock) {
+    _tree = tree;
+    _treeLock = treeLock;
+}
+
+bool VoxelSubtreeCache::isOpen() {
+    pthread_mutex_lock(&_cacheLock);
+    bool isOpen = _isOpen;
+    pthread_mutex_unlock(&_cacheLock);
+    return isOpen;
+}
+
+int VoxelSubtreeCache::getCachedSubtreeCount() {
+    pthread_mutex_lock(&_cacheLock);
+    int cachedSubtreeCount = _cached.size();
+    pthread_mutex_unlock(&_cacheLock);
+    return cachedSubtreeCount;
+}
+
+void VoxelSubtreeCache::open(const QString& directory) {
+    QDir dir(directory);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        qDebug("couldn't create voxel cache directory %s\n", directory.toLocal8Bit().constData());
+    }
+    _directory = directory;
+    VoxelSubtreeVersions cached;
+    std::map<uint32_t, uint64_t> lastUsed;
+
+    // the files are named <octal code in hex>-<hash in hex>-<voxel count in hex>.svo, and the ones that aren't are
+    // left over from older versions of the cache
+    QFileInfoList files = dir.entryInfoList(QStringList("*" + SUBTREE_FILE_EXTENSION), QDir::Files);
+    foreach (const QFileInfo& file, files) {
+        QStringList parts = file.completeBaseName().split('-');
+        bool validHash = false;
+        bool validVoxelCount = false;
+        VoxelSubtreeVersion version = NO_SUBTREE_VERSION;
+        if (parts.size() == 3) {
+            version.hash = parts.at(1).toULongLong(&validHash, HEX_NUMBER_BASE);
+            version.voxelCount = parts.at(2).toUInt(&validVoxelCount, HEX_NUMBER_BASE);
+        }
+        unsigned char* octalCode = (validHash && validVoxelCount) ? hexStringToOctalCode(parts.at(0)) : NULL;
+        bool validCode = octalCode && VoxelSubtreeVersions::isVersionedSubtree(octalCode);
+        uint32_t key = validCode ? VoxelSubtreeVersions::keyForOctalCode(octalCode) : 0;
+        delete[] octalCode;
+
+        // only the most recently written version of a subtree is kept
+        uint64_t lastModified = file.lastModified().toMSecsSinceEpoch() * 1000;
+        if (!validCode || version == NO_SUBTREE_VERSION ||
+                (cached.getVersionForKey(key) != NO_SUBTREE_VERSION && lastUsed[key] >= lastModified)) {
+            QFile::remove(file.absoluteFilePath());
+            continue;
+        }
+        if (cached.getVersionForKey(key) != NO_SUBTREE_VERSION) {
+            QFile::remove(pathForSubtree(key, cached.getVersionForKey(key)));
+        }
+        cached.setVersionForKey(key, version);
+        lastUsed[key] = lastModified;
+    }
+    qDebug("voxel cache in %s has %d subtrees\n", directory.toLocal8Bit().constData(), cached.size());
+
+    pthread_mutex_lock(&_cacheLock);
+    _cached.swap(cached);
+    _lastUsed.swap(lastUsed);
+    _isOpen = true;
+    pthread_mutex_unlock(&_cacheLock);
+}
+
+// the files hold the same bitstream as SVO files, so they can also be imported
+static void encodeSubtree(VoxelTree* tree, VoxelNode* node, QByteArray& data) {
+    VoxelNodeBag nodeBag;
+    nodeBag.insert(node);
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    while (!nodeBag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        int bytesWritten = tree->encodeTreeBitstream(nodeBag.extract(), outputBuffer, sizeof(outputBuffer), nodeBag,
+                                                     params);
+        data.append((const char*)outputBuffer, bytesWritten);
+    }
+}
+
+static VoxelNode* getSubtreeNode(VoxelTree* tree, uint32_t key) {
+    unsigned char* octalCode = VoxelSubtreeVersions::octalCodeForKey(key);
+    VoxelPositionSize details;
+    voxelDetailsForCode(octalCode, details);
+    delete[] octalCode;
+    return tree->getVoxelAt(details.x, details.y, details.z, details.s);
+}
+
+void VoxelSubtreeCache::processSubtreeVersions(uint16_t voxelServerID, unsigned char* packet, int length) {
+    pthread_mutex_lock(&_cacheLock);
+    if (!_isOpen) {
+        pthread_mutex_unlock(&_cacheLock);
+        return;
+    }
+
+    // the first time a server tells us about its subtrees, it's told what we have
+    VoxelSubtreeVersions cachedToSend;
+    bool sendCached = _serversSentCache.insert(voxelServerID).second;
+    if (sendCached) {
+        cachedToSend = _cached;
+    }
+
+    VoxelSubtreeVersions versions;
+    versions.readFromPacket(packet, length);
+
+    uint64_t now = usecTimestampNow();
+    for (VoxelSubtreeVersions::const_iterator it = versions.begin(); it != versions.end(); it++) {
+        uint32_t key = it->first;
+        const VoxelSubtreeVersion& version = it->second;
+        VoxelNode* node = getSubtreeNode(_tree, key);
+
+        // nothing is done about a subtree while there's a job for it, or while the tree's copy of it is unchanged since
+        // it was last checked against this version
+        std::map<uint32_t, TreeCopy>::const_iterator copy = _treeCopies.find(key);
+        bool copyIsKnown = copy != _treeCopies.end() && copy->second.version == version &&
+            (copy->second.pending || (node && node->getLastChanged() < copy->second.checkedAt));
+
+        Job job;
+        job.key = key;
+        job.version = version;
+        job.voxelServerID = voxelServerID;
+        if (_cached.getVersionForKey(key) == version) {
+            _lastUsed[key] = now;
+            if (copyIsKnown && (copy->second.pending || copy->second.matches)) {
+                continue;
+            }
+            // the server left this one out, so it comes from the cache, in place of whatever the tree has of it
+            job.type = RESTORE_SUBTREE;
+
+        } else if (node && !copyIsKnown) {
+            // the cache's thread hashes the copy to see whether we've been sent all of it
+            job.type = CHECK_SUBTREE;
+            encodeSubtree(_tree, node, job.data);
+
+        } else {
+            continue;
+        }
+        TreeCopy& treeCopy = _treeCopies[key];
+        treeCopy.version = version;
+        treeCopy.checkedAt = now;
+        treeCopy.pending = true;
+        treeCopy.matches = false;
+        _jobs.push_back(job);
+    }
+    pthread_mutex_unlock(&_cacheLock);
+
+    if (sendCached) {
+        sendCachedSubtrees(voxelServerID, cachedToSend, VoxelSubtreeVersions::REPLACE_VERSIONS);
+    }
+}
+
+bool VoxelSubtreeCache::process() {
+    if (!isOpen()) {
+        _checkTree = new VoxelTree();
+        open(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/voxelCache");
+    }
+
+    int jobsDone = 0;
+    while (jobsDone < MAX_JOBS_PER_PASS) {
+        pthread_mutex_lock(&_cacheLock);
+        if (_jobs.empty()) {
+            pthread_mutex_unlock(&_cacheLock);
+            break;
+        }
+        Job job = _jobs.front();
+        _jobs.pop_front();
+        pthread_mutex_unlock(&_cacheLock);
+
+        if (job.type == RESTORE_SUBTREE) {
+            restoreSubtree(job);
+        } else {
+            checkSubtree(job);
+        }
+        jobsDone++;
+    }
+
+    if (jobsDone == 0 && isThreaded()) {
+        usleep(IDLE_INTERVAL_USECS);
+    }
+    return isStillRunning();  // keep running till they terminate us
+}
+
+void VoxelSubtreeCache::restoreSubtree(const Job& job) {
+    QByteArray data;
+    QFile file(pathForSubtree(job.key, job.version));
+    if (file.open(QIODevice::ReadOnly)) {
+        data = file.readAll();
+    }
+    if (data.isEmpty()) {
+        // without the file, the server will have to send it after all
+        VoxelSubtreeVersions removed;
+        pthread_mutex_lock(&_cacheLock);
+        if (_cached.getVersionForKey(job.key) == job.version) {
+            removeSubtree(job.key, removed);
+        }
+        _treeCopies.erase(job.key);
+        pthread_mutex_unlock(&_cacheLock);
+
+        removeFiles(removed);
+        if (!removed.isEmpty()) {
+            sendCachedSubtrees(UNKNOWN_NODE_ID, removed, VoxelSubtreeVersions::REMOVE_VERSIONS);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(_treeLock);
+    VoxelNode* node = getSubtreeNode(_tree, job.key);
+    if (node) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            node->safeDeepDeleteChildAtIndex(i);
+        }
+    }
+    ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS, NULL, job.voxelServerID);
+    _tree->readBitstreamToTree((unsigned char*)data.data(), data.size(), args);
+    uint64_t restoredAt = usecTimestampNow();
+    pthread_mutex_unlock(_treeLock);
+
+    pthread_mutex_lock(&_cacheLock);
+    TreeCopy& treeCopy = _treeCopies[job.key];
+    treeCopy.version = job.version;
+    treeCopy.checkedAt = restoredAt;
+    treeCopy.pending = false;
+    treeCopy.matches = true;
+    pthread_mutex_unlock(&_cacheLock);
+
+    _subtreesRestored++;
+    _bytesRestored += data.size();
+}
+
+void VoxelSubtreeCache::checkSubtree(const Job& job) {
+    // the copy is read into a tree of our own to be hashed, as the server hashes its tree
+    _checkTree->eraseAllVoxels();
+    ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+    _checkTree->readBitstreamToTree((unsigned char*)job.data.data(), job.data.size(), args);
+    VoxelNode* node = getSubtreeNode(_checkTree, job.key);
+    bool matches = node && VoxelSubtreeVersions::computeVersion(node) == job.version;
+
+    // we've been sent all of it, so it can be cached, replacing any older version
+    bool written = false;
+    if (matches) {
+        QFile file(pathForSubtree(job.key, job.version));
+        written = file.open(QIODevice::WriteOnly) && file.write(job.data) == job.data.size();
+        if (file.isOpen() && !written) {
+            file.remove();
+        }
+    }
+
+    VoxelSubtreeVersions added;
+    VoxelSubtreeVersions replaced;
+    VoxelSubtreeVersions removed;
+    pthread_mutex_lock(&_cacheLock);
+    std::map<uint32_t, TreeCopy>::iterator copy = _treeCopies.find(job.key);
+    if (copy != _treeCopies.end() && copy->second.version == job.version) {
+        copy->second.pending = false;
+        copy->second.matches = matches;
+    }
+    if (written) {
+        VoxelSubtreeVersion cachedVersion = _cached.getVersionForKey(job.key);
+        if (cachedVersion != job.version) {
+            replaced.setVersionForKey(job.key, cachedVersion);
+        }
+        _cached.setVersionForKey(job.key, job.version);
+        _lastUsed[job.key] = usecTimestampNow();
+        added.setVersionForKey(job.key, job.version);
+        _subtreesAdded++;
+        evictToBudget(removed);
+    }
+    pthread_mutex_unlock(&_cacheLock);
+
+    removeFiles(replaced);
+    removeFiles(removed);
+    if (!removed.isEmpty()) {
+        sendCachedSubtrees(UNKNOWN_NODE_ID, removed, VoxelSubtreeVersions::REMOVE_VERSIONS);
+    }
+    if (!added.isEmpty()) {
+        sendCachedSubtrees(UNKNOWN_NODE_ID, added, VoxelSubtreeVersions::ADD_VERSIONS);
+    }
+}
+
+QString VoxelSubtreeCache::pathForSubtree(uint32_t key, const VoxelSubtreeVersion& version) const {
+    unsigned char* octalCode = VoxelSubtreeVersions::octalCodeForKey(key);
+    QString name = octalCodeToHexString(octalCode) + "-" + QString::number(version.hash, HEX_NUMBER_BASE).toUpper() +
+        "-" + QString::number(version.voxelCount, HEX_NUMBER_BASE).toUpper();
+    delete[] octalCode;
+    return _directory + "/" + name + SUBTREE_FILE_EXTENSION;
+}
+
+void VoxelSubtreeCache::removeFiles(const VoxelSubtreeVersions& versions) {
+    for (VoxelSubtreeVersions::const_iterator it = versions.begin(); it != versions.end(); it++) {
+        QFile::remove(pathForSubtree(it->first, it->second));
+    }
+}
+
+void VoxelSubtreeCache::removeSubtree(uint32_t key, VoxelSubtreeVersions& removed) {
+    VoxelSubtreeVersion version = _cached.getVersionForKey(key);
+    if (version != NO_SUBTREE_VERSION) {
+        _cached.setVersionForKey(key, NO_SUBTREE_VERSION);
+        removed.setVersionForKey(key, version);
+    }
+    _lastUsed.erase(key);
+}
+
+void VoxelSubtreeCache::evictToBudget(VoxelSubtreeVersions& removed) {
+    if (_cached.size() <= _maxCachedSubtrees) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, uint32_t> > leastRecentlyUsed;
+    for (VoxelSubtreeVersions::const_iterator it = _cached.begin(); it != _cached.end(); it++) {
+        leastRecentlyUsed.push_back(std::make_pair(_lastUsed[it->first], it->first));
+    }
+    std::sort(leastRecentlyUsed.begin(), leastRecentlyUsed.end());
+    int evictions = _cached.size() - _maxCachedSubtrees;
+    for (int i = 0; i < evictions; i++) {
+        removeSubtree(leastRecentlyUsed[i].second, removed);
+    }
+}
+
+void VoxelSubtreeCache::sendCachedSubtrees(uint16_t voxelServerID, const VoxelSubtreeVersions& versions,
+                                           VoxelSubtreeVersions::PacketMode mode) {
+    NodeList* nodeList = NodeList::getInstance();
+    Node* voxelServer = (voxelServerID == UNKNOWN_NODE_ID) ? NULL : nodeList->nodeWithID(voxelServerID);
+    if (voxelServerID != UNKNOWN_NODE_ID && !(voxelServer && voxelServer->getActiveSocket())) {
+        _serversSentCache.erase(voxelServerID); // try again next time
+        return;
+    }
+
+    // an empty list still goes out once, so that a replace clears what the server had
+    unsigned char packet[MAX_PACKET_SIZE];
+    VoxelSubtreeVersions::const_iterator position = versions.begin();
+    do {
+        int packetLength = versions.writeToPacket(packet, MAX_PACKET_SIZE, PACKET_TYPE_VOXEL_CACHED_SUBTREES, position,
+                                                  mode);
+        if (voxelServer) {
+            nodeList->getNodeSocket()->send(voxelServer->getActiveSocket(), packet, packetLength);
+        } else {
+            nodeList->broadcastToNodes(packet, packetLength, &NODE_TYPE_VOXEL_SERVER, 1);
+        }
+
+        // a list that takes more than one packet is replaced by the first, and added to by the rest
+        if (mode == VoxelSubtreeVersions::REPLACE_VERSIONS) {
+            mode = VoxelSubtreeVersions::ADD_VERSIONS;
+        }
+    } while (position != versions.end());
+}
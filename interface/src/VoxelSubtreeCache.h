@@ -0,0 +1,128 @@
+//
+//  VoxelSubtreeCache.h
+//  interface
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Keeps the versioned subtrees (see VoxelSubtreeVersions.h) that voxel servers send us in files named by octal code and
+//  version, so that they don't have to be sent again when we come back to them, even after a restart.
+//
+//  The servers tell us the versions of the subtrees they reach in our view. If we have that version of a subtree cached,
+//  the server left it out, and we read it from the cache unless the tree still has it. Otherwise we hash our own copy,
+//  and if that matches, we have all of the subtree and it goes into the cache. Each server is sent the list of cached
+//  subtrees the first time it tells us about its subtrees, and then the changes to the list as they happen.
+//
+//  The voxel packet thread only encodes the tree's copies of subtrees that have changed since they were last checked,
+//  with the tree locked. The cache's own thread hashes them, reads and writes the files, and only locks the tree to put
+//  a subtree read from the cache into it.
+//
+
+#ifndef __interface__VoxelSubtreeCache__
+#define __interface__VoxelSubtreeCache__
+
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+
+#include <QByteArray>
+#include <QString>
+
+#include <GenericThread.h>
+#include <VoxelSubtreeVersions.h>
+
+class VoxelNode;
+class VoxelTree;
+
+class VoxelSubtreeCache : public virtual GenericThread {
+public:
+    static const int DEFAULT_MAX_CACHED_SUBTREES = 16384;
+    static const int IDLE_INTERVAL_USECS = 10 * 1000;
+    static const int MAX_JOBS_PER_PASS = 8;
+
+    VoxelSubtreeCache(int maxCachedSubtrees = DEFAULT_MAX_CACHED_SUBTREES);
+    ~VoxelSubtreeCache();
+
+    /// the tree that subtrees are restored into, and the lock the cache's thread holds while it does that
+    void setTree(VoxelTree* tree, pthread_mutex_t* treeLock);
+
+    /// Handles a PACKET_TYPE_VOXEL_SUBTREE_VERSIONS from a voxel server, which the caller has locked the tree for. Until
+    /// the cache's thread has opened the cache, the packets are ignored, and the servers send everything.
+    void processSubtreeVersions(uint16_t voxelServerID, unsigned char* packet, int length);
+
+    bool isOpen();
+    int getCachedSubtreeCount();
+    unsigned long getSubtreesRestored() const { return _subtreesRestored; }
+    unsigned long getBytesRestored() const { return _bytesRestored; }
+    unsigned long getSubtreesAdded() const { return _subtreesAdded; }
+
+protected:
+    /// Implements generic processing behavior for this thread.
+    virtual bool process();
+
+private:
+    // disallow copying of VoxelSubtreeCache objects
+    VoxelSubtreeCache(const VoxelSubtreeCache&);
+    VoxelSubtreeCache& operator= (const VoxelSubtreeCache&);
+
+    enum JobType {
+        RESTORE_SUBTREE,    // read the cached version into the tree
+        CHECK_SUBTREE       // hash the tree's copy, which is in data, and cache it if it's the version
+    };
+
+    struct Job {
+        JobType             type;
+        uint32_t            key;
+        VoxelSubtreeVersion version;
+        uint16_t            voxelServerID;
+        QByteArray          data;
+    };
+
+    /// what the tree's copy of a subtree was last checked against, and whether it had that version
+    struct TreeCopy {
+        VoxelSubtreeVersion version;
+        uint64_t            checkedAt;
+        bool                pending;    // there's a job for it that hasn't been done yet
+        bool                matches;
+    };
+
+    /// reads the list of cached subtrees from a directory, which is created if it doesn't exist
+    void open(const QString& directory);
+
+    void restoreSubtree(const Job& job);
+    void checkSubtree(const Job& job);
+
+    QString pathForSubtree(uint32_t key, const VoxelSubtreeVersion& version) const;
+    void removeFiles(const VoxelSubtreeVersions& versions);
+
+    /// these leave the files for removeFiles(), so that they aren't removed with the cache locked
+    void removeSubtree(uint32_t key, VoxelSubtreeVersions& removed);
+    void evictToBudget(VoxelSubtreeVersions& removed);
+
+    /// sends to every voxel server if voxelServerID is UNKNOWN_NODE_ID
+    void sendCachedSubtrees(uint16_t voxelServerID, const VoxelSubtreeVersions& versions,
+                            VoxelSubtreeVersions::PacketMode mode);
+
+    VoxelTree*                      _tree;
+    pthread_mutex_t*                _treeLock;
+
+    int                             _maxCachedSubtrees;
+
+    pthread_mutex_t                 _cacheLock; // protects the members from here to the next blank line
+    bool                            _isOpen;
+    VoxelSubtreeVersions            _cached;
+    std::map<uint32_t, uint64_t>    _lastUsed;  // by key, for evicting the least recently used subtrees
+    std::map<uint32_t, TreeCopy>    _treeCopies; // by key
+    std::deque<Job>                 _jobs;
+
+    std::set<uint16_t>              _serversSentCache; // only used from the voxel packet thread
+    QString                         _directory; // only used from the cache's thread, like _checkTree
+    VoxelTree*                      _checkTree; // to hash the copies being checked
+
+    unsigned long                   _subtreesRestored;
+    unsigned long                   _bytesRestored;
+    unsigned long                   _subtreesAdded;
+};
+
+#endif /* defined(__interface__VoxelSubtreeCache__) */
@@ -32,6 +32,8 @@
 #include "renderer/ProgramObject.h"
 #include "VoxelConstants.h"
 #include "VoxelSystem.h"
+#include "VoxelTreeParallel.h"
+#include "VoxelTreeVisitor.h"
 
 float identityVertices[] = { 0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1,
                              0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1,
@@ -59,8 +61,10 @@ VoxelSystem::VoxelSystem(float treeScale, int maxVoxels) :
     _tree = new VoxelTree();
     pthread_mutex_init(&_bufferWriteLock, NULL);
     pthread_mutex_init(&_treeLock, NULL);
+    _subtreeCache.setTree(_tree, &_treeLock);
 
-    VoxelNode::addDeleteHook(this);
+    _writeVoxelNodes = NULL;
+    pthread_mutex_init(&_deletedNodeIndexesLock, NULL);
     _abandonedVBOSlots = 0;
     _falseColorizeBySource = false;
     _dataSourceID = UNKNOWN_NODE_ID;
@@ -72,12 +76,6 @@ VoxelSystem::VoxelSystem(float treeScale, int maxVoxels) :
     connect(_tree, SIGNAL(importProgress(int)), SIGNAL(importProgress(int)));
 }
 
-void VoxelSystem::nodeDeleted(VoxelNode* node) {
-    if (node->isKnownBufferIndex() && (node->getVoxelSystem() == this)) {
-        freeBufferIndex(node->getBufferIndex());
-    }
-}
-
 // returns an available index, starts by reusing a previously freed index, but if there isn't one available
 // it will use the end of the VBO array and grow our accounting of that array.
 // and makes the index available for some other node to use
@@ -100,8 +98,33 @@ void VoxelSystem::freeBufferIndex(glBufferIndex index) {
     _freeIndexes.push_back(index);
 }
 
+// called by our nodes as they're deleted, from whichever thread deletes them
+void VoxelSystem::bufferIndexDeleted(glBufferIndex index) {
+    pthread_mutex_lock(&_deletedNodeIndexesLock);
+    _deletedNodeIndexes.push_back(index);
+    pthread_mutex_unlock(&_deletedNodeIndexesLock);
+}
+
+// Deleted nodes leave their buffer indexes with us to collect here. We also hold a handle for every slot in the write
+// arrays, and only free a slot if the node that owns it now is the one that was deleted, since a slot that was freed
+// some other way may have been handed to another node since.
+void VoxelSystem::freeDeletedNodeBufferIndexes() {
+    _freedNodeIndexes.clear();
+    pthread_mutex_lock(&_deletedNodeIndexesLock);
+    _deletedNodeIndexes.swap(_freedNodeIndexes);
+    pthread_mutex_unlock(&_deletedNodeIndexesLock);
+    for (size_t i = 0; i < _freedNodeIndexes.size(); i++) {
+        glBufferIndex index = _freedNodeIndexes[i];
+        if (index < _voxelsInWriteArrays && !_writeVoxelNodes[index].isNull() && !_writeVoxelNodes[index].isValid()) {
+            _writeVoxelNodes[index] = VoxelNodeHandle();
+            freeBufferIndex(index);
+        }
+    }
+}
+
 // This will run through the list of _freeIndexes and reset their VBO array values to be "invisible".
 void VoxelSystem::clearFreeBufferIndexes() {
+    freeDeletedNodeBufferIndexes();
     for (int i = 0; i < _freeIndexes.size(); i++) {
         glBufferIndex nodeIndex = _freeIndexes[i];
         glm::vec3 startVertex(FLT_MAX, FLT_MAX, FLT_MAX);
@@ -121,11 +144,12 @@ VoxelSystem::~VoxelSystem() {
     delete[] _writeColorsArray;
     delete[] _writeVoxelDirtyArray;
     delete[] _readVoxelDirtyArray;
+    delete[] _writeVoxelNodes;
+    // the tree's nodes tell us their buffer indexes as they go, so it goes before the lock they take
     delete _tree;
+    pthread_mutex_destroy(&_deletedNodeIndexesLock);
     pthread_mutex_destroy(&_bufferWriteLock);
     pthread_mutex_destroy(&_treeLock);
-
-    VoxelNode::removeDeleteHook(this);
 }
 
 void VoxelSystem::loadVoxelsFile(const char* fileName, bool wantColorRandomizer) {
@@ -186,6 +210,17 @@ float VoxelSystem::getVoxelsBytesReadPerSecondAverage() {
 }
 
 int VoxelSystem::parseData(unsigned char* sourceBuffer, int numBytes) {
+    int bytesReceived = numBytes;
+
+    // compressed packets are inflated first, and then handled like the packet that was compressed
+    unsigned char decompressedPacket[MAX_VOXEL_PACKET_SIZE];
+    if (*sourceBuffer == PACKET_TYPE_VOXEL_DATA_COMPRESSED) {
+        numBytes = _packetCompressor.decompress(sourceBuffer, numBytes, decompressedPacket);
+        if (numBytes == 0 || !packetVersionMatch(decompressedPacket)) {
+            return bytesReceived;
+        }
+        sourceBuffer = decompressedPacket;
+    }
 
     unsigned char command = *sourceBuffer;
     int numBytesPacketHeader = numBytesForPacketHeader(sourceBuffer);
@@ -202,6 +237,21 @@ int VoxelSystem::parseData(unsigned char* sourceBuffer, int numBytes) {
             _tree->readBitstreamToTree(voxelData, numBytes - numBytesPacketHeader, args);
         }
             break;
+        case PACKET_TYPE_VOXEL_DATA_CODED_COLORS: {
+            PerformanceWarning warn(Menu::getInstance()->isOptionChecked(MenuOption::PipelineWarnings),
+                                    "readBitstreamToTree()");
+            // ask the VoxelTree to read the bitstream with coded colors into the tree
+            ReadBitstreamToTreeParams args(WANT_COLOR, WANT_EXISTS_BITS, NULL, getDataSourceID(), WANT_COLOR_CODING);
+            _tree->readBitstreamToTree(voxelData, numBytes - numBytesPacketHeader, args);
+        }
+            break;
+        case PACKET_TYPE_VOXEL_SUBTREE_VERSIONS: {
+            PerformanceWarning warn(Menu::getInstance()->isOptionChecked(MenuOption::PipelineWarnings),
+                                    "processSubtreeVersions()");
+            // fills in the subtrees the server left out from the cache, and caches the ones we have all of
+            _subtreeCache.processSubtreeVersions(getDataSourceID(), sourceBuffer, numBytes);
+        }
+            break;
         case PACKET_TYPE_VOXEL_DATA_MONOCHROME: {
             PerformanceWarning warn(Menu::getInstance()->isOptionChecked(MenuOption::PipelineWarnings),
                                     "readBitstreamToTree()");
@@ -240,9 +290,9 @@ int VoxelSystem::parseData(unsigned char* sourceBuffer, int numBytes) {
     
     pthread_mutex_unlock(&_treeLock);
 
-    Application::getInstance()->getBandwidthMeter()->inputStream(BandwidthMeter::VOXELS).updateValue(numBytes);
+    Application::getInstance()->getBandwidthMeter()->inputStream(BandwidthMeter::VOXELS).updateValue(bytesReceived);
  
-    return numBytes;
+    return bytesReceived;
 }
 
 void VoxelSystem::setupNewVoxelsForDrawing() {
@@ -466,6 +516,7 @@ int VoxelSystem::updateNodeInArraysAsFullVBO(VoxelNode* node) {
         updateNodeInArrays(nodeIndex, startVertex, voxelScale, node->getColor());
         node->setBufferIndex(nodeIndex);
         node->setVoxelSystem(this);
+        _writeVoxelNodes[nodeIndex] = VoxelNodeHandle(node);
         return 1; // rendered
     } else {
         node->setBufferIndex(GLBUFFER_INDEX_UNKNOWN);
@@ -505,6 +556,7 @@ int VoxelSystem::updateNodeInArraysAsPartialVBO(VoxelNode* node) {
             nodeIndex = getNextBufferIndex();
             node->setBufferIndex(nodeIndex);
             node->setVoxelSystem(this);
+            _writeVoxelNodes[nodeIndex] = VoxelNodeHandle(node);
         }
         _writeVoxelDirtyArray[nodeIndex] = true;
 
@@ -551,6 +603,9 @@ void VoxelSystem::init() {
     _readVoxelDirtyArray = new bool[_maxVoxels];
     memset(_readVoxelDirtyArray, false, _maxVoxels * sizeof(bool));
 
+    // we hold a weak handle to the node in each slot so we can reclaim slots of nodes that get deleted
+    _writeVoxelNodes = new VoxelNodeHandle[_maxVoxels];
+
     // prep the data structures for incoming voxel data
     _writeVerticesArray = new GLfloat[VERTEX_POINTS_PER_VOXEL * _maxVoxels];
     _readVerticesArray = new GLfloat[VERTEX_POINTS_PER_VOXEL * _maxVoxels];
@@ -973,8 +1028,9 @@ void VoxelSystem::falseColorizeDistanceFromView() {
     setupNewVoxelsForDrawing();
 }
 
-// combines the removeOutOfView args into a single class
-class removeOutOfViewArgs {
+// "Remove" voxels from the tree that are not in view. We don't actually delete them,
+// we remove them from the tree and place them into a holding area for later deletion
+class RemoveOutOfViewVisitor {
 public:
     VoxelSystem*    thisVoxelSystem;
     ViewFrustum*    thisViewFrustum;
@@ -985,7 +1041,7 @@ public:
     unsigned long   nodesIntersect;
     unsigned long   nodesOutside;
     
-    removeOutOfViewArgs(VoxelSystem* voxelSystem) :
+    RemoveOutOfViewVisitor(VoxelSystem* voxelSystem) :
         thisVoxelSystem(voxelSystem),
         thisViewFrustum(voxelSystem->getViewFrustum()),
         dontRecurseBag(),
@@ -995,60 +1051,54 @@ public:
         nodesIntersect(0),
         nodesOutside(0)
     { }
-};
-
-void VoxelSystem::cancelImport() {
-    _tree->cancelImport();
-}
 
-// "Remove" voxels from the tree that are not in view. We don't actually delete them,
-// we remove them from the tree and place them into a holding area for later deletion
-bool VoxelSystem::removeOutOfViewOperation(VoxelNode* node, void* extraData) {
-    removeOutOfViewArgs* args = (removeOutOfViewArgs*)extraData;
-
-    // If our node was previously added to the don't recurse bag, then return false to
-    // stop the further recursion. This means that the whole node and it's children are
-    // known to be in view, so don't recurse them
-    if (args->dontRecurseBag.contains(node)) {
-        args->dontRecurseBag.remove(node);
-        return false; // stop recursion
-    }
-    
-    VoxelSystem* thisVoxelSystem = args->thisVoxelSystem;
-    args->nodesScanned++;
-    // Need to operate on our child nodes, so we can remove them
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        VoxelNode* childNode = node->getChildAtIndex(i);
-        if (childNode) {
-            ViewFrustum::location inFrustum = childNode->inFrustum(*args->thisViewFrustum);
-            switch (inFrustum) {
-                case ViewFrustum::OUTSIDE: {
-                    args->nodesOutside++;
-                    args->nodesRemoved++;
-                    node->removeChildAtIndex(i);
-                    thisVoxelSystem->_removedVoxels.insert(childNode);
-                    // by removing the child, it will not get recursed!
-                } break;
-                case ViewFrustum::INSIDE: {
-                    // if the child node is fully INSIDE the view, then there's no need to recurse it
-                    // because we know all it's children will also be in the view, so we want to 
-                    // tell the caller to NOT recurse this child
-                    args->nodesInside++;
-                    args->dontRecurseBag.insert(childNode);
-                } break;
-                case ViewFrustum::INTERSECT: {
-                    // if the child node INTERSECTs the view, then we don't want to remove it because
-                    // it is at least partially in view. But we DO want to recurse the children because
-                    // some of them may not be in view... nothing specifically to do, just keep iterating
-                    // the children
-                    args->nodesIntersect++;
-                } break;
+    bool visit(VoxelNode* node) {
+        // If our node was previously added to the don't recurse bag, then return false to
+        // stop the further recursion. This means that the whole node and it's children are
+        // known to be in view, so don't recurse them
+        if (dontRecurseBag.contains(node)) {
+            dontRecurseBag.remove(node);
+            return false; // stop recursion
+        }
+        
+        nodesScanned++;
+        // Need to operate on our child nodes, so we can remove them
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* childNode = node->getChildAtIndex(i);
+            if (childNode) {
+                ViewFrustum::location inFrustum = childNode->inFrustum(*thisViewFrustum);
+                switch (inFrustum) {
+                    case ViewFrustum::OUTSIDE: {
+                        nodesOutside++;
+                        nodesRemoved++;
+                        node->removeChildAtIndex(i);
+                        thisVoxelSystem->_removedVoxels.insert(childNode);
+                        // by removing the child, it will not get recursed!
+                    } break;
+                    case ViewFrustum::INSIDE: {
+                        // if the child node is fully INSIDE the view, then there's no need to recurse it
+                        // because we know all it's children will also be in the view, so we want to 
+                        // tell the caller to NOT recurse this child
+                        nodesInside++;
+                        dontRecurseBag.insert(childNode);
+                    } break;
+                    case ViewFrustum::INTERSECT: {
+                        // if the child node INTERSECTs the view, then we don't want to remove it because
+                        // it is at least partially in view. But we DO want to recurse the children because
+                        // some of them may not be in view... nothing specifically to do, just keep iterating
+                        // the children
+                        nodesIntersect++;
+                    } break;
+                }
             }
         }
+        return true; // keep going!
     }
-    return true; // keep going!
-}
+};
 
+void VoxelSystem::cancelImport() {
+    _tree->cancelImport();
+}
 
 bool VoxelSystem::isViewChanging() {
     bool result = false; // assume the best
@@ -1079,8 +1129,8 @@ bool VoxelSystem::hasViewChanged() {
 
 void VoxelSystem::removeOutOfView() {
     PerformanceWarning warn(Menu::getInstance()->isOptionChecked(MenuOption::PipelineWarnings), "removeOutOfView()");
-    removeOutOfViewArgs args(this);
-    _tree->recurseTreeWithOperation(removeOutOfViewOperation,(void*)&args);
+    RemoveOutOfViewVisitor args(this);
+    visitNodes(_tree->rootNode, args);
 
     if (args.nodesRemoved) {
         _tree->setDirtyBit();
@@ -1127,6 +1177,34 @@ bool VoxelSystem::findCapsulePenetration(const glm::vec3& start, const glm::vec3
     return result;
 }
 
+bool VoxelSystem::findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration,
+                                         VoxelNeighborhood& neighborhood) {
+    pthread_mutex_lock(&_treeLock);
+    neighborhood.updateForCapsule(_tree, start, end, radius);
+    bool result = neighborhood.findCapsulePenetration(start, end, radius, penetration);
+    pthread_mutex_unlock(&_treeLock);
+    return result;
+}
+
+int VoxelSystem::findSpherePenetrations(const glm::vec3* centers, const float* radii, glm::vec3* penetrations,
+                                        int sphereCount, VoxelNeighborhood& neighborhood) {
+    if (sphereCount == 0) {
+        return 0;
+    }
+    glm::vec3 minimum = centers[0];
+    glm::vec3 maximum = centers[0];
+    for (int i = 0; i < sphereCount; i++) {
+        glm::vec3 extent(radii[i], radii[i], radii[i]);
+        minimum = glm::min(minimum, centers[i] - extent);
+        maximum = glm::max(maximum, centers[i] + extent);
+    }
+    pthread_mutex_lock(&_treeLock);
+    neighborhood.update(_tree, minimum, maximum);
+    int result = neighborhood.findSpherePenetrations(centers, radii, penetrations, sphereCount);
+    pthread_mutex_unlock(&_treeLock);
+    return result;
+}
+
 class falseColorizeRandomEveryOtherArgs {
 public:
     falseColorizeRandomEveryOtherArgs() : totalNodes(0), colorableNodes(0), coloredNodes(0), colorThis(true) {};
@@ -1159,21 +1237,34 @@ void VoxelSystem::falseColorizeRandomEveryOther() {
     setupNewVoxelsForDrawing();
 }
 
-class collectStatsForTreesAndVBOsArgs {
+// a VBO index that more than one node claims, kept to be logged once the walk is done
+struct DuplicateVBOIndex {
+    glBufferIndex index;
+    bool isDirty;
+    bool shouldRender;
+};
+
+// walked in parallel, so each worker gathers its own counts, and join() adds them up... the indexes found so far are a
+// bitmap shared by all the workers, so that a duplicate is noticed whichever workers' nodes claim it
+class CollectStatsForTreesAndVBOsVisitor {
 public:
-    collectStatsForTreesAndVBOsArgs() : 
-        totalNodes(0), 
-        dirtyNodes(0), 
+    CollectStatsForTreesAndVBOsVisitor(unsigned long expectedMax, volatile uint32_t* foundIndexBits,
+                                       glBufferIndex indexBitCount) :
+        totalNodes(0),
+        dirtyNodes(0),
         shouldRenderNodes(0),
         coloredNodes(0),
         nodesInVBO(0),
         nodesInVBONotShouldRender(0),
         nodesInVBOOverExpectedMax(0),
         duplicateVBOIndex(0),
-        leafNodes(0)
-        {
-            memset(hasIndexFound, false, MAX_VOXELS_PER_SYSTEM * sizeof(bool));
-        };
+        leafNodes(0),
+        minInVBO(GLBUFFER_INDEX_UNKNOWN),
+        maxInVBO(0),
+        expectedMax(expectedMax),
+        foundIndexBits(foundIndexBits),
+        indexBitCount(indexBitCount)
+        { };
 
     unsigned long totalNodes;
     unsigned long dirtyNodes;
@@ -1184,54 +1275,74 @@ public:
     unsigned long nodesInVBOOverExpectedMax;
     unsigned long duplicateVBOIndex;
     unsigned long leafNodes;
+    glBufferIndex minInVBO;
+    glBufferIndex maxInVBO;
+    std::vector<DuplicateVBOIndex> duplicates;
 
     unsigned long expectedMax;
-    
-    bool hasIndexFound[MAX_VOXELS_PER_SYSTEM];
-};
+    volatile uint32_t* foundIndexBits;
+    glBufferIndex indexBitCount;
 
-bool VoxelSystem::collectStatsForTreesAndVBOsOperation(VoxelNode* node, void* extraData) {
-    collectStatsForTreesAndVBOsArgs* args = (collectStatsForTreesAndVBOsArgs*)extraData;
-    args->totalNodes++;
-
-    if (node->isLeaf()) {
-        args->leafNodes++;
-    }
-
-    if (node->isColored()) {
-        args->coloredNodes++;
-    }
+    bool visit(VoxelNode* node) {
+        totalNodes++;
 
-    if (node->getShouldRender()) {
-        args->shouldRenderNodes++;
-    }
+        if (node->isLeaf()) {
+            leafNodes++;
+        }
 
-    if (node->isDirty()) {
-        args->dirtyNodes++;
-    }
+        if (node->isColored()) {
+            coloredNodes++;
+        }
 
-    if (node->isKnownBufferIndex()) {
-        args->nodesInVBO++;
-        unsigned long nodeIndex = node->getBufferIndex();
-        if (args->hasIndexFound[nodeIndex]) {
-            args->duplicateVBOIndex++;
-            qDebug("duplicateVBO found... index=%ld, isDirty=%s, shouldRender=%s \n", nodeIndex, 
-                    debug::valueOf(node->isDirty()), debug::valueOf(node->getShouldRender()));
-        } else {
-            args->hasIndexFound[nodeIndex] = true;
+        if (node->getShouldRender()) {
+            shouldRenderNodes++;
         }
-        if (nodeIndex > args->expectedMax) {
-            args->nodesInVBOOverExpectedMax++;
+
+        if (node->isDirty()) {
+            dirtyNodes++;
         }
-        
-        // if it's in VBO but not-shouldRender, track that also...
-        if (!node->getShouldRender()) {
-            args->nodesInVBONotShouldRender++;
+
+        if (node->isKnownBufferIndex()) {
+            nodesInVBO++;
+            glBufferIndex nodeIndex = node->getBufferIndex();
+            minInVBO = std::min(minInVBO, nodeIndex);
+            maxInVBO = std::max(maxInVBO, nodeIndex);
+            if (nodeIndex < indexBitCount) {
+                uint32_t bit = 1u << (nodeIndex % 32);
+                if (__sync_fetch_and_or(&foundIndexBits[nodeIndex / 32], bit) & bit) {
+                    duplicateVBOIndex++;
+                    DuplicateVBOIndex duplicate = { nodeIndex, node->isDirty(), node->getShouldRender() };
+                    duplicates.push_back(duplicate);
+                }
+            }
+            if (nodeIndex > expectedMax) {
+                nodesInVBOOverExpectedMax++;
+            }
+            
+            // if it's in VBO but not-shouldRender, track that also...
+            if (!node->getShouldRender()) {
+                nodesInVBONotShouldRender++;
+            }
         }
+
+        return true; // keep going!
     }
 
-    return true; // keep going!
-}
+    void join(const CollectStatsForTreesAndVBOsVisitor& other) {
+        totalNodes += other.totalNodes;
+        dirtyNodes += other.dirtyNodes;
+        shouldRenderNodes += other.shouldRenderNodes;
+        coloredNodes += other.coloredNodes;
+        nodesInVBO += other.nodesInVBO;
+        nodesInVBONotShouldRender += other.nodesInVBONotShouldRender;
+        nodesInVBOOverExpectedMax += other.nodesInVBOOverExpectedMax;
+        duplicateVBOIndex += other.duplicateVBOIndex;
+        leafNodes += other.leafNodes;
+        minInVBO = std::min(minInVBO, other.minInVBO);
+        maxInVBO = std::max(maxInVBO, other.maxInVBO);
+        duplicates.insert(duplicates.end(), other.duplicates.begin(), other.duplicates.end());
+    }
+};
 
 void VoxelSystem::collectStatsForTreesAndVBOs() {
     PerformanceWarning warn(true, "collectStatsForTreesAndVBOs()", true);
@@ -1246,9 +1357,15 @@ void VoxelSystem::collectStatsForTreesAndVBOs() {
         }
     }
 
-    collectStatsForTreesAndVBOsArgs args;
-    args.expectedMax = _voxelsInWriteArrays;
-    _tree->recurseTreeWithOperation(collectStatsForTreesAndVBOsOperation,&args);
+    std::vector<uint32_t> foundIndexBits((_maxVoxels + 31) / 32, 0);
+    CollectStatsForTreesAndVBOsVisitor args(_voxelsInWriteArrays, &foundIndexBits[0], _maxVoxels);
+    visitNodesParallel(_tree->rootNode, args);
+
+    // the workers don't log, so the duplicates they found are logged here
+    for (size_t i = 0; i < args.duplicates.size(); i++) {
+        qDebug("duplicateVBO found... index=%ld, isDirty=%s, shouldRender=%s \n", args.duplicates[i].index,
+                debug::valueOf(args.duplicates[i].isDirty), debug::valueOf(args.duplicates[i].shouldRender));
+    }
 
     qDebug("Local Voxel Tree Statistics:\n total nodes %ld \n leaves %ld \n dirty %ld \n colored %ld \n shouldRender %ld \n",
         args.totalNodes, args.leafNodes, args.dirtyNodes, args.coloredNodes, args.shouldRenderNodes);
@@ -1259,19 +1376,8 @@ void VoxelSystem::collectStatsForTreesAndVBOs() {
     qDebug(" inVBO %ld \n nodesInVBOOverExpectedMax %ld \n duplicateVBOIndex %ld \n nodesInVBONotShouldRender %ld \n", 
         args.nodesInVBO, args.nodesInVBOOverExpectedMax, args.duplicateVBOIndex, args.nodesInVBONotShouldRender);
 
-    glBufferIndex minInVBO = GLBUFFER_INDEX_UNKNOWN;
-    glBufferIndex maxInVBO = 0;
-
-    for (glBufferIndex i = 0; i < MAX_VOXELS_PER_SYSTEM; i++) {
-        if (args.hasIndexFound[i]) {
-            minInVBO = std::min(minInVBO,i);
-            maxInVBO = std::max(maxInVBO,i);
-        }
-    }
-
     qDebug(" minInVBO=%ld \n maxInVBO=%ld \n _voxelsInWriteArrays=%ld \n _voxelsInReadArrays=%ld \n", 
-            minInVBO, maxInVBO, _voxelsInWriteArrays, _voxelsInReadArrays);
-
+            args.minInVBO, args.maxInVBO, _voxelsInWriteArrays, _voxelsInReadArrays);
 }
 
 
@@ -1596,19 +1702,25 @@ void VoxelSystem::nodeAdded(Node* node) {
     }
 }
 
-bool VoxelSystem::killSourceVoxelsOperation(VoxelNode* node, void* extraData) {
-    uint16_t killedNodeID = *(uint16_t*)extraData;
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        VoxelNode* childNode = node->getChildAtIndex(i);
-        if (childNode) {
-            uint16_t childNodeID = childNode->getSourceID();
-            if (childNodeID == killedNodeID) {
-                node->safeDeepDeleteChildAtIndex(i);
+class KillSourceVoxelsVisitor {
+public:
+    KillSourceVoxelsVisitor(uint16_t killedNodeID) : killedNodeID(killedNodeID) { };
+
+    bool visit(VoxelNode* node) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* childNode = node->getChildAtIndex(i);
+            if (childNode) {
+                uint16_t childNodeID = childNode->getSourceID();
+                if (childNodeID == killedNodeID) {
+                    node->safeDeepDeleteChildAtIndex(i);
+                }
             }
         }
+        return true;
     }
-    return true;
-}
+
+    uint16_t killedNodeID;
+};
 
 void VoxelSystem::nodeKilled(Node* node) {
     if (node->getType() == NODE_TYPE_VOXEL_SERVER) {
@@ -1618,7 +1730,8 @@ void VoxelSystem::nodeKilled(Node* node) {
         
         if (_voxelServerCount > 0) {
             // Kill any voxels from the local tree that match this nodeID
-            _tree->recurseTreeWithOperation(killSourceVoxelsOperation, &nodeID);
+            KillSourceVoxelsVisitor visitor(nodeID);
+            visitNodes(_tree->rootNode, visitor);
             _tree->setDirtyBit();
         } else {
             // Last server, take the easy way and kill all the local voxels!
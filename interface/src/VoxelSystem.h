@@ -18,17 +18,20 @@
 #include <CoverageMapV2.h>
 #include <NodeData.h>
 #include <ViewFrustum.h>
+#include <VoxelNeighborhood.h>
+#include <VoxelPacketCompressor.h>
 #include <VoxelTree.h>
 
 #include "Camera.h"
 #include "Util.h"
+#include "VoxelSubtreeCache.h"
 #include "world.h"
 
 class ProgramObject;
 
 const int NUM_CHILDREN = 8;
 
-class VoxelSystem : public NodeData, public VoxelNodeDeleteHook, public NodeListHook {
+class VoxelSystem : public NodeData, public NodeListHook, public VoxelNodeBufferIndexOwner {
     Q_OBJECT
 public:
     VoxelSystem(float treeScale = TREE_SCALE, int maxVoxels = MAX_VOXELS_PER_SYSTEM);
@@ -60,6 +63,8 @@ public:
     float getVoxelsCreatedPerSecondAverage();
     float getVoxelsColoredPerSecondAverage();
     float getVoxelsBytesReadPerSecondAverage();
+    VoxelPacketCompressor& getPacketCompressor() { return _packetCompressor; }
+    VoxelSubtreeCache& getSubtreeCache() { return _subtreeCache; }
 
     void killLocalVoxels();
 
@@ -73,6 +78,12 @@ public:
     bool findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration);
     bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration);
 
+    // these use (and keep up to date) a cached neighborhood of voxels around the caller
+    bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration,
+                                VoxelNeighborhood& neighborhood);
+    int findSpherePenetrations(const glm::vec3* centers, const float* radii, glm::vec3* penetrations, int sphereCount,
+                               VoxelNeighborhood& neighborhood);
+
     void deleteVoxelAt(float x, float y, float z, float s);
     VoxelNode* getVoxelAt(float x, float y, float z, float s) const;
     void createVoxel(float x, float y, float z, float s, 
@@ -90,9 +101,9 @@ public:
     CoverageMapV2 myCoverageMapV2;
     CoverageMap   myCoverageMap;
 
-    virtual void nodeDeleted(VoxelNode* node);
     virtual void nodeAdded(Node* node);
     virtual void nodeKilled(Node* node);
+    virtual void bufferIndexDeleted(glBufferIndex index);
     
 signals:
     void importSize(float x, float y, float z);
@@ -137,6 +148,7 @@ private:
     
     int  _callsToTreesToArrays;
     VoxelNodeBag _removedVoxels;
+    friend class RemoveOutOfViewVisitor;
 
     // Operation functions for tree recursion methods
     static int _nodeCount;
@@ -146,14 +158,11 @@ private:
     static bool falseColorizeInViewOperation(VoxelNode* node, void* extraData);
     static bool falseColorizeDistanceFromViewOperation(VoxelNode* node, void* extraData);
     static bool getDistanceFromViewRangeOperation(VoxelNode* node, void* extraData);
-    static bool removeOutOfViewOperation(VoxelNode* node, void* extraData);
     static bool falseColorizeRandomEveryOtherOperation(VoxelNode* node, void* extraData);
-    static bool collectStatsForTreesAndVBOsOperation(VoxelNode* node, void* extraData);
     static bool falseColorizeOccludedOperation(VoxelNode* node, void* extraData);
     static bool falseColorizeSubTreeOperation(VoxelNode* node, void* extraData);
     static bool falseColorizeOccludedV2Operation(VoxelNode* node, void* extraData);
     static bool falseColorizeBySourceOperation(VoxelNode* node, void* extraData);
-    static bool killSourceVoxelsOperation(VoxelNode* node, void* extraData);
 
     int updateNodeInArraysAsFullVBO(VoxelNode* node);
     int updateNodeInArraysAsPartialVBO(VoxelNode* node);
@@ -173,6 +182,10 @@ private:
     GLubyte* _writeColorsArray;
     bool* _writeVoxelDirtyArray;
     bool* _readVoxelDirtyArray;
+    VoxelNodeHandle* _writeVoxelNodes; // which node owns each slot in the write arrays, used to reclaim deleted nodes
+    std::vector<glBufferIndex> _deletedNodeIndexes; // left by our nodes as they're deleted, on any thread
+    std::vector<glBufferIndex> _freedNodeIndexes; // reused by freeDeletedNodeBufferIndexes()
+    pthread_mutex_t _deletedNodeIndexesLock;
     unsigned long _voxelsUpdated;
     unsigned long _voxelsInReadArrays;
     unsigned long _voxelsInWriteArrays;
@@ -193,6 +206,9 @@ private:
     pthread_mutex_t _bufferWriteLock;
     pthread_mutex_t _treeLock;
 
+    VoxelPacketCompressor _packetCompressor; // only used from the voxel packet processing thread
+    VoxelSubtreeCache _subtreeCache; // runs on a thread of its own, which Application starts
+
     ViewFrustum _lastKnowViewFrustum;
     ViewFrustum _lastStableViewFrustum;
     ViewFrustum* _viewFrustum;
@@ -213,6 +229,7 @@ private:
     std::vector<glBufferIndex> _freeIndexes;
 
     void freeBufferIndex(glBufferIndex index);
+    void freeDeletedNodeBufferIndexes();
     void clearFreeBufferIndexes();
     glBufferIndex getNextBufferIndex();
     
@@ -91,6 +91,11 @@ void Hand::calculateGeometry() {
         }
     }
 
+    // my own finger tips shouldn't sink into voxels
+    if (_owningAvatar && _owningAvatar->getOwningNode() == NULL) {
+        updateFingerTipCollisionsWithVoxels();
+    }
+
     // generate finger root balls....
     _leapFingerRootBalls.clear();
     for (size_t i = 0; i < getNumPalms(); ++i) {
@@ -113,6 +118,29 @@ void Hand::calculateGeometry() {
     }
 }
 
+void Hand::updateFingerTipCollisionsWithVoxels() {
+    int ballCount = _leapFingerTipBalls.size();
+    if (ballCount == 0) {
+        return;
+    }
+    // query all the finger tips against the voxels at once
+    std::vector<glm::vec3> centers(ballCount);
+    std::vector<float> radii(ballCount);
+    std::vector<glm::vec3> penetrations(ballCount);
+    for (int i = 0; i < ballCount; i++) {
+        centers[i] = _leapFingerTipBalls[i].position;
+        radii[i] = _leapFingerTipBalls[i].radius;
+    }
+    if (Application::getInstance()->getVoxels()->findSpherePenetrations(&centers[0], &radii[0], &penetrations[0],
+                                                                        ballCount, _voxelNeighborhood) > 0) {
+        for (int i = 0; i < ballCount; i++) {
+            HandBall& ball = _leapFingerTipBalls[i];
+            ball.position -= penetrations[i];
+            ball.touchForce = glm::length(penetrations[i]) / ball.radius;
+        }
+    }
+}
+
 void Hand::setRaveGloveEffectsMode(QKeyEvent* event) {
 
     _raveGloveEffectsModeChanged = true;
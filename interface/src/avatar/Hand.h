@@ -18,6 +18,7 @@
 #include "SerialInterface.h"
 #include "ParticleSystem.h"
 #include <SharedUtil.h>
+#include <VoxelNeighborhood.h>
 #include <vector>
 
 enum RaveLightsSetting {
@@ -74,6 +75,7 @@ private:
     glm::vec3      _ballColor;
     std::vector<HandBall> _leapFingerTipBalls;
     std::vector<HandBall> _leapFingerRootBalls;
+    VoxelNeighborhood _voxelNeighborhood;
     
     // private methods
     void setLeapHands(const std::vector<glm::vec3>& handPositions,
@@ -84,6 +86,7 @@ private:
     void renderLeapHands();
     void renderLeapFingerTrails();
     void calculateGeometry();
+    void updateFingerTipCollisionsWithVoxels();
 };
 
 #endif
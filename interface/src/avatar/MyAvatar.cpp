@@ -871,7 +871,8 @@ void MyAvatar::updateCollisionWithVoxels(float deltaTime) {
     glm::vec3 penetration;
     if (Application::getInstance()->getVoxels()->findCapsulePenetration(
             _position - glm::vec3(0.0f, _pelvisFloatingHeight - radius, 0.0f),
-            _position + glm::vec3(0.0f, _height - _pelvisFloatingHeight + radius, 0.0f), radius, penetration)) {
+            _position + glm::vec3(0.0f, _height - _pelvisFloatingHeight + radius, 0.0f), radius, penetration,
+            _voxelNeighborhood)) {
         _lastCollisionPosition = _position;
         updateCollisionSound(penetration, deltaTime, VOXEL_COLLISION_FREQUENCY);
         applyHardCollision(penetration, VOXEL_ELASTICITY, VOXEL_DAMPING);
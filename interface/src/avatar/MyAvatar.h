@@ -72,6 +72,7 @@ public:
     bool _speedBrakes;
     bool _isThrustOn;
     float _collisionRadius;
+    VoxelNeighborhood _voxelNeighborhood;
 
 	// private methods
     float getBallRenderAlpha(int ball, bool lookingInMirror) const;
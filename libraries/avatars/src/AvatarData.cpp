@@ -41,6 +41,9 @@ AvatarData::AvatarData(Node* owningNode) :
     _wantDelta(true),
     _wantLowResMoving(true),
     _wantOcclusionCulling(true),
+    _wantCompression(false),
+    _wantColorCoding(false),
+    _wantVoxelCache(false),
     _headData(NULL),
     _handData(NULL)
 {
@@ -193,6 +196,13 @@ int AvatarData::getBroadcastData(unsigned char* destinationBuffer) {
         *destinationBuffer++ = (unsigned char)it->jointID;
         destinationBuffer += packOrientationQuatToBytes(destinationBuffer, it->rotation);
     }
+
+    // more voxel sending features, the first set of bit items is full
+    unsigned char moreBitItems = 0;
+    if (_wantCompression) { setAtBit(moreBitItems, WANT_COMPRESSION_BIT); }
+    if (_wantColorCoding) { setAtBit(moreBitItems, WANT_COLOR_CODING_BIT); }
+    if (_wantVoxelCache)  { setAtBit(moreBitItems, WANT_VOXEL_CACHE_BIT); }
+    *destinationBuffer++ = moreBitItems;
     
     return destinationBuffer - bufferStart;
 }
@@ -309,6 +319,14 @@ int AvatarData::parseData(unsigned char* sourceBuffer, int numBytes) {
             sourceBuffer += unpackOrientationQuatFromBytes(sourceBuffer, it->rotation); 
         }
     }
+
+    // more voxel sending features
+    if (sourceBuffer - startPosition < numBytes) {
+        unsigned char moreBitItems = *sourceBuffer++;
+        _wantCompression = oneAtBit(moreBitItems, WANT_COMPRESSION_BIT);
+        _wantColorCoding = oneAtBit(moreBitItems, WANT_COLOR_CODING_BIT);
+        _wantVoxelCache = oneAtBit(moreBitItems, WANT_VOXEL_CACHE_BIT);
+    }
     
     return sourceBuffer - startPosition;
 }
@@ -29,6 +29,9 @@ const int WANT_DELTA_AT_BIT = 2;
 const int KEY_STATE_START_BIT = 3;  // 4th and 5th bits
 const int HAND_STATE_START_BIT = 5; // 6th and 7th bits
 const int WANT_OCCLUSION_CULLING_BIT = 7; // 8th bit
+const int WANT_COMPRESSION_BIT = 0; // 1st bit of the second set of bit items
+const int WANT_COLOR_CODING_BIT = 1; // 2nd bit of the second set of bit items
+const int WANT_VOXEL_CACHE_BIT = 2; // 3rd bit of the second set of bit items
 
 const float MAX_AUDIO_LOUDNESS = 1000.0; // close enough for mouth animation
 
@@ -114,6 +117,9 @@ public:
     bool getWantDelta() const { return _wantDelta; }
     bool getWantLowResMoving() const { return _wantLowResMoving; }
     bool getWantOcclusionCulling() const { return _wantOcclusionCulling; }
+    bool getWantCompression() const { return _wantCompression; }
+    bool getWantColorCoding() const { return _wantColorCoding; }
+    bool getWantVoxelCache() const { return _wantVoxelCache; }
     uint16_t getLeaderID() const { return _leaderID; }
     
     void setHeadData(HeadData* headData) { _headData = headData; }
@@ -125,6 +131,9 @@ public slots:
     void setWantColor(bool wantColor) { _wantColor = wantColor; }
     void setWantDelta(bool wantDelta) { _wantDelta = wantDelta; }
     void setWantOcclusionCulling(bool wantOcclusionCulling) { _wantOcclusionCulling = wantOcclusionCulling; }
+    void setWantCompression(bool wantCompression) { _wantCompression = wantCompression; }
+    void setWantColorCoding(bool wantColorCoding) { _wantColorCoding = wantColorCoding; }
+    void setWantVoxelCache(bool wantVoxelCache) { _wantVoxelCache = wantVoxelCache; }
     
 protected:
     glm::vec3 _position;
@@ -163,6 +172,9 @@ protected:
     bool _wantDelta;
     bool _wantLowResMoving;
     bool _wantOcclusionCulling;
+    bool _wantCompression;
+    bool _wantColorCoding;
+    bool _wantVoxelCache;
     
     std::vector<JointData> _joints;
     
@@ -0,0 +1,300 @@
+//
+//  EventLoop.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#include <sys/select.h>
+#include <sys/time.h>
+#endif
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include <QtCore/QDebug>
+
+#include "NodeList.h"
+#include "SharedUtil.h"
+#include "UDPSocket.h"
+#include "EventLoop.h"
+
+// a timer more than this far behind skips the deadlines it has missed, rather than firing for every one of them
+const uint64_t MAX_TIMER_CATCH_UP_USECS = 1000 * 1000;
+
+#ifdef __linux__
+const int MAX_EVENTS_PER_WAIT = 16;
+#endif
+
+EventLoop::EventLoop() :
+    _nextTimerID(1),
+    _stopping(false),
+    _pollHandle(-1),
+    _timerHandle(-1),
+    _wakeUps(0)
+{
+    pthread_mutex_init(&_postedLock, NULL);
+#ifdef __linux__
+    _pollHandle = epoll_create1(EPOLL_CLOEXEC);
+    _timerHandle = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    _wakeHandles[0] = _wakeHandles[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_pollHandle < 0 || _timerHandle < 0 || _wakeHandles[0] < 0) {
+        qDebug("EventLoop couldn't be set up: %s\n", strerror(errno));
+        return;
+    }
+    int handles[] = { _timerHandle, _wakeHandles[0] };
+    for (int i = 0; i < 2; i++) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = handles[i];
+        epoll_ctl(_pollHandle, EPOLL_CTL_ADD, handles[i], &event);
+    }
+#else
+    if (pipe(_wakeHandles) < 0) {
+        qDebug("EventLoop couldn't be set up: %s\n", strerror(errno));
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(_wakeHandles[i], F_SETFL, fcntl(_wakeHandles[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifdef __linux__
+    close(_wakeHandles[0]);
+    close(_timerHandle);
+    close(_pollHandle);
+#else
+    close(_wakeHandles[0]);
+    close(_wakeHandles[1]);
+#endif
+    pthread_mutex_destroy(&_postedLock);
+}
+
+uint64_t EventLoop::monotonicUsecs() {
+#ifdef __linux__
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    uint64_t ticks = mach_absolute_time();
+    // split up so that converting to nanoseconds can't overflow
+    uint64_t ticksPerUsec = 1000ULL * timebase.denom;
+    return (ticks / ticksPerUsec) * timebase.numer + (ticks % ticksPerUsec) * timebase.numer / ticksPerUsec;
+#else
+    return usecTimestampNow();
+#endif
+}
+
+void EventLoop::watchSocket(UDPSocket* socket, Callback callback, void* context) {
+    socket->setBlocking(false);
+    Watch watch = { socket->getHandle(), callback, context };
+    _watches.push_back(watch);
+#ifdef __linux__
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = watch.handle;
+    epoll_ctl(_pollHandle, EPOLL_CTL_ADD, watch.handle, &event);
+#endif
+}
+
+int EventLoop::addTimer(uint64_t intervalUsecs, Callback callback, void* context, bool fireNow) {
+    Timer timer = { _nextTimerID++, intervalUsecs, monotonicUsecs() + (fireNow ? 0 : intervalUsecs), callback, context };
+    _timers.push_back(timer);
+    return timer.id;
+}
+
+void EventLoop::removeTimer(int timerID) {
+    for (std::vector<Timer>::iterator timer = _timers.begin(); timer != _timers.end(); timer++) {
+        if (timer->id == timerID) {
+            _timers.erase(timer);
+            return;
+        }
+    }
+}
+
+void EventLoop::post(Callback callback, void* context) {
+    Posted posted = { callback, context };
+    pthread_mutex_lock(&_postedLock);
+    _posted.push_back(posted);
+    pthread_mutex_unlock(&_postedLock);
+    wake();
+}
+
+void EventLoop::run() {
+    while (true) {
+        pthread_mutex_lock(&_postedLock);
+        bool stopping = _stopping;
+        _stopping = false;
+        pthread_mutex_unlock(&_postedLock);
+        if (stopping) {
+            return;
+        }
+        wait();
+        
+        // the callbacks are done with whatever nodes they looked up
+        NodeList::doneWithNodes();
+    }
+}
+
+void EventLoop::stop() {
+    pthread_mutex_lock(&_postedLock);
+    _stopping = true;
+    pthread_mutex_unlock(&_postedLock);
+    wake();
+}
+
+void EventLoop::wake() {
+#ifdef __linux__
+    uint64_t count = 1;
+    write(_wakeHandles[1], &count, sizeof(count));
+#else
+    // if the pipe is full, the loop has plenty to wake it already
+    char wakeUp = 0;
+    write(_wakeHandles[1], &wakeUp, sizeof(wakeUp));
+#endif
+}
+
+void EventLoop::wait() {
+    uint64_t nextDeadline = 0;
+    for (std::vector<Timer>::const_iterator timer = _timers.begin(); timer != _timers.end(); timer++) {
+        if (nextDeadline == 0 || timer->deadline < nextDeadline) {
+            nextDeadline = timer->deadline;
+        }
+    }
+
+#ifdef __linux__
+    // an absolute deadline that has already passed fires right away, and a zero one disarms the timer
+    itimerspec timerSetting;
+    memset(&timerSetting, 0, sizeof(timerSetting));
+    timerSetting.it_value.tv_sec = nextDeadline / 1000000;
+    timerSetting.it_value.tv_nsec = (nextDeadline % 1000000) * 1000;
+    timerfd_settime(_timerHandle, TFD_TIMER_ABSTIME, &timerSetting, NULL);
+
+    epoll_event events[MAX_EVENTS_PER_WAIT];
+    int eventCount = epoll_wait(_pollHandle, events, MAX_EVENTS_PER_WAIT, -1);
+    if (eventCount < 0) {
+        if (errno != EINTR) {
+            qDebug("EventLoop::wait() failed: %s\n", strerror(errno));
+        }
+        return;
+    }
+    _wakeUps++;
+
+    fireTimers();
+    for (int i = 0; i < eventCount; i++) {
+        int handle = events[i].data.fd;
+        if (handle == _timerHandle) {
+            uint64_t expirations;
+            read(_timerHandle, &expirations, sizeof(expirations));
+        } else if (handle == _wakeHandles[0]) {
+            uint64_t count;
+            read(_wakeHandles[0], &count, sizeof(count));
+        } else {
+            for (size_t j = 0; j < _watches.size(); j++) {
+                if (_watches[j].handle == handle) {
+                    _watches[j].callback(_watches[j].context);
+                    break;
+                }
+            }
+        }
+    }
+#else
+    fd_set readHandles;
+    FD_ZERO(&readHandles);
+    int maxHandle = _wakeHandles[0];
+    FD_SET(_wakeHandles[0], &readHandles);
+    for (std::vector<Watch>::const_iterator watch = _watches.begin(); watch != _watches.end(); watch++) {
+        FD_SET(watch->handle, &readHandles);
+        maxHandle = std::max(maxHandle, watch->handle);
+    }
+    timeval timeout;
+    if (nextDeadline) {
+        uint64_t now = monotonicUsecs();
+        uint64_t usecsToWait = (nextDeadline > now) ? nextDeadline - now : 0;
+        timeout.tv_sec = usecsToWait / 1000000;
+        timeout.tv_usec = usecsToWait % 1000000;
+    }
+    int readyCount = select(maxHandle + 1, &readHandles, NULL, NULL, nextDeadline ? &timeout : NULL);
+    if (readyCount < 0) {
+        if (errno != EINTR) {
+            qDebug("EventLoop::wait() failed: %s\n", strerror(errno));
+        }
+        return;
+    }
+    _wakeUps++;
+
+    fireTimers();
+    if (readyCount > 0) {
+        if (FD_ISSET(_wakeHandles[0], &readHandles)) {
+            char wakeUps[64];
+            while (read(_wakeHandles[0], wakeUps, sizeof(wakeUps)) > 0) {
+            }
+        }
+        for (size_t j = 0; j < _watches.size(); j++) {
+            if (FD_ISSET(_watches[j].handle, &readHandles)) {
+                _watches[j].callback(_watches[j].context);
+            }
+        }
+    }
+#endif
+    runPosted();
+}
+
+void EventLoop::fireTimers() {
+    // callbacks can add and remove timers, so the due ones are picked out first and looked up again to be fired
+    uint64_t now = monotonicUsecs();
+    std::vector<int> dueTimerIDs;
+    for (std::vector<Timer>::iterator timer = _timers.begin(); timer != _timers.end(); timer++) {
+        if (timer->deadline <= now) {
+            dueTimerIDs.push_back(timer->id);
+            timer->deadline += timer->intervalUsecs;
+            if (timer->deadline + MAX_TIMER_CATCH_UP_USECS < now) {
+                timer->deadline = now + timer->intervalUsecs;
+            }
+        }
+    }
+    for (std::vector<int>::const_iterator id = dueTimerIDs.begin(); id != dueTimerIDs.end(); id++) {
+        for (size_t i = 0; i < _timers.size(); i++) {
+            if (_timers[i].id == *id) {
+                _timers[i].callback(_timers[i].context);
+                break;
+            }
+        }
+    }
+}
+
+void EventLoop::runPosted() {
+    pthread_mutex_lock(&_postedLock);
+    if (_posted.empty()) {
+        pthread_mutex_unlock(&_postedLock);
+        return;
+    }
+    std::vector<Posted> posted;
+    posted.swap(_posted);
+    pthread_mutex_unlock(&_postedLock);
+
+    for (std::vector<Posted>::const_iterator work = posted.begin(); work != posted.end(); work++) {
+        work->callback(work->context);
+    }
+}
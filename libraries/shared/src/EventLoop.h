@@ -0,0 +1,97 @@
+//
+//  EventLoop.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Runs a server's main thread: calls back when a watched socket has packets waiting, when a periodic timer comes due,
+//  and for work posted from other threads, and sleeps in between. On Linux it waits in epoll, with a timerfd armed for
+//  the next timer and an eventfd to be woken for posted work; elsewhere it uses select() and a pipe.
+//
+//  Timers keep to a fixed schedule from when they're added, so a late callback doesn't push the ones after it back. A
+//  timer that falls behind fires once per pass until it has caught up, unless it's so far behind that it skips ahead.
+//
+
+#ifndef __shared__EventLoop__
+#define __shared__EventLoop__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+class UDPSocket;
+
+class EventLoop {
+public:
+    typedef void (*Callback)(void* context);
+
+    EventLoop();
+    ~EventLoop();
+
+    /// Calls back whenever the socket has packets waiting, until they've been read. The socket is made non-blocking, so
+    /// the callback can read until there's nothing left, or just a batch and be called again.
+    void watchSocket(UDPSocket* socket, Callback callback, void* context);
+
+    /// Calls back every intervalUsecs, the first time right away if fireNow is set, and returns an ID for removeTimer().
+    int addTimer(uint64_t intervalUsecs, Callback callback, void* context, bool fireNow = false);
+    void removeTimer(int timerID);
+
+    /// Has the loop's thread call back as soon as it can, in the order posted. Any thread can post.
+    void post(Callback callback, void* context);
+
+    /// runs until stop() is called
+    void run();
+
+    /// ends run() once the callback in progress returns, from any thread
+    void stop();
+
+    unsigned long getWakeUps() const { return _wakeUps; }
+
+    /// microseconds on a clock that only ever moves forward, which timers are scheduled against
+    static uint64_t monotonicUsecs();
+
+private:
+    // disallow copying of EventLoop objects
+    EventLoop(const EventLoop&);
+    EventLoop& operator= (const EventLoop&);
+
+    struct Watch {
+        int handle;
+        Callback callback;
+        void* context;
+    };
+
+    struct Timer {
+        int id;
+        uint64_t intervalUsecs;
+        uint64_t deadline;
+        Callback callback;
+        void* context;
+    };
+
+    struct Posted {
+        Callback callback;
+        void* context;
+    };
+
+    void wait();
+    void fireTimers();
+    void runPosted();
+    void wake();
+
+    std::vector<Watch> _watches;
+    std::vector<Timer> _timers;
+    int _nextTimerID;
+
+    pthread_mutex_t _postedLock; // protects _posted and _stopping
+    std::vector<Posted> _posted;
+    bool _stopping;
+
+    int _pollHandle;        // the epoll instance, on Linux
+    int _timerHandle;       // the timerfd, on Linux
+    int _wakeHandles[2];    // an eventfd twice on Linux, the read and write ends of a pipe elsewhere
+
+    unsigned long _wakeUps;
+};
+
+#endif /* defined(__shared__EventLoop__) */
@@ -9,6 +9,7 @@
 //
 
 #include "GenericThread.h"
+#include "NodeList.h"
 
 GenericThread::GenericThread() :
     _stopThread(false),
@@ -50,6 +51,9 @@ void* GenericThread::threadRoutine() {
         if (!_isThreaded) {
             break;
         }
+        
+        // nothing process() looked up in the NodeList is held on to for the next call
+        NodeList::doneWithNodes();
     }
     
     if (_isThreaded) {
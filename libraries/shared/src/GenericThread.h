@@ -42,6 +42,11 @@ protected:
     void unlock() { pthread_mutex_unlock(&_mutex); }
     
     bool isStillRunning() const { return !_stopThread; }
+
+    bool isThreaded() const { return _isThreaded; }
+
+    /// Is the caller running on this object's own thread
+    bool isOnThread() const { return _isThreaded && pthread_equal(pthread_self(), _thread); }
     
 private:
     pthread_mutex_t _mutex;
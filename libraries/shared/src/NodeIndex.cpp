@@ -0,0 +1,120 @@
+//
+//  NodeIndex.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstddef>
+
+#ifdef _WIN32
+#include "Syssocket.h"
+#else
+#include <netinet/in.h>
+#endif
+
+#include "NodeIndex.h"
+
+static char removedEntry;
+Node* const NodeIndex::REMOVED = (Node*)&removedEntry;
+
+NodeIndex::NodeIndex(int maxEntries) :
+    _maxEntries(maxEntries),
+    _entryCount(0)
+{
+    unsigned long capacity = 1;
+    while (capacity < (unsigned long)maxEntries * 2) {
+        capacity <<= 1;
+    }
+    _mask = capacity - 1;
+    _entries = new Entry[capacity];
+    clear();
+}
+
+NodeIndex::~NodeIndex() {
+    delete[] _entries;
+}
+
+bool NodeIndex::insert(uint64_t key, Node* node) {
+    if (_entryCount == _maxEntries) {
+        return false;
+    }
+    // linear probing, so the entry goes in the first free or removed slot along from the key's, where every lookup
+    // will pass it
+    unsigned long slot = slotFor(key);
+    while (_entries[slot].node != NULL && _entries[slot].node != REMOVED) {
+        slot = (slot + 1) & _mask;
+    }
+    _entries[slot].key = key;
+    __sync_synchronize();
+    _entries[slot].node = node;
+    _entryCount++;
+    return true;
+}
+
+Node* NodeIndex::find(uint64_t key, Test test, const void* context) const {
+    // the first free slot ends the key's run, and a table left with only removed ones ends after one lap
+    unsigned long slot = slotFor(key);
+    for (unsigned long probes = 0; probes <= _mask; probes++, slot = (slot + 1) & _mask) {
+        Node* node = _entries[slot].node;
+        if (node == NULL) {
+            return NULL;
+        }
+        __sync_synchronize();
+        
+        // an entry reused for another key while we look at it has its key written first, so a mismatched node is
+        // one that was removed, which was killed before that and fails the test
+        if (node != REMOVED && _entries[slot].key == key && test(node, context)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+void NodeIndex::remove(uint64_t key, Node* node) {
+    unsigned long slot = slotFor(key);
+    bool found = false;
+    for (unsigned long probes = 0; probes <= _mask && !found; probes++) {
+        Node* entryNode = _entries[slot].node;
+        if (entryNode == NULL) {
+            return;
+        }
+        found = entryNode == node && _entries[slot].key == key;
+        if (!found) {
+            slot = (slot + 1) & _mask;
+        }
+    }
+    if (!found) {
+        return;
+    }
+    _entries[slot].node = REMOVED;
+    _entryCount--;
+    
+    // removed entries at the end of a run can be freed, as no key's run goes past them
+    while (_entries[(slot + 1) & _mask].node == NULL && _entries[slot].node == REMOVED) {
+        _entries[slot].node = NULL;
+        slot = (slot - 1) & _mask;
+    }
+}
+
+void NodeIndex::clear() {
+    for (unsigned long slot = 0; slot <= _mask; slot++) {
+        _entries[slot].node = NULL;
+    }
+    _entryCount = 0;
+}
+
+bool NodeIndex::socketKey(const sockaddr* socket, uint64_t& key) {
+    if (socket == NULL || socket->sa_family != AF_INET) {
+        return false;
+    }
+    const sockaddr_in* socketIn = (const sockaddr_in*)socket;
+    key = ((uint64_t)socketIn->sin_addr.s_addr << 16) | socketIn->sin_port;
+    return true;
+}
+
+unsigned long NodeIndex::slotFor(uint64_t key) const {
+    // Fibonacci hashing, which spreads the runs of consecutive IDs and ports across the table
+    const uint64_t GOLDEN_RATIO_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+    return (unsigned long)((key * GOLDEN_RATIO_MULTIPLIER) >> 32) & _mask;
+}
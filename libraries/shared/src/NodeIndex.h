@@ -0,0 +1,83 @@
+//
+//  NodeIndex.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A hash index over a NodeList's nodes, by node ID or by socket, so the per packet lookups don't scan the whole list.
+//  Readers on any thread look nodes up without a lock while one writer at a time adds and removes entries: a reader
+//  only ever sees an entry whose node is fully in place, removed entries are marked rather than emptied so the probes
+//  passing through them carry on, and the nodes themselves outlive any lookup that can reach them (see NodeList).
+//
+//  A key can have several entries, a killed node's along with its replacement's, so lookups take a test of the node
+//  they're after and return the first entry under the key that passes it.
+//
+
+#ifndef __shared__NodeIndex__
+#define __shared__NodeIndex__
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include "Syssocket.h"
+#else
+#include <sys/socket.h>
+#endif
+
+class Node;
+
+class NodeIndex {
+public:
+    /// whether a node found under a key is the one being looked for
+    typedef bool (*Test)(const Node* node, const void* context);
+
+    /// \param maxEntries the most entries the index will be asked to hold, which it keeps to half full at most
+    NodeIndex(int maxEntries);
+    ~NodeIndex();
+
+    /// Adds an entry for the node under the key. Returns false if the index is full.
+    /// \thread the writer, one at a time
+    bool insert(uint64_t key, Node* node);
+
+    /// the first node under the key that passes the test, or NULL if none does
+    /// \thread any thread
+    Node* find(uint64_t key, Test test, const void* context) const;
+
+    /// Removes the node's entry under the key, if it has one, so the slot can be reused.
+    /// \thread the writer, one at a time
+    void remove(uint64_t key, Node* node);
+
+    /// Drops every entry, for an index no reader is probing.
+    /// \thread the writer
+    void clear();
+
+    int getEntryCount() const { return _entryCount; }
+
+    /// the key for a node ID
+    static uint64_t idKey(uint16_t nodeID) { return nodeID; }
+
+    /// the key for an IPv4 socket, which is all socketMatch() compares; false for any other family
+    static bool socketKey(const sockaddr* socket, uint64_t& key);
+
+private:
+    // disallow copying of NodeIndex objects
+    NodeIndex(const NodeIndex&);
+    NodeIndex& operator= (const NodeIndex&);
+
+    struct Entry {
+        uint64_t key;
+        Node* volatile node; // NULL while the entry is free, set only once the key is in place
+    };
+
+    // marks a removed entry, which doesn't end a run the way a free one does
+    static Node* const REMOVED;
+
+    unsigned long slotFor(uint64_t key) const;
+
+    Entry* _entries;
+    unsigned long _mask;
+    int _maxEntries;
+    int _entryCount;
+};
+
+#endif /* defined(__shared__NodeIndex__) */
@@ -7,6 +7,7 @@
 //
 
 #include <pthread.h>
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
@@ -15,8 +16,10 @@
 
 #include "NodeList.h"
 #include "NodeTypes.h"
+#include "PacketBuffer.h"
 #include "PacketHeaders.h"
 #include "SharedUtil.h"
+#include "UDPSendBatch.h"
 
 #ifdef _WIN32
 #include "Syssocket.h"
@@ -59,7 +62,12 @@ NodeList* NodeList::getInstance() {
 NodeList::NodeList(char newOwnerType, unsigned short int newSocketListenPort) :
     _nodeBuckets(),
     _numNodes(0),
+    _nodesByID(MAX_NUM_NODES),
+    _nodesBySocket(MAX_NUM_NODES * 2),
+    _epoch(1),
     _nodeSocket(newSocketListenPort),
+    _reportedPacketsDropped(0),
+    _broadcastBatch(NULL),
     _ownerType(newOwnerType),
     _nodeTypesOfInterest(NULL),
     _ownerID(UNKNOWN_NODE_ID),
@@ -67,15 +75,35 @@ NodeList::NodeList(char newOwnerType, unsigned short int newSocketListenPort) :
 {
     memcpy(_domainHostname, DEFAULT_DOMAIN_HOSTNAME, sizeof(DEFAULT_DOMAIN_HOSTNAME));
     memcpy(_domainIP, DEFAULT_DOMAIN_IP, sizeof(DEFAULT_DOMAIN_IP));
+    pthread_mutex_init(&_nodeListLock, NULL);
+    pthread_key_create(&_readerKey, forgetReader);
+    pthread_mutex_init(&_readersLock, NULL);
+    pthread_mutex_init(&_broadcastLock, NULL);
 }
 
 NodeList::~NodeList() {
     delete _nodeTypesOfInterest;
     
+    // stop the spawned threads, if they were started, so nothing is left looking at the nodes
+    stopSilentNodeRemovalThread();
+    
     clear();
     
-    // stop the spawned threads, if they were started
-    stopSilentNodeRemovalThread();
+    // there's no one left to read the list, so the nodes still held by a reader's epoch go too
+    for (int i = 0; i < _retiredNodes.size(); i++) {
+        delete _retiredNodes[i].node;
+    }
+    for (int i = 0; i < MAX_NUM_NODES / NODES_PER_BUCKET; i++) {
+        delete[] _nodeBuckets[i];
+    }
+    pthread_mutex_destroy(&_nodeListLock);
+    pthread_key_delete(_readerKey);
+    for (int i = 0; i < _readers.size(); i++) {
+        delete _readers[i];
+    }
+    pthread_mutex_destroy(&_readersLock);
+    delete _broadcastBatch;
+    pthread_mutex_destroy(&_broadcastLock);
 }
 
 void NodeList::setDomainHostname(const char* domainHostname) {    
@@ -96,16 +124,40 @@ void NodeList::setDomainIPToLocalhost() {
     sprintf(_domainIP, "%d.%d.%d.%d", (ip & 0xFF), ((ip >> 8) & 0xFF),((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
 }
 
-void NodeList::timePingReply(sockaddr *nodeAddress, unsigned char *packetData) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (socketMatch(node->getPublicSocket(), nodeAddress) || 
-            socketMatch(node->getLocalSocket(), nodeAddress)) {     
+static bool isAliveWithSocket(const Node* node, const void* socket) {
+    return node->isAlive() && (socketMatch(node->getPublicSocket(), (const sockaddr*)socket) ||
+                               socketMatch(node->getLocalSocket(), (const sockaddr*)socket));
+}
 
-            int pingTime = usecTimestampNow() - *(uint64_t*)(packetData + numBytesForPacketHeader(packetData));
-            
-            node->setPingMs(pingTime / 1000);
-            break;
-        }
+static bool isAliveWithActiveSocket(const Node* node, const void* socket) {
+    return node->isAlive() && node->getActiveSocket() && socketMatch(node->getActiveSocket(), (const sockaddr*)socket);
+}
+
+static bool isAliveWithID(const Node* node, const void* nodeID) {
+    return node->isAlive() && node->getNodeID() == *(const uint16_t*)nodeID;
+}
+
+struct NodeSockets {
+    sockaddr* publicSocket;
+    sockaddr* localSocket;
+    char nodeType;
+};
+
+static bool isAliveWithSockets(const Node* node, const void* sockets) {
+    const NodeSockets* nodeSockets = (const NodeSockets*)sockets;
+    return node->isAlive() && const_cast<Node*>(node)->matches(nodeSockets->publicSocket, nodeSockets->localSocket,
+                                                               nodeSockets->nodeType);
+}
+
+void NodeList::timePingReply(sockaddr *nodeAddress, unsigned char *packetData) {
+    beginReading();
+    uint64_t key;
+    Node* node = NodeIndex::socketKey(nodeAddress, key) ? _nodesBySocket.find(key, isAliveWithSocket, nodeAddress)
+                                                        : NULL;
+    if (node) {
+        int pingTime = usecTimestampNow() - *(uint64_t*)(packetData + numBytesForPacketHeader(packetData));
+        
+        node->setPingMs(pingTime / 1000);
     }
 }
 
@@ -167,6 +219,11 @@ void NodeList::processBulkNodeData(sockaddr *senderAddress, unsigned char *packe
             if (!matchingNode) {
                 // we're missing this node, we need to add it to the list
                 matchingNode = addOrUpdateNode(NULL, NULL, NODE_TYPE_AGENT, nodeID);
+                
+                if (!matchingNode) {
+                    // the list is full, so the rest of the packet is dropped
+                    break;
+                }
             }
             
             currentPosition += updateNodeWithData(matchingNode,
@@ -189,6 +246,11 @@ int NodeList::updateNodeWithData(sockaddr *senderAddress, unsigned char *packetD
 }
 
 int NodeList::updateNodeWithData(Node *node, unsigned char *packetData, int dataBytes) {
+    if (!node) {
+        // addOrUpdateNode() had no room for it
+        return 0;
+    }
+    
     node->lock();
     
     node->setLastHeardMicrostamp(usecTimestampNow());
@@ -209,23 +271,29 @@ int NodeList::updateNodeWithData(Node *node, unsigned char *packetData, int data
 }
 
 Node* NodeList::nodeWithAddress(sockaddr *senderAddress) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (node->getActiveSocket() && socketMatch(node->getActiveSocket(), senderAddress)) {
-            return &(*node);
-        }
-    }
+    beginReading();
     
-    return NULL;
+    // the active socket is either the public or the local one, and the index has both
+    uint64_t key;
+    if (!NodeIndex::socketKey(senderAddress, key)) {
+        return NULL;
+    }
+    return _nodesBySocket.find(key, isAliveWithActiveSocket, senderAddress);
 }
 
 Node* NodeList::nodeWithID(uint16_t nodeID) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (node->getNodeID() == nodeID) {
-            return &(*node);
-        }
-    }
+    beginReading();
+    return _nodesByID.find(NodeIndex::idKey(nodeID), isAliveWithID, &nodeID);
+}
 
-    return NULL;
+Node* NodeList::nodeWithSockets(sockaddr* publicSocket, sockaddr* localSocket, char nodeType) {
+    beginReading();
+    uint64_t key;
+    if (!NodeIndex::socketKey(publicSocket, key)) {
+        return NULL;
+    }
+    NodeSockets sockets = { publicSocket, localSocket, nodeType };
+    return _nodesBySocket.find(key, isAliveWithSockets, &sockets);
 }
 
 int NodeList::getNumAliveNodes() const {
@@ -241,18 +309,138 @@ int NodeList::getNumAliveNodes() const {
 }
 
 void NodeList::clear() {
-    // delete all of the nodes in the list, set the pointers back to NULL and the number of nodes to 0
+    pthread_mutex_lock(&_nodeListLock);
+    for (int i = 0; i < _numNodes; i++) {
+        Node* node = _nodeBuckets[i / NODES_PER_BUCKET][i % NODES_PER_BUCKET];
+        if (node) {
+            node->setAlive(false);
+        }
+    }
+    pthread_mutex_unlock(&_nodeListLock);
+    
+    removeDeadNodes();
+}
+
+void NodeList::removeDeadNodes() {
+    std::vector<Node*> releasedNodes;
+    
+    pthread_mutex_lock(&_nodeListLock);
+    takeOutDeadNodes();
+    takeReleasedNodes(releasedNodes);
+    pthread_mutex_unlock(&_nodeListLock);
+    
+    // nothing can reach these any more, so they're deleted without holding the list up, or locking them
+    for (int i = 0; i < releasedNodes.size(); i++) {
+        delete releasedNodes[i];
+    }
+}
+
+// called with _nodeListLock held
+void NodeList::takeOutNode(int slot) {
+    Node*& slotNode = _nodeBuckets[slot / NODES_PER_BUCKET][slot % NODES_PER_BUCKET];
+    Node* node = slotNode;
+    slotNode = NULL;
+    
+    _nodesByID.remove(NodeIndex::idKey(node->getNodeID()), node);
+    uint64_t key;
+    if (NodeIndex::socketKey(node->getPublicSocket(), key)) {
+        _nodesBySocket.remove(key, node);
+    }
+    if (NodeIndex::socketKey(node->getLocalSocket(), key)) {
+        _nodesBySocket.remove(key, node);
+    }
+    
+    _freeSlots.push_back(slot);
+    RetiredNode retiredNode = { node, 0 };
+    _retiredNodes.push_back(retiredNode);
+}
+
+// called with _nodeListLock held
+void NodeList::takeOutDeadNodes() {
+    int firstTakenOut = _retiredNodes.size();
     for (int i = 0; i < _numNodes; i++) {
-        Node** nodeBucket = _nodeBuckets[i / NODES_PER_BUCKET];
-        Node* node = nodeBucket[i % NODES_PER_BUCKET];
+        Node* node = _nodeBuckets[i / NODES_PER_BUCKET][i % NODES_PER_BUCKET];
+        if (node && !node->isAlive()) {
+            takeOutNode(i);
+        }
+    }
+    if (firstTakenOut == _retiredNodes.size()) {
+        return;
+    }
+    
+    // a reader that can still reach the nodes began reading before they were taken out, so in this epoch or an
+    // earlier one, and those that begin after can't
+    __sync_synchronize();
+    uint64_t epoch = __sync_fetch_and_add(&_epoch, 1);
+    for (int i = firstTakenOut; i < _retiredNodes.size(); i++) {
+        _retiredNodes[i].epoch = epoch;
+    }
+}
+
+// called with _nodeListLock held
+void NodeList::takeReleasedNodes(std::vector<Node*>& releasedNodes) {
+    // the readers' epochs are read after the nodes were taken out, so a reader that reached one is seen reading
+    __sync_synchronize();
+    uint64_t oldestReadingEpoch = _epoch;
+    pthread_mutex_lock(&_readersLock);
+    for (int i = 0; i < _readers.size(); i++) {
+        uint64_t readerEpoch = _readers[i]->epoch;
+        if (readerEpoch != 0 && readerEpoch < oldestReadingEpoch) {
+            oldestReadingEpoch = readerEpoch;
+        }
+    }
+    pthread_mutex_unlock(&_readersLock);
+    
+    int numKept = 0;
+    for (int i = 0; i < _retiredNodes.size(); i++) {
+        if (_retiredNodes[i].epoch < oldestReadingEpoch) {
+            releasedNodes.push_back(_retiredNodes[i].node);
+        } else {
+            _retiredNodes[numKept++] = _retiredNodes[i];
+        }
+    }
+    _retiredNodes.resize(numKept);
+}
+
+void NodeList::beginReading() const {
+    Reader* reader = (Reader*)pthread_getspecific(_readerKey);
+    if (!reader) {
+        reader = new Reader();
+        reader->nodeList = const_cast<NodeList*>(this);
+        reader->epoch = 0;
+        pthread_setspecific(_readerKey, reader);
         
-        node->lock();
-        delete node;
+        pthread_mutex_lock(&_readersLock);
+        _readers.push_back(reader);
+        pthread_mutex_unlock(&_readersLock);
+    }
+    if (reader->epoch == 0) {
+        reader->epoch = _epoch;
         
-        node = NULL;
+        // we have to be seen reading before we look at anything that may be taken out
+        __sync_synchronize();
     }
-    
-    _numNodes = 0;
+}
+
+void NodeList::doneWithNodes() {
+    if (!_sharedInstance) {
+        return;
+    }
+    Reader* reader = (Reader*)pthread_getspecific(_sharedInstance->_readerKey);
+    if (reader && reader->epoch != 0) {
+        // we have to be done with the nodes before we're seen to be
+        __sync_synchronize();
+        reader->epoch = 0;
+    }
+}
+
+// called as a thread that used the list exits
+void NodeList::forgetReader(void* reader) {
+    NodeList* nodeList = ((Reader*)reader)->nodeList;
+    pthread_mutex_lock(&nodeList->_readersLock);
+    nodeList->_readers.erase(std::find(nodeList->_readers.begin(), nodeList->_readers.end(), (Reader*)reader));
+    pthread_mutex_unlock(&nodeList->_readersLock);
+    delete (Reader*)reader;
 }
 
 void NodeList::setNodeTypesOfInterest(const char* nodeTypesOfInterest, int numNodeTypesOfInterest) {
@@ -284,6 +472,13 @@ void NodeList::sendDomainServerCheckIn() {
         printedDomainServerIP = true;
     }
     
+    // the kernel drops what arrives while the node socket's receive buffer is full, which otherwise goes unnoticed
+    if (_nodeSocket.getPacketsDropped() > _reportedPacketsDropped) {
+        qDebug("%lu packets dropped by the node socket since the last check in, %lu received in all\n",
+               _nodeSocket.getPacketsDropped() - _reportedPacketsDropped, _nodeSocket.getPacketsReceived());
+        _reportedPacketsDropped = _nodeSocket.getPacketsDropped();
+    }
+    
     static unsigned char* checkInPacket = NULL;
     static int checkInPacketSize = 0;
     
@@ -376,18 +571,20 @@ void NodeList::sendAssignmentRequest() {
 }
 
 Node* NodeList::addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, char nodeType, uint16_t nodeId) {
-    NodeList::iterator node = end();
+    // the node is almost always there already, which the index tells us without a lock
+    Node* node = nodeWithSockets(publicSocket, localSocket, nodeType);
     
-    if (publicSocket) {
-        for (node = begin(); node != end(); node++) {
-            if (node->matches(publicSocket, localSocket, nodeType)) {
-                // we already have this node, stop checking
-                break;
-            }
+    if (!node) {
+        pthread_mutex_lock(&_nodeListLock);
+        
+        // another thread may have added it since we looked
+        node = nodeWithSockets(publicSocket, localSocket, nodeType);
+        if (node) {
+            pthread_mutex_unlock(&_nodeListLock);
         }
-    } 
+    }
     
-    if (node == end()) {
+    if (!node) {
         // we didn't have this node, so add them
         Node* newNode = new Node(publicSocket, localSocket, nodeType, nodeId);
         
@@ -405,7 +602,17 @@ Node* NodeList::addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, c
             newNode->activatePublicSocket();
         }
         
-        addNodeToList(newNode);
+        bool added = addNodeToList(newNode);
+        pthread_mutex_unlock(&_nodeListLock);
+        
+        if (!added) {
+            qDebug("NodeList is full, can't add another node\n");
+            delete newNode;
+            return NULL;
+        }
+        qDebug() << "Added" << *newNode << "\n";
+        
+        notifyHooksOfAddedNode(newNode);
         
         return newNode;
     } else {
@@ -418,37 +625,84 @@ Node* NodeList::addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, c
         }
         
         // we had this node already, do nothing for now
-        return &*node;
+        return node;
     }    
 }
 
-void NodeList::addNodeToList(Node* newNode) {
+// called with _nodeListLock held
+bool NodeList::addNodeToList(Node* newNode) {
+    if (_freeSlots.empty() && _numNodes == MAX_NUM_NODES) {
+        // the killed nodes the silent node thread hasn't got to yet make room
+        takeOutDeadNodes();
+    }
+    
+    int slot;
+    if (!_freeSlots.empty()) {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+    } else if (_numNodes < MAX_NUM_NODES) {
+        slot = _numNodes;
+    } else {
+        return false;
+    }
+    
     // find the correct array to add this node to
-    int bucketIndex = _numNodes / NODES_PER_BUCKET;
+    int bucketIndex = slot / NODES_PER_BUCKET;
     
     if (!_nodeBuckets[bucketIndex]) {
         _nodeBuckets[bucketIndex] = new Node*[NODES_PER_BUCKET]();
     }
     
-    _nodeBuckets[bucketIndex][_numNodes % NODES_PER_BUCKET] = newNode;
-    
-    ++_numNodes;
-    
-    qDebug() << "Added" << *newNode << "\n";
+    _nodesByID.insert(NodeIndex::idKey(newNode->getNodeID()), newNode);
+    uint64_t key;
+    if (NodeIndex::socketKey(newNode->getPublicSocket(), key)) {
+        _nodesBySocket.insert(key, newNode);
+    }
+    if (NodeIndex::socketKey(newNode->getLocalSocket(), key) &&
+            !socketMatch(newNode->getLocalSocket(), newNode->getPublicSocket())) {
+        _nodesBySocket.insert(key, newNode);
+    }
     
-    notifyHooksOfAddedNode(newNode);
+    // the node has to be in place before iterators on other threads can see it in its slot, and in its slot before
+    // they can see the slot's there
+    __sync_synchronize();
+    _nodeBuckets[bucketIndex][slot % NODES_PER_BUCKET] = newNode;
+    if (slot == _numNodes) {
+        __sync_synchronize();
+        ++_numNodes;
+    }
+    return true;
 }
 
 unsigned NodeList::broadcastToNodes(unsigned char* broadcastData, size_t dataBytes, const char* nodeTypes, int numNodeTypes) {
     unsigned n = 0;
+    pthread_mutex_lock(&_broadcastLock);
+    if (!_broadcastBatch) {
+        _broadcastBatch = new UDPSendBatch(&_nodeSocket);
+    }
+
+    // every node is sent the same bytes, so they share one buffer rather than the batch copying them for each
+    PacketBuffer* buffer = NULL;
     for(NodeList::iterator node = begin(); node != end(); node++) {
         // only send to the NodeTypes we are asked to send to.
         if (node->getActiveSocket() != NULL && memchr(nodeTypes, node->getType(), numNodeTypes)) {
+            if (!buffer) {
+                buffer = PacketBuffer::copyOf(broadcastData, dataBytes);
+            }
             // we know which socket is good for this node, send there
-            _nodeSocket.send(node->getActiveSocket(), broadcastData, dataBytes);
+            if (buffer) {
+                _broadcastBatch->queue(node->getActiveSocket(), buffer);
+            } else {
+                _broadcastBatch->queue(node->getActiveSocket(), broadcastData, dataBytes);
+            }
             ++n;
         }
     }
+    _broadcastBatch->flush();
+    if (buffer) {
+        buffer->release();
+    }
+    pthread_mutex_unlock(&_broadcastLock);
     return n;
 }
 
@@ -498,6 +752,10 @@ void* removeSilentNodes(void *args) {
             }
         }
         
+        // the pass is over, and with it this thread's hold on the nodes, so the dead ones can be taken out
+        NodeList::doneWithNodes();
+        nodeList->removeDeadNodes();
+        
         sleepTime = NODE_SILENCE_THRESHOLD_USECS - (usecTimestampNow() - checkTimeUSecs);
         #ifdef _WIN32
         Sleep( static_cast<int>(1000.0f*sleepTime) );
@@ -551,53 +809,61 @@ void NodeList::saveData(QSettings* settings) {
 }
 
 NodeList::iterator NodeList::begin() const {
-    Node** nodeBucket = NULL;
+    beginReading();
     
-    for (int i = 0; i < _numNodes; i++) {
-        if (i % NODES_PER_BUCKET == 0) {
-            nodeBucket =  _nodeBuckets[i / NODES_PER_BUCKET];
-        }
-        
-        if (nodeBucket[i % NODES_PER_BUCKET]->isAlive()) {
-            return NodeListIterator(this, i);
+    // the slots up to the count we read are all in their buckets, whatever other threads add while we go over them
+    int numNodes = _numNodes;
+    __sync_synchronize();
+    
+    for (int i = 0; i < numNodes; i++) {
+        Node* node = _nodeBuckets[i / NODES_PER_BUCKET][i % NODES_PER_BUCKET];
+        if (node && node->isAlive()) {
+            return NodeListIterator(this, i, numNodes, node);
         }
     }
     
     // there's no alive node to start from - return the end
-    return end();
+    return NodeListIterator(this, numNodes, numNodes, NULL);
 }
 
 NodeList::iterator NodeList::end() const {
-    return NodeListIterator(this, _numNodes);
+    int numNodes = _numNodes;
+    return NodeListIterator(this, numNodes, numNodes, NULL);
 }
 
-NodeListIterator::NodeListIterator(const NodeList* nodeList, int nodeIndex) :
-    _nodeIndex(nodeIndex) {
+NodeListIterator::NodeListIterator(const NodeList* nodeList, int nodeIndex, int numNodes, Node* node) :
+    _nodeIndex(nodeIndex),
+    _numNodes(numNodes),
+    _node(node) {
     _nodeList = nodeList;
 }
 
 NodeListIterator& NodeListIterator::operator=(const NodeListIterator& otherValue) {
     _nodeList = otherValue._nodeList;
     _nodeIndex = otherValue._nodeIndex;
+    _numNodes = otherValue._numNodes;
+    _node = otherValue._node;
     return *this;
 }
 
 bool NodeListIterator::operator==(const NodeListIterator &otherValue) {
-    return _nodeIndex == otherValue._nodeIndex;
+    // the end of one pass is the end of any other, however many nodes each began with
+    bool atEnd = _nodeIndex >= _numNodes;
+    bool otherAtEnd = otherValue._nodeIndex >= otherValue._numNodes;
+    return (atEnd || otherAtEnd) ? (atEnd && otherAtEnd) : (_nodeIndex == otherValue._nodeIndex);
 }
 
 bool NodeListIterator::operator!=(const NodeListIterator &otherValue) {
     return !(*this == otherValue);
 }
 
+// the node is kept from when we came to its slot, which may have been freed and reused since
 Node& NodeListIterator::operator*() {
-    Node** nodeBucket = _nodeList->_nodeBuckets[_nodeIndex / NODES_PER_BUCKET];
-    return *nodeBucket[_nodeIndex % NODES_PER_BUCKET];
+    return *_node;
 }
 
 Node* NodeListIterator::operator->() {
-    Node** nodeBucket = _nodeList->_nodeBuckets[_nodeIndex / NODES_PER_BUCKET];
-    return nodeBucket[_nodeIndex % NODES_PER_BUCKET];
+    return _node;
 }
 
 NodeListIterator& NodeListIterator::operator++() {
@@ -612,13 +878,17 @@ NodeList::iterator NodeListIterator::operator++(int) {
 }
 
 void NodeListIterator::skipDeadAndStopIncrement() {
-    while (_nodeIndex != _nodeList->_numNodes) {
+    while (_nodeIndex != _numNodes) {
         ++_nodeIndex;
         
-        if (_nodeIndex == _nodeList->_numNodes) {
+        if (_nodeIndex == _numNodes) {
+            _node = NULL;
             break;
-        } else if ((*(*this)).isAlive()) {
-            // skip over the dead nodes
+        }
+        
+        // skip over the free slots and the dead nodes
+        _node = _nodeList->_nodeBuckets[_nodeIndex / NODES_PER_BUCKET][_nodeIndex % NODES_PER_BUCKET];
+        if (_node && _node->isAlive()) {
             break;
         }
     }
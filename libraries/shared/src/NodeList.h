@@ -13,10 +13,12 @@
 #include <stdint.h>
 #include <iterator>
 #include <unistd.h>
+#include <vector>
 
 #include <QtCore/QSettings>
 
 #include "Node.h"
+#include "NodeIndex.h"
 #include "NodeTypes.h"
 #include "UDPSocket.h"
 
@@ -44,6 +46,7 @@ extern const int DEFAULT_DOMAINSERVER_PORT;
 const int UNKNOWN_NODE_ID = 0;
 
 class NodeListIterator;
+class UDPSendBatch;
 
 // Callers who want to hook add/kill callbacks should implement this class
 class NodeListHook {
@@ -88,8 +91,20 @@ public:
     int size() { return _numNodes; }
     int getNumAliveNodes() const;
     
+    /// Kills every node and empties the list. The nodes are deleted once every thread that may hold one is done.
     void clear();
     
+    /// Takes the killed nodes out of the list, so their slots can go to new ones, and deletes those taken out earlier
+    /// that no thread can still hold.
+    void removeDeadNodes();
+    
+    /// Tells the list that the calling thread holds no node it iterated over or looked up, so the nodes taken out
+    /// before now can be deleted as far as it's concerned. Threads that use the list call this between passes over
+    /// their work, where they hold none; until a thread does, nothing taken out after it first used the list is
+    /// deleted.
+    /// \thread any thread
+    static void doneWithNodes();
+    
     void setNodeTypesOfInterest(const char* nodeTypesOfInterest, int numNodeTypesOfInterest);
     
     void sendDomainServerCheckIn();
@@ -97,9 +112,15 @@ public:
     
     void sendAssignmentRequest();
     
+    /// the alive node whose active socket is senderAddress, found through the socket index
     Node* nodeWithAddress(sockaddr *senderAddress);
+
+    /// the alive node with the ID, found through the ID index
     Node* nodeWithID(uint16_t nodeID);
     
+    /// The alive node with these sockets and type, which is added if there isn't one, or NULL if the list is full. A
+    /// node without a public socket is always added.
+    /// \thread any thread, those adding nodes take turns
     Node* addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, char nodeType, uint16_t nodeId);
     
     void processNodeData(sockaddr *senderAddress, unsigned char *packetData, size_t dataBytes);
@@ -133,13 +154,53 @@ private:
     NodeList(NodeList const&); // Don't implement, needed to avoid copies of singleton
     void operator=(NodeList const&); // Don't implement, needed to avoid copies of singleton
     
-    void addNodeToList(Node* newNode);
+    bool addNodeToList(Node* newNode);
+    Node* nodeWithSockets(sockaddr* publicSocket, sockaddr* localSocket, char nodeType);
+    void takeOutNode(int slot);
+    void takeOutDeadNodes();
+    void takeReleasedNodes(std::vector<Node*>& releasedNodes);
+    
+    // a thread that uses the list, and the epoch it began using it in, or 0 while it holds no node
+    struct Reader {
+        NodeList* nodeList;
+        volatile uint64_t epoch;
+    };
+    
+    // a node taken out of the list, and the epoch it was taken out in
+    struct RetiredNode {
+        Node* node;
+        uint64_t epoch;
+    };
+    
+    void beginReading() const;
+    static void forgetReader(void* reader);
     
     char _domainHostname[MAX_HOSTNAME_BYTES];
     char _domainIP[INET_ADDRSTRLEN];
+
+    // Nodes go in free slots of the buckets, or are appended and published by bumping _numNodes, so iterating over the
+    // list and looking nodes up needs no lock while other threads add, kill and take out nodes; the threads changing
+    // the list take turns with _nodeListLock. A node taken out of its slot and the indexes is deleted once no thread
+    // can still hold it: every thread using the list is in the _epoch it began reading in until it calls
+    // doneWithNodes(), and the nodes taken out in an epoch are deleted once no reader is left in that epoch or an
+    // earlier one.
     Node** _nodeBuckets[MAX_NUM_NODES / NODES_PER_BUCKET];
-    int _numNodes;
+    volatile int _numNodes; // the slots that have ever been used, free ones among them
+    std::vector<int> _freeSlots;
+    NodeIndex _nodesByID;
+    NodeIndex _nodesBySocket; // by public and local socket
+    pthread_mutex_t _nodeListLock;
+    std::vector<RetiredNode> _retiredNodes;
+    
+    volatile uint64_t _epoch;
+    pthread_key_t _readerKey;
+    mutable std::vector<Reader*> _readers;
+    mutable pthread_mutex_t _readersLock;
+
     UDPSocket _nodeSocket;
+    unsigned long _reportedPacketsDropped; // by the node socket, as of the last domain server check in
+    UDPSendBatch* _broadcastBatch; // kept between broadcasts, taken turns with through _broadcastLock
+    pthread_mutex_t _broadcastLock;
     char _ownerType;
     char* _nodeTypesOfInterest;
     uint16_t _ownerID;
@@ -153,9 +214,11 @@ private:
     std::vector<NodeListHook*> _hooks;
 };
 
+/// Iterates over the alive nodes in the slots that were in use when it began, so nodes appended meanwhile by other
+/// threads are left for the next pass, while those put in freed slots may or may not be passed over.
 class NodeListIterator : public std::iterator<std::input_iterator_tag, Node> {
 public:
-    NodeListIterator(const NodeList* nodeList, int nodeIndex);
+    NodeListIterator(const NodeList* nodeList, int nodeIndex, int numNodes, Node* node);
     ~NodeListIterator() {};
     
     int getNodeIndex() { return _nodeIndex; };
@@ -175,6 +238,8 @@ private:
     
     const NodeList* _nodeList;
     int _nodeIndex;
+    int _numNodes;
+    Node* _node;
 };
 
 #endif /* defined(__hifi__NodeList__) */
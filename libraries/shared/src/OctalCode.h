@@ -25,6 +25,8 @@ int bytesRequiredForCodeLength(unsigned char threeBitCodes);
 int branchIndexWithDescendant(unsigned char * ancestorOctalCode, unsigned char * descendantOctalCode);
 unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber);
 int numberOfThreeBitSectionsInCode(unsigned char * octalCode);
+char getOctalCodeSectionValue(unsigned char* octalCode, int section);
+void setOctalCodeSectionValue(unsigned char* octalCode, int section, char sectionValue);
 unsigned char* chopOctalCode(unsigned char* originalOctalCode, int chopLevels);
 unsigned char* rebaseOctalCode(unsigned char* originalOctalCode, unsigned char* newParentOctalCode, 
                                bool includeColorSpace = false);
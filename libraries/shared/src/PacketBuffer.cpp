@@ -0,0 +1,73 @@
+//
+//  PacketBuffer.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <string.h>
+
+#include "PacketBuffer.h"
+
+// beyond this many idle buffers (6MB of them), released ones go back to the heap rather than the pool
+const int MAX_FREE_BUFFERS = 4096;
+
+pthread_mutex_t PacketBuffer::_poolLock = PTHREAD_MUTEX_INITIALIZER;
+PacketBuffer* PacketBuffer::_firstFree = NULL;
+int PacketBuffer::_freeCount = 0;
+unsigned long PacketBuffer::_heapAllocations = 0;
+unsigned long PacketBuffer::_poolAllocations = 0;
+
+PacketBuffer::PacketBuffer() :
+    _length(0),
+    _references(1),
+    _nextFree(NULL)
+{
+}
+
+PacketBuffer* PacketBuffer::allocate() {
+    pthread_mutex_lock(&_poolLock);
+    PacketBuffer* buffer = _firstFree;
+    if (buffer) {
+        _firstFree = buffer->_nextFree;
+        _freeCount--;
+        _poolAllocations++;
+    } else {
+        _heapAllocations++;
+    }
+    pthread_mutex_unlock(&_poolLock);
+
+    if (!buffer) {
+        return new PacketBuffer();
+    }
+    buffer->_length = 0;
+    buffer->_references = 1;
+    buffer->_nextFree = NULL;
+    return buffer;
+}
+
+PacketBuffer* PacketBuffer::copyOf(const unsigned char* packetData, ssize_t packetLength) {
+    if (packetLength < 0 || packetLength > CAPACITY) {
+        return NULL;
+    }
+    PacketBuffer* buffer = allocate();
+    memcpy(buffer->_data, packetData, packetLength);
+    buffer->_length = packetLength;
+    return buffer;
+}
+
+void PacketBuffer::release() {
+    if (__sync_sub_and_fetch(&_references, 1) > 0) {
+        return;
+    }
+    pthread_mutex_lock(&_poolLock);
+    if (_freeCount < MAX_FREE_BUFFERS) {
+        _nextFree = _firstFree;
+        _firstFree = this;
+        _freeCount++;
+        pthread_mutex_unlock(&_poolLock);
+        return;
+    }
+    pthread_mutex_unlock(&_poolLock);
+    delete this;
+}
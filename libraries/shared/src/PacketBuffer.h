@@ -0,0 +1,71 @@
+//
+//  PacketBuffer.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A reference counted buffer for one packet, so a packet can be written once and then handed along from the socket to
+//  the threads that process and send it, rather than copied at every step. Whoever holds a reference calls release()
+//  when done with it, and the last release puts the buffer back in a shared pool for the next allocate(). The heap is
+//  only touched when the pool runs dry, which after warming up is rarely. Whatever a buffer is handed to, a queue or
+//  a batch, takes a reference of its own if it keeps the buffer, so the caller always releases theirs.
+//
+//  The contents belong to whoever allocated the buffer until it's handed on, after which they're read only.
+//
+
+#ifndef __shared__PacketBuffer__
+#define __shared__PacketBuffer__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "UDPSocket.h" // for MAX_BUFFER_LENGTH_BYTES
+
+class PacketBuffer {
+public:
+    static const int CAPACITY = MAX_BUFFER_LENGTH_BYTES;
+
+    /// a buffer from the pool, empty and with one reference, which is the caller's
+    static PacketBuffer* allocate();
+
+    /// a buffer from the pool holding a copy of the packet, or NULL if it's too big for one
+    static PacketBuffer* copyOf(const unsigned char* packetData, ssize_t packetLength);
+
+    /// \thread any thread
+    void retain() { __sync_fetch_and_add(&_references, 1); }
+
+    /// \thread any thread
+    void release();
+
+    /// true while more than one holder shares the buffer, when it shouldn't be written to any more
+    bool isShared() const { return _references > 1; }
+
+    unsigned char* getData() { return _data; }
+    const unsigned char* getData() const { return _data; }
+    ssize_t getLength() const { return _length; }
+    void setLength(ssize_t length) { _length = length; }
+
+    /// the buffers allocate() has had to create, and how many times it has handed out one from the pool instead
+    static unsigned long getHeapAllocations() { return _heapAllocations; }
+    static unsigned long getPoolAllocations() { return _poolAllocations; }
+
+private:
+    PacketBuffer();
+
+    // disallow copying of PacketBuffer objects
+    PacketBuffer(const PacketBuffer&);
+    PacketBuffer& operator= (const PacketBuffer&);
+
+    unsigned char _data[CAPACITY];
+    ssize_t _length;
+    volatile int _references;
+    PacketBuffer* _nextFree;
+
+    static pthread_mutex_t _poolLock;
+    static PacketBuffer* _firstFree;
+    static int _freeCount;
+    static unsigned long _heapAllocations;
+    static unsigned long _poolAllocations;
+};
+
+#endif /* defined(__shared__PacketBuffer__) */
@@ -20,13 +20,17 @@ PACKET_VERSION versionForPacketType(PACKET_TYPE type) {
             return 1;
 
         case PACKET_TYPE_HEAD_DATA:
-            return 4;
+            return 5;
         
         case PACKET_TYPE_AVATAR_FACE_VIDEO:
             return 1;
 
         case PACKET_TYPE_VOXEL_STATS:
             return 2;            
+
+        case PACKET_TYPE_VOXEL_SUBTREE_VERSIONS:
+        case PACKET_TYPE_VOXEL_CACHED_SUBTREES:
+            return 1;
         default:
             return 0;
     }
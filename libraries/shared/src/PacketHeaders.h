@@ -28,6 +28,10 @@ const PACKET_TYPE PACKET_TYPE_SET_VOXEL_DESTRUCTIVE = 'O';
 const PACKET_TYPE PACKET_TYPE_ERASE_VOXEL = 'E';
 const PACKET_TYPE PACKET_TYPE_VOXEL_DATA = 'V';
 const PACKET_TYPE PACKET_TYPE_VOXEL_DATA_MONOCHROME = 'v';
+const PACKET_TYPE PACKET_TYPE_VOXEL_DATA_COMPRESSED = 'c';
+const PACKET_TYPE PACKET_TYPE_VOXEL_DATA_CODED_COLORS = 'p';
+const PACKET_TYPE PACKET_TYPE_VOXEL_SUBTREE_VERSIONS = 'n';
+const PACKET_TYPE PACKET_TYPE_VOXEL_CACHED_SUBTREES = 'K';
 const PACKET_TYPE PACKET_TYPE_BULK_AVATAR_DATA = 'X';
 const PACKET_TYPE PACKET_TYPE_AVATAR_VOXEL_URL = 'U';
 const PACKET_TYPE PACKET_TYPE_AVATAR_FACE_VIDEO = 'F';
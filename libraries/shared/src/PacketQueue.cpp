@@ -0,0 +1,162 @@
+//
+//  PacketQueue.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "PacketQueue.h"
+
+// a full barrier either side of the plain accesses, which is all the ordering the queue needs from the compiler builtins
+static inline unsigned long loadAcquire(volatile unsigned long& value) {
+    unsigned long loaded = value;
+    __sync_synchronize();
+    return loaded;
+}
+
+static inline void storeRelease(volatile unsigned long& value, unsigned long stored) {
+    __sync_synchronize();
+    value = stored;
+}
+
+PacketQueue::PacketQueue(int capacity) :
+    _capacity(1),
+    _pushPosition(0),
+    _popPosition(0),
+    _consumersWaiting(0),
+    _producersWaiting(0),
+    _packetsCopied(0)
+{
+    while (_capacity < capacity) {
+        _capacity <<= 1;
+    }
+    _mask = _capacity - 1;
+    _slots = new Slot[_capacity];
+    for (int i = 0; i < _capacity; i++) {
+        _slots[i].sequence = i;
+    }
+    pthread_mutex_init(&_waitLock, NULL);
+    pthread_cond_init(&_packetPushed, NULL);
+    pthread_cond_init(&_slotFreed, NULL);
+}
+
+PacketQueue::~PacketQueue() {
+    pop(size());
+    pthread_cond_destroy(&_slotFreed);
+    pthread_cond_destroy(&_packetPushed);
+    pthread_mutex_destroy(&_waitLock);
+    delete[] _slots;
+}
+
+bool PacketQueue::push(const sockaddr& address, const unsigned char* packetData, ssize_t packetLength) {
+    PacketBuffer* buffer = PacketBuffer::copyOf(packetData, packetLength);
+    if (!buffer) {
+        return false;
+    }
+    bool pushed = push(address, buffer);
+    buffer->release();
+    if (pushed) {
+        __sync_fetch_and_add(&_packetsCopied, 1);
+    }
+    return pushed;
+}
+
+bool PacketQueue::push(const sockaddr& address, PacketBuffer* buffer) {
+    // claim the slot at the back, unless the consumer hasn't freed it from the last lap yet
+    Slot* slot;
+    unsigned long position = _pushPosition;
+    while (true) {
+        slot = &_slots[position & _mask];
+        long lap = (long)(loadAcquire(slot->sequence) - position);
+        if (lap == 0) {
+            if (__sync_bool_compare_and_swap(&_pushPosition, position, position + 1)) {
+                break;
+            }
+            position = _pushPosition;
+        } else if (lap < 0) {
+            return false;
+        } else {
+            // another producer claimed it first
+            position = _pushPosition;
+        }
+    }
+
+    memcpy(&slot->packet.address, &address, sizeof(address));
+    buffer->retain();
+    slot->packet.buffer = buffer;
+    storeRelease(slot->sequence, position + 1);
+
+    // the consumer marks itself waiting before it looks at the queue a last time, so one of us sees the other
+    __sync_synchronize();
+    if (_consumersWaiting > 0) {
+        pthread_mutex_lock(&_waitLock);
+        pthread_cond_signal(&_packetPushed);
+        pthread_mutex_unlock(&_waitLock);
+    }
+    return true;
+}
+
+PacketQueue::Packet* PacketQueue::peek(int offset) {
+    unsigned long position = _popPosition + offset;
+    Slot* slot = &_slots[position & _mask];
+    return (loadAcquire(slot->sequence) == position + 1) ? &slot->packet : NULL;
+}
+
+void PacketQueue::pop(int count) {
+    for (int i = 0; i < count; i++) {
+        unsigned long position = _popPosition;
+        Slot& slot = _slots[position & _mask];
+        slot.packet.buffer->release();
+        slot.packet.buffer = NULL;
+        storeRelease(slot.sequence, position + _capacity);
+        _popPosition = position + 1;
+    }
+
+    __sync_synchronize();
+    if (count > 0 && _producersWaiting > 0) {
+        pthread_mutex_lock(&_waitLock);
+        pthread_cond_broadcast(&_slotFreed);
+        pthread_mutex_unlock(&_waitLock);
+    }
+}
+
+bool PacketQueue::waitForPacket(uint64_t timeoutUsecs) {
+    if (!isEmpty()) {
+        return true;
+    }
+    waitWhile(&PacketQueue::isEmpty, _consumersWaiting, _packetPushed, timeoutUsecs);
+    return !isEmpty();
+}
+
+bool PacketQueue::waitForSpace(uint64_t timeoutUsecs) {
+    if (!isFull()) {
+        return true;
+    }
+    waitWhile(&PacketQueue::isFull, _producersWaiting, _slotFreed, timeoutUsecs);
+    return !isFull();
+}
+
+void PacketQueue::waitWhile(bool (PacketQueue::*condition)(), volatile int& waiters, pthread_cond_t& changed,
+                            uint64_t timeoutUsecs) {
+    timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t deadlineUsecs = (uint64_t)now.tv_sec * 1000000 + now.tv_usec + timeoutUsecs;
+    timespec deadline;
+    deadline.tv_sec = deadlineUsecs / 1000000;
+    deadline.tv_nsec = (deadlineUsecs % 1000000) * 1000;
+
+    pthread_mutex_lock(&_waitLock);
+    waiters++;
+    __sync_synchronize();
+    while ((this->*condition)()) {
+        if (pthread_cond_timedwait(&changed, &_waitLock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    waiters--;
+    pthread_mutex_unlock(&_waitLock);
+}
@@ -0,0 +1,104 @@
+//
+//  PacketQueue.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A bounded queue of packets that any number of threads push into and one thread takes out of, without a lock on
+//  either side. Packets are PacketBuffers, which are handed through the queue by reference, so the consumer reads them
+//  where the producer wrote them; a packet pushed as bytes is copied into a pooled buffer first. A consumer with
+//  nothing to do can block until a packet is pushed rather than polling, and a producer facing a full queue until a
+//  slot is freed.
+//
+//  The slots are a ring with a sequence number each, which tells producers claiming slots from the back and the
+//  consumer releasing them from the front which lap of the ring a slot is on.
+//
+
+#ifndef __shared__PacketQueue__
+#define __shared__PacketQueue__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "PacketBuffer.h"
+
+class PacketQueue {
+public:
+    static const int DEFAULT_CAPACITY = 1024;
+
+    struct Packet {
+        sockaddr address;
+        PacketBuffer* buffer;
+    };
+
+    /// \param capacity the most packets the queue holds, rounded up to a power of two
+    PacketQueue(int capacity = DEFAULT_CAPACITY);
+    ~PacketQueue();
+
+    /// Adds the buffer to the back of the queue, and wakes the consumer if it's waiting. The queue takes a reference of
+    /// its own, so the caller keeps theirs. Returns false if the queue is full.
+    /// \thread any thread
+    bool push(const sockaddr& address, PacketBuffer* buffer);
+
+    /// Pushes a copy of the packet. Returns false if the queue is full or the packet too big for a buffer.
+    /// \thread any thread
+    bool push(const sockaddr& address, const unsigned char* packetData, ssize_t packetLength);
+
+    /// The packet offset places from the front, or NULL if there isn't one yet. It stays put until it's popped.
+    /// \thread the consumer
+    Packet* peek(int offset = 0);
+
+    /// Frees the slots of the first count packets for the producers, and lets go of their buffers.
+    /// \thread the consumer
+    void pop(int count = 1);
+
+    /// Blocks until there's a packet at the front, or timeoutUsecs has passed, and returns whether there is one.
+    /// \thread the consumer
+    bool waitForPacket(uint64_t timeoutUsecs);
+
+    /// Blocks until the queue isn't full, or timeoutUsecs has passed, and returns whether it has room.
+    /// \thread any thread
+    bool waitForSpace(uint64_t timeoutUsecs);
+
+    /// the number of packets queued, which other threads may be changing as it's read
+    int size() const { return (int)(_pushPosition - _popPosition); }
+    int getCapacity() const { return _capacity; }
+    unsigned long getPacketsCopied() const { return _packetsCopied; }
+
+private:
+    // disallow copying of PacketQueue objects
+    PacketQueue(const PacketQueue&);
+    PacketQueue& operator= (const PacketQueue&);
+
+    struct Slot {
+        // position + 1 once the packet pushed at position is in, position + capacity once it's popped again
+        volatile unsigned long sequence;
+        Packet packet;
+    };
+
+    void waitWhile(bool (PacketQueue::*condition)(), volatile int& waiters, pthread_cond_t& changed,
+                   uint64_t timeoutUsecs);
+    bool isEmpty() { return peek() == NULL; }
+    bool isFull() { return size() >= _capacity; }
+
+    int _capacity;
+    unsigned long _mask;
+    Slot* _slots;
+
+    // the producers' and the consumer's positions are kept on separate cache lines, so they don't contend for one
+    volatile unsigned long _pushPosition;
+    char _pushPadding[64];
+    volatile unsigned long _popPosition;
+    char _popPadding[64];
+
+    pthread_mutex_t _waitLock;
+    pthread_cond_t _packetPushed;
+    pthread_cond_t _slotFreed;
+    volatile int _consumersWaiting;
+    volatile int _producersWaiting;
+
+    unsigned long _packetsCopied;
+};
+
+#endif /* defined(__shared__PacketQueue__) */
@@ -9,6 +9,9 @@
 //
 
 #include <stdint.h>
+#include <algorithm>
+
+#include <QtCore/QDebug>
 
 #include "NodeList.h"
 #include "PacketSender.h"
@@ -17,20 +20,106 @@
 const int PacketSender::DEFAULT_PACKETS_PER_SECOND = 200;
 const int PacketSender::MINIMUM_PACKETS_PER_SECOND = 1;
 
+// less than a frame, since it's usually the render thread that's queueing
+const uint64_t PacketSender::MAX_FULL_QUEUE_WAIT_USECS = 10 * 1000;
+
 
-PacketSender::PacketSender(PacketSenderNotify* notify, int packetsPerSecond) : 
+PacketSender::PacketSender(PacketSenderNotify* notify, int packetsPerSecond, int queueCapacity) : 
     _packetsPerSecond(packetsPerSecond),
+    _packets(queueCapacity),
     _lastSendTime(usecTimestampNow()),
-    _notify(notify)
+    _notify(notify),
+    _sendBatch(NULL),
+    _sentPacketLengths(UDPSendBatch::DEFAULT_MAX_PACKETS),
+    _packetsDropped(0)
 {
 }
 
+PacketSender::~PacketSender() {
+    delete _sendBatch;
+}
+
 
 void PacketSender::queuePacketForSending(sockaddr& address, unsigned char* packetData, ssize_t packetLength) {
-    NetworkPacket packet(address, packetData, packetLength);
-    lock();
-    _packets.push_back(packet);
-    unlock();
+    uint64_t waitStartedAt = 0;
+    while (!_packets.push(address, packetData, packetLength)) {
+        if (!waitForSpace(packetLength, waitStartedAt)) {
+            return;
+        }
+    }
+}
+
+void PacketSender::queuePacketForSending(sockaddr& address, PacketBuffer* packet) {
+    uint64_t waitStartedAt = 0;
+    while (!_packets.push(address, packet)) {
+        if (!waitForSpace(packet->getLength(), waitStartedAt)) {
+            return;
+        }
+    }
+}
+
+bool PacketSender::waitForSpace(ssize_t packetLength, uint64_t& waitStartedAt) {
+    if (packetLength > MAX_PACKET_SIZE) {
+        dropPacket(packetLength, "it's too big to queue");
+        return false;
+    }
+    // without a thread of our own, or on it, we're the ones who send, so make room by sending a batch right away
+    if (!isThreaded() || isOnThread()) {
+        sendQueuedPackets(_sendBatch ? _sendBatch->getMaxPackets() : UDPSendBatch::DEFAULT_MAX_PACKETS);
+        return true;
+    }
+    // otherwise only our own thread can make room, and there's no point waiting once it's stopping, or for long
+    if (!isStillRunning()) {
+        dropPacket(packetLength, "the sending thread has stopped");
+        return false;
+    }
+    uint64_t now = usecTimestampNow();
+    if (waitStartedAt == 0) {
+        waitStartedAt = now;
+    }
+    uint64_t waited = now - waitStartedAt;
+    if (waited >= MAX_FULL_QUEUE_WAIT_USECS) {
+        dropPacket(packetLength, "the queue stayed full");
+        return false;
+    }
+    _packets.waitForSpace(MAX_FULL_QUEUE_WAIT_USECS - waited);
+    return true;
+}
+
+void PacketSender::dropPacket(ssize_t packetLength, const char* reason) {
+    unsigned long packetsDropped = __sync_add_and_fetch(&_packetsDropped, 1);
+
+    // a sender that falls behind drops packets every frame, so only every time the count doubles is reported
+    if ((packetsDropped & (packetsDropped - 1)) == 0) {
+        qDebug("PacketSender dropped a %d byte packet, %s, %lu dropped in all and %d waiting to be sent\n",
+               (int)packetLength, reason, packetsDropped, _packets.size());
+    }
+}
+
+int PacketSender::sendQueuedPackets(int maxPackets) {
+    // the NodeList may not be around yet when we're created
+    if (!_sendBatch) {
+        _sendBatch = new UDPSendBatch(NodeList::getInstance()->getNodeSocket());
+    }
+    maxPackets = std::min(maxPackets, _sendBatch->getMaxPackets());
+
+    // the batch takes its own reference to each packet's buffer, so they're sent from where they were queued
+    int packetsToSend = 0;
+    PacketQueue::Packet* packet;
+    while (packetsToSend < maxPackets && (packet = _packets.peek(packetsToSend)) != NULL) {
+        _sendBatch->queue(&packet->address, packet->buffer);
+        _sentPacketLengths[packetsToSend++] = packet->buffer->getLength();
+    }
+    _packets.pop(packetsToSend);
+
+    _sendBatch->flush();
+
+    if (_notify) {
+        for (int i = 0; i < packetsToSend; i++) {
+            _notify->packetSentNotification(_sentPacketLengths[i]);
+        }
+    }
+    return packetsToSend;
 }
 
 bool PacketSender::process() {
@@ -38,29 +127,23 @@ bool PacketSender::process() {
     uint64_t SEND_INTERVAL_USECS = (_packetsPerSecond == 0) ? USECS_PER_SECOND : (USECS_PER_SECOND / _packetsPerSecond);
     
     if (_packets.size() == 0) {
-        usleep(SEND_INTERVAL_USECS);
-    }
-    while (_packets.size() > 0) {
-        NetworkPacket& packet = _packets.front();
-        
-        // send the packet through the NodeList...
-        UDPSocket* nodeSocket = NodeList::getInstance()->getNodeSocket();
-
-        nodeSocket->send(&packet.getAddress(), packet.getData(), packet.getLength());
-        
-        if (_notify) {
-            _notify->packetSentNotification(packet.getLength());
-        }
-
-        lock();
-        _packets.erase(_packets.begin());
-        unlock();
+        // wake as soon as a packet is queued, but no later than a send interval, for classes with other work to do
+        _packets.waitForPacket(SEND_INTERVAL_USECS);
 
+        // the first packet after a quiet spell goes out on its own, rather than as the burst the spell would allow
+        _lastSendTime = usecTimestampNow();
+    }
+    while (_packets.peek() != NULL) {
+        // everything that has come due since the last send goes out in one batch, so that rates faster than usleep()
+        // can keep up with aren't held to one packet per wake up
         uint64_t now = usecTimestampNow();
-        // dynamically sleep until we need to fire off the next set of voxels
         uint64_t elapsed = now - _lastSendTime;
-        int usecToSleep =  SEND_INTERVAL_USECS - elapsed;
+        sendQueuedPackets(std::max(1, (int)std::min(elapsed / SEND_INTERVAL_USECS,
+                                                    (uint64_t)UDPSendBatch::DEFAULT_MAX_PACKETS)));
+
+        // dynamically sleep until we need to fire off the next set of voxels
         _lastSendTime = now;
+        int usecToSleep =  SEND_INTERVAL_USECS - (usecTimestampNow() - now);
         if (usecToSleep > 0) {
             usleep(usecToSleep);
         }
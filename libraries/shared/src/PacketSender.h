@@ -12,7 +12,8 @@
 #define __shared__PacketSender__
 
 #include "GenericThread.h"
-#include "NetworkPacket.h"
+#include "PacketQueue.h"
+#include "UDPSendBatch.h"
 
 /// Notification Hook for packets being sent by a PacketSender
 class PacketSenderNotify {
@@ -26,19 +27,39 @@ class PacketSender : public virtual GenericThread {
 public:
     static const int DEFAULT_PACKETS_PER_SECOND;
     static const int MINIMUM_PACKETS_PER_SECOND;
+    static const uint64_t MAX_FULL_QUEUE_WAIT_USECS;
 
-    PacketSender(PacketSenderNotify* notify = NULL, int packetsPerSecond = DEFAULT_PACKETS_PER_SECOND);
+    PacketSender(PacketSenderNotify* notify = NULL, int packetsPerSecond = DEFAULT_PACKETS_PER_SECOND,
+                 int queueCapacity = PacketQueue::DEFAULT_CAPACITY);
+    virtual ~PacketSender();
 
-    /// Add packet to outbound queue.
+    /// Add packet to outbound queue. If the queue is full, waits up to MAX_FULL_QUEUE_WAIT_USECS in all for the sending
+    /// thread to make room for it, and drops it if there still isn't any, or when not threaded sends a batch of the
+    /// queued packets straight away, ahead of the packets per second.
     /// \param sockaddr& address the destination address
     /// \param packetData pointer to data
     /// \param ssize_t packetLength size of data
     /// \thread any thread, typically the application thread
     void queuePacketForSending(sockaddr& address, unsigned char*  packetData, ssize_t packetLength);
+
+    /// Add a packet to the outbound queue without copying it. The sender takes a reference of its own, so the caller
+    /// keeps theirs, but the buffer mustn't be written to again while it's shared.
+    /// \param sockaddr& address the destination address
+    /// \param PacketBuffer* packet the packet
+    /// \thread any thread, typically the application thread
+    void queuePacketForSending(sockaddr& address, PacketBuffer* packet);
     
     void setPacketsPerSecond(int packetsPerSecond) { _packetsPerSecond = std::min(MINIMUM_PACKETS_PER_SECOND, packetsPerSecond); }
     int getPacketsPerSecond() const { return _packetsPerSecond; }
 
+    /// how many queued packets had to be copied into the queue, rather than handed over in their buffers
+    unsigned long getPacketsCopied() const { return _packets.getPacketsCopied(); }
+
+    /// how many packets were never sent because there was no room for them in the queue
+    unsigned long getPacketsDropped() const {
+        return __sync_fetch_and_add(const_cast<unsigned long*>(&_packetsDropped), 0);
+    }
+
     void setPacketSenderNotify(PacketSenderNotify* notify) { _notify = notify; }
     PacketSenderNotify* getPacketSenderNotify() const { return _notify; }
 
@@ -51,9 +72,20 @@ protected:
     int packetsToSendCount() const { return _packets.size(); }
 
 private:
-    std::vector<NetworkPacket> _packets;
+    /// Makes room for a packet, or returns false if it has to be dropped. waitStartedAt is when the wait started, or 0
+    /// the first time.
+    bool waitForSpace(ssize_t packetLength, uint64_t& waitStartedAt);
+    void dropPacket(ssize_t packetLength, const char* reason);
+
+    /// sends up to maxPackets from the front of the queue in one batch, returns how many went out
+    int sendQueuedPackets(int maxPackets);
+
+    PacketQueue _packets;
     uint64_t _lastSendTime;
     PacketSenderNotify* _notify;
+    UDPSendBatch* _sendBatch;
+    std::vector<ssize_t> _sentPacketLengths;
+    unsigned long _packetsDropped; // counted from any thread, with the atomic builtins
 };
 
 #endif // __shared__PacketSender__
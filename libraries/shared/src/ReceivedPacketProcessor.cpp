@@ -12,31 +12,43 @@
 #include "ReceivedPacketProcessor.h"
 #include "SharedUtil.h"
 
-void ReceivedPacketProcessor::queueReceivedPacket(sockaddr& address, unsigned char* packetData, ssize_t packetLength) {
+ReceivedPacketProcessor::ReceivedPacketProcessor(int queueCapacity) :
+    _packets(queueCapacity),
+    _packetsDropped(0)
+{
+}
+
+void ReceivedPacketProcessor::noteHeardFrom(sockaddr& address) {
     // Make sure our Node and NodeList knows we've heard from this node.
     Node* node = NodeList::getInstance()->nodeWithAddress(&address);
     if (node) {
         node->setLastHeardMicrostamp(usecTimestampNow());
     }
+}
+
+void ReceivedPacketProcessor::queueReceivedPacket(sockaddr& address, unsigned char* packetData, ssize_t packetLength) {
+    noteHeardFrom(address);
+    if (!_packets.push(address, packetData, packetLength)) {
+        __sync_fetch_and_add(&_packetsDropped, 1);
+    }
+}
 
-    NetworkPacket packet(address, packetData, packetLength);
-    lock();
-    _packets.push_back(packet);
-    unlock();
+void ReceivedPacketProcessor::queueReceivedPacket(sockaddr& address, PacketBuffer* packet) {
+    noteHeardFrom(address);
+    if (!_packets.push(address, packet)) {
+        __sync_fetch_and_add(&_packetsDropped, 1);
+    }
 }
 
 bool ReceivedPacketProcessor::process() {
-    if (_packets.size() == 0) {
-        const uint64_t RECEIVED_THREAD_SLEEP_INTERVAL = (1000 * 1000)/60; // check at 60fps
-        usleep(RECEIVED_THREAD_SLEEP_INTERVAL);
-    }
-    while (_packets.size() > 0) {
-        NetworkPacket& packet = _packets.front();
-        processPacket(packet.getAddress(), packet.getData(), packet.getLength());
+    // wake as soon as a packet is queued, but return at 60fps regardless, for classes that have other work to do
+    const uint64_t RECEIVED_THREAD_SLEEP_INTERVAL = (1000 * 1000)/60;
+    _packets.waitForPacket(RECEIVED_THREAD_SLEEP_INTERVAL);
 
-        lock();
-        _packets.erase(_packets.begin());
-        unlock();
+    PacketQueue::Packet* packet;
+    while ((packet = _packets.peek()) != NULL) {
+        processPacket(packet->address, packet->buffer->getData(), packet->buffer->getLength());
+        _packets.pop();
     }
     return isStillRunning();  // keep running till they terminate us
 }
@@ -12,11 +12,13 @@
 #define __shared__ReceivedPacketProcessor__
 
 #include "GenericThread.h"
-#include "NetworkPacket.h"
+#include "PacketQueue.h"
 
 /// Generalized threaded processor for handling received inbound packets. 
 class ReceivedPacketProcessor : public virtual GenericThread {
 public:
+    /// \param int queueCapacity the most packets that can wait to be processed, beyond which they're dropped
+    ReceivedPacketProcessor(int queueCapacity = PacketQueue::DEFAULT_CAPACITY);
 
     /// Add packet from network receive thread to the processing queue.
     /// \param sockaddr& senderAddress the address of the sender
@@ -24,6 +26,19 @@ public:
     /// \param ssize_t packetLength size of received data
     /// \thread network receive thread
     void queueReceivedPacket(sockaddr& senderAddress, unsigned char*  packetData, ssize_t packetLength);
+
+    /// Add a received packet to the processing queue without copying it. The processor takes a reference of its own,
+    /// so the caller keeps theirs.
+    /// \param sockaddr& senderAddress the address of the sender
+    /// \param PacketBuffer* packet the received packet, as taken from a UDPReceiveBatch
+    /// \thread network receive thread
+    void queueReceivedPacket(sockaddr& senderAddress, PacketBuffer* packet);
+
+    /// How many received packets were dropped because the processing queue was full
+    unsigned long getPacketsDropped() const { return _packetsDropped; }
+
+    /// How many received packets were copied into the processing queue, rather than handed over in their buffers
+    unsigned long getPacketsCopied() const { return _packets.getPacketsCopied(); }
     
 protected:
     /// Callback for processing of recieved packets. Implement this to process the incoming packets.
@@ -43,8 +58,10 @@ protected:
     int packetsToProcessCount() const { return _packets.size(); }
 
 private:
+    void noteHeardFrom(sockaddr& senderAddress);
 
-    std::vector<NetworkPacket> _packets;
+    PacketQueue _packets;
+    unsigned long _packetsDropped;
 };
 
 #endif // __shared__PacketReceiver__
@@ -415,6 +415,37 @@ unsigned char* pointToVoxel(float x, float y, float z, float s, unsigned char r,
     return voxelOut;
 }
 
+// the bit pointToVoxel() writes for each level is whether the point is past the middle of the voxel it's in so far, which
+// makes the coordinate at the last level the point scaled up and rounded down, kept inside the tree
+static uint32_t pointToVoxelCoordinate(float value, int level) {
+    float scaled = floorf(ldexpf(value, level));
+    if (!(scaled >= 0.0f)) {
+        return 0;
+    }
+    uint64_t maxCoordinate = ((uint64_t)1 << level) - 1;
+    return (scaled >= (float)maxCoordinate) ? (uint32_t)maxCoordinate : (uint32_t)scaled;
+}
+
+VoxelCoordinates pointToVoxelCoordinates(float x, float y, float z, float s, unsigned char r, unsigned char g,
+                                         unsigned char b) {
+    VoxelCoordinates voxel;
+
+    // same level as pointToVoxel(): the first with voxels no bigger than s
+    voxel.level = 1;
+    float sTest = 0.5f;
+    while (sTest > s && voxel.level < MAX_VOXEL_COORDINATES_LEVEL) {
+        sTest /= 2.0f;
+        voxel.level++;
+    }
+    voxel.x = pointToVoxelCoordinate(x, voxel.level);
+    voxel.y = pointToVoxelCoordinate(y, voxel.level);
+    voxel.z = pointToVoxelCoordinate(z, voxel.level);
+    voxel.red = r;
+    voxel.green = g;
+    voxel.blue = b;
+    return voxel;
+}
+
 void printVoxelCode(unsigned char* voxelCode) {
     unsigned char octets = voxelCode[0];
 	unsigned int voxelSizeInBits = octets*3;
@@ -82,6 +82,24 @@ struct VoxelDetail {
 
 unsigned char* pointToVoxel(float x, float y, float z, float s, unsigned char r = 0, unsigned char g = 0, unsigned char b = 0);
 
+/// A voxel by integer position, for finding and creating voxels without building an octal code. At level L the voxel is
+/// 1/2^L on a side, with its lowest corner at (x, y, z) / 2^L.
+struct VoxelCoordinates {
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    int level;
+    unsigned char red;
+    unsigned char green;
+    unsigned char blue;
+};
+
+const int MAX_VOXEL_COORDINATES_LEVEL = 32;
+
+/// the voxel pointToVoxel() gives the code of, no deeper than MAX_VOXEL_COORDINATES_LEVEL
+VoxelCoordinates pointToVoxelCoordinates(float x, float y, float z, float s,
+                                         unsigned char r = 0, unsigned char g = 0, unsigned char b = 0);
+
 // Creates a full Voxel edit message, including command header, sequence, and details
 bool createVoxelEditMessage(unsigned char command, short int sequence, 
         int voxelCount, VoxelDetail* voxelDetails, unsigned char*& bufferOut, int& sizeOut);
@@ -0,0 +1,41 @@
+//
+//  UDPReceiveBatch.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include "UDPReceiveBatch.h"
+
+UDPReceiveBatch::UDPReceiveBatch(int maxPackets) :
+    _maxPackets(maxPackets),
+    _packetCount(0),
+    _packetBuffers(maxPackets, (PacketBuffer*)NULL),
+    _senderAddresses(maxPackets),
+    _packetLengths(maxPackets)
+{
+    replaceTakenBuffers();
+}
+
+UDPReceiveBatch::~UDPReceiveBatch() {
+    for (int i = 0; i < _maxPackets; i++) {
+        if (_packetBuffers[i]) {
+            _packetBuffers[i]->release();
+        }
+    }
+}
+
+PacketBuffer* UDPReceiveBatch::takePacket(int packet) {
+    PacketBuffer* buffer = _packetBuffers[packet];
+    buffer->setLength(_packetLengths[packet]);
+    _packetBuffers[packet] = NULL;
+    return buffer;
+}
+
+void UDPReceiveBatch::replaceTakenBuffers() {
+    for (int i = 0; i < _maxPackets; i++) {
+        if (!_packetBuffers[i]) {
+            _packetBuffers[i] = PacketBuffer::allocate();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+//
+//  UDPReceiveBatch.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A reusable set of packet buffers that UDPSocket::receiveBatch() fills with everything waiting on a socket, up to
+//  the batch's size, in one recvmmsg() where there is one. The packets stay valid until the batch is filled again,
+//  unless one is taken out of the batch to be handed on as it is, in which case the batch gets a new buffer for it.
+//
+
+#ifndef __shared__UDPReceiveBatch__
+#define __shared__UDPReceiveBatch__
+
+#include <vector>
+
+#include "PacketBuffer.h"
+#include "UDPSocket.h"
+
+class UDPReceiveBatch {
+public:
+    static const int DEFAULT_MAX_PACKETS = 64;
+
+    UDPReceiveBatch(int maxPackets = DEFAULT_MAX_PACKETS);
+    ~UDPReceiveBatch();
+
+    int getMaxPackets() const { return _maxPackets; }
+    int getPacketCount() const { return _packetCount; }
+
+    unsigned char* getPacketData(int packet) { return _packetBuffers[packet]->getData(); }
+    ssize_t getPacketLength(int packet) const { return _packetLengths[packet]; }
+    sockaddr* getSenderAddress(int packet) { return (sockaddr*)&_senderAddresses[packet]; }
+
+    /// Hands over the packet's buffer, and the reference to it, without copying. The packet can't be read through the
+    /// batch after that.
+    PacketBuffer* takePacket(int packet);
+
+private:
+    friend class UDPSocket;
+
+    // disallow copying of UDPReceiveBatch objects
+    UDPReceiveBatch(const UDPReceiveBatch&);
+    UDPReceiveBatch& operator= (const UDPReceiveBatch&);
+
+    /// gives any slots whose buffers were taken a new one, before the batch is filled again
+    void replaceTakenBuffers();
+
+    int _maxPackets;
+    int _packetCount;
+    std::vector<PacketBuffer*> _packetBuffers; // NULL where one has been taken
+    std::vector<sockaddr_in> _senderAddresses;
+    std::vector<ssize_t> _packetLengths;
+};
+
+#endif /* defined(__shared__UDPReceiveBatch__) */
@@ -0,0 +1,245 @@
+//
+//  UDPSendBatch.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#endif
+
+#include <QtCore/QDebug>
+
+#include "UDPSendBatch.h"
+
+#ifdef __linux__
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// how many messages and packets are handed to one sendmmsg() call
+const int PACKETS_PER_CALL = 64;
+
+// the most segments the kernel takes in a UDP_SEGMENT message, and the most a UDP datagram can carry
+const int MAX_SEGMENTS_PER_MESSAGE = 64;
+const size_t MAX_SEGMENTED_MESSAGE_BYTES = 65507;
+
+#endif
+
+UDPSendBatch::UDPSendBatch(UDPSocket* socket, int maxPackets) :
+    _socket(socket),
+    _maxPackets(maxPackets),
+    _packetCount(0),
+#ifdef __linux__
+    _segmentation(true),
+#else
+    _segmentation(false),
+#endif
+    _growWhenFull(false),
+    _packetData((size_t)maxPackets * MAX_BUFFER_LENGTH_BYTES),
+    _packetBuffers(maxPackets, (PacketBuffer*)NULL),
+    _destAddresses(maxPackets),
+    _packetLengths(maxPackets),
+    _packetsSent(0),
+    _sendCalls(0),
+    _packetsCopied(0)
+{
+}
+
+UDPSendBatch::~UDPSendBatch() {
+    flush();
+}
+
+void UDPSendBatch::queue(const sockaddr* destAddress, const void* data, size_t byteLength) {
+    if (destAddress == NULL) {
+        return;
+    }
+    if (byteLength > MAX_BUFFER_LENGTH_BYTES) {
+        flush();
+        _sendCalls++;
+        if (_socket->send((sockaddr*)destAddress, data, byteLength)) {
+            _packetsSent++;
+        }
+        return;
+    }
+    if (_packetCount == _maxPackets) {
+        makeRoom();
+    }
+    memcpy(&_packetData[(size_t)_packetCount * MAX_BUFFER_LENGTH_BYTES], data, byteLength);
+    _packetsCopied++;
+    memcpy(&_destAddresses[_packetCount], destAddress, sizeof(sockaddr_in));
+    _packetLengths[_packetCount] = byteLength;
+    _packetCount++;
+}
+
+void UDPSendBatch::queue(const sockaddr* destAddress, PacketBuffer* buffer) {
+    if (destAddress == NULL) {
+        return;
+    }
+    if (_packetCount == _maxPackets) {
+        makeRoom();
+    }
+    buffer->retain();
+    _packetBuffers[_packetCount] = buffer;
+    memcpy(&_destAddresses[_packetCount], destAddress, sizeof(sockaddr_in));
+    _packetLengths[_packetCount] = buffer->getLength();
+    _packetCount++;
+}
+
+void UDPSendBatch::makeRoom() {
+    if (!_growWhenFull) {
+        flush();
+        return;
+    }
+    _maxPackets *= 2;
+    _packetData.resize((size_t)_maxPackets * MAX_BUFFER_LENGTH_BYTES);
+    _packetBuffers.resize(_maxPackets, (PacketBuffer*)NULL);
+    _destAddresses.resize(_maxPackets);
+    _packetLengths.resize(_maxPackets);
+}
+
+int UDPSendBatch::flush() {
+    if (_packetCount == 0) {
+        return 0;
+    }
+    int packetsSent = sendQueued(0);
+    _packetsSent += packetsSent;
+    releaseBuffers();
+    _packetCount = 0;
+    return packetsSent;
+}
+
+void UDPSendBatch::releaseBuffers() {
+    for (int packet = 0; packet < _packetCount; packet++) {
+        if (_packetBuffers[packet]) {
+            _packetBuffers[packet]->release();
+            _packetBuffers[packet] = NULL;
+        }
+    }
+}
+
+#ifdef __linux__
+
+// The packets from firstPacket on that can go out as one segmented message: the same destination, all the same size
+// except for a shorter last one, and within the kernel's limits.
+int UDPSendBatch::segmentRunLength(int firstPacket) const {
+    size_t segmentBytes = _packetLengths[firstPacket];
+    if (!_segmentation || segmentBytes == 0) {
+        return 1;
+    }
+    const sockaddr* destAddress = (const sockaddr*)&_destAddresses[firstPacket];
+    size_t totalBytes = segmentBytes;
+    int runLength = 1;
+    while (firstPacket + runLength < _packetCount && runLength < MAX_SEGMENTS_PER_MESSAGE) {
+        int packet = firstPacket + runLength;
+        if (_packetLengths[packet] > segmentBytes || _packetLengths[packet] == 0 ||
+                totalBytes + _packetLengths[packet] > MAX_SEGMENTED_MESSAGE_BYTES ||
+                !socketMatch((const sockaddr*)&_destAddresses[packet], destAddress)) {
+            break;
+        }
+        totalBytes += _packetLengths[packet];
+        runLength++;
+        if (_packetLengths[packet] < segmentBytes) {
+            break;
+        }
+    }
+    return runLength;
+}
+
+int UDPSendBatch::sendQueued(int firstPacket) {
+    mmsghdr messages[PACKETS_PER_CALL];
+    iovec packetVectors[PACKETS_PER_CALL];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr alignment;
+    } controls[PACKETS_PER_CALL];
+    int messagePackets[PACKETS_PER_CALL];
+
+    int packetsSent = 0;
+    int packet = firstPacket;
+    while (packet < _packetCount) {
+        int messageCount = 0;
+        int vectorCount = 0;
+        for (int next = packet; next < _packetCount && messageCount < PACKETS_PER_CALL; ) {
+            int runLength = segmentRunLength(next);
+            if (vectorCount + runLength > PACKETS_PER_CALL) {
+                break;
+            }
+            mmsghdr& message = messages[messageCount];
+            memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_name = &_destAddresses[next];
+            message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            message.msg_hdr.msg_iov = &packetVectors[vectorCount];
+            message.msg_hdr.msg_iovlen = runLength;
+            for (int i = 0; i < runLength; i++) {
+                packetVectors[vectorCount].iov_base = getQueuedData(next + i);
+                packetVectors[vectorCount].iov_len = _packetLengths[next + i];
+                vectorCount++;
+            }
+            if (runLength > 1) {
+                message.msg_hdr.msg_control = controls[messageCount].buffer;
+                message.msg_hdr.msg_controllen = sizeof(controls[messageCount].buffer);
+                cmsghdr* control = CMSG_FIRSTHDR(&message.msg_hdr);
+                control->cmsg_level = SOL_UDP;
+                control->cmsg_type = UDP_SEGMENT;
+                control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segmentBytes = _packetLengths[next];
+                memcpy(CMSG_DATA(control), &segmentBytes, sizeof(segmentBytes));
+            }
+            messagePackets[messageCount++] = runLength;
+            next += runLength;
+        }
+
+        _sendCalls++;
+        int messagesSent = sendmmsg(_socket->getHandle(), messages, messageCount, 0);
+        if (messagesSent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // the first message couldn't be sent, which for a segmented one may just be the kernel or the device not
+            // supporting it, in which case the rest go out one datagram at a time
+            if (messagePackets[0] > 1 &&
+                    (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                qDebug("UDPSendBatch::flush() segmented send failed: %s, sending packets separately\n",
+                       strerror(errno));
+                _segmentation = false;
+                continue;
+            }
+            qDebug("Failed to send packet: %s\n", strerror(errno));
+            packet += messagePackets[0];
+            continue;
+        }
+        for (int i = 0; i < messagesSent; i++) {
+            packetsSent += messagePackets[i];
+            packet += messagePackets[i];
+        }
+    }
+    return packetsSent;
+}
+
+#else
+
+int UDPSendBatch::segmentRunLength(int firstPacket) const {
+    return 1;
+}
+
+int UDPSendBatch::sendQueued(int firstPacket) {
+    int packetsSent = 0;
+    for (int packet = firstPacket; packet < _packetCount; packet++) {
+        _sendCalls++;
+        if (_socket->send((sockaddr*)&_destAddresses[packet], getQueuedData(packet), _packetLengths[packet])) {
+            packetsSent++;
+        }
+    }
+    return packetsSent;
+}
+
+#endif
@@ -0,0 +1,94 @@
+//
+//  UDPSendBatch.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Collects outgoing packets for any number of destinations and sends them with as few system calls as possible. On
+//  Linux a flush is one sendmmsg() for the whole batch, and a run of equal sized packets to the same destination goes
+//  out as a single UDP_SEGMENT (GSO) message that the kernel cuts back into datagrams, so the receiver sees exactly the
+//  packets that were queued. Anywhere else, or if the kernel turns segmentation down, it falls back to one sendto() per
+//  packet through the UDPSocket.
+//
+//  Packets are either copied in when they're queued, so the caller can reuse its buffer right away, or queued as a
+//  PacketBuffer, which the batch holds a reference to until it's sent rather than copying. A batch belongs to the
+//  thread using it, the socket can be shared.
+//
+
+#ifndef __shared__UDPSendBatch__
+#define __shared__UDPSendBatch__
+
+#include <stddef.h>
+#include <vector>
+
+#include "PacketBuffer.h"
+#include "UDPSocket.h"
+
+class UDPSendBatch {
+public:
+    static const int DEFAULT_MAX_PACKETS = 64;
+
+    UDPSendBatch(UDPSocket* socket, int maxPackets = DEFAULT_MAX_PACKETS);
+    ~UDPSendBatch();
+
+    /// Queues a copy of the packet, flushing first if the batch is full. A packet too big for a batch slot is sent on
+    /// its own after whatever was queued before it, even if the batch grows.
+    void queue(const sockaddr* destAddress, const void* data, size_t byteLength);
+
+    /// Queues the buffer's packet without copying it, flushing first if the batch is full. The batch takes a reference
+    /// of its own, so the caller keeps theirs.
+    void queue(const sockaddr* destAddress, PacketBuffer* buffer);
+
+    /// sends everything queued, returns the number of packets that went out
+    int flush();
+
+    bool isEmpty() const { return _packetCount == 0; }
+    int getPacketCount() const { return _packetCount; }
+    int getMaxPackets() const { return _maxPackets; }
+
+    /// whether same destination runs are sent as segmented messages, on by default where the platform has it
+    void setSegmentation(bool segmentation) { _segmentation = segmentation; }
+    bool getSegmentation() const { return _segmentation; }
+
+    /// whether a full batch makes room for more packets instead of flushing, for a caller that has to choose when its
+    /// packets go out, off by default
+    void setGrowWhenFull(bool growWhenFull) { _growWhenFull = growWhenFull; }
+    bool getGrowWhenFull() const { return _growWhenFull; }
+
+    unsigned long getPacketsSent() const { return _packetsSent; }
+    unsigned long getSendCalls() const { return _sendCalls; }
+    unsigned long getPacketsCopied() const { return _packetsCopied; }
+
+private:
+    // disallow copying of UDPSendBatch objects
+    UDPSendBatch(const UDPSendBatch&);
+    UDPSendBatch& operator= (const UDPSendBatch&);
+
+    /// flushes, or grows if the batch is set to, so that there's room for a packet
+    void makeRoom();
+    int sendQueued(int firstPacket);
+    int segmentRunLength(int firstPacket) const;
+    void releaseBuffers();
+
+    unsigned char* getQueuedData(int packet) {
+        return _packetBuffers[packet] ? _packetBuffers[packet]->getData()
+                                      : &_packetData[(size_t)packet * MAX_BUFFER_LENGTH_BYTES];
+    }
+
+    UDPSocket* _socket;
+    int _maxPackets;
+    int _packetCount;
+    bool _segmentation;
+    bool _growWhenFull;
+
+    std::vector<unsigned char> _packetData;    // _maxPackets slots of MAX_BUFFER_LENGTH_BYTES
+    std::vector<PacketBuffer*> _packetBuffers; // the buffer a packet was queued as, or NULL if it was copied
+    std::vector<sockaddr_in> _destAddresses;
+    std::vector<size_t> _packetLengths;
+
+    unsigned long _packetsSent;
+    unsigned long _sendCalls;
+    unsigned long _packetsCopied;
+};
+
+#endif /* defined(__shared__UDPSendBatch__) */
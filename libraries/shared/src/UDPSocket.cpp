@@ -6,7 +6,9 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
@@ -20,8 +22,18 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/uio.h>
+
+// how many packets are asked for in one recvmmsg() call
+const int PACKETS_PER_RECEIVE_CALL = 64;
+#endif
+
 #include <QtCore/QDebug>
 
+#include "SharedUtil.h"
+#include "UDPReceiveBatch.h"
 #include "UDPSocket.h"
 
 sockaddr_in destSockaddr, senderAddress;
@@ -131,7 +143,9 @@ sockaddr_in socketForHostname(const char* hostname) {
 
 UDPSocket::UDPSocket(unsigned short int listeningPort) :
     _listeningPort(listeningPort),
-    blocking(true)
+    blocking(true),
+    _packetsReceived(0),
+    _packetsDropped(0)
 {
     init();
     // create the socket
@@ -168,6 +182,12 @@ UDPSocket::UDPSocket(unsigned short int listeningPort) :
     tv.tv_usec = 500000;
     setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof tv);
     
+#ifdef __linux__
+    // have the kernel tell us how many packets it has dropped for want of room, alongside the packets we do get
+    int reportDrops = 1;
+    setsockopt(handle, SOL_SOCKET, SO_RXQ_OVFL, &reportDrops, sizeof(reportDrops));
+#endif
+
     qDebug("Created UDP socket listening on port %hu.\n", _listeningPort);
 }
 
@@ -239,7 +259,141 @@ bool UDPSocket::receive(sockaddr* recvAddress, void* receivedData, ssize_t* rece
     *receivedBytes = recvfrom(handle, static_cast<char*>(receivedData), MAX_BUFFER_LENGTH_BYTES,
                               0, recvAddress, &addressSize);
     
-    return (*receivedBytes > 0);
+    if (*receivedBytes > 0) {
+        _packetsReceived++;
+        return true;
+    }
+    return false;
+}
+
+#ifdef __linux__
+
+int UDPSocket::receiveBatch(UDPReceiveBatch& batch) {
+    mmsghdr messages[PACKETS_PER_RECEIVE_CALL];
+    iovec packetVectors[PACKETS_PER_RECEIVE_CALL];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint32_t))];
+        cmsghdr alignment;
+    } controls[PACKETS_PER_RECEIVE_CALL];
+
+    batch.replaceTakenBuffers();
+    batch._packetCount = 0;
+    while (batch._packetCount < batch._maxPackets) {
+        int firstPacket = batch._packetCount;
+        int packetsToReceive = std::min(PACKETS_PER_RECEIVE_CALL, batch._maxPackets - firstPacket);
+        for (int i = 0; i < packetsToReceive; i++) {
+            packetVectors[i].iov_base = batch.getPacketData(firstPacket + i);
+            packetVectors[i].iov_len = MAX_BUFFER_LENGTH_BYTES;
+            mmsghdr& message = messages[i];
+            memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_name = &batch._senderAddresses[firstPacket + i];
+            message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            message.msg_hdr.msg_iov = &packetVectors[i];
+            message.msg_hdr.msg_iovlen = 1;
+            message.msg_hdr.msg_control = controls[i].buffer;
+            message.msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+        }
+
+        // only the first call waits, the rest just take whatever else has arrived
+        int packetsReceived = recvmmsg(handle, messages, packetsToReceive,
+                                       firstPacket == 0 ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+        if (packetsReceived <= 0) {
+            break;
+        }
+        for (int i = 0; i < packetsReceived; i++) {
+            for (cmsghdr* control = CMSG_FIRSTHDR(&messages[i].msg_hdr); control != NULL;
+                    control = CMSG_NXTHDR(&messages[i].msg_hdr, control)) {
+                if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL) {
+                    uint32_t dropped;
+                    memcpy(&dropped, CMSG_DATA(control), sizeof(dropped));
+                    _packetsDropped = std::max(_packetsDropped, (unsigned long)dropped);
+                }
+            }
+            // empty datagrams are left out, as receive() leaves them out
+            if (messages[i].msg_len == 0) {
+                continue;
+            }
+            int packet = batch._packetCount++;
+            if (packet != firstPacket + i) {
+                std::swap(batch._packetBuffers[packet], batch._packetBuffers[firstPacket + i]);
+                batch._senderAddresses[packet] = batch._senderAddresses[firstPacket + i];
+            }
+            batch._packetLengths[packet] = messages[i].msg_len;
+        }
+        if (packetsReceived < packetsToReceive) {
+            break;
+        }
+    }
+    _packetsReceived += batch._packetCount;
+    return batch._packetCount;
+}
+
+#else
+
+int UDPSocket::receiveBatch(UDPReceiveBatch& batch) {
+    batch.replaceTakenBuffers();
+    batch._packetCount = 0;
+    while (batch._packetCount < batch._maxPackets) {
+#ifdef _WIN32
+        // without MSG_DONTWAIT to drain with, a batch is one packet
+        if (batch._packetCount > 0) {
+            break;
+        }
+        int addressSize = sizeof(sockaddr_in);
+        int flags = 0;
+#else
+        socklen_t addressSize = sizeof(sockaddr_in);
+        int flags = (batch._packetCount == 0) ? 0 : MSG_DONTWAIT;
+#endif
+        int packet = batch._packetCount;
+        ssize_t receivedBytes = recvfrom(handle, (char*)batch.getPacketData(packet), MAX_BUFFER_LENGTH_BYTES, flags,
+                                         batch.getSenderAddress(packet), &addressSize);
+        if (receivedBytes < 0) {
+            break;
+        }
+        if (receivedBytes > 0) {
+            batch._packetLengths[packet] = receivedBytes;
+            batch._packetCount++;
+        }
+    }
+    _packetsReceived += batch._packetCount;
+    return batch._packetCount;
+}
+
+#endif
+
+bool UDPSocket::setReceiveBufferSize(int bytes) {
+    setsockopt(handle, SOL_SOCKET, SO_RCVBUF, (const char*)&bytes, sizeof(bytes));
+#ifdef __linux__
+    // past net.core.rmem_max only a privileged process can go, but it's worth asking
+    if (getReceiveBufferSize() < bytes) {
+        setsockopt(handle, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes));
+    }
+#endif
+    // Linux reports double what was asked for, to allow for its bookkeeping
+    int receiveBufferSize = getReceiveBufferSize();
+    if (receiveBufferSize < bytes) {
+        qDebug("Asked for a %d byte receive buffer on port %hu, got %d.\n", bytes, _listeningPort, receiveBufferSize);
+        return false;
+    }
+    return true;
+}
+
+bool UDPSocket::setServerReceiveBufferSize(int argc, const char* argv[]) {
+    const char* RECEIVE_BUFFER_BYTES = "--receiveBufferBytes";
+    const char* receiveBufferBytes = getCmdOption(argc, argv, RECEIVE_BUFFER_BYTES);
+    return setReceiveBufferSize(receiveBufferBytes ? atoi(receiveBufferBytes) : DEFAULT_SERVER_RECEIVE_BUFFER_BYTES);
+}
+
+int UDPSocket::getReceiveBufferSize() const {
+    int bytes = 0;
+#ifdef _WIN32
+    int optionLength = sizeof(bytes);
+#else
+    socklen_t optionLength = sizeof(bytes);
+#endif
+    getsockopt(handle, SOL_SOCKET, SO_RCVBUF, (char*)&bytes, &optionLength);
+    return bytes;
 }
 
 int UDPSocket::send(sockaddr* destAddress, const void* data, size_t byteLength) const {
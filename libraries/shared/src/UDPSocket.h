@@ -18,6 +18,11 @@
 
 #define MAX_BUFFER_LENGTH_BYTES 1500
 
+// what servers ask for, so that bursts can queue up between their batches; the kernel caps it at net.core.rmem_max
+const int DEFAULT_SERVER_RECEIVE_BUFFER_BYTES = 4 * 1024 * 1024;
+
+class UDPReceiveBatch;
+
 class UDPSocket {    
 public:
     UDPSocket(unsigned short int listeningPort);
@@ -26,14 +31,33 @@ public:
     unsigned short int getListeningPort() const { return _listeningPort; }
     void setBlocking(bool blocking);
     bool isBlocking() const { return blocking; }
+    int getHandle() const { return handle; }
     int send(sockaddr* destAddress, const void* data, size_t byteLength) const;
     int send(char* destAddress, int destPort, const void* data, size_t byteLength) const;
     bool receive(void* receivedData, ssize_t* receivedBytes) const;
     bool receive(sockaddr* recvAddress, void* receivedData, ssize_t* receivedBytes) const;
+
+    /// Fills the batch with the packets waiting on the socket, waiting for the first one as receive() would, and returns
+    /// how many there are
+    int receiveBatch(UDPReceiveBatch& batch);
+
+    /// asks the kernel for a receive buffer of the given size, returns false if it couldn't have it all
+    bool setReceiveBufferSize(int bytes);
+
+    /// sets a server's receive buffer to the size given with --receiveBufferBytes, or DEFAULT_SERVER_RECEIVE_BUFFER_BYTES
+    bool setServerReceiveBufferSize(int argc, const char* argv[]);
+    int getReceiveBufferSize() const;
+
+    unsigned long getPacketsReceived() const { return _packetsReceived; }
+
+    /// packets the kernel dropped because the receive buffer was full, as of the last batch received (Linux only)
+    unsigned long getPacketsDropped() const { return _packetsDropped; }
 private:
     int handle;
     unsigned short int _listeningPort;
     bool blocking;
+    mutable unsigned long _packetsReceived;
+    unsigned long _packetsDropped;
 };
 
 bool socketMatch(const sockaddr* first, const sockaddr* second);
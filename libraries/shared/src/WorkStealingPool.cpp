@@ -0,0 +1,211 @@
+//
+//  WorkStealingPool.cpp
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#ifdef _WIN32
+#include "Syssocket.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "WorkStealingPool.h"
+
+WorkStealingPool* WorkStealingPool::_sharedInstance = NULL;
+
+// a thread and the index of the worker it runs
+struct WorkerStart {
+    WorkStealingPool* pool;
+    int workerIndex;
+};
+
+WorkStealingPool* WorkStealingPool::getInstance() {
+    static pthread_mutex_t instanceLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&instanceLock);
+    if (!_sharedInstance) {
+        _sharedInstance = new WorkStealingPool(getProcessorCount());
+    }
+    pthread_mutex_unlock(&instanceLock);
+    return _sharedInstance;
+}
+
+int WorkStealingPool::getProcessorCount() {
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    int processorCount = systemInfo.dwNumberOfProcessors;
+#else
+    int processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (processorCount > 0) ? processorCount : 1;
+}
+
+WorkStealingPool::WorkStealingPool(int workerCount) :
+    _workerCount(workerCount > 0 ? workerCount : 1),
+    _threads(NULL),
+    _task(NULL),
+    _context(NULL),
+    _batch(0),
+    _busyWorkers(0),
+    _stopping(false),
+    _stealCount(0)
+{
+    pthread_mutex_init(&_runLock, NULL);
+    pthread_mutex_init(&_stateLock, NULL);
+    pthread_cond_init(&_workReady, NULL);
+    pthread_cond_init(&_workDone, NULL);
+
+    _queues = new Queue[_workerCount];
+    for (int i = 0; i < _workerCount; i++) {
+        pthread_mutex_init(&_queues[i].lock, NULL);
+        _queues[i].begin = _queues[i].end = 0;
+    }
+
+    // worker 0 is whoever calls run()
+    if (_workerCount > 1) {
+        _threads = new pthread_t[_workerCount - 1];
+        for (int i = 1; i < _workerCount; i++) {
+            WorkerStart* start = new WorkerStart();
+            start->pool = this;
+            start->workerIndex = i;
+            pthread_create(&_threads[i - 1], NULL, workerEntry, start);
+        }
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    pthread_mutex_lock(&_stateLock);
+    _stopping = true;
+    pthread_cond_broadcast(&_workReady);
+    pthread_mutex_unlock(&_stateLock);
+
+    for (int i = 1; i < _workerCount; i++) {
+        pthread_join(_threads[i - 1], NULL);
+    }
+    delete[] _threads;
+
+    for (int i = 0; i < _workerCount; i++) {
+        pthread_mutex_destroy(&_queues[i].lock);
+    }
+    delete[] _queues;
+
+    pthread_cond_destroy(&_workDone);
+    pthread_cond_destroy(&_workReady);
+    pthread_mutex_destroy(&_stateLock);
+    pthread_mutex_destroy(&_runLock);
+}
+
+void WorkStealingPool::run(Task task, void* context, int taskCount) {
+    if (taskCount <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&_runLock);
+    _task = task;
+    _context = context;
+
+    // deal the tasks out in contiguous runs, so neighboring tasks tend to end up on the same worker
+    for (int i = 0; i < _workerCount; i++) {
+        _queues[i].begin = (int)((long long)taskCount * i / _workerCount);
+        _queues[i].end = (int)((long long)taskCount * (i + 1) / _workerCount);
+    }
+
+    if (_workerCount > 1) {
+        pthread_mutex_lock(&_stateLock);
+        _batch++;
+        _busyWorkers = _workerCount - 1;
+        pthread_cond_broadcast(&_workReady);
+        pthread_mutex_unlock(&_stateLock);
+    }
+
+    work(0);
+
+    if (_workerCount > 1) {
+        pthread_mutex_lock(&_stateLock);
+        while (_busyWorkers > 0) {
+            pthread_cond_wait(&_workDone, &_stateLock);
+        }
+        pthread_mutex_unlock(&_stateLock);
+    }
+    pthread_mutex_unlock(&_runLock);
+}
+
+void WorkStealingPool::work(int workerIndex) {
+    int taskIndex;
+    while (takeTask(workerIndex, taskIndex) || stealTasks(workerIndex, taskIndex)) {
+        _task(_context, taskIndex, workerIndex);
+    }
+}
+
+bool WorkStealingPool::takeTask(int workerIndex, int& taskIndex) {
+    Queue& queue = _queues[workerIndex];
+    pthread_mutex_lock(&queue.lock);
+    bool found = queue.begin < queue.end;
+    if (found) {
+        taskIndex = queue.begin++;
+    }
+    pthread_mutex_unlock(&queue.lock);
+    return found;
+}
+
+// takes the back half of the first other worker's queue that has anything left, keeps the first of the stolen tasks
+// to run right away and puts the rest in our own queue
+bool WorkStealingPool::stealTasks(int workerIndex, int& taskIndex) {
+    for (int i = 1; i < _workerCount; i++) {
+        Queue& victim = _queues[(workerIndex + i) % _workerCount];
+        pthread_mutex_lock(&victim.lock);
+        int remaining = victim.end - victim.begin;
+        if (remaining <= 0) {
+            pthread_mutex_unlock(&victim.lock);
+            continue;
+        }
+        int stolenCount = (remaining + 1) / 2;
+        int stolenEnd = victim.end;
+        victim.end -= stolenCount;
+        pthread_mutex_unlock(&victim.lock);
+
+        taskIndex = stolenEnd - stolenCount;
+        Queue& queue = _queues[workerIndex];
+        pthread_mutex_lock(&queue.lock);
+        queue.begin = taskIndex + 1;
+        queue.end = stolenEnd;
+        pthread_mutex_unlock(&queue.lock);
+
+        __sync_fetch_and_add(&_stealCount, 1);
+        return true;
+    }
+    return false;
+}
+
+void* WorkStealingPool::workerRoutine(int workerIndex) {
+    unsigned long lastBatch = 0;
+    pthread_mutex_lock(&_stateLock);
+    while (true) {
+        while (!_stopping && _batch == lastBatch) {
+            pthread_cond_wait(&_workReady, &_stateLock);
+        }
+        if (_stopping) {
+            break;
+        }
+        lastBatch = _batch;
+        pthread_mutex_unlock(&_stateLock);
+
+        work(workerIndex);
+
+        pthread_mutex_lock(&_stateLock);
+        if (--_busyWorkers == 0) {
+            pthread_cond_signal(&_workDone);
+        }
+    }
+    pthread_mutex_unlock(&_stateLock);
+    return NULL;
+}
+
+void* WorkStealingPool::workerEntry(void* arg) {
+    WorkerStart* start = (WorkerStart*)arg;
+    WorkStealingPool* pool = start->pool;
+    int workerIndex = start->workerIndex;
+    delete start;
+    return pool->workerRoutine(workerIndex);
+}
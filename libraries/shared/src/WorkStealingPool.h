@@ -0,0 +1,77 @@
+//
+//  WorkStealingPool.h
+//  shared
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A fixed pool of worker threads that runs batches of independent tasks. Each batch's tasks are dealt out evenly to the
+//  workers' queues up front, and a worker that runs out of tasks steals half of the remaining tasks of another worker,
+//  so uneven tasks (like subtrees of different sizes) still keep every worker busy until the end.
+//
+
+#ifndef __shared__WorkStealingPool__
+#define __shared__WorkStealingPool__
+
+#include <pthread.h>
+
+class WorkStealingPool {
+public:
+    /// called once for every task index in a batch, workerIndex is in [0, getWorkerCount())
+    typedef void (*Task)(void* context, int taskIndex, int workerIndex);
+
+    /// the shared pool, with a worker for every processor
+    static WorkStealingPool* getInstance();
+
+    /// \param workerCount number of workers including the thread that calls run(), so workerCount - 1 threads are created
+    WorkStealingPool(int workerCount);
+    ~WorkStealingPool();
+
+    int getWorkerCount() const { return _workerCount; }
+
+    /// Runs task for every index in [0, taskCount) and returns once they have all finished. The calling thread works on
+    /// the batch too, as worker 0. Batches from different threads are run one at a time, and a task must not call run()
+    /// itself.
+    void run(Task task, void* context, int taskCount);
+
+    /// how many times a worker has taken tasks from another's queue, as the workers may still be adding to it
+    unsigned long getStealCount() const { return __sync_fetch_and_add(const_cast<unsigned long*>(&_stealCount), 0); }
+
+private:
+    // disallow copying of WorkStealingPool objects
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator= (const WorkStealingPool&);
+
+    struct Queue {
+        pthread_mutex_t lock;
+        int begin; // the owner takes tasks from the front
+        int end;   // thieves take tasks from the back
+    };
+
+    bool takeTask(int workerIndex, int& taskIndex);
+    bool stealTasks(int workerIndex, int& taskIndex);
+    void work(int workerIndex);
+    void* workerRoutine(int workerIndex);
+
+    static void* workerEntry(void* arg);
+    static int getProcessorCount();
+
+    int _workerCount;
+    pthread_t* _threads;
+    Queue* _queues;
+
+    pthread_mutex_t _runLock;
+    pthread_mutex_t _stateLock;
+    pthread_cond_t _workReady;
+    pthread_cond_t _workDone;
+
+    Task _task;
+    void* _context;
+    unsigned long _batch;
+    int _busyWorkers;
+    bool _stopping;
+    unsigned long _stealCount; // bumped by the stealing worker without the state lock
+
+    static WorkStealingPool* _sharedInstance;
+};
+
+#endif // __shared__WorkStealingPool__
@@ -133,6 +133,11 @@ bool AABox::contains(const AABox& otherBox) const {
     return true;
 }
 
+bool AABox::touches(const AABox& otherBox) const {
+    return _corner.x <= otherBox._topFarLeft.x && otherBox._corner.x <= _topFarLeft.x &&
+        _corner.y <= otherBox._topFarLeft.y && otherBox._corner.y <= _topFarLeft.y &&
+        _corner.z <= otherBox._topFarLeft.z && otherBox._corner.z <= _topFarLeft.z;
+}
 
 // determines whether a value is within the expanded extents
 static bool isWithinExpanded(float value, float corner, float size, float expansion) {
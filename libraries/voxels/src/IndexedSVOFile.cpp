@@ -0,0 +1,586 @@
+//
+//  IndexedSVOFile.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <zlib.h>
+
+#include <QtCore/QDebug>
+
+#include <WorkStealingPool.h>
+
+#include "AABox.h"
+#include "IndexedSVOFile.h"
+#include "JurisdictionMap.h"
+#include "OctalCode.h"
+#include "ViewFrustum.h"
+#include "VoxelConstants.h"
+#include "VoxelNodeBag.h"
+#include "VoxelTree.h"
+#include "VoxelTreeVisitor.h"
+
+// the file starts with a header:
+//
+//      char        magic[4]        "HSVO"
+//      uint16_t    version
+//      uint8_t     index depth
+//      uint8_t     flags
+//      uint32_t    chunk count
+//
+// followed by an index entry per chunk:
+//
+//      octal code, padded out to the size of a code at the index depth (the top chunk has the root's code)
+//      uint64_t    offset of the chunk in the file
+//      uint32_t    bytes stored
+//      uint32_t    bytes once uncompressed
+//
+// followed by the chunks themselves
+const char INDEXED_SVO_MAGIC[] = { 'H', 'S', 'V', 'O' };
+const unsigned char INDEXED_SVO_COMPRESSED = 0x01;
+const int INDEXED_SVO_HEADER_BYTES = sizeof(INDEXED_SVO_MAGIC) + sizeof(uint16_t) + 2 * sizeof(uint8_t) + sizeof(uint32_t);
+const int INDEX_ENTRY_BYTES_WITHOUT_CODE = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+const uint16_t IndexedSVOFile::CURRENT_VERSION;
+
+// Collects the nodes at the index depth that have something below them, in octal code order. Nodes whose subtrees
+// are still waiting in the unloaded source file are leaves in the tree, and have their source subtree noted instead.
+class CollectSubtreesVisitor {
+public:
+    CollectSubtreesVisitor(int indexDepth, IndexedSVOFile* unloadedSource) :
+        _indexDepth(indexDepth),
+        _unloadedSource(unloadedSource) { };
+
+    bool visit(VoxelNode* node) {
+        if (numberOfThreeBitSectionsInCode(node->getOctalCode()) < _indexDepth) {
+            return true;
+        }
+        int sourceSubtree = -1;
+        if (_unloadedSource && node->isLeaf()) {
+            sourceSubtree = _unloadedSource->findSubtree(node->getOctalCode());
+            if (sourceSubtree != -1 && _unloadedSource->isSubtreeLoaded(sourceSubtree)) {
+                sourceSubtree = -1;
+            }
+        }
+        if (!node->isLeaf() || sourceSubtree != -1) {
+            subtrees.push_back(node);
+            sourceSubtrees.push_back(sourceSubtree);
+        }
+        return false;
+    }
+
+    std::vector<VoxelNode*> subtrees;
+    std::vector<int> sourceSubtrees;
+
+private:
+    int _indexDepth;
+    IndexedSVOFile* _unloadedSource;
+};
+
+// encodes node's subtree like VoxelTree::writeToSVOFile() does, but stopping at stopDepth
+static void encodeChunk(VoxelTree* tree, VoxelNode* node, int stopDepth, std::vector<unsigned char>& chunk) {
+    VoxelNodeBag nodeBag;
+    nodeBag.insert(node);
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // chunks are encoded on several threads at once
+    while (!nodeBag.isEmpty()) {
+        VoxelNode* subTree = nodeBag.extract();
+
+        // the encode levels count from the node being encoded, not from the root
+        int maxEncodeLevel = INT_MAX;
+        if (stopDepth != INT_MAX) {
+            maxEncodeLevel = stopDepth - numberOfThreeBitSectionsInCode(subTree->getOctalCode()) + 1;
+        }
+        EncodeBitstreamParams params(maxEncodeLevel, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        int bytesWritten = tree->encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
+        chunk.insert(chunk.end(), &outputBuffer[0], &outputBuffer[0] + bytesWritten);
+    }
+}
+
+// compresses the chunk in place, unless that doesn't make it any smaller, and returns the bytes to store
+static uint32_t compressChunk(std::vector<unsigned char>& chunk) {
+    if (chunk.empty()) {
+        return 0;
+    }
+    uLongf compressedBytes = compressBound(chunk.size());
+    std::vector<unsigned char> compressedChunk(compressedBytes);
+    if (compress2(&compressedChunk[0], &compressedBytes, &chunk[0], chunk.size(), Z_DEFAULT_COMPRESSION) == Z_OK &&
+            compressedBytes < chunk.size()) {
+        compressedChunk.resize(compressedBytes);
+        chunk.swap(compressedChunk);
+    }
+    return chunk.size();
+}
+
+// Encodes and compresses a batch of chunks, a task per chunk on the shared pool, since they only read the tree. The
+// chunks copied from an unloaded source are left empty, for write() to copy itself.
+class EncodeChunksTask {
+public:
+    EncodeChunksTask(VoxelTree* tree, const CollectSubtreesVisitor& collectSubtrees, int indexDepth, bool compress) :
+        _tree(tree), _collectSubtrees(collectSubtrees), _indexDepth(indexDepth), _compress(compress), _batchStart(0) { };
+
+    void encodeBatch(uint32_t batchStart, uint32_t batchSize) {
+        _batchStart = batchStart;
+        chunks.resize(batchSize);
+        rawBytes.resize(batchSize);
+        storedBytes.resize(batchSize);
+        WorkStealingPool::getInstance()->run(encodeChunkTask, this, batchSize);
+    }
+
+    std::vector<std::vector<unsigned char> > chunks;
+    std::vector<uint32_t> rawBytes;
+    std::vector<uint32_t> storedBytes;
+
+private:
+    static void encodeChunkTask(void* context, int taskIndex, int workerIndex) {
+        EncodeChunksTask* task = static_cast<EncodeChunksTask*>(context);
+        uint32_t i = task->_batchStart + taskIndex;
+        std::vector<unsigned char>& chunk = task->chunks[taskIndex];
+        chunk.clear();
+        if (i == 0) {
+            encodeChunk(task->_tree, task->_tree->rootNode, task->_indexDepth, chunk);
+        } else if (task->_collectSubtrees.sourceSubtrees[i - 1] == -1) {
+            encodeChunk(task->_tree, task->_collectSubtrees.subtrees[i - 1], INT_MAX, chunk);
+        }
+        task->rawBytes[taskIndex] = chunk.size();
+        task->storedBytes[taskIndex] = task->_compress ? compressChunk(chunk) : chunk.size();
+    }
+
+    VoxelTree* _tree;
+    const CollectSubtreesVisitor& _collectSubtrees;
+    int _indexDepth;
+    bool _compress;
+    uint32_t _batchStart;
+};
+
+// writes the header, followed by room for the index, which is filled in once we know where the chunks went
+static void writeHeader(std::ofstream& file, int indexDepth, bool compress, uint32_t chunkCount, uint32_t indexBytes) {
+    unsigned char flags = compress ? INDEXED_SVO_COMPRESSED : 0;
+    uint16_t version = IndexedSVOFile::CURRENT_VERSION;
+    unsigned char depth = indexDepth;
+    file.write(INDEXED_SVO_MAGIC, sizeof(INDEXED_SVO_MAGIC));
+    file.write((const char*)&version, sizeof(version));
+    file.write((const char*)&depth, sizeof(depth));
+    file.write((const char*)&flags, sizeof(flags));
+    file.write((const char*)&chunkCount, sizeof(chunkCount));
+
+    std::vector<char> emptyIndex(indexBytes, 0);
+    file.write(&emptyIndex[0], emptyIndex.size());
+}
+
+// adds a chunk's entry to an index that was zeroed to begin with, so codes shorter than octalCodeBytes come out padded
+static void putIndexEntry(char*& indexAt, int octalCodeBytes, const unsigned char* octalCode, int codeBytes,
+                          uint64_t offset, uint32_t storedBytes, uint32_t rawBytes) {
+    memcpy(indexAt, octalCode, codeBytes);
+    indexAt += octalCodeBytes;
+    memcpy(indexAt, &offset, sizeof(offset));
+    indexAt += sizeof(offset);
+    memcpy(indexAt, &storedBytes, sizeof(storedBytes));
+    indexAt += sizeof(storedBytes);
+    memcpy(indexAt, &rawBytes, sizeof(rawBytes));
+    indexAt += sizeof(rawBytes);
+}
+
+bool IndexedSVOFile::write(VoxelTree* tree, const char* filename, int indexDepth, bool compress) {
+    indexDepth = std::max(1, std::min(indexDepth, MAX_INDEX_DEPTH));
+    int octalCodeBytes = bytesRequiredForCodeLength(indexDepth);
+
+    CollectSubtreesVisitor collectSubtrees(indexDepth, NULL);
+    visitNodes(tree->rootNode, collectSubtrees);
+    uint32_t chunkCount = collectSubtrees.subtrees.size() + 1;
+
+    std::ofstream file(filename, std::ios::out|std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    qDebug("saving to file %s...\n", filename);
+
+    std::vector<char> index(chunkCount * (octalCodeBytes + INDEX_ENTRY_BYTES_WITHOUT_CODE), 0);
+    writeHeader(file, indexDepth, compress, chunkCount, index.size());
+
+    // the chunks are encoded a batch at a time, so that only a batch of them is held in memory before it's written
+    const uint32_t CHUNKS_PER_BATCH = 256;
+    EncodeChunksTask encodeChunks(tree, collectSubtrees, indexDepth, compress);
+    uint64_t offset = INDEXED_SVO_HEADER_BYTES + index.size();
+    char* indexAt = &index[0];
+    for (uint32_t batchStart = 0; batchStart < chunkCount; batchStart += CHUNKS_PER_BATCH) {
+        encodeChunks.encodeBatch(batchStart, std::min(CHUNKS_PER_BATCH, chunkCount - batchStart));
+
+        for (uint32_t i = batchStart; i < batchStart + encodeChunks.chunks.size(); i++) {
+            VoxelNode* node = (i == 0) ? tree->rootNode : collectSubtrees.subtrees[i - 1];
+            const std::vector<unsigned char>& chunk = encodeChunks.chunks[i - batchStart];
+            uint32_t storedBytes = encodeChunks.storedBytes[i - batchStart];
+            if (storedBytes > 0) {
+                file.write((const char*)&chunk[0], storedBytes);
+            }
+            unsigned char* octalCode = node->getOctalCode();
+            putIndexEntry(indexAt, octalCodeBytes, octalCode,
+                          bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(octalCode)), offset, storedBytes,
+                          encodeChunks.rawBytes[i - batchStart]);
+            offset += storedBytes;
+        }
+    }
+
+    file.seekp(INDEXED_SVO_HEADER_BYTES, std::ios::beg);
+    file.write(&index[0], index.size());
+    file.close();
+    return !file.fail();
+}
+
+void IndexedSVOFile::takeSnapshot(VoxelTree* tree, Snapshot& snapshot, int indexDepth, bool compress,
+                                  IndexedSVOFile* unloadedSource) {
+    if (unloadedSource) {
+        indexDepth = unloadedSource->getIndexDepth();
+    }
+    indexDepth = std::max(1, std::min(indexDepth, MAX_INDEX_DEPTH));
+    int octalCodeBytes = bytesRequiredForCodeLength(indexDepth);
+
+    CollectSubtreesVisitor collectSubtrees(indexDepth, unloadedSource);
+    visitNodes(tree->rootNode, collectSubtrees);
+    uint32_t chunkCount = collectSubtrees.subtrees.size() + 1;
+
+    // all of the chunks are held at once, but when there's an unloaded source only the resident ones are encoded
+    EncodeChunksTask encodeChunks(tree, collectSubtrees, indexDepth, compress);
+    encodeChunks.encodeBatch(0, chunkCount);
+
+    snapshot.indexDepth = indexDepth;
+    snapshot.compressed = compress;
+    snapshot.octalCodes.assign(chunkCount * octalCodeBytes, 0);
+    snapshot.chunks.swap(encodeChunks.chunks);
+    snapshot.storedBytes.swap(encodeChunks.storedBytes);
+    snapshot.rawBytes.swap(encodeChunks.rawBytes);
+    snapshot.copied.assign(chunkCount, false);
+    snapshot.sourceOffsets.assign(chunkCount, 0);
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        VoxelNode* node = (i == 0) ? tree->rootNode : collectSubtrees.subtrees[i - 1];
+        unsigned char* octalCode = node->getOctalCode();
+        memcpy(&snapshot.octalCodes[i * octalCodeBytes], octalCode,
+               bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(octalCode)));
+
+        int sourceSubtree = (i == 0) ? -1 : collectSubtrees.sourceSubtrees[i - 1];
+        if (sourceSubtree != -1) {
+            const Chunk& sourceChunk = unloadedSource->_chunks[sourceSubtree + 1];
+            snapshot.copied[i] = true;
+            snapshot.sourceOffsets[i] = sourceChunk.offset;
+            snapshot.storedBytes[i] = sourceChunk.storedBytes;
+            snapshot.rawBytes[i] = sourceChunk.rawBytes;
+        }
+    }
+}
+
+void IndexedSVOFile::Snapshot::clear() {
+    // swapped out rather than cleared, to give the memory back
+    std::vector<unsigned char>().swap(octalCodes);
+    std::vector<std::vector<unsigned char> >().swap(chunks);
+    std::vector<uint32_t>().swap(storedBytes);
+    std::vector<uint32_t>().swap(rawBytes);
+    std::vector<bool>().swap(copied);
+    std::vector<uint64_t>().swap(sourceOffsets);
+}
+
+bool IndexedSVOFile::writeSnapshot(const Snapshot& snapshot, const char* filename, const char* sourceFilename) {
+    int octalCodeBytes = bytesRequiredForCodeLength(snapshot.indexDepth);
+    uint32_t chunkCount = snapshot.chunks.size();
+
+    std::ifstream source;
+    if (sourceFilename) {
+        source.open(sourceFilename, std::ios::in|std::ios::binary);
+        if (!source.is_open()) {
+            qDebug("IndexedSVOFile::writeSnapshot() couldn't read %s\n", sourceFilename);
+            return false;
+        }
+    }
+    std::ofstream file(filename, std::ios::out|std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    qDebug("saving to file %s...\n", filename);
+
+    std::vector<char> index(chunkCount * (octalCodeBytes + INDEX_ENTRY_BYTES_WITHOUT_CODE), 0);
+    writeHeader(file, snapshot.indexDepth, snapshot.compressed, chunkCount, index.size());
+
+    uint64_t offset = INDEXED_SVO_HEADER_BYTES + index.size();
+    std::vector<unsigned char> sourceChunk;
+    char* indexAt = &index[0];
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        const std::vector<unsigned char>* chunk = &snapshot.chunks[i];
+        uint32_t storedBytes = snapshot.storedBytes[i];
+        if (snapshot.copied[i] && storedBytes > 0) {
+            // copied as it is, compressed or not
+            sourceChunk.resize(storedBytes);
+            source.seekg(snapshot.sourceOffsets[i], std::ios::beg);
+            if (!source.is_open() || !source.read((char*)&sourceChunk[0], storedBytes)) {
+                qDebug("IndexedSVOFile::writeSnapshot() chunk %d of the source is truncated\n", i);
+                return false;
+            }
+            chunk = &sourceChunk;
+        }
+        if (storedBytes > 0) {
+            file.write((const char*)&(*chunk)[0], storedBytes);
+        }
+        putIndexEntry(indexAt, octalCodeBytes, &snapshot.octalCodes[i * octalCodeBytes], octalCodeBytes, offset,
+                      storedBytes, snapshot.rawBytes[i]);
+        offset += storedBytes;
+    }
+
+    file.seekp(INDEXED_SVO_HEADER_BYTES, std::ios::beg);
+    file.write(&index[0], index.size());
+    file.close();
+    return !file.fail();
+}
+
+bool IndexedSVOFile::isIndexedSVOFile(const char* filename) {
+    std::ifstream file(filename, std::ios::in|std::ios::binary);
+    char magic[sizeof(INDEXED_SVO_MAGIC)];
+    return file.is_open() && file.read(magic, sizeof(magic)) &&
+        memcmp(magic, INDEXED_SVO_MAGIC, sizeof(INDEXED_SVO_MAGIC)) == 0;
+}
+
+IndexedSVOFile::IndexedSVOFile() :
+    _indexDepth(0),
+    _compressed(false),
+    _octalCodeBytes(0),
+    _bytesLoaded(0) {
+}
+
+IndexedSVOFile::~IndexedSVOFile() {
+    close();
+}
+
+bool IndexedSVOFile::open(const char* filename, bool writable) {
+    close();
+    _file.open(filename, writable ? std::ios::in|std::ios::out|std::ios::binary : std::ios::in|std::ios::binary);
+    if (!_file.is_open()) {
+        return false;
+    }
+
+    char magic[sizeof(INDEXED_SVO_MAGIC)];
+    uint16_t version;
+    unsigned char depth;
+    unsigned char flags;
+    uint32_t chunkCount;
+    _file.read(magic, sizeof(magic));
+    _file.read((char*)&version, sizeof(version));
+    _file.read((char*)&depth, sizeof(depth));
+    _file.read((char*)&flags, sizeof(flags));
+    _file.read((char*)&chunkCount, sizeof(chunkCount));
+    if (!_file || memcmp(magic, INDEXED_SVO_MAGIC, sizeof(INDEXED_SVO_MAGIC)) != 0) {
+        qDebug("IndexedSVOFile::open() %s is not an indexed SVO file\n", filename);
+        close();
+        return false;
+    }
+    if (version > CURRENT_VERSION || depth < 1 || depth > MAX_INDEX_DEPTH || chunkCount < 1) {
+        qDebug("IndexedSVOFile::open() can't read %s, version %d, index depth %d\n", filename, version, depth);
+        close();
+        return false;
+    }
+    _indexDepth = depth;
+    _compressed = (flags & INDEXED_SVO_COMPRESSED);
+    _octalCodeBytes = bytesRequiredForCodeLength(_indexDepth);
+
+    std::vector<char> index(chunkCount * (_octalCodeBytes + INDEX_ENTRY_BYTES_WITHOUT_CODE));
+    _file.read(&index[0], index.size());
+    if (!_file) {
+        qDebug("IndexedSVOFile::open() the index of %s is truncated\n", filename);
+        close();
+        return false;
+    }
+    _chunks.resize(chunkCount);
+    _octalCodes.resize(chunkCount * _octalCodeBytes);
+    const char* indexAt = &index[0];
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        Chunk& chunk = _chunks[i];
+        memcpy(getChunkOctalCode(i), indexAt, _octalCodeBytes);
+        indexAt += _octalCodeBytes;
+        memcpy(&chunk.offset, indexAt, sizeof(chunk.offset));
+        indexAt += sizeof(chunk.offset);
+        memcpy(&chunk.storedBytes, indexAt, sizeof(chunk.storedBytes));
+        indexAt += sizeof(chunk.storedBytes);
+        memcpy(&chunk.rawBytes, indexAt, sizeof(chunk.rawBytes));
+        indexAt += sizeof(chunk.rawBytes);
+        chunk.loaded = false;
+    }
+    return true;
+}
+
+void IndexedSVOFile::close() {
+    if (_file.is_open()) {
+        _file.close();
+    }
+    _file.clear();
+    _chunks.clear();
+    _octalCodes.clear();
+    _bytesLoaded = 0;
+}
+
+int IndexedSVOFile::findSubtree(unsigned char* octalCode) {
+    int sections = numberOfThreeBitSectionsInCode(octalCode);
+    if (sections < _indexDepth) {
+        return -1;
+    }
+    // the subtree's code is the first _indexDepth sections of the node's code
+    std::vector<unsigned char> subtreeCode(_octalCodeBytes, 0);
+    subtreeCode[0] = _indexDepth;
+    for (int section = 0; section < _indexDepth; section++) {
+        setOctalCodeSectionValue(&subtreeCode[0], section, getOctalCodeSectionValue(octalCode, section));
+    }
+
+    // subtrees are stored in octal code order, which for codes of the same length is byte order
+    int low = 1;
+    int high = _chunks.size() - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        int comparison = memcmp(getChunkOctalCode(middle), &subtreeCode[0], _octalCodeBytes);
+        if (comparison == 0) {
+            return middle - 1;
+        } else if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+VoxelNode* IndexedSVOFile::getSubtreeNode(VoxelTree* tree, int subtree) {
+    unsigned char* octalCode = getSubtreeOctalCode(subtree);
+    VoxelNode* node = tree->rootNode;
+    for (int section = 0; node && section < _indexDepth; section++) {
+        node = node->getChildAtIndex(getOctalCodeSectionValue(octalCode, section));
+    }
+    return node;
+}
+
+bool IndexedSVOFile::readStoredChunk(int chunkIndex, std::vector<unsigned char>& storedData) {
+    const Chunk& chunk = _chunks[chunkIndex];
+    storedData.resize(chunk.storedBytes);
+    if (chunk.storedBytes == 0) {
+        return true;
+    }
+    _file.clear();
+    _file.seekg(chunk.offset, std::ios::beg);
+    _file.read((char*)&storedData[0], chunk.storedBytes);
+    if (!_file) {
+        qDebug("IndexedSVOFile::readStoredChunk() chunk %d is truncated\n", chunkIndex);
+        return false;
+    }
+    return true;
+}
+
+bool IndexedSVOFile::loadChunk(VoxelTree* tree, int chunkIndex) {
+    Chunk& chunk = _chunks[chunkIndex];
+    if (chunk.loaded) {
+        return true;
+    }
+    if (chunk.rawBytes > 0) {
+        std::vector<unsigned char> storedData;
+        if (!readStoredChunk(chunkIndex, storedData)) {
+            return false;
+        }
+        std::vector<unsigned char> rawData;
+        if (chunk.storedBytes != chunk.rawBytes) {
+            rawData.resize(chunk.rawBytes);
+            uLongf rawBytes = chunk.rawBytes;
+            if (uncompress(&rawData[0], &rawBytes, &storedData[0], chunk.storedBytes) != Z_OK ||
+                    rawBytes != chunk.rawBytes) {
+                qDebug("IndexedSVOFile::loadChunk() chunk %d is corrupt\n", chunkIndex);
+                return false;
+            }
+        } else {
+            rawData.swap(storedData);
+        }
+        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+        tree->readBitstreamToTree(&rawData[0], rawData.size(), args);
+        _bytesLoaded += chunk.storedBytes;
+    }
+    chunk.loaded = true;
+    return true;
+}
+
+bool IndexedSVOFile::loadTop(VoxelTree* tree) {
+    return isOpen() && loadChunk(tree, 0);
+}
+
+bool IndexedSVOFile::loadSubtree(VoxelTree* tree, int subtree) {
+    return loadTop(tree) && loadChunk(tree, subtree + 1);
+}
+
+bool IndexedSVOFile::loadAll(VoxelTree* tree) {
+    if (!loadTop(tree)) {
+        return false;
+    }
+    for (int i = 0; i < getSubtreeCount(); i++) {
+        if (!loadSubtree(tree, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int IndexedSVOFile::loadSubtreesInJurisdiction(VoxelTree* tree, const JurisdictionMap& jurisdiction) {
+    if (!loadTop(tree)) {
+        return 0;
+    }
+    int subtreesLoaded = 0;
+    for (int i = 0; i < getSubtreeCount(); i++) {
+        // subtrees that hold the jurisdiction's root are above it, and the ones that hold its end nodes are within it
+        if (jurisdiction.isMyJurisdiction(getSubtreeOctalCode(i), CHECK_NODE_ONLY) != JurisdictionMap::BELOW &&
+                !isSubtreeLoaded(i) && loadSubtree(tree, i)) {
+            subtreesLoaded++;
+        }
+    }
+    return subtreesLoaded;
+}
+
+int IndexedSVOFile::loadSubtreesInView(VoxelTree* tree, const ViewFrustum& viewFrustum) {
+    if (!loadTop(tree)) {
+        return 0;
+    }
+    int subtreesLoaded = 0;
+    for (int i = 0; i < getSubtreeCount(); i++) {
+        VoxelPositionSize details;
+        voxelDetailsForCode(getSubtreeOctalCode(i), details);
+        AABox box(glm::vec3(details.x, details.y, details.z) * (float)TREE_SCALE, details.s * TREE_SCALE);
+        if (viewFrustum.boxInFrustum(box) != ViewFrustum::OUTSIDE && !isSubtreeLoaded(i) && loadSubtree(tree, i)) {
+            subtreesLoaded++;
+        }
+    }
+    return subtreesLoaded;
+}
+
+bool IndexedSVOFile::rewriteSubtree(VoxelTree* tree, int subtree) {
+    VoxelNode* node = getSubtreeNode(tree, subtree);
+    std::vector<unsigned char> chunk;
+    if (node) {
+        encodeChunk(tree, node, INT_MAX, chunk);
+    }
+    Chunk& indexChunk = _chunks[subtree + 1];
+    uint32_t rawBytes = chunk.size();
+    uint32_t storedBytes = _compressed ? compressChunk(chunk) : rawBytes;
+
+    // the new chunk goes on the end, and only then is the index pointed at it
+    _file.clear();
+    _file.seekp(0, std::ios::end);
+    uint64_t offset = _file.tellp();
+    if (storedBytes > 0) {
+        _file.write((const char*)&chunk[0], storedBytes);
+    }
+    _file.seekp(INDEXED_SVO_HEADER_BYTES + (subtree + 1) * (_octalCodeBytes + INDEX_ENTRY_BYTES_WITHOUT_CODE) +
+                _octalCodeBytes, std::ios::beg);
+    _file.write((const char*)&offset, sizeof(offset));
+    _file.write((const char*)&storedBytes, sizeof(storedBytes));
+    _file.write((const char*)&rawBytes, sizeof(rawBytes));
+    _file.flush();
+    if (!_file) {
+        qDebug("IndexedSVOFile::rewriteSubtree() couldn't write subtree %d\n", subtree);
+        _file.clear();
+        return false;
+    }
+    indexChunk.offset = offset;
+    indexChunk.storedBytes = storedBytes;
+    indexChunk.rawBytes = rawBytes;
+    return true;
+}
@@ -0,0 +1,137 @@
+//
+//  IndexedSVOFile.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A versioned SVO container that can be read a piece at a time. The tree is cut at an index depth: one chunk holds
+//  everything above that depth (including the colors of the nodes at it, so a partly loaded tree still has a coarse
+//  version of everything), and every node at the index depth that has children gets a chunk of its own. A header and
+//  an index of chunk offsets by octal code come first, so any subtree can be found and read without parsing the rest
+//  of the file. Each chunk is the same bitstream the old SVO files hold, optionally zlib compressed.
+//
+//  VoxelTree::readFromSVOFile() reads both kinds of file.
+//
+//  A file opened for writing can also have single subtrees rewritten in place, which appends the new chunk and points
+//  the index at it, leaving the old chunk as garbage until the file is written out again.
+//
+
+#ifndef __hifi__IndexedSVOFile__
+#define __hifi__IndexedSVOFile__
+
+#include <fstream>
+#include <stdint.h>
+#include <vector>
+
+class JurisdictionMap;
+class ViewFrustum;
+class VoxelNode;
+class VoxelTree;
+
+class IndexedSVOFile {
+public:
+    static const uint16_t CURRENT_VERSION = 1;
+    static const int DEFAULT_INDEX_DEPTH = 3;
+    static const int MAX_INDEX_DEPTH = 7;
+
+    /// A tree's chunks encoded into memory, so the tree only has to stay locked while they're encoded and not while
+    /// they're written. The subtrees an unloaded source hasn't loaded aren't encoded, just noted, for writeSnapshot()
+    /// to copy from the source's file.
+    struct Snapshot {
+        Snapshot() : indexDepth(0), compressed(false) { }
+        void clear();
+
+        int                                         indexDepth;
+        bool                                        compressed;
+        std::vector<unsigned char>                  octalCodes;     // a code padded out to the index depth per chunk
+        std::vector<std::vector<unsigned char> >    chunks;         // empty for the chunks that are copied
+        std::vector<uint32_t>                       storedBytes;
+        std::vector<uint32_t>                       rawBytes;
+        std::vector<bool>                           copied;
+        std::vector<uint64_t>                       sourceOffsets;  // where the copied chunks are in the source
+    };
+
+    /// Writes the whole tree, returns false if the file couldn't be written.
+    static bool write(VoxelTree* tree, const char* filename, int indexDepth = DEFAULT_INDEX_DEPTH,
+                      bool compress = true);
+
+    /// Encodes the whole tree into a snapshot. If unloadedSource is given, its index depth is used, and the subtrees it
+    /// hasn't loaded are left to be copied from its file as they are.
+    static void takeSnapshot(VoxelTree* tree, Snapshot& snapshot, int indexDepth = DEFAULT_INDEX_DEPTH,
+                             bool compress = true, IndexedSVOFile* unloadedSource = NULL);
+
+    /// Writes a snapshot out, returns false if the file couldn't be written. The copied chunks are read from the source
+    /// file through a stream of their own, so the source can stay open and be read from meanwhile, and even have
+    /// subtrees rewritten, as that only appends to it. The source can't be the file being written.
+    static bool writeSnapshot(const Snapshot& snapshot, const char* filename, const char* sourceFilename = NULL);
+
+    /// true if the file starts with the indexed SVO header, rather than being an old style SVO file
+    static bool isIndexedSVOFile(const char* filename);
+
+    IndexedSVOFile();
+    ~IndexedSVOFile();
+
+    /// reads the header and index, the chunks are only read when they're loaded
+    bool open(const char* filename, bool writable = false);
+    void close();
+    bool isOpen() const { return _file.is_open(); }
+
+    int getIndexDepth() const { return _indexDepth; }
+    bool isCompressed() const { return _compressed; }
+    int getSubtreeCount() const { return _chunks.size() - 1; }
+    unsigned char* getSubtreeOctalCode(int subtree) { return getChunkOctalCode(subtree + 1); }
+
+    /// where the subtree's chunk is in the file, for readers that stream it themselves; subtree -1 is the top of the tree
+    uint64_t getSubtreeOffset(int subtree) const { return _chunks[subtree + 1].offset; }
+    uint32_t getSubtreeStoredBytes(int subtree) const { return _chunks[subtree + 1].storedBytes; }
+    uint32_t getSubtreeRawBytes(int subtree) const { return _chunks[subtree + 1].rawBytes; }
+
+    /// the subtree holding the node with this octal code, or -1 if the node is above the index depth or has no subtree
+    int findSubtree(unsigned char* octalCode);
+
+    /// the root node of the subtree in the tree, or NULL if the tree doesn't have it
+    VoxelNode* getSubtreeNode(VoxelTree* tree, int subtree);
+
+    /// loads everything above the index depth, the other loads do this first if it hasn't been done yet
+    bool loadTop(VoxelTree* tree);
+    bool loadSubtree(VoxelTree* tree, int subtree);
+    bool isSubtreeLoaded(int subtree) const { return _chunks[subtree + 1].loaded; }
+    /// for callers that drop subtrees from the tree, or that already have them
+    void setSubtreeLoaded(int subtree, bool loaded) { _chunks[subtree + 1].loaded = loaded; }
+    bool loadAll(VoxelTree* tree);
+
+    /// load just the subtrees that overlap a jurisdiction or a view, and return how many were loaded
+    int loadSubtreesInJurisdiction(VoxelTree* tree, const JurisdictionMap& jurisdiction);
+    int loadSubtreesInView(VoxelTree* tree, const ViewFrustum& viewFrustum);
+
+    /// encodes the subtree from the tree again and stores it in place of the old one, the file must be writable
+    bool rewriteSubtree(VoxelTree* tree, int subtree);
+
+    unsigned long getBytesLoaded() const { return _bytesLoaded; }
+
+private:
+    // disallow copying of IndexedSVOFile objects
+    IndexedSVOFile(const IndexedSVOFile&);
+    IndexedSVOFile& operator= (const IndexedSVOFile&);
+
+    struct Chunk {
+        uint64_t    offset;
+        uint32_t    storedBytes; // the same as rawBytes if the chunk isn't compressed
+        uint32_t    rawBytes;
+        bool        loaded;
+    };
+
+    unsigned char* getChunkOctalCode(int chunk) { return &_octalCodes[chunk * _octalCodeBytes]; }
+    bool loadChunk(VoxelTree* tree, int chunk);
+    bool readStoredChunk(int chunk, std::vector<unsigned char>& storedData);
+
+    std::fstream                _file;
+    int                         _indexDepth;
+    bool                        _compressed;
+    int                         _octalCodeBytes;
+    std::vector<Chunk>          _chunks;     // the top of the tree first, then the subtrees in octal code order
+    std::vector<unsigned char>  _octalCodes; // _octalCodeBytes for each chunk
+    unsigned long               _bytesLoaded;
+};
+
+#endif /* defined(__hifi__IndexedSVOFile__) */
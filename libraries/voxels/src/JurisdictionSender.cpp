@@ -10,6 +10,7 @@
 
 #include <PerfStat.h>
 
+#include <NodeList.h>
 #include <OctalCode.h>
 #include <SharedUtil.h>
 #include <PacketHeaders.h>
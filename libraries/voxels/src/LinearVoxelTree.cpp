@@ -0,0 +1,415 @@
+//
+//  LinearVoxelTree.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <QtCore/QDebug>
+
+#include "OctalCode.h"
+#include "SharedUtil.h"
+#include "LinearVoxelTree.h"
+#include "VoxelConstants.h"
+
+const int BYTES_PER_COLOR = 3;
+
+static int countBits(unsigned char byte) {
+    int count = 0;
+    for (; byte; byte &= byte - 1) {
+        count++;
+    }
+    return count;
+}
+
+LinearVoxelTree::LinearVoxelTree() : _rootCode(NULL) {
+}
+
+LinearVoxelTree::~LinearVoxelTree() {
+    delete[] _rootCode;
+}
+
+void LinearVoxelTree::clear() {
+    _levels.clear();
+    delete[] _rootCode;
+    _rootCode = NULL;
+}
+
+bool LinearVoxelTree::build(VoxelNode* regionRoot) {
+    clear();
+
+    // walk the region breadth first, appending children in index order, which keeps every level sorted by key
+    std::vector<VoxelNode*> currentNodes(1, regionRoot);
+    std::vector<VoxelNode*> nextNodes;
+    std::vector<uint64_t> currentKeys(1, 0);
+    while (!currentNodes.empty()) {
+        if ((int)_levels.size() > MAX_DEPTH) {
+            qDebug("LinearVoxelTree::build() region is deeper than %d levels, not packing it\n", MAX_DEPTH);
+            clear();
+            return false;
+        }
+        _levels.push_back(Level());
+        Level& level = _levels.back();
+        level.keys.swap(currentKeys);
+        level.colors.resize(currentNodes.size() * 4);
+        level.childMasks.resize(currentNodes.size());
+        level.firstChild.resize(currentNodes.size());
+
+        nextNodes.clear();
+        for (uint32_t i = 0; i < currentNodes.size(); i++) {
+            VoxelNode* node = currentNodes[i];
+            memcpy(&level.colors[i * 4], node->getTrueColor(), sizeof(nodeColor));
+            level.firstChild[i] = nextNodes.size();
+            unsigned char childMask = 0;
+            for (int childIndex = 0; childIndex < NUMBER_OF_CHILDREN; childIndex++) {
+                VoxelNode* child = node->getChildAtIndex(childIndex);
+                if (child) {
+                    childMask |= (1 << childIndex);
+                    nextNodes.push_back(child);
+                    currentKeys.push_back((level.keys[i] << 3) | childIndex);
+                }
+            }
+            level.childMasks[i] = childMask;
+        }
+        currentNodes.swap(nextNodes);
+    }
+
+    int codeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(regionRoot->getOctalCode()));
+    _rootCode = new unsigned char[codeBytes];
+    memcpy(_rootCode, regionRoot->getOctalCode(), codeBytes);
+    return true;
+}
+
+void LinearVoxelTree::expandInto(VoxelNode* destinationNode) const {
+    if (_levels.empty()) {
+        return;
+    }
+    // each level's nodes, in the order of the level's keys, for finding the parents of the next level
+    std::vector<std::vector<VoxelNode*> > levelNodes(_levels.size());
+    levelNodes[0].push_back(destinationNode);
+    for (uint32_t levelIndex = 0; levelIndex < _levels.size(); levelIndex++) {
+        const Level& level = _levels[levelIndex];
+        for (uint32_t i = 0; i < level.keys.size(); i++) {
+            VoxelNode* node = levelNodes[levelIndex][i];
+            if (level.colors[i * 4 + 3]) {
+                node->setColor(*(const nodeColor*)&level.colors[i * 4]);
+            }
+            for (int childIndex = 0; childIndex < NUMBER_OF_CHILDREN; childIndex++) {
+                if (level.childMasks[i] & (1 << childIndex)) {
+                    VoxelNode* child = node->getChildAtIndex(childIndex);
+                    levelNodes[levelIndex + 1].push_back(child ? child : node->addChildAtIndex(childIndex));
+                }
+            }
+        }
+    }
+}
+
+bool LinearVoxelTree::getVoxelAt(float x, float y, float z, float s, nodeColor& color) const {
+    if (_levels.empty()) {
+        return false;
+    }
+    unsigned char* octalCode = pointToVoxel(x, y, z, s);
+    int sections = numberOfThreeBitSectionsInCode(octalCode);
+    int rootSections = numberOfThreeBitSectionsInCode(_rootCode);
+    int levelIndex = sections - rootSections;
+    bool found = false;
+    if (levelIndex >= 0 && levelIndex < (int)_levels.size() && isAncestorOf(_rootCode, octalCode)) {
+        uint64_t key = 0;
+        for (int section = rootSections; section < sections; section++) {
+            key = (key << 3) | getOctalCodeSectionValue(octalCode, section);
+        }
+        const Level& level = _levels[levelIndex];
+        std::vector<uint64_t>::const_iterator position = std::lower_bound(level.keys.begin(), level.keys.end(), key);
+        if (position != level.keys.end() && *position == key) {
+            memcpy(color, &level.colors[(position - level.keys.begin()) * 4], sizeof(nodeColor));
+            found = true;
+        }
+    }
+    delete[] octalCode;
+    return found;
+}
+
+int LinearVoxelTree::writeOctalCode(const NodeRef& node, unsigned char* outputBuffer) const {
+    int rootSections = numberOfThreeBitSectionsInCode(_rootCode);
+    int sections = rootSections + node.level;
+    int codeBytes = bytesRequiredForCodeLength(sections);
+    memset(outputBuffer, 0, codeBytes);
+    memcpy(outputBuffer, _rootCode, bytesRequiredForCodeLength(rootSections));
+    *outputBuffer = sections;
+    uint64_t key = _levels[node.level].keys[node.index];
+    for (int section = sections - 1; section >= rootSections; section--) {
+        setOctalCodeSectionValue(outputBuffer, section, key & 7);
+        key >>= 3;
+    }
+    return codeBytes;
+}
+
+int LinearVoxelTree::encodeTreeBitstream(const NodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                                         std::vector<NodeRef>& bag) const {
+    int codeLength = writeOctalCode(node, outputBuffer);
+    int childBytesWritten = encodeTreeBitstreamRecursion(node, outputBuffer + codeLength, availableBytes - codeLength, bag);
+
+    // like VoxelTree, a subtree with no colors and no children below it is the same as nothing at all
+    if (childBytesWritten == 2) {
+        childBytesWritten = 0;
+    }
+    return childBytesWritten ? codeLength + childBytesWritten : 0;
+}
+
+int LinearVoxelTree::encodeTreeBitstreamRecursion(const NodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                                                  std::vector<NodeRef>& bag) const {
+    const Level& level = _levels[node.level];
+    unsigned char childMask = level.childMasks[node.index];
+    if (!childMask) {
+        return 0;
+    }
+    const Level& childLevel = _levels[node.level + 1];
+    uint32_t firstChild = level.firstChild[node.index];
+    int childCount = countBits(childMask);
+
+    // every child is sent with a color, and the ones that aren't leaves may have subtrees to follow
+    int bytesAtThisLevel = sizeof(unsigned char) + childCount * BYTES_PER_COLOR + sizeof(unsigned char);
+    if (availableBytes < bytesAtThisLevel) {
+        bag.push_back(node);
+        return 0;
+    }
+    unsigned char childrenColoredBits = 0;
+    unsigned char childrenExistInPacketBits = 0;
+    unsigned char* colorsAt = outputBuffer + sizeof(childrenColoredBits);
+    for (int i = 0, child = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (childMask & (1 << i)) {
+            childrenColoredBits |= (1 << (7 - i));
+            if (childLevel.childMasks[firstChild + child]) {
+                childrenExistInPacketBits |= (1 << (7 - i));
+            }
+            memcpy(colorsAt, &childLevel.colors[(firstChild + child) * 4], BYTES_PER_COLOR);
+            colorsAt += BYTES_PER_COLOR;
+            child++;
+        }
+    }
+    *outputBuffer = childrenColoredBits;
+    unsigned char* childExistsPlaceHolder = colorsAt;
+    *childExistsPlaceHolder = childrenExistInPacketBits;
+    outputBuffer += bytesAtThisLevel;
+    availableBytes -= bytesAtThisLevel;
+
+    // subtrees that don't write anything (because they didn't fit) come out of the exists bits
+    for (int i = 0, child = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (!(childMask & (1 << i))) {
+            continue;
+        }
+        if (oneAtBit(childrenExistInPacketBits, i)) {
+            int childTreeBytesOut = encodeTreeBitstreamRecursion(NodeRef(node.level + 1, firstChild + child),
+                                                                 outputBuffer, availableBytes, bag);
+            if (childTreeBytesOut == 2) {
+                childTreeBytesOut = 0;
+            }
+            bytesAtThisLevel += childTreeBytesOut;
+            availableBytes -= childTreeBytesOut;
+            outputBuffer += childTreeBytesOut;
+            if (childTreeBytesOut == 0) {
+                childrenExistInPacketBits -= (1 << (7 - i));
+                *childExistsPlaceHolder = childrenExistInPacketBits;
+            }
+        }
+        child++;
+    }
+    return bytesAtThisLevel;
+}
+
+void LinearVoxelTree::writeToSVOFile(const char* filename) const {
+    std::ofstream file(filename, std::ios::out|std::ios::binary);
+    if (file.is_open() && !_levels.empty()) {
+        qDebug("saving to file %s...\n", filename);
+
+        std::vector<NodeRef> bag(1, NodeRef(0, 0));
+        static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
+        while (!bag.empty()) {
+            NodeRef subTree = bag.back();
+            bag.pop_back();
+            int bytesWritten = encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, bag);
+            file.write((const char*)&outputBuffer[0], bytesWritten);
+        }
+    }
+    file.close();
+}
+
+// a node read from a file, before the levels are sorted and linked up
+struct LinearVoxelEntry {
+    uint64_t        key;
+    int             level;
+    unsigned char   color[4];
+    bool            hasColor;
+    uint32_t        order;
+
+    bool operator<(const LinearVoxelEntry& other) const {
+        if (level != other.level) {
+            return level < other.level;
+        }
+        return (key != other.key) ? key < other.key : order < other.order;
+    }
+};
+
+static void addEntry(std::vector<LinearVoxelEntry>& entries, int level, uint64_t key, const unsigned char* color) {
+    LinearVoxelEntry entry;
+    entry.key = key;
+    entry.level = level;
+    entry.hasColor = (color != NULL);
+    if (color) {
+        memcpy(entry.color, color, BYTES_PER_COLOR);
+        entry.color[3] = 1;
+    }
+    entry.order = entries.size();
+    entries.push_back(entry);
+}
+
+// the same walk as VoxelTree::readNodeData(), with no exists bits and with colors, returns the bytes read or -1 if the
+// data goes deeper than a key can hold
+static int readLinearNodeData(std::vector<LinearVoxelEntry>& entries, int level, uint64_t key,
+                              const unsigned char* nodeData, int bytesLeftToRead) {
+    unsigned char colorInPacketMask = *nodeData;
+    int bytesRead = sizeof(colorInPacketMask);
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (oneAtBit(colorInPacketMask, i)) {
+            if (level + 1 > LinearVoxelTree::MAX_DEPTH) {
+                return -1;
+            }
+            addEntry(entries, level + 1, (key << 3) | i, nodeData + bytesRead);
+            bytesRead += BYTES_PER_COLOR;
+        }
+    }
+    unsigned char childMask = *(nodeData + bytesRead);
+    bytesRead += sizeof(childMask);
+
+    for (int childIndex = 0; bytesLeftToRead - bytesRead > 0 && childIndex < NUMBER_OF_CHILDREN; childIndex++) {
+        if (oneAtBit(childMask, childIndex)) {
+            if (level + 1 > LinearVoxelTree::MAX_DEPTH) {
+                return -1;
+            }
+            uint64_t childKey = (key << 3) | childIndex;
+            addEntry(entries, level + 1, childKey, NULL);
+            int childBytesRead = readLinearNodeData(entries, level + 1, childKey, nodeData + bytesRead,
+                                                    bytesLeftToRead - bytesRead);
+            if (childBytesRead < 0) {
+                return -1;
+            }
+            bytesRead += childBytesRead;
+        }
+    }
+    return bytesRead;
+}
+
+bool LinearVoxelTree::readFromSVOFile(const char* filename) {
+    std::ifstream file(filename, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    qDebug("loading file %s...\n", filename);
+    unsigned long fileLength = file.tellg();
+    file.seekg(0, std::ios::beg);
+    unsigned char* entireFile = new unsigned char[fileLength];
+    file.read((char*)entireFile, fileLength);
+    file.close();
+
+    // collect every node the file mentions, in file order, then sort them into levels
+    std::vector<LinearVoxelEntry> entries;
+    addEntry(entries, 0, 0, NULL);
+    bool tooDeep = false;
+    unsigned long bytesRead = 0;
+    while (bytesRead < fileLength && !tooDeep) {
+        unsigned char* octalCode = entireFile + bytesRead;
+        int sections = numberOfThreeBitSectionsInCode(octalCode);
+        if (sections > MAX_DEPTH) {
+            tooDeep = true;
+            break;
+        }
+        // the nodes down to the start of each chunk are created if they're missing, like createMissingNode() does
+        uint64_t key = 0;
+        for (int section = 0; section < sections; section++) {
+            key = (key << 3) | getOctalCodeSectionValue(octalCode, section);
+            addEntry(entries, section + 1, key, NULL);
+        }
+        int octalCodeBytes = bytesRequiredForCodeLength(sections);
+        int nodeBytesRead = readLinearNodeData(entries, sections, key, octalCode + octalCodeBytes,
+                                               fileLength - (bytesRead + octalCodeBytes));
+        if (nodeBytesRead < 0) {
+            tooDeep = true;
+            break;
+        }
+        bytesRead += octalCodeBytes + nodeBytesRead;
+    }
+    delete[] entireFile;
+    if (tooDeep) {
+        qDebug("LinearVoxelTree::readFromSVOFile() %s is deeper than %d levels, not loading it\n", filename, MAX_DEPTH);
+        return false;
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    clear();
+    _rootCode = new unsigned char[1];
+    *_rootCode = 0;
+    for (uint32_t i = 0; i < entries.size(); ) {
+        const LinearVoxelEntry& first = entries[i];
+        if (first.level == (int)_levels.size()) {
+            _levels.push_back(Level());
+        }
+        Level& level = _levels.back();
+
+        // later colors win, with the same rule as VoxelNode::setColor(), which only takes colors that change the rgb
+        unsigned char color[4] = { 0, 0, 0, 0 };
+        uint32_t duplicate = i;
+        for (; duplicate < entries.size() && entries[duplicate].level == first.level &&
+               entries[duplicate].key == first.key; duplicate++) {
+            const LinearVoxelEntry& entry = entries[duplicate];
+            if (entry.hasColor && memcmp(color, entry.color, BYTES_PER_COLOR) != 0) {
+                memcpy(color, entry.color, sizeof(color));
+            }
+        }
+        level.keys.push_back(first.key);
+        level.colors.insert(level.colors.end(), color, color + sizeof(color));
+        i = duplicate;
+    }
+
+    // link each level to the next one down, children are next to each other because their keys share the parent's prefix
+    for (uint32_t levelIndex = 0; levelIndex < _levels.size(); levelIndex++) {
+        Level& level = _levels[levelIndex];
+        level.childMasks.assign(level.keys.size(), 0);
+        level.firstChild.assign(level.keys.size(), 0);
+        if (levelIndex + 1 == _levels.size()) {
+            continue;
+        }
+        const std::vector<uint64_t>& childKeys = _levels[levelIndex + 1].keys;
+        uint32_t child = 0;
+        for (uint32_t i = 0; i < level.keys.size(); i++) {
+            level.firstChild[i] = child;
+            while (child < childKeys.size() && (childKeys[child] >> 3) == level.keys[i]) {
+                level.childMasks[i] |= (1 << (childKeys[child] & 7));
+                child++;
+            }
+        }
+    }
+    return true;
+}
+
+unsigned long LinearVoxelTree::getNodeCount() const {
+    unsigned long nodeCount = 0;
+    for (uint32_t i = 0; i < _levels.size(); i++) {
+        nodeCount += _levels[i].keys.size();
+    }
+    return nodeCount;
+}
+
+unsigned long LinearVoxelTree::getMemoryUsage() const {
+    unsigned long memoryUsage = 0;
+    for (uint32_t i = 0; i < _levels.size(); i++) {
+        const Level& level = _levels[i];
+        memoryUsage += level.keys.capacity() * sizeof(uint64_t) + level.colors.capacity() +
+            level.childMasks.capacity() + level.firstChild.capacity() * sizeof(uint32_t);
+    }
+    return memoryUsage;
+}
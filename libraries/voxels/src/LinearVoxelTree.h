@@ -0,0 +1,91 @@
+//
+//  LinearVoxelTree.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Packed, pointer free storage for a read-mostly region of a voxel tree. Each level of the region is a set of parallel
+//  arrays sorted by Morton key (the child indexes from the region root down to the node, three bits per level, which is
+//  the same thing as the node's octal code below the region root), holding each node's color, child mask and the
+//  position of its first child in the next level down. Whole region scans walk the arrays front to back, and the
+//  encoder and SVO persistence work straight from them without any VoxelNodes.
+//
+//  To edit a region, expand it back into a VoxelTree with expandInto() and build() it again afterwards.
+//
+
+#ifndef __hifi__LinearVoxelTree__
+#define __hifi__LinearVoxelTree__
+
+#include <stdint.h>
+#include <vector>
+
+#include "VoxelNode.h"
+
+class LinearVoxelTree {
+public:
+    // three bits per level have to fit in a 64 bit key
+    static const int MAX_DEPTH = 21;
+
+    /// a node in the packed storage, used the way VoxelNodeBag holds VoxelNodes for the encoder
+    class NodeRef {
+    public:
+        int         level;
+        uint32_t    index;
+        NodeRef(int level = 0, uint32_t index = 0) : level(level), index(index) { };
+    };
+
+    LinearVoxelTree();
+    ~LinearVoxelTree();
+
+    /// packs the subtree below regionRoot, returns false (and stays empty) if the region is deeper than MAX_DEPTH
+    bool build(VoxelNode* regionRoot);
+
+    /// adds the packed voxels below destinationNode, which should be at the same place as the region root
+    void expandInto(VoxelNode* destinationNode) const;
+
+    void clear();
+    bool isEmpty() const { return _levels.empty(); }
+
+    /// looks up the voxel at a position and size in voxel units like VoxelTree::getVoxelAt(), returns false if there
+    /// is no such voxel in the region
+    bool getVoxelAt(float x, float y, float z, float s, nodeColor& color) const;
+
+    /// Encodes the node in the same bitstream format as VoxelTree::encodeTreeBitstream() produces with color, without
+    /// exists bits and without a view frustum. Subtrees that don't fit are added to bag, to be encoded next.
+    int encodeTreeBitstream(const NodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                            std::vector<NodeRef>& bag) const;
+
+    /// these read and write the same files as VoxelTree, without going through VoxelNodes. Only whole trees (a region
+    /// rooted at the root of the tree) can be read.
+    void writeToSVOFile(const char* filename) const;
+    bool readFromSVOFile(const char* filename);
+
+    int getDepth() const { return _levels.size(); }
+    unsigned long getNodeCount() const;
+    unsigned long getNodeCount(int level) const { return _levels[level].keys.size(); }
+    uint64_t getKey(int level, uint32_t index) const { return _levels[level].keys[index]; }
+    const unsigned char* getColor(int level, uint32_t index) const { return &_levels[level].colors[index * 4]; }
+    unsigned char getChildMask(int level, uint32_t index) const { return _levels[level].childMasks[index]; }
+    unsigned long getMemoryUsage() const;
+
+private:
+    // disallow copying of LinearVoxelTree objects
+    LinearVoxelTree(const LinearVoxelTree&);
+    LinearVoxelTree& operator= (const LinearVoxelTree&);
+
+    struct Level {
+        std::vector<uint64_t>       keys;
+        std::vector<unsigned char>  colors;      // four bytes per node, laid out like nodeColor
+        std::vector<unsigned char>  childMasks;  // bit i set if the node has a child at index i
+        std::vector<uint32_t>       firstChild;  // index in the next level of the node's first child
+    };
+
+    int encodeTreeBitstreamRecursion(const NodeRef& node, unsigned char* outputBuffer, int availableBytes,
+                                     std::vector<NodeRef>& bag) const;
+    int writeOctalCode(const NodeRef& node, unsigned char* outputBuffer) const;
+
+    std::vector<Level>  _levels;
+    unsigned char*      _rootCode;
+};
+
+#endif /* defined(__hifi__LinearVoxelTree__) */
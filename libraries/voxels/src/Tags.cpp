@@ -6,6 +6,9 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <iostream>
 
 #include <zconf.h>
@@ -13,103 +16,176 @@
 
 #include "Tags.h"
 
-Tag::Tag(int tagId, std::stringstream &ss) : _tagId(tagId) {
-    int size = ss.get() << 8 | ss.get();
+// compressed bytes are read this many at a time
+const int INFLATE_CHUNK_SIZE = 65536;
 
-    _name.clear();
-    for (int i = 0; i < size; ++i) {        _name += ss.get();
+// gzip ends with the size of the uncompressed data, which is the most deflate can expand to from the file size
+const int GZIP_SIZE_TRAILER_BYTES = 4;
+const int MAX_DEFLATE_RATIO = 1032;
+
+TagReader::TagReader(const unsigned char* data, int size) :
+    _position(data),
+    _end(data + size),
+    _nextTagUnnamed(false),
+    _failed(false)
+{
+}
+
+int TagReader::getByte() {
+    if (_position == _end) {
+        _failed = true;
+        return 0;
+    }
+    return *_position++;
+}
+
+int TagReader::getShort() {
+    int high = getByte();
+    return high << 8 | getByte();
+}
+
+int32_t TagReader::getInt() {
+    int32_t high = getShort();
+    return high << 16 | getShort();
+}
+
+int64_t TagReader::getLong() {
+    int64_t high = (uint32_t)getInt();
+    return high << 32 | (uint32_t)getInt();
+}
+
+const unsigned char* TagReader::skip(int bytes) {
+    if (bytes < 0 || bytes > _end - _position) {
+        fail();
+        return NULL;
     }
+    const unsigned char* start = _position;
+    _position += bytes;
+    return start;
 }
 
-Tag* Tag::readTag(int tagId, std::stringstream &ss) {
+void TagReader::fail() {
+    _position = _end;
+    _failed = true;
+}
+
+bool TagReader::takeNextTagUnnamed() {
+    bool unnamed = _nextTagUnnamed;
+    _nextTagUnnamed = false;
+    return unnamed;
+}
+
+Tag::Tag(int tagId, TagReader& reader) : _tagId(tagId) {
+    if (reader.takeNextTagUnnamed()) {
+        return;
+    }
+    int size = reader.getShort();
+    const unsigned char* name = reader.skip(size);
+    if (name) {
+        _name.assign((const char*)name, size);
+    }
+}
+
+Tag* Tag::readTag(int tagId, TagReader& reader) {
 
     switch (tagId) {
     case TAG_Byte:
-        return new TagByte(ss);
+        return new TagByte(reader);
     case TAG_Short:
-        return new TagShort(ss);
+        return new TagShort(reader);
     case TAG_Int:
-        return new TagInt(ss);
+        return new TagInt(reader);
     case TAG_Long:
-        return new TagLong(ss);
+        return new TagLong(reader);
     case TAG_Float:
-        return new TagFloat(ss);
+        return new TagFloat(reader);
     case TAG_Double:
-        return new TagDouble(ss);
+        return new TagDouble(reader);
     case TAG_Byte_Array:
-        return new TagByteArray(ss);
+        return new TagByteArray(reader);
     case TAG_String:
-        return new TagString(ss);
+        return new TagString(reader);
     case TAG_List:
-        return new TagList(ss);
+        return new TagList(reader);
     case TAG_Compound:
-        return new TagCompound(ss);
+        return new TagCompound(reader);
     case TAG_Int_Array:
-        return new TagIntArray(ss);
+        return new TagIntArray(reader);
     default:
         return NULL;
     }
 }
 
-TagByte::TagByte(std::stringstream &ss) : Tag(TAG_Byte, ss) {
-    _data = ss.get();
+TagByte::TagByte(TagReader& reader) : Tag(TAG_Byte, reader) {
+    _data = reader.getByte();
 }
 
-TagShort::TagShort(std::stringstream &ss) : Tag(TAG_Short, ss) {
-    _data = ss.get() << 8 | ss.get();
+TagShort::TagShort(TagReader& reader) : Tag(TAG_Short, reader) {
+    _data = reader.getShort();
 }
 
-TagInt::TagInt(std::stringstream &ss) : Tag(TAG_Int, ss) {
-    _data = ss.get() << 24 | ss.get() << 16 | ss.get() << 8 | ss.get();
+TagInt::TagInt(TagReader& reader) : Tag(TAG_Int, reader) {
+    _data = reader.getInt();
 }
 
-TagLong::TagLong(std::stringstream &ss) : Tag(TAG_Long, ss) {
-    _data = (((int64_t) ss.get()) << 56 | ((int64_t) ss.get()) << 48
-             |((int64_t) ss.get()) << 40 | ((int64_t) ss.get()) << 32
-             |           ss.get()  << 24 |            ss.get()  << 16
-             |           ss.get()  << 8  |            ss.get());
+TagLong::TagLong(TagReader& reader) : Tag(TAG_Long, reader) {
+    _data = reader.getLong();
 }
 
 // We don't need Float and double, so we just ignore the bytes
-TagFloat::TagFloat(std::stringstream &ss) : Tag(TAG_Float, ss) {
-    ss.seekg(4, ss.cur);
+TagFloat::TagFloat(TagReader& reader) : Tag(TAG_Float, reader) {
+    reader.skip(sizeof(float));
 }
 
-TagDouble::TagDouble(std::stringstream &ss) : Tag(TAG_Double, ss) {
-    ss.seekg(8, ss.cur);
+TagDouble::TagDouble(TagReader& reader) : Tag(TAG_Double, reader) {
+    reader.skip(sizeof(double));
 }
 
-TagByteArray::TagByteArray(std::stringstream &ss) : Tag(TAG_Byte_Array, ss) {
-    _size = ss.get() << 24 | ss.get() << 16 | ss.get() << 8 | ss.get();
-
-    _data = new char[_size];
-    for (int i = 0; i < _size; ++i) {
-        _data[i] = ss.get();
+TagByteArray::TagByteArray(TagReader& reader) : Tag(TAG_Byte_Array, reader) {
+    _size = reader.getInt();
+    _data = (const char*)reader.skip(_size);
+    if (!_data) {
+        _size = 0;
     }
 }
 
-TagString::TagString(std::stringstream &ss) : Tag(TAG_String, ss) {
-    _size = ss.get() << 8 | ss.get();
-
-    for (int i = 0; i < _size; ++i) {
-        _data += ss.get();
+TagString::TagString(TagReader& reader) : Tag(TAG_String, reader) {
+    _size = reader.getShort();
+    const unsigned char* data = reader.skip(_size);
+    if (data) {
+        _data.assign((const char*)data, _size);
+    } else {
+        _size = 0;
     }
 }
 
-TagList::TagList(std::stringstream &ss) :
-    Tag(TAG_List, ss) {
-    _tagId = ss.get();
-    _size  = ss.get() << 24 | ss.get() << 16 | ss.get() << 8 | ss.get();
+TagList::TagList(TagReader& reader) :
+    Tag(TAG_List, reader),
+    _size(0) {
+    _tagId = reader.getByte();
+    int size = reader.getInt();
+
+    for (int i = 0; i < size && !reader.hasFailed(); ++i) {
+        reader.setNextTagUnnamed();
+        Tag* tag = readTag(_tagId, reader);
+        if (!tag) {
+            // there's no telling where the next tag starts
+            reader.fail();
+            break;
+        }
+        _data.push_back(tag);
+        ++_size;
+    }
+}
 
-    for (int i = 0; i < _size; ++i) {
-        ss.putback(0);
-        ss.putback(0);
-        _data.push_back(readTag(_tagId, ss));
+TagList::~TagList() {
+    for (std::list<Tag*>::iterator it = _data.begin(); it != _data.end(); it++) {
+        delete *it;
     }
 }
 
-TagCompound::TagCompound(std::stringstream &ss) :
-    Tag(TAG_Compound, ss),
+TagCompound::TagCompound(TagReader& reader) :
+    Tag(TAG_Compound, reader),
     _size(0),
     _width(0),
     _length(0),
@@ -118,54 +194,84 @@ TagCompound::TagCompound(std::stringstream &ss) :
     _blocksId(NULL)
 {
     int tagId;
+    const TagByteArray* blocksId = NULL;
+    const TagByteArray* blocksData = NULL;
 
-    while (TAG_End != (tagId = ss.get())) {
-        _data.push_back(readTag(tagId, ss));
+    while (TAG_End != (tagId = reader.getByte())) {
+        Tag* tag = readTag(tagId, reader);
+        if (NULL == tag) {
+            reader.fail();
+            return;
+        }
+        _data.push_back(tag);
         ++_size;
 
-        if (NULL == _data.back()) {
-            _blocksId   = NULL;
-            _blocksData = NULL;
-            return;
-        } else if (TAG_Short == tagId) {
-            if        ("Width"  == _data.back()->getName()) {
-                _width  = ((TagShort*) _data.back())->getData();
-            } else if ("Height" == _data.back()->getName()) {
-                _height = ((TagShort*) _data.back())->getData();
-            } else if ("Length" == _data.back()->getName()) {
-                _length = ((TagShort*) _data.back())->getData();
+        if (TAG_Short == tagId) {
+            if        ("Width"  == tag->getName()) {
+                _width  = ((TagShort*) tag)->getData();
+            } else if ("Height" == tag->getName()) {
+                _height = ((TagShort*) tag)->getData();
+            } else if ("Length" == tag->getName()) {
+                _length = ((TagShort*) tag)->getData();
             }
         } else if (TAG_Byte_Array == tagId) {
-            if        ("Blocks"  == _data.back()->getName()) {
-                _blocksId   = ((TagByteArray*) _data.back())->getData();
-            } else if ("Data"    == _data.back()->getName()) {
-                _blocksData = ((TagByteArray*) _data.back())->getData();
+            if        ("Blocks"  == tag->getName()) {
+                blocksId   = (TagByteArray*) tag;
+            } else if ("Data"    == tag->getName()) {
+                blocksData = (TagByteArray*) tag;
             }
         }
     }
+
+    // the blocks are only any use if there's one for every place in the schematic
+    if (reader.hasFailed() || _width < 0 || _height < 0 || _length < 0) {
+        return;
+    }
+    int64_t blockCount = (int64_t)_width * _height * _length;
+    if (blocksId && blocksId->getSize() >= blockCount) {
+        _blocksId = blocksId->getData();
+    }
+    if (blocksData && blocksData->getSize() >= blockCount) {
+        _blocksData = blocksData->getData();
+    }
 }
 
-TagIntArray::TagIntArray(std::stringstream &ss) : Tag(TAG_Int_Array, ss) {
-    _size = ss.get() << 24 | ss.get() << 16 | ss.get() << 8 | ss.get();
+TagCompound::~TagCompound() {
+    for (std::list<Tag*>::iterator it = _data.begin(); it != _data.end(); it++) {
+        delete *it;
+    }
+}
 
-    _data = new int[_size];
-    for (int i = 0; i < _size; ++i) {
-        _data[i] = ss.get();
+TagIntArray::TagIntArray(TagReader& reader) : Tag(TAG_Int_Array, reader) {
+    _size = reader.getInt();
+    _data = reader.skip((_size >= 0 && _size <= INT_MAX / (int)sizeof(int32_t)) ? _size * (int)sizeof(int32_t) : -1);
+    if (!_data) {
+        _size = 0;
     }
 }
 
-int retrieveData(std::string filename, std::stringstream &ss) {
+int32_t TagIntArray::getData(int index) const {
+    const unsigned char* value = _data + index * sizeof(int32_t);
+    return (int32_t)((uint32_t)value[0] << 24 | (uint32_t)value[1] << 16 | (uint32_t)value[2] << 8 | value[3]);
+}
+
+int retrieveData(std::string filename, std::vector<unsigned char>& data) {
     std::ifstream file(filename.c_str(), std::ios::binary);
+    data.clear();
 
     int type = file.peek();
-    if (type == 0x0A) {
-        ss.flush();
-        ss << file;
-        return 0;
+    if (type == TAG_Compound) {
+        file.seekg(0, std::ios::end);
+        data.resize(file.tellg());
+        file.seekg(0, std::ios::beg);
+        if (!data.empty()) {
+            file.read((char*)&data[0], data.size());
+        }
+        return file ? 0 : 1;
     }
 
     if (type == 0x1F) {
-        int ret = ungzip(file, ss);
+        int ret = ungzip(file, data);
         return ret;
     }
 
@@ -173,75 +279,51 @@ int retrieveData(std::string filename, std::stringstream &ss) {
     return 1;
 }
 
-int ungzip(std::ifstream &file, std::stringstream &ss) {
-    std::string gzipedBytes;
-    gzipedBytes.clear();
-    ss.flush();
-
-    while (!file.eof()) {
-        gzipedBytes += (char) file.get();
+// Inflates the file a chunk at a time, straight into data, which is sized from the gzip trailer up front.
+int ungzip(std::ifstream& file, std::vector<unsigned char>& data) {
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+    if (fileSize >= GZIP_SIZE_TRAILER_BYTES) {
+        unsigned char trailer[GZIP_SIZE_TRAILER_BYTES];
+        file.seekg(-GZIP_SIZE_TRAILER_BYTES, std::ios::end);
+        file.read((char*)trailer, GZIP_SIZE_TRAILER_BYTES);
+        uint32_t uncompressedSize = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+        data.reserve(std::min((uint64_t)uncompressedSize, (uint64_t)fileSize * MAX_DEFLATE_RATIO));
     }
-    file.close();
-
-    if (gzipedBytes.size() == 0) {
-        ss << gzipedBytes;
-        return 0;
-    }
-
-    unsigned int full_length  = gzipedBytes.size();
-    unsigned int half_length  = gzipedBytes.size()/2;
-    unsigned int uncompLength = full_length;
-
-    char* uncomp = (char*) calloc(sizeof(char), uncompLength);
+    file.clear();
+    file.seekg(0, std::ios::beg);
 
     z_stream strm;
-    strm.next_in   = (Bytef *) gzipedBytes.c_str();
-    strm.avail_in  = full_length;
-    strm.total_out = 0;
-    strm.zalloc    = Z_NULL;
-    strm.zfree     = Z_NULL;
-
-    bool done = false;
-
+    memset(&strm, 0, sizeof(strm));
     if (inflateInit2(&strm, (16 + MAX_WBITS)) != Z_OK) {
-        free(uncomp);
         return 1;
     }
 
-    while (!done) {
-        // If our output buffer is too small
-        if (strm.total_out >= uncompLength) {
-            // Increase size of output buffer
-            char* uncomp2 = (char*) calloc(sizeof(char), uncompLength + half_length);
-            memcpy(uncomp2, uncomp, uncompLength);
-            uncompLength += half_length;
-            free(uncomp);
-            uncomp = uncomp2;
+    std::vector<unsigned char> input(INFLATE_CHUNK_SIZE);
+    size_t length = 0;
+    int err = Z_OK;
+    while (err == Z_OK) {
+        if (strm.avail_in == 0) {
+            file.read((char*)&input[0], input.size());
+            strm.next_in  = &input[0];
+            strm.avail_in = file.gcount();
+            if (strm.avail_in == 0) {
+                break; // the file ended before the stream did
+            }
         }
-
-        strm.next_out  = (Bytef *) (uncomp + strm.total_out);
-        strm.avail_out = uncompLength - strm.total_out;
-
-        // Inflate another chunk.
-        int err = inflate (&strm, Z_SYNC_FLUSH);
-        if (err == Z_STREAM_END) {
-            done = true;
-        } else if (err != Z_OK) {
-            break;
+        if (length == data.size()) {
+            data.resize(std::max(data.capacity(), length + INFLATE_CHUNK_SIZE));
         }
-    }
-
-    if (inflateEnd (&strm) != Z_OK) {
-        free(uncomp);
-        return 1;
-    }
+        strm.next_out  = &data[length];
+        strm.avail_out = data.size() - length;
 
-    for (size_t i = 0; i < strm.total_out; ++i) {
-        ss << uncomp[i];
+        err = inflate(&strm, Z_NO_FLUSH);
+        length = data.size() - strm.avail_out;
     }
-    free(uncomp);
+    inflateEnd(&strm);
+    data.resize(length);
 
-    return 0;
+    return (err == Z_STREAM_END) ? 0 : 1;
 }
 
 
@@ -9,12 +9,12 @@
 #ifndef __hifi__Tags__
 #define __hifi__Tags__
 
-#include <cstdlib>
-#include <cstring>
+#include <stdint.h>
 
 #include <fstream>
-#include <sstream>
 #include <list>
+#include <string>
+#include <vector>
 
 #define TAG_End        0
 #define TAG_Byte       1
@@ -29,18 +29,49 @@
 #define TAG_Compound  10
 #define TAG_Int_Array 11
 
-int  retrieveData(std::string filename, std::stringstream &ss);
-int  ungzip(std::ifstream &file, std::stringstream &ss);
+/// reads a schematic file into data, inflating it if it's gzipped, returns 0 on success
+int  retrieveData(std::string filename, std::vector<unsigned char>& data);
+int  ungzip(std::ifstream& file, std::vector<unsigned char>& data);
 void computeBlockColor(int id, int data, int& r, int& g, int& b, int& create);
 
+/// Reads NBT values from a decompressed buffer in place. Reading past the end of the buffer gives zeros and marks the
+/// reader as failed, rather than reading outside it.
+class TagReader {
+public:
+    TagReader(const unsigned char* data, int size);
+
+    int         getByte();
+    int         getShort();
+    int32_t     getInt();
+    int64_t     getLong();
+
+    /// skips over bytes, returning where they start, or NULL if there aren't that many left
+    const unsigned char* skip(int bytes);
+
+    /// the tags of a list don't have names
+    void        setNextTagUnnamed() { _nextTagUnnamed = true; }
+    bool        takeNextTagUnnamed();
+
+    /// stops reading, for when the data doesn't make sense
+    void        fail();
+    bool        hasFailed() const { return _failed; }
+
+private:
+    const unsigned char*    _position;
+    const unsigned char*    _end;
+    bool                    _nextTagUnnamed;
+    bool                    _failed;
+};
+
 class Tag {
 public:
-    Tag(int tagId, std::stringstream &ss);
+    Tag(int tagId, TagReader& reader);
+    virtual ~Tag() { }
 
     int         getTagId() const {return _tagId;}
     std::string getName () const {return _name; }
 
-    static Tag* readTag(int tagId, std::stringstream &ss);
+    static Tag* readTag(int tagId, TagReader& reader);
 
 protected:
     int         _tagId;
@@ -49,7 +80,7 @@ protected:
 
 class TagByte : public Tag  {
 public:
-    TagByte(std::stringstream &ss);
+    TagByte(TagReader& reader);
 
     int8_t getData() const {return _data;}
 
@@ -59,7 +90,7 @@ private:
 
 class TagShort : public Tag  {
 public:
-    TagShort(std::stringstream &ss);
+    TagShort(TagReader& reader);
 
     int16_t getData() const {return _data;}
 
@@ -69,7 +100,7 @@ private:
 
 class TagInt : public Tag  {
 public:
-    TagInt(std::stringstream &ss);
+    TagInt(TagReader& reader);
 
     int32_t getData() const {return _data;}
 
@@ -79,7 +110,7 @@ private:
 
 class TagLong : public Tag  {
 public:
-    TagLong(std::stringstream &ss);
+    TagLong(TagReader& reader);
 
     int64_t getData() const {return _data;}
 
@@ -89,29 +120,30 @@ private:
 
 class TagFloat : public Tag  {
 public:
-    TagFloat(std::stringstream &ss);
+    TagFloat(TagReader& reader);
 };
 
 class TagDouble : public Tag  {
 public:
-    TagDouble(std::stringstream &ss);
+    TagDouble(TagReader& reader);
 };
 
+/// the bytes stay in the buffer the tag was read from, and are only valid as long as it is
 class TagByteArray : public Tag {
 public:
-    TagByteArray(std::stringstream &ss);
+    TagByteArray(TagReader& reader);
 
-    int   getSize() const {return _size;}
-    char* getData() const {return _data;}
+    int         getSize() const {return _size;}
+    const char* getData() const {return _data;}
 
 private:
-    int   _size;
-    char* _data;
+    int         _size;
+    const char* _data;
 };
 
 class TagString : public Tag {
 public:
-    TagString(std::stringstream &ss);
+    TagString(TagReader& reader);
 
     int         getSize() const {return _size;}
     std::string getData() const {return _data;}
@@ -123,11 +155,12 @@ private:
 
 class TagList : public Tag {
 public:
-    TagList(std::stringstream &ss);
+    TagList(TagReader& reader);
+    ~TagList();
 
-    int             getTagId() const {return _tagId;}
-    int             getSize () const {return _size; }
-    std::list<Tag*> getData () const {return _data; }
+    int                     getTagId() const {return _tagId;}
+    int                     getSize () const {return _size; }
+    const std::list<Tag*>&  getData () const {return _data; }
 
 private:
     int             _tagId;
@@ -137,40 +170,43 @@ private:
 
 class TagCompound : public Tag {
 public:
-    TagCompound(std::stringstream &ss);
+    TagCompound(TagReader& reader);
+    ~TagCompound();
+
+    int                     getSize      () const {return _size;      }
+    const std::list<Tag*>&  getData      () const {return _data;      }
 
-    int             getSize      () const {return _size;      }
-    std::list<Tag*> getData      () const {return _data;      }
+    int                     getWidth     () const {return _width;     }
+    int                     getLength    () const {return _length;    }
+    int                     getHeight    () const {return _height;    }
 
-    int             getWidth     () const {return _width;     }
-    int             getLength    () const {return _length;    }
-    int             getHeight    () const {return _height;    }
-    char*           getBlocksId  () const {return _blocksId;  }
-    char*           getBlocksData() const {return _blocksData;}
+    /// the block arrays, in the buffer the schematic was read from, or NULL if there aren't width * length * height of them
+    const char*             getBlocksId  () const {return _blocksId;  }
+    const char*             getBlocksData() const {return _blocksData;}
 
 private:
     int             _size;
     std::list<Tag*> _data;
 
     // Specific to schematics file
-    int   _width;
-    int   _length;
-    int   _height;
-    char* _blocksData;
-    char* _blocksId;
+    int         _width;
+    int         _length;
+    int         _height;
+    const char* _blocksData;
+    const char* _blocksId;
 };
 
+/// the ints stay in the buffer the tag was read from, big endian, and are only valid as long as it is
 class TagIntArray : public Tag {
 public:
-    TagIntArray(std::stringstream &ss);
-    ~TagIntArray() {delete _data;}
+    TagIntArray(TagReader& reader);
 
-    int  getSize() const {return _size;}
-    int* getData() const {return _data;}
+    int     getSize() const {return _size;}
+    int32_t getData(int index) const;
 
 private:
-    int  _size;
-    int* _data;
+    int                     _size;
+    const unsigned char*    _data;
 };
 
 #endif /* defined(__hifi__Tags__) */
@@ -0,0 +1,175 @@
+//
+//  VoxelColorCoding.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+
+#include "VoxelColorCoding.h"
+
+const int BYTES_PER_CODED_COLOR = 3;
+const int MIN_COLOR_DELTA = -8;
+const int MAX_COLOR_DELTA = 7;
+const int MODE_SHIFT = 4;
+const int PALETTE_SIZE_MASK = 0x0F;
+
+static int paletteIndexBits(int paletteSize) {
+    return paletteSize <= 1 ? 0 : (paletteSize <= 2 ? 1 : 2);
+}
+
+static int bitsToBytes(int bits) {
+    return (bits + 7) / 8;
+}
+
+int encodeChildColors(const unsigned char colors[][3], int colorCount, const unsigned char* referenceColor,
+                      unsigned char* output) {
+
+    // work out which of the codings apply
+    bool allReference = referenceColor != NULL;
+    bool deltasFit = referenceColor != NULL;
+    unsigned char palette[MAX_COLOR_CODING_PALETTE_SIZE][3];
+    unsigned char paletteIndexes[8];
+    int paletteSize = 0;
+
+    for (int i = 0; i < colorCount; i++) {
+        for (int component = 0; component < BYTES_PER_CODED_COLOR && referenceColor; component++) {
+            int delta = colors[i][component] - referenceColor[component];
+            allReference = allReference && delta == 0;
+            deltasFit = deltasFit && delta >= MIN_COLOR_DELTA && delta <= MAX_COLOR_DELTA;
+        }
+        if (paletteSize >= 0) {
+            int index = 0;
+            while (index < paletteSize && memcmp(palette[index], colors[i], BYTES_PER_CODED_COLOR) != 0) {
+                index++;
+            }
+            if (index == paletteSize) {
+                if (paletteSize == MAX_COLOR_CODING_PALETTE_SIZE) {
+                    paletteSize = -1; // too many colors for a palette
+                    continue;
+                }
+                memcpy(palette[paletteSize++], colors[i], BYTES_PER_CODED_COLOR);
+            }
+            paletteIndexes[i] = index;
+        }
+    }
+
+    // and pick the smallest of them, the plain colors are always an option
+    int mode = COLOR_CODING_RGB;
+    int bytes = colorCount * BYTES_PER_CODED_COLOR;
+    if (allReference) {
+        mode = COLOR_CODING_REFERENCE;
+        bytes = 0;
+    }
+    int deltaBytes = bitsToBytes(colorCount * BYTES_PER_CODED_COLOR * 4);
+    if (deltasFit && deltaBytes < bytes) {
+        mode = COLOR_CODING_DELTA;
+        bytes = deltaBytes;
+    }
+    int paletteBytes = paletteSize * BYTES_PER_CODED_COLOR + bitsToBytes(colorCount * paletteIndexBits(paletteSize));
+    if (paletteSize > 0 && paletteBytes < bytes) {
+        mode = COLOR_CODING_PALETTE;
+        bytes = paletteBytes;
+    }
+
+    unsigned char* outputAt = output;
+    *outputAt++ = (mode << MODE_SHIFT) | (mode == COLOR_CODING_PALETTE ? paletteSize - 1 : 0);
+    switch (mode) {
+        case COLOR_CODING_RGB:
+            memcpy(outputAt, colors, colorCount * BYTES_PER_CODED_COLOR);
+            break;
+
+        case COLOR_CODING_DELTA:
+            memset(outputAt, 0, bytes);
+            for (int nibble = 0; nibble < colorCount * BYTES_PER_CODED_COLOR; nibble++) {
+                int component = nibble % BYTES_PER_CODED_COLOR;
+                int delta = colors[nibble / BYTES_PER_CODED_COLOR][component] - referenceColor[component];
+                outputAt[nibble / 2] |= (delta & 0x0F) << ((nibble % 2) ? 0 : 4);
+            }
+            break;
+
+        case COLOR_CODING_PALETTE: {
+            memcpy(outputAt, palette, paletteSize * BYTES_PER_CODED_COLOR);
+            unsigned char* indexesAt = outputAt + paletteSize * BYTES_PER_CODED_COLOR;
+            int indexBits = paletteIndexBits(paletteSize);
+            memset(indexesAt, 0, bitsToBytes(colorCount * indexBits));
+            for (int i = 0; indexBits && i < colorCount; i++) {
+                int bit = i * indexBits;
+                indexesAt[bit / 8] |= paletteIndexes[i] << (8 - indexBits - (bit % 8));
+            }
+            break;
+        }
+    }
+    return 1 + bytes;
+}
+
+int decodeChildColors(const unsigned char* input, int bytesLeftToRead, int colorCount,
+                      const unsigned char* referenceColor, unsigned char colors[][3]) {
+    if (bytesLeftToRead < 1) {
+        return 0;
+    }
+    int mode = *input >> MODE_SHIFT;
+    const unsigned char* inputAt = input + 1;
+    int bytes;
+    switch (mode) {
+        case COLOR_CODING_RGB:
+            bytes = colorCount * BYTES_PER_CODED_COLOR;
+            if (bytes >= bytesLeftToRead) {
+                return 0;
+            }
+            memcpy(colors, inputAt, bytes);
+            break;
+
+        case COLOR_CODING_REFERENCE:
+            if (!referenceColor) {
+                return 0;
+            }
+            bytes = 0;
+            for (int i = 0; i < colorCount; i++) {
+                memcpy(colors[i], referenceColor, BYTES_PER_CODED_COLOR);
+            }
+            break;
+
+        case COLOR_CODING_DELTA:
+            bytes = bitsToBytes(colorCount * BYTES_PER_CODED_COLOR * 4);
+            if (!referenceColor || bytes >= bytesLeftToRead) {
+                return 0;
+            }
+            for (int nibble = 0; nibble < colorCount * BYTES_PER_CODED_COLOR; nibble++) {
+                int component = nibble % BYTES_PER_CODED_COLOR;
+                int delta = (inputAt[nibble / 2] >> ((nibble % 2) ? 0 : 4)) & 0x0F;
+                if (delta > MAX_COLOR_DELTA) {
+                    delta -= 16; // sign extend
+                }
+                colors[nibble / BYTES_PER_CODED_COLOR][component] = referenceColor[component] + delta;
+            }
+            break;
+
+        case COLOR_CODING_PALETTE: {
+            int paletteSize = (*input & PALETTE_SIZE_MASK) + 1;
+            int indexBits = paletteIndexBits(paletteSize);
+            bytes = paletteSize * BYTES_PER_CODED_COLOR + bitsToBytes(colorCount * indexBits);
+            if (paletteSize > MAX_COLOR_CODING_PALETTE_SIZE || bytes >= bytesLeftToRead) {
+                return 0;
+            }
+            const unsigned char* indexesAt = inputAt + paletteSize * BYTES_PER_CODED_COLOR;
+            for (int i = 0; i < colorCount; i++) {
+                int index = 0;
+                if (indexBits) {
+                    int bit = i * indexBits;
+                    index = (indexesAt[bit / 8] >> (8 - indexBits - (bit % 8))) & ((1 << indexBits) - 1);
+                }
+                if (index >= paletteSize) {
+                    return 0;
+                }
+                memcpy(colors[i], inputAt + index * BYTES_PER_CODED_COLOR, BYTES_PER_CODED_COLOR);
+            }
+            break;
+        }
+
+        default:
+            return 0;
+    }
+    return 1 + bytes;
+}
@@ -0,0 +1,40 @@
+//
+//  VoxelColorCoding.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Compact coding of the colors of a node's children, for the coded color variant of the voxel bitstream. Rather than
+//  3 bytes per child, each node's colored children get a mode byte followed by whichever of these is smallest:
+//
+//      COLOR_CODING_RGB        the colors as they are, 3 bytes each
+//      COLOR_CODING_REFERENCE  nothing, every child has the reference color
+//      COLOR_CODING_DELTA      signed 4 bit differences from the reference color, a nibble per component
+//      COLOR_CODING_PALETTE    up to 4 distinct colors, then a 1 or 2 bit palette index per child
+//
+//  The reference color is the node's own color, which the receiver has just read from the same bitstream, so it's
+//  usually its children's average. Every coding is lossless.
+//
+
+#ifndef __hifi__VoxelColorCoding__
+#define __hifi__VoxelColorCoding__
+
+const int COLOR_CODING_RGB = 0;
+const int COLOR_CODING_REFERENCE = 1;
+const int COLOR_CODING_DELTA = 2;
+const int COLOR_CODING_PALETTE = 3;
+const int MAX_COLOR_CODING_PALETTE_SIZE = 4;
+
+/// the most bytes the colors of a node's children can take, the mode byte and the colors of 8 children
+const int MAX_CODED_CHILD_COLORS_BYTES = 1 + 8 * 3;
+
+/// Codes colorCount 3 byte colors into output, which must hold MAX_CODED_CHILD_COLORS_BYTES. The reference color can be
+/// NULL if the receiver won't have one. Returns the number of bytes written.
+int encodeChildColors(const unsigned char colors[][3], int colorCount, const unsigned char* referenceColor,
+                      unsigned char* output);
+
+/// Reads colors written by encodeChildColors(), returns the number of bytes read, or 0 if the input is bad.
+int decodeChildColors(const unsigned char* input, int bytesLeftToRead, int colorCount,
+                      const unsigned char* referenceColor, unsigned char colors[][3]);
+
+#endif /* defined(__hifi__VoxelColorCoding__) */
@@ -11,6 +11,7 @@
 #ifndef __shared__VoxelEditPacketSender__
 #define __shared__VoxelEditPacketSender__
 
+#include <NodeList.h> // for MAX_PACKET_SIZE
 #include <PacketSender.h>
 #include <SharedUtil.h> // for VoxelDetail
 #include "JurisdictionMap.h"
@@ -0,0 +1,99 @@
+//
+//  VoxelGrid.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <stdint.h>
+
+#include "VoxelConstants.h"
+#include "VoxelGrid.h"
+
+// above the voxels' level, any children but none or all of them marks a mix
+const int MIXED_CELL_CHILDREN = 0x01;
+
+VoxelGrid::VoxelGrid(int level, int width, int height, int length) :
+    _level(level),
+    _dimensions(level + 1),
+    _cells(level + 1)
+{
+    // each level up covers the one below, rounding up
+    for (int i = level; i >= 0; i--) {
+        Dimensions& dimensions = _dimensions[i];
+        if (i == level) {
+            dimensions.width = width;
+            dimensions.height = height;
+            dimensions.length = length;
+        } else {
+            dimensions.width = (_dimensions[i + 1].width + 1) / 2;
+            dimensions.height = (_dimensions[i + 1].height + 1) / 2;
+            dimensions.length = (_dimensions[i + 1].length + 1) / 2;
+        }
+    }
+    _cells[level].resize((size_t)width * height * length, EMPTY_CELL);
+}
+
+uint32_t VoxelGrid::makeCell(int children, unsigned char red, unsigned char green, unsigned char blue) {
+    return (uint32_t)children << 24 | red << 16 | green << 8 | blue;
+}
+
+void VoxelGrid::getCellColor(uint32_t cell, unsigned char* color) {
+    color[0] = (cell >> 16) & 0xFF;
+    color[1] = (cell >> 8) & 0xFF;
+    color[2] = cell & 0xFF;
+}
+
+void VoxelGrid::setVoxel(int x, int y, int z, unsigned char red, unsigned char green, unsigned char blue) {
+    setPartialVoxel(x, y, z, FULL_CELL_CHILDREN, red, green, blue);
+}
+
+void VoxelGrid::setPartialVoxel(int x, int y, int z, int childMask, unsigned char red, unsigned char green,
+                                unsigned char blue) {
+    const Dimensions& dimensions = _dimensions[_level];
+    _cells[_level][((size_t)z * dimensions.height + y) * dimensions.width + x] = makeCell(childMask, red, green, blue);
+}
+
+uint32_t VoxelGrid::getCell(int level, int x, int y, int z) const {
+    const Dimensions& dimensions = _dimensions[level];
+    if (x >= dimensions.width || y >= dimensions.height || z >= dimensions.length || _cells[level].empty()) {
+        return EMPTY_CELL;
+    }
+    return _cells[level][((size_t)z * dimensions.height + y) * dimensions.width + x];
+}
+
+void VoxelGrid::summarize() {
+    for (int level = _level - 1; level >= 0; level--) {
+        const Dimensions& dimensions = _dimensions[level];
+        std::vector<uint32_t>& cells = _cells[level];
+        cells.resize((size_t)dimensions.width * dimensions.height * dimensions.length);
+
+        std::vector<uint32_t>::iterator cell = cells.begin();
+        for (int z = 0; z < dimensions.length; z++) {
+            for (int y = 0; y < dimensions.height; y++) {
+                for (int x = 0; x < dimensions.width; x++) {
+                    bool empty = true;
+                    bool uniform = true;
+                    uint32_t firstChild = getCell(level + 1, x * 2, y * 2, z * 2);
+                    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+                        // the child index bits are x, y, z from high to low, as in octal codes
+                        uint32_t child = getCell(level + 1, x * 2 + ((i >> 2) & 1), y * 2 + ((i >> 1) & 1),
+                                                 z * 2 + (i & 1));
+                        empty = empty && child == EMPTY_CELL;
+                        uniform = uniform && isUniformCell(child) && child == firstChild;
+                    }
+                    *cell++ = empty ? EMPTY_CELL : (uniform ? firstChild : makeCell(MIXED_CELL_CHILDREN, 0, 0, 0));
+                }
+            }
+        }
+    }
+}
+
+unsigned long VoxelGrid::getVoxelCount() const {
+    unsigned long count = 0;
+    const std::vector<uint32_t>& voxels = _cells[_level];
+    for (std::vector<uint32_t>::const_iterator it = voxels.begin(); it != voxels.end(); it++) {
+        count += (*it != EMPTY_CELL);
+    }
+    return count;
+}
@@ -0,0 +1,70 @@
+//
+//  VoxelGrid.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A dense block of same sized voxels, the way the importers come across them, with its lowest corner at the origin of
+//  the tree. Once all of the voxels are in, summarize() works out, for every level above them, which regions are empty
+//  and which are filled with a single color, so that VoxelTree::createVoxelsFromGrid() can build the tree from the top
+//  down creating only the nodes that are needed: a region of one color becomes a single leaf, and an empty one is
+//  never visited.
+//
+//  Each cell is a color in its low three bytes, and how it's filled in its high byte: 0 if it's empty, and 0xFF if it's
+//  a single color. Anything else is a mix, which at the level of the voxels is which of the voxel's children are filled
+//  (for the half blocks of slabs and stairs).
+//
+
+#ifndef __hifi__VoxelGrid__
+#define __hifi__VoxelGrid__
+
+#include <stdint.h>
+#include <vector>
+
+class VoxelGrid {
+public:
+    static const uint32_t EMPTY_CELL = 0;
+    static const int FULL_CELL_CHILDREN = 0xFF;
+
+    /// width x height x length voxels at the given level, all empty
+    VoxelGrid(int level, int width, int height, int length);
+
+    int getLevel() const { return _level; }
+    int getWidth() const { return _dimensions[_level].width; }
+    int getHeight() const { return _dimensions[_level].height; }
+    int getLength() const { return _dimensions[_level].length; }
+
+    /// fills a voxel, replacing whatever was there
+    void setVoxel(int x, int y, int z, unsigned char red, unsigned char green, unsigned char blue);
+
+    /// fills some of a voxel's children, given as bits in octal code child order, replacing whatever was there
+    void setPartialVoxel(int x, int y, int z, int childMask, unsigned char red, unsigned char green, unsigned char blue);
+
+    /// fills in the levels above the voxels, once they're all in
+    void summarize();
+
+    /// the cell at a level, from 0 for the root down to the voxels' level; outside the grid cells are empty
+    uint32_t getCell(int level, int x, int y, int z) const;
+
+    static int getCellChildren(uint32_t cell) { return cell >> 24; }
+    static bool isUniformCell(uint32_t cell) { return getCellChildren(cell) == FULL_CELL_CHILDREN; }
+    static void getCellColor(uint32_t cell, unsigned char* color);
+
+    /// the number of voxels, partial ones included
+    unsigned long getVoxelCount() const;
+
+private:
+    struct Dimensions {
+        int width;
+        int height;
+        int length;
+    };
+
+    static uint32_t makeCell(int children, unsigned char red, unsigned char green, unsigned char blue);
+
+    int                                 _level;
+    std::vector<Dimensions>             _dimensions;    // by level
+    std::vector<std::vector<uint32_t> > _cells;         // by level, x fastest then y then z
+};
+
+#endif /* defined(__hifi__VoxelGrid__) */
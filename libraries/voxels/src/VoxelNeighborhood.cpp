@@ -0,0 +1,168 @@
+//
+//  VoxelNeighborhood.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include "GeometryUtil.h"
+#include "VoxelNeighborhood.h"
+#include "VoxelTree.h"
+#include "VoxelTreeVisitor.h"
+
+// collects the colored leaves that touch the bounds
+class FetchLeavesVisitor {
+public:
+    FetchLeavesVisitor(const AABox& bounds, std::vector<AABox>& leaves) : _bounds(bounds), _leaves(leaves) { };
+
+    bool visit(VoxelNode* node) {
+        if (!node->getAABox().touches(_bounds)) {
+            return false;
+        }
+        if (node->isLeaf()) {
+            if (node->isColored()) {
+                _leaves.push_back(node->getAABox());
+            }
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const AABox& _bounds;
+    std::vector<AABox>& _leaves;
+};
+
+// whether the box lies inside the node without touching its faces, so that leaves outside the node can't touch the box
+static bool isInsideNode(const AABox& box, const VoxelNode* node) {
+    const AABox& nodeBox = node->getAABox();
+    return glm::all(glm::greaterThan(box.getCorner(), nodeBox.getCorner())) &&
+        glm::all(glm::lessThan(box.getCorner() + box.getSize(), nodeBox.getCorner() + nodeBox.getSize()));
+}
+
+// the smallest node whose subtree holds every leaf that can touch the box
+static VoxelNode* findCoveringNode(VoxelTree* tree, const AABox& box) {
+    VoxelNode* node = tree->rootNode;
+    bool descended = true;
+    while (descended) {
+        descended = false;
+        for (int i = 0; i < NUMBER_OF_CHILDREN && !descended; i++) {
+            VoxelNode* child = node->getChildAtIndex(i);
+            if (child && isInsideNode(box, child)) {
+                node = child;
+                descended = true;
+            }
+        }
+    }
+    return node;
+}
+
+VoxelNeighborhood::VoxelNeighborhood(float margin) :
+    _margin(margin),
+    _tree(NULL),
+    _coveringNode(NULL),
+    _coveringNodeLastChanged(0),
+    _refetchCount(0),
+    _isValid(false) {
+}
+
+bool VoxelNeighborhood::update(VoxelTree* tree, const glm::vec3& minimum, const glm::vec3& maximum) {
+    glm::vec3 queryMinimum = minimum / (float)TREE_SCALE;
+    glm::vec3 queryMaximum = maximum / (float)TREE_SCALE;
+
+    // if we're still inside our box, and nothing has changed in the subtree covering it, we have what we need... edits
+    // mark the nodes above them as changed, so the covering node's time is enough, and we look it up again rather than
+    // keep the node itself, as it may since have been deleted
+    if (_isValid && _tree == tree &&
+            glm::all(glm::greaterThanEqual(queryMinimum, _bounds.getCorner())) &&
+            glm::all(glm::lessThanEqual(queryMaximum, _bounds.getCorner() + _bounds.getSize()))) {
+        VoxelNode* coveringNode = findCoveringNode(tree, _bounds);
+        if (coveringNode == _coveringNode && coveringNode->getLastChanged() == _coveringNodeLastChanged) {
+            return false;
+        }
+    }
+
+    glm::vec3 margin = glm::vec3(_margin, _margin, _margin) / (float)TREE_SCALE;
+    _bounds.setBox(queryMinimum - margin, (queryMaximum - queryMinimum) + margin * 2.0f);
+    _leaves.clear();
+    FetchLeavesVisitor visitor(_bounds, _leaves);
+    visitNodes(tree->rootNode, visitor);
+
+    _tree = tree;
+    _coveringNode = findCoveringNode(tree, _bounds);
+    _coveringNodeLastChanged = _coveringNode->getLastChanged();
+    _isValid = true;
+    _refetchCount++;
+    return true;
+}
+
+bool VoxelNeighborhood::updateForSphere(VoxelTree* tree, const glm::vec3& center, float radius) {
+    glm::vec3 extent(radius, radius, radius);
+    return update(tree, center - extent, center + extent);
+}
+
+bool VoxelNeighborhood::updateForCapsule(VoxelTree* tree, const glm::vec3& start, const glm::vec3& end, float radius) {
+    glm::vec3 extent(radius, radius, radius);
+    return update(tree, glm::min(start, end) - extent, glm::max(start, end) + extent);
+}
+
+bool VoxelNeighborhood::findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration) const {
+    return findSpherePenetrations(&center, &radius, &penetration, 1) > 0;
+}
+
+bool VoxelNeighborhood::findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius,
+                                               glm::vec3& penetration) const {
+    glm::vec3 voxelStart = start / (float)TREE_SCALE;
+    glm::vec3 voxelEnd = end / (float)TREE_SCALE;
+    float voxelRadius = radius / TREE_SCALE;
+    penetration = glm::vec3(0.0f, 0.0f, 0.0f);
+    bool found = false;
+    for (size_t i = 0; i < _leaves.size(); i++) {
+        const AABox& leaf = _leaves[i];
+        glm::vec3 leafPenetration;
+        if (leaf.expandedIntersectsSegment(voxelStart, voxelEnd, voxelRadius) &&
+                leaf.findCapsulePenetration(voxelStart, voxelEnd, voxelRadius, leafPenetration)) {
+            penetration = addPenetrations(penetration, leafPenetration * (float)TREE_SCALE);
+            found = true;
+        }
+    }
+    return found;
+}
+
+int VoxelNeighborhood::findSpherePenetrations(const glm::vec3* centers, const float* radii, glm::vec3* penetrations,
+                                              int sphereCount) const {
+    // work out the box around all the spheres, so we can skip leaves that none of them could touch
+    glm::vec3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+    glm::vec3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    std::vector<bool> found(sphereCount, false);
+    for (int s = 0; s < sphereCount; s++) {
+        glm::vec3 extent(radii[s], radii[s], radii[s]);
+        minimum = glm::min(minimum, (centers[s] - extent) / (float)TREE_SCALE);
+        maximum = glm::max(maximum, (centers[s] + extent) / (float)TREE_SCALE);
+        penetrations[s] = glm::vec3(0.0f, 0.0f, 0.0f);
+    }
+    AABox sphereBounds;
+    sphereBounds.setBox(minimum, maximum - minimum);
+
+    int penetratingSpheres = 0;
+    for (size_t i = 0; i < _leaves.size(); i++) {
+        const AABox& leaf = _leaves[i];
+        if (!leaf.touches(sphereBounds)) {
+            continue;
+        }
+        for (int s = 0; s < sphereCount; s++) {
+            glm::vec3 voxelCenter = centers[s] / (float)TREE_SCALE;
+            float voxelRadius = radii[s] / TREE_SCALE;
+            glm::vec3 leafPenetration;
+            if (leaf.expandedContains(voxelCenter, voxelRadius) &&
+                    leaf.findSpherePenetration(voxelCenter, voxelRadius, leafPenetration)) {
+                penetrations[s] = addPenetrations(penetrations[s], leafPenetration * (float)TREE_SCALE);
+                if (!found[s]) {
+                    found[s] = true;
+                    penetratingSpheres++;
+                }
+            }
+        }
+    }
+    return penetratingSpheres;
+}
@@ -0,0 +1,61 @@
+//
+//  VoxelNeighborhood.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Caches the colored leaves of a VoxelTree in a box around something that collides with voxels every frame (like
+//  an avatar), so that its collision queries don't have to descend from the root of the tree each time. The cache is
+//  refetched only when the subtree covering the cached box changes or when a query falls outside the box. All positions
+//  and sizes are in meters (TREE_SCALE'd), like VoxelTree::findSpherePenetration().
+//
+
+#ifndef __hifi__VoxelNeighborhood__
+#define __hifi__VoxelNeighborhood__
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "AABox.h"
+
+class VoxelNode;
+class VoxelTree;
+
+const float DEFAULT_NEIGHBORHOOD_MARGIN = 1.0f; // meters
+
+class VoxelNeighborhood {
+public:
+    VoxelNeighborhood(float margin = DEFAULT_NEIGHBORHOOD_MARGIN);
+
+    /// Makes sure the neighborhood covers the box between minimum and maximum, refetching the leaves from the tree
+    /// (with margin to spare on every side) if needed. Returns true if the leaves were refetched.
+    bool update(VoxelTree* tree, const glm::vec3& minimum, const glm::vec3& maximum);
+    bool updateForSphere(VoxelTree* tree, const glm::vec3& center, float radius);
+    bool updateForCapsule(VoxelTree* tree, const glm::vec3& start, const glm::vec3& end, float radius);
+    void invalidate() { _isValid = false; };
+
+    /// these only consider leaves in the neighborhood, so update() it to cover the query first
+    bool findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration) const;
+    bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration) const;
+
+    /// Finds the penetration of each of a batch of spheres (like the balls of a hand's fingers), returns the number of
+    /// spheres that penetrate. Spheres that don't penetrate get a zero penetration.
+    int findSpherePenetrations(const glm::vec3* centers, const float* radii, glm::vec3* penetrations, int sphereCount) const;
+
+    int getLeafCount() const { return _leaves.size(); };
+    unsigned long getRefetchCount() const { return _refetchCount; };
+
+private:
+    std::vector<AABox>  _leaves; // in voxel units
+    AABox               _bounds; // in voxel units
+    float               _margin; // in meters
+    VoxelTree*          _tree;
+    VoxelNode*          _coveringNode; // only compared against, never followed
+    uint64_t            _coveringNodeLastChanged;
+    unsigned long       _refetchCount;
+    bool                _isValid;
+};
+
+#endif /* defined(__hifi__VoxelNeighborhood__) */
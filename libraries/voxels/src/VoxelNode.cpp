@@ -25,10 +25,26 @@ VoxelNode::VoxelNode() {
     unsigned char* rootCode = new unsigned char[1];
     *rootCode = 0;
     init(rootCode);
+    markWithChangedTime();
+    calculateAABox();
 }
 
 VoxelNode::VoxelNode(unsigned char * octalCode) {
     init(octalCode);
+    markWithChangedTime();
+    calculateAABox();
+}
+
+VoxelNode::VoxelNode(unsigned char* octalCode, const VoxelNode* source, const glm::vec3& corner, float scale,
+                     uint64_t changedTime) {
+    init(octalCode);
+    memcpy(_trueColor, source->_trueColor, sizeof(nodeColor));
+#ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
+    memcpy(_currentColor, source->_trueColor, sizeof(nodeColor));
+#endif
+    _density = source->_density;
+    _lastChanged = changedTime;
+    _box.setBox(corner, scale, scale, scale);
 }
 
 void VoxelNode::init(unsigned char * octalCode) {
@@ -45,21 +61,25 @@ void VoxelNode::init(unsigned char * octalCode) {
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         _children[i] = NULL;
     }
+    _parent = NULL;
     _childCount = 0;
     _subtreeNodeCount = 1; // that's me
-    _subtreeLeafNodeCount = 0; // that's me
+    _subtreeLeafNodeCount = 1; // that's me, until I have children
     
     _glBufferIndex = GLBUFFER_INDEX_UNKNOWN;
     _voxelSystem = NULL;
     _isDirty = true;
     _shouldRender = false;
     _sourceID = UNKNOWN_NODE_ID;
-    markWithChangedTime();
-    calculateAABox();
+    _handleSlot = VoxelNodeHandle::allocateSlot(this);
 }
 
 VoxelNode::~VoxelNode() {
-    notifyDeleteHooks();
+    // invalidates any outstanding VoxelNodeHandles to this node
+    VoxelNodeHandle::releaseSlot(_handleSlot);
+    if (_voxelSystem && isKnownBufferIndex()) {
+        _voxelSystem->bufferIndexDeleted(_glBufferIndex);
+    }
 
     delete[] _octalCode;
     
@@ -84,24 +104,40 @@ void VoxelNode::handleSubtreeChanged(VoxelTree* myTree) {
     if (myTree->getShouldReaverage()) {
         setColorFromAverageOfChildren();
     }
-    
-    recalculateSubTreeNodeCount();
 }
 
-void VoxelNode::recalculateSubTreeNodeCount() {
-    // Assuming the tree below me as changed, I need to recalculate my node count
-    _subtreeNodeCount = 1; // that's me
-    if (isLeaf()) {
-        _subtreeLeafNodeCount = 1;
-    } else {
-        _subtreeLeafNodeCount = 0;
-        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            if (_children[i]) {
-                _subtreeNodeCount += _children[i]->_subtreeNodeCount;
-                _subtreeLeafNodeCount += _children[i]->_subtreeLeafNodeCount;
-            }
+// applies a change in the size of this node's subtree to it and all of its ancestors
+void VoxelNode::updateSubTreeNodeCounts(long nodeCountDelta, long leafNodeCountDelta) {
+    for (VoxelNode* node = this; node; node = node->_parent) {
+        node->_subtreeNodeCount += nodeCountDelta;
+        node->_subtreeLeafNodeCount += leafNodeCountDelta;
+    }
+}
+
+bool VoxelNode::hasConsistentSubTreeNodeCounts() const {
+    bool consistent = true;
+    int childCount = 0;
+    unsigned long nodeCount = 1; // that's me
+    unsigned long leafNodeCount = 0;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (_children[i]) {
+            // the children are checked first, so their counts can be used for mine
+            consistent = _children[i]->hasConsistentSubTreeNodeCounts() && _children[i]->_parent == this && consistent;
+            childCount++;
+            nodeCount += _children[i]->_subtreeNodeCount;
+            leafNodeCount += _children[i]->_subtreeLeafNodeCount;
         }
     }
+    if (childCount == 0) {
+        leafNodeCount = 1;
+    }
+    if (childCount != _childCount || nodeCount != _subtreeNodeCount || leafNodeCount != _subtreeLeafNodeCount) {
+        qDebug("inconsistent subtree counts: %d children (%d kept), %lu nodes (%lu kept), %lu leaves (%lu kept)\n",
+               childCount, _childCount, nodeCount, _subtreeNodeCount, leafNodeCount, _subtreeLeafNodeCount);
+        printOctalCode(_octalCode);
+        consistent = false;
+    }
+    return consistent;
 }
 
 
@@ -130,13 +166,7 @@ void VoxelNode::calculateAABox() {
 }
 
 void VoxelNode::deleteChildAtIndex(int childIndex) {
-    if (_children[childIndex]) {
-        delete _children[childIndex];
-        _children[childIndex] = NULL;
-        _isDirty = true;
-        markWithChangedTime();
-        _childCount--;
-    }
+    delete removeChildAtIndex(childIndex);
 }
 
 // does not delete the node!
@@ -147,13 +177,22 @@ VoxelNode* VoxelNode::removeChildAtIndex(int childIndex) {
         _isDirty = true;
         markWithChangedTime();
         _childCount--;
+
+        // the removed subtree leaves the counts, and if it was the last child, I'm a leaf again
+        returnedChild->_parent = NULL;
+        updateSubTreeNodeCounts(-(long)returnedChild->_subtreeNodeCount,
+                                (isLeaf() ? 1 : 0) - (long)returnedChild->_subtreeLeafNodeCount);
     }
     return returnedChild;
 }
 
 VoxelNode* VoxelNode::addChildAtIndex(int childIndex) {
     if (!_children[childIndex]) {
+        // the new child is a leaf, and if it's my first child, it takes my place as one
+        updateSubTreeNodeCounts(1, isLeaf() ? 0 : 1);
+
         _children[childIndex] = new VoxelNode(childOctalCode(_octalCode, childIndex));
+        _children[childIndex]->_parent = this;
         _isDirty = true;
         markWithChangedTime();
         _childCount++;
@@ -161,17 +200,46 @@ VoxelNode* VoxelNode::addChildAtIndex(int childIndex) {
     return _children[childIndex];
 }
 
-// handles staging or deletion of all deep children
-void VoxelNode::safeDeepDeleteChildAtIndex(int childIndex) {
-    VoxelNode* childToDelete = getChildAtIndex(childIndex);
-    if (childToDelete) {
-        // If the child is not a leaf, then call ourselves recursively on all the children
-        if (!childToDelete->isLeaf()) {
-            // delete all it's children
-            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-                childToDelete->safeDeepDeleteChildAtIndex(i);
+VoxelNode* VoxelNode::addChildCopyAtIndex(int childIndex, const VoxelNode* source) {
+    if (!_children[childIndex]) {
+        bool wasLeaf = isLeaf();
+        uint64_t now = usecTimestampNow();
+        VoxelNode* child = copySubTreeToChild(childIndex, source, now);
+        updateSubTreeNodeCounts(child->_subtreeNodeCount, (long)child->_subtreeLeafNodeCount - (wasLeaf ? 1 : 0));
+        _isDirty = true;
+        _lastChanged = now;
+    }
+    return _children[childIndex];
+}
+
+// Copies the source to a new child, and then the source's children to it, so that the copy's subtree counts can be
+// added up on the way back. The child's box is its corner of mine, which is the same box its octal code would give.
+VoxelNode* VoxelNode::copySubTreeToChild(int childIndex, const VoxelNode* source, uint64_t changedTime) {
+    float childScale = getScale() * 0.5f;
+    glm::vec3 childCorner = getCorner() + childScale * glm::vec3((childIndex >> 2) & 1, (childIndex >> 1) & 1,
+                                                                 childIndex & 1);
+    VoxelNode* child = new VoxelNode(childOctalCode(_octalCode, childIndex), source, childCorner, childScale,
+                                     changedTime);
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (source->_children[i]) {
+            VoxelNode* grandchild = child->copySubTreeToChild(i, source->_children[i], changedTime);
+            if (child->_childCount == 1) {
+                child->_subtreeLeafNodeCount = 0; // not a leaf after all
             }
+            child->_subtreeNodeCount += grandchild->_subtreeNodeCount;
+            child->_subtreeLeafNodeCount += grandchild->_subtreeLeafNodeCount;
         }
+    }
+    child->_parent = this;
+    _children[childIndex] = child;
+    _childCount++;
+    return child;
+}
+
+// Deleting the child deletes all of its descendants, and the counts only have to be updated once for the whole subtree,
+// rather than once for each of its nodes on the way back up.
+void VoxelNode::safeDeepDeleteChildAtIndex(int childIndex) {
+    if (getChildAtIndex(childIndex)) {
         deleteChildAtIndex(childIndex);
         _isDirty = true;
         markWithChangedTime();
@@ -297,6 +365,9 @@ bool VoxelNode::collapseIdenticalLeaves() {
             _children[i]=NULL; // set it to NULL
         }
         _childCount = 0;
+
+        // eight leaves become one
+        updateSubTreeNodeCounts(-NUMBER_OF_CHILDREN, 1 - NUMBER_OF_CHILDREN);
         nodeColor collapsedColor;
         collapsedColor[0]=red;        
         collapsedColor[1]=green;        
@@ -402,24 +473,3 @@ float VoxelNode::distanceToPoint(const glm::vec3& point) const {
     float distance = sqrtf(glm::dot(temp, temp));
     return distance;
 }
-
-std::vector<VoxelNodeDeleteHook*> VoxelNode::_hooks;
-
-void VoxelNode::addDeleteHook(VoxelNodeDeleteHook* hook) {
-    _hooks.push_back(hook);
-}
-
-void VoxelNode::removeDeleteHook(VoxelNodeDeleteHook* hook) {
-    for (int i = 0; i < _hooks.size(); i++) {
-        if (_hooks[i] == hook) {
-            _hooks.erase(_hooks.begin() + i);
-            return;
-        }
-    }
-}
-
-void VoxelNode::notifyDeleteHooks() {
-    for (int i = 0; i < _hooks.size(); i++) {
-        _hooks[i]->nodeDeleted(this);
-    }
-}
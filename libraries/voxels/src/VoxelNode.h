@@ -13,19 +13,20 @@
 #include "AABox.h"
 #include "ViewFrustum.h"
 #include "VoxelConstants.h"
+#include "VoxelNodeHandle.h"
 
 class VoxelTree; // forward declaration
 class VoxelNode; // forward declaration
-class VoxelSystem; // forward declaration
 
 typedef unsigned char colorPart;
 typedef unsigned char nodeColor[4];
 typedef unsigned char rgbColor[3];
 
-// Callers who want delete hook callbacks should implement this class
-class VoxelNodeDeleteHook {
+// Whatever draws nodes at buffer indexes should implement this class, to be told the index of each of its nodes
+// that's deleted, from whatever tree or thread deletes it
+class VoxelNodeBufferIndexOwner {
 public:
-    virtual void nodeDeleted(VoxelNode* node) = 0;
+    virtual void bufferIndexDeleted(glBufferIndex index) = 0;
 };
 
 class VoxelNode {
@@ -36,9 +37,15 @@ public:
     
     unsigned char* getOctalCode() const { return _octalCode; };
     VoxelNode* getChildAtIndex(int childIndex) const { return _children[childIndex]; };
+    VoxelNode* getParent() const { return _parent; };
     void deleteChildAtIndex(int childIndex);
     VoxelNode* removeChildAtIndex(int childIndex);
     VoxelNode* addChildAtIndex(int childIndex);
+
+    /// Adds a copy of the source node and everything below it as the child at childIndex, unless there's already a child
+    /// there. The copy is one change to the tree: its nodes' boxes come from their parents', they share a change time,
+    /// and the subtree counts are passed up once for all of them.
+    VoxelNode* addChildCopyAtIndex(int childIndex, const VoxelNode* source);
     void safeDeepDeleteChildAtIndex(int childIndex); // handles deletion of all descendents
 
     void setColorFromAverageOfChildren();
@@ -78,9 +85,8 @@ public:
     glBufferIndex getBufferIndex() const { return _glBufferIndex; };
     bool isKnownBufferIndex() const { return (_glBufferIndex != GLBUFFER_INDEX_UNKNOWN); };
     void setBufferIndex(glBufferIndex index) { _glBufferIndex = index; };
-    VoxelSystem* getVoxelSystem() const { return _voxelSystem; };
-    void setVoxelSystem(VoxelSystem* voxelSystem) { _voxelSystem = voxelSystem; };
-    
+    VoxelNodeBufferIndexOwner* getVoxelSystem() const { return _voxelSystem; };
+    void setVoxelSystem(VoxelNodeBufferIndexOwner* voxelSystem) { _voxelSystem = voxelSystem; };
 
     // Used by VoxelSystem for rendering in/out of view and LOD
     void setShouldRender(bool shouldRender);
@@ -108,18 +114,25 @@ public:
     void     setSourceID(uint16_t sourceID)       { _sourceID = sourceID; };
     uint16_t getSourceID()                  const { return _sourceID;     };
 
-    static void addDeleteHook(VoxelNodeDeleteHook* hook);
-    static void removeDeleteHook(VoxelNodeDeleteHook* hook);
+    // callers who need to know if a node has been deleted should hold a VoxelNodeHandle instead of a raw pointer
+    uint32_t getHandleSlot() const { return _handleSlot; };
     
-    void recalculateSubTreeNodeCount();
+    // the counts are kept up to date along the path to the root as children are added, deleted and collapsed
     unsigned long getSubTreeNodeCount()         const { return _subtreeNodeCount; };
     unsigned long getSubTreeInternalNodeCount() const { return _subtreeNodeCount - _subtreeLeafNodeCount; };
     unsigned long getSubTreeLeafNodeCount()     const { return _subtreeLeafNodeCount; };
 
+    /// Recounts the whole subtree and checks it against the counts, child counts and parents kept by each of its nodes.
+    /// Meant for debugging and benchmarks, since it visits every node.
+    bool hasConsistentSubTreeNodeCounts() const;
+
 private:
+    VoxelNode(unsigned char* octalCode, const VoxelNode* source, const glm::vec3& corner, float scale,
+              uint64_t changedTime); // copy constructor for addChildCopyAtIndex(), without the children
     void calculateAABox();
     void init(unsigned char * octalCode);
-    void notifyDeleteHooks();
+    VoxelNode* copySubTreeToChild(int childIndex, const VoxelNode* source, uint64_t changedTime);
+    void updateSubTreeNodeCounts(long nodeCountDelta, long leafNodeCountDelta);
 
     nodeColor _trueColor;
 #ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
@@ -127,20 +140,20 @@ private:
     bool      _falseColored;
 #endif
     glBufferIndex   _glBufferIndex;
-    VoxelSystem*    _voxelSystem;
+    VoxelNodeBufferIndexOwner* _voxelSystem;
     bool            _isDirty;
     uint64_t        _lastChanged;
     bool            _shouldRender;
     AABox           _box;
     unsigned char*  _octalCode;
     VoxelNode*      _children[8];
+    VoxelNode*      _parent;
     int             _childCount;
     unsigned long   _subtreeNodeCount;
     unsigned long   _subtreeLeafNodeCount;
     float           _density;       // If leaf: density = 1, if internal node: 0-1 density of voxels inside
     uint16_t        _sourceID;
-
-    static std::vector<VoxelNodeDeleteHook*> _hooks;
+    uint32_t        _handleSlot;
 };
 
 #endif /* defined(__hifi__VoxelNode__) */
@@ -13,11 +13,9 @@ VoxelNodeBag::VoxelNodeBag() :
     _bagElements(NULL),
     _elementsInUse(0),
     _sizeOfElementsArray(0) {
-    VoxelNode::addDeleteHook(this);
 };
 
 VoxelNodeBag::~VoxelNodeBag() {
-    VoxelNode::removeDeleteHook(this);
     deleteAll();
 }
 
@@ -30,58 +28,103 @@ void VoxelNodeBag::deleteAll() {
     _sizeOfElementsArray = 0;
 }
 
+// binary search for the handle slot, the bag is kept sorted by slot and each slot appears at most once. Returns the
+// index the slot is at if found, or the index it should be inserted at if not.
+int VoxelNodeBag::findSlot(uint32_t slot, bool& found) const {
+    int low = 0;
+    int high = _elementsInUse;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        uint32_t middleSlot = _bagElements[middle].getSlot();
+        if (middleSlot == slot) {
+            found = true;
+            return middle;
+        }
+        if (middleSlot < slot) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    found = false;
+    return low;
+}
 
 const int GROW_BAG_BY = 100;
 
 // put a node into the bag
 void VoxelNodeBag::insert(VoxelNode* node) {
+    VoxelNodeHandle handle(node);
+    bool found;
+    int insertAt = findSlot(handle.getSlot(), found);
 
-    // Search for where we should live in the bag (sorted)
-    // Note: change this to binary search... instead of linear!
-    int insertAt = _elementsInUse;
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            return; // exit early!!
-        }
-        
-        if (_bagElements[i] > node) {
-            insertAt = i;
-            break;
-        }
+    // If the slot is already in the bag, then it's either this node (and we de-dupe) or a node that has since been
+    // deleted and whose slot was reused, in which case we just take over its spot
+    if (found) {
+        _bagElements[insertAt] = handle;
+        return; // exit early!!
     }
     // at this point, inserAt will be the location we want to insert at.
     
     // If we don't have room in our bag, then grow the bag
     if (_sizeOfElementsArray < _elementsInUse + 1) {
-        VoxelNode** oldBag = _bagElements;
-        _bagElements = new VoxelNode * [_sizeOfElementsArray + GROW_BAG_BY];
+        VoxelNodeHandle* oldBag = _bagElements;
+        _bagElements = new VoxelNodeHandle[_sizeOfElementsArray + GROW_BAG_BY];
         _sizeOfElementsArray += GROW_BAG_BY;
         
         // If we had an old bag...
         if (oldBag) {
             // copy old elements into the new bag, but leave a space where we need to
             // insert the new node
-            memcpy(_bagElements, oldBag, insertAt * sizeof(VoxelNode*));
-            memcpy(&_bagElements[insertAt + 1], &oldBag[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
+            memcpy(_bagElements, oldBag, insertAt * sizeof(VoxelNodeHandle));
+            memcpy(&_bagElements[insertAt + 1], &oldBag[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNodeHandle));
             delete[] oldBag;
         }
     } else {
         // move existing elements further back in the bag array, leave a space where we need to
         // insert the new node
-        memmove(&_bagElements[insertAt + 1], &_bagElements[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
+        memmove(&_bagElements[insertAt + 1], &_bagElements[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNodeHandle));
     }
-    _bagElements[insertAt] = node;
+    _bagElements[insertAt] = handle;
     _elementsInUse++;
 }
+
+// drop any nodes at the end of the bag that have been deleted since they were inserted
+void VoxelNodeBag::discardDeletedFromEnd() {
+    while (_elementsInUse && !_bagElements[_elementsInUse - 1].isValid()) {
+        _elementsInUse--;
+    }
+}
+
+bool VoxelNodeBag::isEmpty() const {
+    // deleted nodes are left for extract() to discard, and there are rarely any at the end to look past
+    for (int i = _elementsInUse - 1; i >= 0; i--) {
+        if (_bagElements[i].isValid()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int VoxelNodeBag::count() const {
+    int count = 0;
+    for (int i = 0; i < _elementsInUse; i++) {
+        if (_bagElements[i].isValid()) {
+            count++;
+        }
+    }
+    return count;
+}
  
 // pull a node out of the bag (could come in any order)
 VoxelNode* VoxelNodeBag::extract() {
+    discardDeletedFromEnd();
+
     // pull the last node out, and shrink our list...
     if (_elementsInUse) {
         
         // get the last element
-        VoxelNode* node = _bagElements[_elementsInUse - 1];
+        VoxelNode* node = _bagElements[_elementsInUse - 1].get();
         
         // reduce the count
         _elementsInUse--;
@@ -92,43 +135,21 @@ VoxelNode* VoxelNodeBag::extract() {
 }
 
 bool VoxelNodeBag::contains(VoxelNode* node) {
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            return true; // exit early!!
-        }
-        // if we're past where it should be, then it's not here!
-        if (_bagElements[i] > node) {
-            return false;
-        }
-    }
-    // if we made it through the entire bag, it's not here!
-    return false;
+    VoxelNodeHandle handle(node);
+    bool found;
+    int foundAt = findSlot(handle.getSlot(), found);
+    return found && _bagElements[foundAt] == handle;
 }
 
 void VoxelNodeBag::remove(VoxelNode* node) {
-    int foundAt = -1;
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            foundAt = i;
-            break;
-        }
-        // if we're past where it should be, then it's not here!
-        if (_bagElements[i] > node) {
-            break;
-        }
-    }
+    VoxelNodeHandle handle(node);
+    bool found;
+    int foundAt = findSlot(handle.getSlot(), found);
+
     // if we found it, then we need to remove it....
-    if (foundAt != -1) {
-        memmove(&_bagElements[foundAt], &_bagElements[foundAt + 1], (_elementsInUse - foundAt) * sizeof(VoxelNode*));
+    if (found && _bagElements[foundAt] == handle) {
+        memmove(&_bagElements[foundAt], &_bagElements[foundAt + 1],
+                (_elementsInUse - foundAt - 1) * sizeof(VoxelNodeHandle));
         _elementsInUse--;
     }
 }
-
-
-void VoxelNodeBag::nodeDeleted(VoxelNode* node) {
-    remove(node); // note: remove can safely handle nodes that aren't in it, so we don't need to check contains()
-}
-
-
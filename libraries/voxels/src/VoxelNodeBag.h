@@ -10,13 +10,16 @@
 //  more than once (in other words, it de-dupes automatically), also, it supports collapsing it's several peer nodes
 //  into a parent node in cases where you add enough peers that it makes more sense to just add the parent.
 //
+//  The bag holds VoxelNodeHandles rather than raw pointers, so nodes that are deleted while they're in the bag are
+//  simply skipped when they're extracted, rather than the bag being notified on every node deletion.
+//
 
 #ifndef __hifi__VoxelNodeBag__
 #define __hifi__VoxelNodeBag__
 
 #include "VoxelNode.h"
 
-class VoxelNodeBag : public VoxelNodeDeleteHook {
+class VoxelNodeBag {
 
 public:
     VoxelNodeBag();
@@ -27,21 +30,18 @@ public:
     bool contains(VoxelNode* node); // is this node in the bag?
     void remove(VoxelNode* node); // remove a specific item from the bag
     
-    bool isEmpty() const { return (_elementsInUse == 0); };
-    int count() const { return _elementsInUse; };
+    bool isEmpty() const; // deleted nodes don't count, so a non-empty bag always has something to extract()
+    int count() const; // the nodes that haven't been deleted since they were inserted
 
     void deleteAll();
 
-    static void voxelNodeDeleteHook(VoxelNode* node, void* extraData);
-
-    virtual void nodeDeleted(VoxelNode* node);
-
 private:
-    
-    VoxelNode** _bagElements;
-    int         _elementsInUse;
-    int         _sizeOfElementsArray;
-    int         _hookID;
+    int findSlot(uint32_t slot, bool& found) const;
+    void discardDeletedFromEnd();
+
+    VoxelNodeHandle*    _bagElements;
+    int                 _elementsInUse;
+    int                 _sizeOfElementsArray;
 };
 
 #endif /* defined(__hifi__VoxelNodeBag__) */
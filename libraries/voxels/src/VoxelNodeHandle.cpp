@@ -0,0 +1,100 @@
+//
+//  VoxelNodeHandle.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cassert>
+#include <cstdio>
+
+#include "VoxelNode.h"
+#include "VoxelNodeHandle.h"
+
+VoxelNodeHandle::Slot* volatile VoxelNodeHandle::_chunks[MAX_SLOT_CHUNKS] = { NULL };
+volatile uint32_t               VoxelNodeHandle::_slotCount = 0;
+volatile uint64_t               VoxelNodeHandle::_freeSlotHead = VoxelNodeHandle::INVALID_SLOT;
+volatile uint32_t               VoxelNodeHandle::_freeSlotCount = 0;
+
+VoxelNodeHandle::VoxelNodeHandle(const VoxelNode* node) :
+    _slot(INVALID_SLOT),
+    _generation(0) {
+    if (node) {
+        _slot = node->getHandleSlot();
+        _generation = slotAt(_slot).generation;
+    }
+}
+
+VoxelNode* VoxelNodeHandle::get() const {
+    if (_slot == INVALID_SLOT) {
+        return NULL;
+    }
+    const Slot& slot = slotAt(_slot);
+    return (slot.generation == _generation) ? slot.node : NULL;
+}
+
+uint32_t VoxelNodeHandle::popFreeSlot() {
+    uint64_t head = _freeSlotHead;
+    while ((uint32_t)head != INVALID_SLOT) {
+        uint32_t slot = (uint32_t)head;
+        
+        // the slot may be popped by another thread meanwhile, in which case the head's count has moved on and the
+        // swap fails, whatever we read here
+        uint64_t newHead = (((head >> 32) + 1) << 32) | slotAt(slot).nextFree;
+        if (__sync_bool_compare_and_swap(&_freeSlotHead, head, newHead)) {
+            __sync_fetch_and_sub(&_freeSlotCount, 1);
+            return slot;
+        }
+        head = _freeSlotHead;
+    }
+    return INVALID_SLOT;
+}
+
+uint32_t VoxelNodeHandle::allocateSlot(VoxelNode* node) {
+    uint32_t slot = popFreeSlot();
+    if (slot == INVALID_SLOT) {
+        slot = __sync_fetch_and_add(&_slotCount, 1);
+        int chunk = slot >> SLOT_CHUNK_BITS;
+        if (chunk >= MAX_SLOT_CHUNKS) {
+            __sync_fetch_and_sub(&_slotCount, 1);
+            printf("VoxelNodeHandle::allocateSlot() out of node slots!\n");
+            assert(false);
+            return INVALID_SLOT;
+        }
+        if (!_chunks[chunk]) {
+            Slot* newChunk = new Slot[SLOTS_PER_CHUNK];
+            for (uint32_t i = 0; i < SLOTS_PER_CHUNK; i++) {
+                newChunk[i].node = NULL;
+                newChunk[i].generation = 1; // generation 0 is never valid, so default handles never match
+                newChunk[i].nextFree = INVALID_SLOT;
+            }
+            
+            // the first slots of a chunk can be claimed by several threads at once, and only one chunk is kept
+            if (!__sync_bool_compare_and_swap(&_chunks[chunk], (Slot*)NULL, newChunk)) {
+                delete[] newChunk;
+            }
+        }
+    }
+    slotAt(slot).node = node;
+    return slot;
+}
+
+void VoxelNodeHandle::releaseSlot(uint32_t slot) {
+    if (slot == INVALID_SLOT) {
+        return;
+    }
+    Slot& releasedSlot = slotAt(slot);
+    releasedSlot.node = NULL;
+    // bumping the generation is what invalidates all outstanding handles to this node
+    releasedSlot.generation++;
+    if (releasedSlot.generation == 0) {
+        releasedSlot.generation = 1;
+    }
+    
+    uint64_t head;
+    do {
+        head = _freeSlotHead;
+        releasedSlot.nextFree = (uint32_t)head;
+    } while (!__sync_bool_compare_and_swap(&_freeSlotHead, head, (((head >> 32) + 1) << 32) | slot));
+    __sync_fetch_and_add(&_freeSlotCount, 1);
+}
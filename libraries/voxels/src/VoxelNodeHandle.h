@@ -0,0 +1,78 @@
+//
+//  VoxelNodeHandle.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A weak reference to a VoxelNode. Every VoxelNode owns a slot in a global slot table, and each slot carries a
+//  generation number that is bumped when the node is deleted. A handle remembers the slot and the generation it was
+//  taken at, so it can be validated lazily when it is used instead of having every node deletion notify every
+//  observer. Deleting a node is O(1) regardless of how many bags or systems hold handles to it.
+//
+//  Note: a handle only tells you the node hasn't been deleted yet. Callers still need to synchronize with whoever is
+//  deleting nodes (the tree locks) if they intend to hold on to the returned pointer.
+//
+
+#ifndef __hifi__VoxelNodeHandle__
+#define __hifi__VoxelNodeHandle__
+
+#include <stdint.h>
+
+class VoxelNode; // forward declaration
+
+class VoxelNodeHandle {
+public:
+    static const uint32_t INVALID_SLOT = 0xFFFFFFFF;
+
+    VoxelNodeHandle() : _slot(INVALID_SLOT), _generation(0) { };
+    VoxelNodeHandle(const VoxelNode* node);
+
+    // returns the node if it is still alive, or NULL if it has been deleted since this handle was taken
+    VoxelNode* get() const;
+    bool isValid() const { return get() != NULL; };
+    bool isNull() const { return _slot == INVALID_SLOT; };
+
+    uint32_t getSlot() const { return _slot; };
+    uint32_t getGeneration() const { return _generation; };
+
+    bool operator==(const VoxelNodeHandle& other) const {
+        return _slot == other._slot && _generation == other._generation;
+    };
+    bool operator!=(const VoxelNodeHandle& other) const { return !(*this == other); };
+
+    // slot table management, called by VoxelNode on construction and destruction, from any thread
+    static uint32_t allocateSlot(VoxelNode* node);
+    static void releaseSlot(uint32_t slot);
+
+    static unsigned long getSlotsInUse() { return _slotCount - _freeSlotCount; };
+
+private:
+    struct Slot {
+        VoxelNode*          node;
+        uint32_t            generation;
+        volatile uint32_t   nextFree; // the free slot under this one on the free list, while it's on it
+    };
+
+    static uint32_t popFreeSlot();
+
+    static Slot& slotAt(uint32_t slot) { return _chunks[slot >> SLOT_CHUNK_BITS][slot & SLOT_CHUNK_MASK]; };
+
+    uint32_t _slot;
+    uint32_t _generation;
+
+    static const int SLOT_CHUNK_BITS = 16;
+    static const uint32_t SLOTS_PER_CHUNK = 1 << SLOT_CHUNK_BITS;
+    static const uint32_t SLOT_CHUNK_MASK = SLOTS_PER_CHUNK - 1;
+    static const int MAX_SLOT_CHUNKS = 4096;
+
+    // Chunks are never moved or freed once allocated, so lookups don't need a lock, and neither do the nodes being
+    // created and deleted on several threads at once: new slots are claimed by bumping _slotCount, and freed ones are
+    // kept on a list threaded through the slots, whose head is a slot in the low half and a count of the changes to it
+    // in the high half, so a thread can't swap in a head that was popped and pushed again since it read it.
+    static Slot* volatile           _chunks[MAX_SLOT_CHUNKS];
+    static volatile uint32_t        _slotCount;
+    static volatile uint64_t        _freeSlotHead;
+    static volatile uint32_t        _freeSlotCount;
+};
+
+#endif /* defined(__hifi__VoxelNodeHandle__) */
@@ -0,0 +1,100 @@
+//
+//  VoxelPacketChain.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstring>
+
+#include <SharedUtil.h>
+
+#include "VoxelPacketChain.h"
+
+VoxelPacketChain::VoxelPacketChain(int packetBytes) :
+    _buffer(NULL),
+    _ownsBuffer(true),
+    _packetBytes(packetBytes),
+    _firstPacketBytes(packetBytes),
+    _maxPackets(0),
+    _allocatedPackets(0),
+    _current(0),
+    _isFull(false),
+    _packetsStarted(0),
+    _sectionRoot(NULL),
+    _sectionStart(0)
+{
+    reset(1, packetBytes);
+}
+
+VoxelPacketChain::VoxelPacketChain(unsigned char* buffer, int bufferBytes) :
+    _buffer(buffer),
+    _ownsBuffer(false),
+    _packetBytes(bufferBytes),
+    _firstPacketBytes(bufferBytes),
+    _maxPackets(1),
+    _allocatedPackets(1),
+    _lengths(1, 0),
+    _current(0),
+    _isFull(false),
+    _packetsStarted(0),
+    _sectionRoot(NULL),
+    _sectionStart(0)
+{
+}
+
+VoxelPacketChain::~VoxelPacketChain() {
+    if (_ownsBuffer) {
+        delete[] _buffer;
+    }
+}
+
+void VoxelPacketChain::reset(int maxPackets, int firstPacketBytes) {
+    if (_ownsBuffer && maxPackets > _allocatedPackets) {
+        delete[] _buffer;
+        _buffer = new unsigned char[maxPackets * _packetBytes];
+        _allocatedPackets = maxPackets;
+    }
+    _maxPackets = std::min(maxPackets, _allocatedPackets);
+    _firstPacketBytes = std::min(firstPacketBytes, _packetBytes);
+    _lengths.assign(_maxPackets, 0);
+    _current = 0;
+    _isFull = false;
+    _sectionRoot = NULL;
+    _sectionStart = 0;
+    _openLevels.clear();
+}
+
+int VoxelPacketChain::getTotalBytes() const {
+    int totalBytes = 0;
+    for (int i = 0; i <= _current; i++) {
+        totalBytes += _lengths[i];
+    }
+    return totalBytes;
+}
+
+void VoxelPacketChain::write(const unsigned char* data, int bytes) {
+    memcpy(getWritePosition(), data, bytes);
+    _lengths[_current] += bytes;
+}
+
+void VoxelPacketChain::nextPacket() {
+    _current++;
+    _lengths[_current] = 0;
+    _packetsStarted++;
+}
+
+// the children of a level are written in distance order when occlusion culling, but have to be read in index order
+void VoxelPacketChain::reshuffleSlices(OpenLevel& level) {
+    unsigned char* packet = getPacket(_current);
+    _reshuffleBuffer.resize(_packetBytes);
+    int allSlicesSize = 0;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (oneAtBit(level.slicedBits, i)) {
+            memcpy(&_reshuffleBuffer[allSlicesSize], packet + level.sliceStarts[i], level.sliceSizes[i]);
+            allSlicesSize += level.sliceSizes[i];
+        }
+    }
+    memcpy(packet + level.firstSlice, &_reshuffleBuffer[0], allSlicesSize);
+}
@@ -0,0 +1,97 @@
+//
+//  VoxelPacketChain.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Packet buffers for VoxelTree::encodeTreeIntoPackets() to fill one after another in a single traversal. When a level
+//  doesn't fit in a packet, the encoder moves on to the next packet, starting it with the octal code of the subtree it's
+//  encoding and the levels it's in the middle of, without their colors, so that it can carry on where it left off rather
+//  than leaving the rest of the subtree in the bag to be traversed again from the top. Only once the last packet is
+//  full does anything go in the bag.
+//
+
+#ifndef __hifi__VoxelPacketChain__
+#define __hifi__VoxelPacketChain__
+
+#include <vector>
+
+#include "VoxelConstants.h"
+
+class VoxelNode;
+
+class VoxelPacketChain {
+public:
+    /// packets of packetBytes each, in buffers the chain allocates as it needs them
+    VoxelPacketChain(int packetBytes);
+
+    /// a single packet, written to a buffer the caller owns
+    VoxelPacketChain(unsigned char* buffer, int bufferBytes);
+
+    ~VoxelPacketChain();
+
+    /// Empties the chain and gives it room for up to maxPackets. The first packet can be given less room than the rest,
+    /// for filling out a packet that already has something in it.
+    void reset(int maxPackets, int firstPacketBytes);
+
+    /// the packets that have been written to, the last of which may still have room
+    int getPacketCount() const { return _current + 1; }
+    unsigned char* getPacket(int index) { return _buffer + index * _packetBytes; }
+    int getPacketLength(int index) const { return _lengths[index]; }
+    int getTotalBytes() const;
+
+    /// true once something has been left for the bag because the last packet was full
+    bool isFull() const { return _isFull; }
+
+    /// how many times the encoder has moved on to the next packet
+    unsigned long getPacketsStarted() const { return _packetsStarted; }
+
+private:
+    friend class VoxelTree;
+
+    /// What the encoder has written of a level it's in the middle of, so that the level can be closed in one packet and
+    /// reopened in the next. Offsets are into the current packet.
+    struct OpenLevel {
+        unsigned char   existsInTreeBits;
+        unsigned char   unfinishedBits;     // children still to be written, including the one being written
+        int             currentChild;
+        int             levelStart;
+        int             existsInPacketBits;
+        bool            colorsInPacket;     // false once the level has been reopened without them
+
+        // children are written in distance order when occlusion culling, and put back in index order at the end
+        unsigned char   slicedBits;
+        int             firstSlice;
+        int             sliceStarts[NUMBER_OF_CHILDREN];
+        int             sliceSizes[NUMBER_OF_CHILDREN];
+    };
+
+    unsigned char* getWritePosition() { return getPacket(_current) + _lengths[_current]; }
+    int getLength() const { return _lengths[_current]; }
+    void setLength(int length) { _lengths[_current] = length; }
+    int getAvailable() const { return ((_current == 0) ? _firstPacketBytes : _packetBytes) - _lengths[_current]; }
+    bool hasNextPacket() const { return _current + 1 < _maxPackets; }
+
+    void write(const unsigned char* data, int bytes);
+    void nextPacket();
+    void reshuffleSlices(OpenLevel& level);
+
+    unsigned char*              _buffer;
+    bool                        _ownsBuffer;
+    int                         _packetBytes;
+    int                         _firstPacketBytes;
+    int                         _maxPackets;
+    int                         _allocatedPackets;
+    std::vector<int>            _lengths;
+    int                         _current;
+    bool                        _isFull;
+    unsigned long               _packetsStarted;
+
+    // the subtree being encoded, its octal code starts every packet it's written to
+    VoxelNode*                  _sectionRoot;
+    int                         _sectionStart;
+    std::vector<OpenLevel>      _openLevels;
+    std::vector<unsigned char>  _reshuffleBuffer;
+};
+
+#endif /* defined(__hifi__VoxelPacketChain__) */
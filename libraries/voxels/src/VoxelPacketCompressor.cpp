@@ -0,0 +1,82 @@
+//
+//  VoxelPacketCompressor.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <zlib.h>
+
+#include <QtCore/QDebug>
+
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+
+#include "VoxelPacketCompressor.h"
+
+const int COMPRESSION_USECS_SAMPLES = 100;
+
+VoxelPacketCompressor::VoxelPacketCompressor(int compressionLevel) :
+    _compressionLevel(compressionLevel),
+    _packetsCompressed(0),
+    _packetsNotCompressed(0),
+    _packetsDecompressed(0),
+    _originalBytes(0),
+    _compressedBytes(0),
+    _compressUsecs(COMPRESSION_USECS_SAMPLES),
+    _decompressUsecs(COMPRESSION_USECS_SAMPLES) {
+}
+
+int VoxelPacketCompressor::compress(const unsigned char* packet, int packetLength, unsigned char* compressedPacket) {
+    uint64_t start = usecTimestampNow();
+    int numBytesPacketHeader = populateTypeAndVersion(compressedPacket, PACKET_TYPE_VOXEL_DATA_COMPRESSED);
+
+    // anything that doesn't end up smaller than the original is no use to us, so don't let zlib write more than that
+    uLongf compressedBytes = packetLength - numBytesPacketHeader - 1;
+    int compressedPacketLength = 0;
+    if (packetLength > numBytesPacketHeader + 1 && packetLength <= MAX_VOXEL_PACKET_SIZE &&
+            compress2(compressedPacket + numBytesPacketHeader, &compressedBytes, packet, packetLength,
+                      _compressionLevel) == Z_OK) {
+        compressedPacketLength = numBytesPacketHeader + compressedBytes;
+    }
+
+    _compressUsecs.updateAverage(usecTimestampNow() - start);
+    _originalBytes += packetLength;
+    if (compressedPacketLength) {
+        _compressedBytes += compressedPacketLength;
+        _packetsCompressed++;
+    } else {
+        _compressedBytes += packetLength;
+        _packetsNotCompressed++;
+    }
+    return compressedPacketLength;
+}
+
+int VoxelPacketCompressor::decompress(const unsigned char* compressedPacket, int compressedPacketLength,
+                                      unsigned char* packet) {
+    uint64_t start = usecTimestampNow();
+    int numBytesPacketHeader = numBytesForPacketHeader((unsigned char*)compressedPacket);
+    uLongf packetLength = MAX_VOXEL_PACKET_SIZE;
+    if (compressedPacketLength <= numBytesPacketHeader ||
+            uncompress(packet, &packetLength, compressedPacket + numBytesPacketHeader,
+                       compressedPacketLength - numBytesPacketHeader) != Z_OK) {
+        qDebug("VoxelPacketCompressor::decompress() dropping a corrupt packet of %d bytes\n", compressedPacketLength);
+        return 0;
+    }
+
+    _decompressUsecs.updateAverage(usecTimestampNow() - start);
+    _originalBytes += packetLength;
+    _compressedBytes += compressedPacketLength;
+    _packetsDecompressed++;
+    return packetLength;
+}
+
+float VoxelPacketCompressor::getCompressionRatio() const {
+    return _compressedBytes ? (float)_originalBytes / _compressedBytes : 1.0f;
+}
+
+void VoxelPacketCompressor::printStats() {
+    qDebug("voxel packets: %lu compressed, %lu not worth compressing, %lu decompressed, ratio %f, "
+           "%f usecs to compress, %f usecs to decompress\n", _packetsCompressed, _packetsNotCompressed,
+           _packetsDecompressed, getCompressionRatio(), getAverageCompressUsecs(), getAverageDecompressUsecs());
+}
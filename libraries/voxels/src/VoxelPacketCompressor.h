@@ -0,0 +1,63 @@
+//
+//  VoxelPacketCompressor.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  zlib compression of whole voxel packets, for clients that ask for it. A compressed packet has its own packet header,
+//  followed by the deflated bytes of the original packet, header and all, so the receiver inflates it and then handles
+//  the result like any other packet. Each compressor keeps the stats for the packets that went through it.
+//
+
+#ifndef __hifi__VoxelPacketCompressor__
+#define __hifi__VoxelPacketCompressor__
+
+#include <stdint.h>
+
+#include <SimpleMovingAverage.h>
+
+#include "VoxelConstants.h"
+
+class VoxelPacketCompressor {
+public:
+    static const int DEFAULT_COMPRESSION_LEVEL = 1; // Z_BEST_SPEED, the larger levels barely help on packets this small
+    static const int MAX_COMPRESSED_PACKET_SIZE = MAX_VOXEL_PACKET_SIZE;
+
+    VoxelPacketCompressor(int compressionLevel = DEFAULT_COMPRESSION_LEVEL);
+
+    /// Compresses the packet into compressedPacket, which must hold MAX_COMPRESSED_PACKET_SIZE bytes. Returns the length
+    /// of the compressed packet, or 0 if compressing doesn't make it any smaller, in which case the original should be
+    /// sent as it is.
+    int compress(const unsigned char* packet, int packetLength, unsigned char* compressedPacket);
+
+    /// Inflates a PACKET_TYPE_VOXEL_DATA_COMPRESSED packet into packet, which must hold MAX_VOXEL_PACKET_SIZE bytes.
+    /// Returns the length of the original packet, or 0 if the compressed packet is corrupt.
+    int decompress(const unsigned char* compressedPacket, int compressedPacketLength, unsigned char* packet);
+
+    int getCompressionLevel() const { return _compressionLevel; }
+
+    unsigned long getPacketsCompressed() const { return _packetsCompressed; }
+    unsigned long getPacketsNotCompressed() const { return _packetsNotCompressed; }
+    unsigned long getPacketsDecompressed() const { return _packetsDecompressed; }
+
+    /// original bytes over the bytes sent or received, packets sent uncompressed count at 1:1
+    float getCompressionRatio() const;
+
+    /// average usecs spent on a single packet
+    float getAverageCompressUsecs() { return _compressUsecs.getAverage(); }
+    float getAverageDecompressUsecs() { return _decompressUsecs.getAverage(); }
+
+    void printStats();
+
+private:
+    int _compressionLevel;
+    unsigned long _packetsCompressed;
+    unsigned long _packetsNotCompressed;
+    unsigned long _packetsDecompressed;
+    uint64_t _originalBytes;
+    uint64_t _compressedBytes;
+    SimpleMovingAverage _compressUsecs;
+    SimpleMovingAverage _decompressUsecs;
+};
+
+#endif /* defined(__hifi__VoxelPacketCompressor__) */
@@ -491,6 +491,7 @@ void VoxelSceneStats::printDebugDetails() {
     qDebug("    traversed           : %lu\n", _traversed                );
     qDebug("        internal        : %lu\n", _internal                 );
     qDebug("        leaves          : %lu\n", _leaves                   );
+    qDebug("    traversed per voxel sent : %.2f\n", getTraversedPerVoxelSent());
     qDebug("    skipped distance    : %lu\n", _skippedDistance          );
     qDebug("        internal        : %lu\n", _internalSkippedDistance  );
     qDebug("        leaves          : %lu\n", _leavesSkippedDistance    );
@@ -543,6 +544,11 @@ VoxelSceneStats::ItemInfo VoxelSceneStats::_ITEMS[] = {
     { "Mode"                 , greenish  },
 };
 
+float VoxelSceneStats::getTraversedPerVoxelSent() const {
+    unsigned long voxelsSent = _existsInPacketBitsWritten + _colorSent;
+    return voxelsSent == 0 ? 0.0f : (float)_traversed / (float)voxelsSent;
+}
+
 char* VoxelSceneStats::getItemValue(Item item) {
     const uint64_t USECS_PER_SECOND = 1000 * 1000;
     int calcFPS, calcAverageFPS, calculatedKBPS;
@@ -580,8 +586,8 @@ char* VoxelSceneStats::getItemValue(Item item) {
             break;
         }
         case ITEM_TRAVERSED: {
-            sprintf(_itemValueBuffer, "%lu total %lu internal %lu leaves", 
-                    _traversed, _internal, _leaves);
+            sprintf(_itemValueBuffer, "%lu total %lu internal %lu leaves (%.2f per voxel sent)", 
+                    _traversed, _internal, _leaves, getTraversedPerVoxelSent());
             break;
         }
         case ITEM_SKIPPED: {
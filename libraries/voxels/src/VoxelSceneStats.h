@@ -126,6 +126,10 @@ public:
     /// \param Item item The item from the stats you're interested in.
     char* getItemValue(Item item);
     
+    /// Returns how many nodes were traversed for each voxel that went into a packet, which falls as less of the scene has
+    /// to be traversed again after not fitting in a packet
+    float getTraversedPerVoxelSent() const;
+
     /// Returns OctCode for root node of the jurisdiction of this particular voxel server
     unsigned char* getJurisdictionRoot() const { return _jurisdictionRoot; }
 
@@ -0,0 +1,170 @@
+//
+//  VoxelSubtreeVersions.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+
+#include <OctalCode.h>
+#include <SharedUtil.h>
+
+#include "VoxelNode.h"
+#include "VoxelSubtreeVersions.h"
+
+const int MAX_KEY_SECTIONS = 10;
+const int VERSION_BYTES = sizeof(uint64_t) + sizeof(uint32_t);
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+static inline void hashByte(uint64_t& hash, unsigned char byte) {
+    hash = (hash ^ byte) * FNV_PRIME;
+}
+
+static inline void hashWord(uint64_t& hash, uint64_t word) {
+    for (int i = 0; i < (int)sizeof(word); i++) {
+        hashByte(hash, (word >> (i * BITS_IN_BYTE)) & 0xFF);
+    }
+}
+
+// Only what a client can be sent goes into the hash: the colors of colored nodes and where they are. Uncolored nodes
+// with nothing colored below them aren't sent, so they're left out, as is the color of the subtree root, which is sent
+// with its parent. The colored nodes hashed are added to voxelCount.
+static uint64_t hashSubtree(VoxelNode* node, uint32_t& voxelCount, bool& hasColors) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hasColors = false;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* childNode = node->getChildAtIndex(i);
+        if (!childNode) {
+            continue;
+        }
+        if (childNode->isColored()) {
+            const int COLORED_CHILD = 1;
+            hashByte(hash, i);
+            hashByte(hash, COLORED_CHILD);
+            for (int j = 0; j < SIZE_OF_COLOR_DATA; j++) {
+                hashByte(hash, childNode->getTrueColor()[j]);
+            }
+            hasColors = true;
+            voxelCount++;
+        }
+        bool childHasColors;
+        uint64_t childHash = hashSubtree(childNode, voxelCount, childHasColors);
+        if (childHasColors) {
+            const int CHILD_SUBTREE = 2;
+            hashByte(hash, i);
+            hashByte(hash, CHILD_SUBTREE);
+            hashWord(hash, childHash);
+            hasColors = true;
+        }
+    }
+    return hash;
+}
+
+VoxelSubtreeVersion VoxelSubtreeVersions::computeVersion(VoxelNode* subtreeRoot) {
+    VoxelSubtreeVersion version = { 0, 0 };
+    bool hasColors;
+    version.hash = hashSubtree(subtreeRoot, version.voxelCount, hasColors);
+    if (version == NO_SUBTREE_VERSION) {
+        version.hash = 1;
+    }
+    return version;
+}
+
+// the sections follow a leading one bit, so that codes of different lengths get different keys
+uint32_t VoxelSubtreeVersions::keyForOctalCode(unsigned char* octalCode) {
+    uint32_t key = 1;
+    int sections = numberOfThreeBitSectionsInCode(octalCode);
+    for (int i = 0; i < sections; i++) {
+        key = (key << BITS_IN_OCTAL) | getOctalCodeSectionValue(octalCode, i);
+    }
+    return key;
+}
+
+unsigned char* VoxelSubtreeVersions::octalCodeForKey(uint32_t key) {
+    int sections = 0;
+    for (uint32_t remaining = key; remaining > 1; remaining >>= BITS_IN_OCTAL) {
+        sections++;
+    }
+    int codeBytes = bytesRequiredForCodeLength(sections);
+    unsigned char* octalCode = new unsigned char[codeBytes];
+    memset(octalCode, 0, codeBytes);
+    *octalCode = sections;
+    for (int i = sections - 1; i >= 0; i--) {
+        setOctalCodeSectionValue(octalCode, i, key & 0x07);
+        key >>= BITS_IN_OCTAL;
+    }
+    return octalCode;
+}
+
+VoxelSubtreeVersion VoxelSubtreeVersions::getVersionForKey(uint32_t key) const {
+    std::map<uint32_t, VoxelSubtreeVersion>::const_iterator it = _versions.find(key);
+    return (it == _versions.end()) ? NO_SUBTREE_VERSION : it->second;
+}
+
+void VoxelSubtreeVersions::setVersionForKey(uint32_t key, const VoxelSubtreeVersion& version) {
+    if (version == NO_SUBTREE_VERSION) {
+        _versions.erase(key);
+    } else {
+        _versions[key] = version;
+    }
+}
+
+int VoxelSubtreeVersions::writeToPacket(unsigned char* packet, int maxLength, PACKET_TYPE type, const_iterator& position,
+                                        PacketMode mode) const {
+    unsigned char* packetAt = packet + populateTypeAndVersion(packet, type);
+    *packetAt++ = mode;
+
+    for (; position != _versions.end(); position++) {
+        unsigned char* octalCode = octalCodeForKey(position->first);
+        int codeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(octalCode));
+        if (packetAt - packet + codeBytes + VERSION_BYTES > maxLength) {
+            delete[] octalCode;
+            break;
+        }
+        memcpy(packetAt, octalCode, codeBytes);
+        packetAt += codeBytes;
+        memcpy(packetAt, &position->second.hash, sizeof(position->second.hash));
+        packetAt += sizeof(position->second.hash);
+        memcpy(packetAt, &position->second.voxelCount, sizeof(position->second.voxelCount));
+        packetAt += sizeof(position->second.voxelCount);
+        delete[] octalCode;
+    }
+    return packetAt - packet;
+}
+
+int VoxelSubtreeVersions::readFromPacket(unsigned char* packet, int length) {
+    unsigned char* packetAt = packet + numBytesForPacketHeader(packet);
+    unsigned char* packetEnd = packet + length;
+    if (packetAt >= packetEnd) {
+        return 0;
+    }
+    unsigned char mode = *packetAt++;
+    if (mode == REPLACE_VERSIONS) {
+        _versions.clear();
+    }
+
+    int versionsRead = 0;
+    while (packetAt < packetEnd) {
+        int codeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(packetAt));
+        if (packetAt + codeBytes + VERSION_BYTES > packetEnd) {
+            break; // truncated
+        }
+        bool validCode = numberOfThreeBitSectionsInCode(packetAt) <= MAX_KEY_SECTIONS;
+        uint32_t key = validCode ? keyForOctalCode(packetAt) : 0;
+        packetAt += codeBytes;
+        VoxelSubtreeVersion version;
+        memcpy(&version.hash, packetAt, sizeof(version.hash));
+        packetAt += sizeof(version.hash);
+        memcpy(&version.voxelCount, packetAt, sizeof(version.voxelCount));
+        packetAt += sizeof(version.voxelCount);
+
+        if (validCode) {
+            setVersionForKey(key, (mode == REMOVE_VERSIONS) ? NO_SUBTREE_VERSION : version);
+            versionsRead++;
+        }
+    }
+    return versionsRead;
+}
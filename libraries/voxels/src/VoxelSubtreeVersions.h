@@ -0,0 +1,97 @@
+//
+//  VoxelSubtreeVersions.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Versions of the subtrees rooted at VERSIONED_SUBTREE_DEPTH, for clients that keep the subtrees they've been sent in a
+//  disk cache. A subtree's version is a 64 bit hash of the colored voxels in it along with how many there are, so the
+//  same content has the same version on every server and across restarts, and a client can tell that it has all of a
+//  subtree by hashing its own copy.
+//
+//  The same packet format goes both ways. Clients list the versions they have cached (PACKET_TYPE_VOXEL_CACHED_SUBTREES),
+//  and the voxel server lists the versions of the subtrees it reaches in the client's view
+//  (PACKET_TYPE_VOXEL_SUBTREE_VERSIONS), both the ones it sent and the ones it left out because the client has them.
+//
+
+#ifndef __hifi__VoxelSubtreeVersions__
+#define __hifi__VoxelSubtreeVersions__
+
+#include <map>
+#include <stdint.h>
+
+#include <PacketHeaders.h>
+
+class VoxelNode;
+
+const int VERSIONED_SUBTREE_DEPTH = 5; // 4 meter subtrees
+
+/// the hash of the colored voxels in a subtree, and how many of them went into it
+struct VoxelSubtreeVersion {
+    uint64_t hash;
+    uint32_t voxelCount;
+
+    bool operator==(const VoxelSubtreeVersion& other) const {
+        return hash == other.hash && voxelCount == other.voxelCount;
+    }
+    bool operator!=(const VoxelSubtreeVersion& other) const { return !(*this == other); }
+};
+
+const VoxelSubtreeVersion NO_SUBTREE_VERSION = { 0, 0 };
+
+class VoxelSubtreeVersions {
+public:
+    typedef std::map<uint32_t, VoxelSubtreeVersion>::const_iterator const_iterator;
+
+    /// what the receiver of a packet does with the versions in it
+    enum PacketMode {
+        ADD_VERSIONS,       // adds them to, or updates them in, what it has from the sender
+        REPLACE_VERSIONS,   // replaces everything it has from the sender with them
+        REMOVE_VERSIONS     // removes those subtrees, whatever their versions
+    };
+
+    /// hashes the colored voxels below the node, never returns NO_SUBTREE_VERSION
+    static VoxelSubtreeVersion computeVersion(VoxelNode* subtreeRoot);
+
+    static bool isVersionedSubtree(unsigned char* octalCode) { return *octalCode == VERSIONED_SUBTREE_DEPTH; }
+
+    /// packs an octal code of up to 10 sections into an integer key
+    static uint32_t keyForOctalCode(unsigned char* octalCode);
+
+    /// the octal code for a key, which the caller deletes
+    static unsigned char* octalCodeForKey(uint32_t key);
+
+    /// NO_SUBTREE_VERSION if there isn't one
+    VoxelSubtreeVersion getVersion(unsigned char* octalCode) const {
+        return getVersionForKey(keyForOctalCode(octalCode));
+    }
+    VoxelSubtreeVersion getVersionForKey(uint32_t key) const;
+
+    /// setting NO_SUBTREE_VERSION removes the subtree
+    void setVersion(unsigned char* octalCode, const VoxelSubtreeVersion& version) {
+        setVersionForKey(keyForOctalCode(octalCode), version);
+    }
+    void setVersionForKey(uint32_t key, const VoxelSubtreeVersion& version);
+
+    void clear() { _versions.clear(); }
+    void swap(VoxelSubtreeVersions& other) { _versions.swap(other._versions); }
+    int size() const { return _versions.size(); }
+    bool isEmpty() const { return _versions.empty(); }
+
+    /// iterates over key, version pairs
+    const_iterator begin() const { return _versions.begin(); }
+    const_iterator end() const { return _versions.end(); }
+
+    /// Writes a packet of the given type holding as many versions as will fit, starting at position, and moves position
+    /// past the ones written. Returns the length of the packet.
+    int writeToPacket(unsigned char* packet, int maxLength, PACKET_TYPE type, const_iterator& position,
+                      PacketMode mode = ADD_VERSIONS) const;
+
+    /// applies the versions in a packet, returns how many there were
+    int readFromPacket(unsigned char* packet, int length);
+
+private:
+    std::map<uint32_t, VoxelSubtreeVersion> _versions;
+};
+
+#endif /* defined(__hifi__VoxelSubtreeVersions__) */
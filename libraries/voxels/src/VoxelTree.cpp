@@ -10,10 +10,12 @@
 #define _USE_MATH_DEFINES
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 #include <cmath>
 #include <fstream> // to load voxels from file
+#include <vector>
 
 #include <glm/gtc/noise.hpp>
 
@@ -23,14 +25,22 @@
 
 #include "CoverageMap.h"
 #include "GeometryUtil.h"
+#include "IndexedSVOFile.h"
 #include "OctalCode.h"
 #include "PacketHeaders.h"
 #include "SharedUtil.h"
 #include "Tags.h"
 #include "ViewFrustum.h"
+#include "VoxelColorCoding.h"
 #include "VoxelConstants.h"
+#include "VoxelGrid.h"
 #include "VoxelNodeBag.h"
+#include "VoxelPacketChain.h"
+#include "VoxelSubtreeVersions.h"
 #include "VoxelTree.h"
+#include "VoxelTreePager.h"
+#include "VoxelTreeParallel.h"
+#include "VoxelTreeVisitor.h"
 
 float boundaryDistanceForRenderLevel(unsigned int renderLevel) {
     return ::VOXEL_SIZE_SCALE / powf(2, renderLevel);
@@ -49,8 +59,10 @@ VoxelTree::VoxelTree(bool shouldReaverage) :
     voxelsColoredStats(100),
     voxelsBytesReadStats(100),
     _isDirty(true),
+    _readBitstreamStarted(0),
     _shouldReaverage(shouldReaverage),
-    _stopImport(false) {
+    _stopImport(false),
+    _pager(NULL) {
     rootNode = new VoxelNode();
     
     pthread_mutex_init(&_encodeSetLock, NULL);
@@ -133,14 +145,8 @@ void VoxelTree::recurseTreeWithOperation(RecurseVoxelTreeOperation operation, vo
 
 // Recurses voxel node with an operation function
 void VoxelTree::recurseNodeWithOperation(VoxelNode* node, RecurseVoxelTreeOperation operation, void* extraData) {
-    if (operation(node, extraData)) {
-        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            VoxelNode* child = node->getChildAtIndex(i);
-            if (child) {
-                recurseNodeWithOperation(child, operation, extraData);
-            }
-        }
-    }
+    FunctionPointerVisitor visitor(operation, extraData);
+    visitNodes(node, visitor);
 }
 
 // Recurses voxel tree calling the RecurseVoxelTreeOperation function for each node.
@@ -154,35 +160,8 @@ void VoxelTree::recurseTreeWithOperationDistanceSorted(RecurseVoxelTreeOperation
 // Recurses voxel node with an operation function
 void VoxelTree::recurseNodeWithOperationDistanceSorted(VoxelNode* node, RecurseVoxelTreeOperation operation, 
                                                        const glm::vec3& point, void* extraData) {
-    if (operation(node, extraData)) {
-        // determine the distance sorted order of our children
-        VoxelNode*  sortedChildren[NUMBER_OF_CHILDREN];
-        float       distancesToChildren[NUMBER_OF_CHILDREN];
-        int         indexOfChildren[NUMBER_OF_CHILDREN]; // not really needed
-        int         currentCount = 0;
-
-        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            VoxelNode* childNode = node->getChildAtIndex(i);
-            if (childNode) {
-                // chance to optimize, doesn't need to be actual distance!! Could be distance squared
-                float distanceSquared = childNode->distanceSquareToPoint(point);
-                //qDebug("recurseNodeWithOperationDistanceSorted() CHECKING child[%d] point=%f,%f center=%f,%f distance=%f...\n", i, point.x, point.y, center.x, center.y, distance);
-                //childNode->printDebugDetails("");
-                currentCount = insertIntoSortedArrays((void*)childNode, distanceSquared, i,
-                                                      (void**)&sortedChildren, (float*)&distancesToChildren,
-                                                      (int*)&indexOfChildren, currentCount, NUMBER_OF_CHILDREN);
-            }
-        }
-
-        for (int i = 0; i < currentCount; i++) {
-            VoxelNode* childNode = sortedChildren[i];
-            if (childNode) {
-                //qDebug("recurseNodeWithOperationDistanceSorted() PROCESSING child[%d] distance=%f...\n", i, distancesToChildren[i]);
-                //childNode->printDebugDetails("");
-                recurseNodeWithOperationDistanceSorted(childNode, operation, point, extraData);
-            }
-        }
-    }
+    FunctionPointerVisitor visitor(operation, extraData);
+    visitNodesDistanceSorted(node, point, visitor);
 }
 
 
@@ -241,13 +220,36 @@ VoxelNode* VoxelTree::createMissingNode(VoxelNode* lastParentNode, unsigned char
 }
 
 int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData, int bytesLeftToRead,
-                            ReadBitstreamToTreeParams& args) {
+                            ReadBitstreamToTreeParams& args, const unsigned char* referenceColor) {
     // give this destination node the child mask from the packet
     const unsigned char ALL_CHILDREN_ASSUMED_TO_EXIST = 0xFF;
     unsigned char colorInPacketMask = *nodeData;
 
     // instantiate variable for bytes already read
     int bytesRead = sizeof(colorInPacketMask);
+
+    // coded colors are read all at once, and the colors of the children are kept for coding their own children against
+    unsigned char childColors[NUMBER_OF_CHILDREN][3];
+    if (args.includeColor && args.codeColors && colorInPacketMask) {
+        int colorCount = 0;
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            colorCount += oneAtBit(colorInPacketMask, i) ? 1 : 0;
+        }
+        unsigned char codedColors[NUMBER_OF_CHILDREN][3];
+        int codedBytes = decodeChildColors(nodeData + bytesRead, bytesLeftToRead - bytesRead, colorCount,
+                                           referenceColor, codedColors);
+        if (!codedBytes) {
+            qDebug("VoxelTree::readNodeData() bad coded colors, skipping the rest of the bitstream\n");
+            return bytesLeftToRead;
+        }
+        bytesRead += codedBytes;
+        for (int i = 0, coded = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(colorInPacketMask, i)) {
+                memcpy(childColors[i], codedColors[coded++], 3);
+            }
+        }
+    }
+
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         // check the colors mask to see if we have a child to color in
         if (oneAtBit(colorInPacketMask, i)) {
@@ -255,7 +257,7 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
             if (!destinationNode->getChildAtIndex(i)) {
                 destinationNode->addChildAtIndex(i);
                 if (destinationNode->isDirty()) {
-                    _isDirty = true;
+                    setDirtyBit();
                     _nodesChangedFromBitstream++;
                 }
                 voxelsCreated++;
@@ -264,8 +266,11 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
 
             // pull the color for this child
             nodeColor newColor = { 128, 128, 128, 1};
-            if (args.includeColor) {
+            if (args.includeColor && args.codeColors) {
+                memcpy(newColor, childColors[i], 3);
+            } else if (args.includeColor) {
                 memcpy(newColor, nodeData + bytesRead, 3);
+                memcpy(childColors[i], newColor, 3);
                 bytesRead += 3;
             }
             bool nodeWasDirty = destinationNode->getChildAtIndex(i)->isDirty();
@@ -273,7 +278,7 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
             destinationNode->getChildAtIndex(i)->setSourceID(args.sourceID);
             bool nodeIsDirty = destinationNode->getChildAtIndex(i)->isDirty();
             if (nodeIsDirty) {
-                _isDirty = true;
+                setDirtyBit();
             }
             if (!nodeWasDirty && nodeIsDirty) {
                 _nodesChangedFromBitstream++;
@@ -300,7 +305,7 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
                 destinationNode->addChildAtIndex(childIndex);
                 bool nodeIsDirty = destinationNode->isDirty();
                 if (nodeIsDirty) {
-                    _isDirty = true;
+                    setDirtyBit();
                 }
                 if (!nodeWasDirty && nodeIsDirty) {
                     _nodesChangedFromBitstream++;
@@ -311,7 +316,8 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
 
             // tell the child to read the subsequent data
             bytesRead += readNodeData(destinationNode->getChildAtIndex(childIndex),
-                                      nodeData + bytesRead, bytesLeftToRead - bytesRead, args);
+                                      nodeData + bytesRead, bytesLeftToRead - bytesRead, args,
+                                      oneAtBit(colorInPacketMask, childIndex) ? childColors[childIndex] : NULL);
         }
         childIndex++;
     }
@@ -322,7 +328,18 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
             // subtree/node, because it shouldn't actually exist in the tree.
             if (!oneAtBit(childrenInTreeMask, i) && destinationNode->getChildAtIndex(i)) {
                 destinationNode->safeDeepDeleteChildAtIndex(i);
-                _isDirty = true; // by definition!
+                setDirtyBit(); // by definition!
+            }
+        }
+    }
+
+    // a change read in below this node leaves its time on this node too, so that the time covers the whole subtree
+    if (destinationNode->getLastChanged() < _readBitstreamStarted) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* child = destinationNode->getChildAtIndex(i);
+            if (child && child->getLastChanged() >= _readBitstreamStarted) {
+                destinationNode->markWithChangedTime();
+                break;
             }
         }
     }
@@ -340,6 +357,7 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
     }
 
     _nodesChangedFromBitstream = 0;
+    _readBitstreamStarted = usecTimestampNow();
 
     // Keep looping through the buffer calling readNodeData() this allows us to pack multiple root-relative Octal codes
     // into a single network packet. readNodeData() basically goes down a tree from the root, and fills things in from there
@@ -355,7 +373,7 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
             // octal code is always relative to root!
             bitstreamRootNode = createMissingNode(args.destinationNode, (unsigned char*) bitstreamAt);
             if (bitstreamRootNode->isDirty()) {
-                _isDirty = true;
+                setDirtyBit();
                 _nodesChangedFromBitstream++;
             }
         }
@@ -366,6 +384,13 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
         theseBytesRead += readNodeData(bitstreamRootNode, bitstreamAt + octalCodeBytes, 
                                        bufferSizeBytes - (bytesRead + octalCodeBytes), args);
 
+        // readNodeData() marked the changed nodes up to where it started, the rest of the way up to the root is marked here
+        if (bitstreamRootNode->getLastChanged() >= _readBitstreamStarted) {
+            for (VoxelNode* ancestor = bitstreamRootNode->getParent(); ancestor; ancestor = ancestor->getParent()) {
+                ancestor->markWithChangedTime();
+            }
+        }
+
         // skip bitstream to new startPoint
         bitstreamAt += theseBytesRead;
         bytesRead +=  theseBytesRead;
@@ -464,7 +489,7 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
                 ancestorNode->setColor(node->getColor());
             }
         }
-        _isDirty = true;
+        setDirtyBit();
         args->pathChanged = true;
 
         // ends recursion, unwinds up stack
@@ -488,7 +513,7 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
         node->deleteChildAtIndex(childIndex); // note: this will track dirtiness and lastChanged for this node
 
         // track our tree dirtiness
-        _isDirty = true;
+        setDirtyBit();
 
         // track that path has changed
         args->pathChanged = true;
@@ -516,7 +541,7 @@ void VoxelTree::eraseAllVoxels() {
     // XXXBHG Hack attack - is there a better way to erase the voxel tree?
     delete rootNode; // this will recurse and delete all children
     rootNode = new VoxelNode();
-    _isDirty = true;
+    setDirtyBit();
 }
 
 class ReadCodeColorBufferToTreeArgs {
@@ -549,39 +574,10 @@ void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraD
     // Since we traverse the tree in code order, we know that if our code
     // matches, then we've reached  our target node.
     if (lengthOfNodeCode == args->lengthOfCode) {
-        // we've reached our target -- we might have found our node, but that node might have children.
-        // in this case, we only allow you to set the color if you explicitly asked for a destructive
-        // write.
-        if (!node->isLeaf() && args->destructive) {
-            // if it does exist, make sure it has no children
-            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-                node->deleteChildAtIndex(i);
-            }
-        } else {
-            if (!node->isLeaf()) {
-                qDebug("WARNING! operation would require deleting children, add Voxel ignored!\n ");
-            }
-        }
-
-        // If we get here, then it means, we either had a true leaf to begin with, or we were in
-        // destructive mode and we deleted all the child trees. So we can color.
-        if (node->isLeaf()) {
-            // give this node its color
-            int octalCodeBytes = bytesRequiredForCodeLength(args->lengthOfCode);
-
-            nodeColor newColor;
-            memcpy(newColor, args->codeColorBuffer + octalCodeBytes, SIZE_OF_COLOR_DATA);
-            newColor[SIZE_OF_COLOR_DATA] = 1;
-            node->setColor(newColor);
-
-            // It's possible we just reset the node to it's exact same color, in
-            // which case we don't consider this to be dirty...
-            if (node->isDirty()) {
-                // track our tree dirtiness
-                _isDirty = true;
-                // track that path has changed
-                args->pathChanged = true;
-            }
+        int octalCodeBytes = bytesRequiredForCodeLength(args->lengthOfCode);
+        if (setVoxelColor(node, args->codeColorBuffer + octalCodeBytes, args->destructive)) {
+            // track that path has changed
+            args->pathChanged = true;
         }
         return;
     }
@@ -607,6 +603,42 @@ void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraD
     }
 }
 
+// Colors the voxel a code color buffer is for, returning true if that changed it
+bool VoxelTree::setVoxelColor(VoxelNode* node, const unsigned char* color, bool destructive) {
+    // we've reached our target -- we might have found our node, but that node might have children.
+    // in this case, we only allow you to set the color if you explicitly asked for a destructive
+    // write.
+    if (!node->isLeaf() && destructive) {
+        // if it does exist, make sure it has no children
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            node->deleteChildAtIndex(i);
+        }
+    } else {
+        if (!node->isLeaf()) {
+            qDebug("WARNING! operation would require deleting children, add Voxel ignored!\n ");
+        }
+    }
+
+    // If we get here, then it means, we either had a true leaf to begin with, or we were in
+    // destructive mode and we deleted all the child trees. So we can color.
+    if (node->isLeaf()) {
+        // give this node its color
+        nodeColor newColor;
+        memcpy(newColor, color, SIZE_OF_COLOR_DATA);
+        newColor[SIZE_OF_COLOR_DATA] = 1;
+        node->setColor(newColor);
+
+        // It's possible we just reset the node to it's exact same color, in
+        // which case we don't consider this to be dirty...
+        if (node->isDirty()) {
+            // track our tree dirtiness
+            setDirtyBit();
+            return true;
+        }
+    }
+    return false;
+}
+
 void VoxelTree::processRemoveVoxelBitstream(unsigned char * bitstream, int bufferSizeBytes) {
     //unsigned short int itemNumber = (*((unsigned short int*)&bitstream[sizeof(PACKET_HEADER)]));
     int atByte = sizeof(short int) + numBytesForPacketHeader(bitstream);
@@ -669,26 +701,35 @@ void VoxelTree::printTreeForDebugging(VoxelNode *startNode) {
 }
 
 // Note: this is an expensive call. Don't call it unless you really need to reaverage the entire tree (from startNode)
-void VoxelTree::reaverageVoxelColors(VoxelNode *startNode) {
-    // if our tree is a reaveraging tree, then we do this, otherwise we don't do anything
-    if (_shouldReaverage) {
-        bool hasChildren = false;
+// averages each node's color from its children's once the children have been averaged themselves
+class ReaverageVisitor {
+public:
+    bool visit(VoxelNode* node) {
+        return true;
+    }
 
+    void postVisit(VoxelNode* node) {
+        bool hasChildren = false;
         for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            if (startNode->getChildAtIndex(i)) {
-                reaverageVoxelColors(startNode->getChildAtIndex(i));
+            if (node->getChildAtIndex(i)) {
                 hasChildren = true;
+                break;
             }
         }
 
         // collapseIdenticalLeaves() returns true if it collapses the leaves
         // in which case we don't need to set the average color
-        if (hasChildren && !startNode->collapseIdenticalLeaves()) {
-            startNode->setColorFromAverageOfChildren();
+        if (hasChildren && !node->collapseIdenticalLeaves()) {
+            node->setColorFromAverageOfChildren();
         }
-        
-        // this is also a good time to recalculateSubTreeNodeCount()
-        startNode->recalculateSubTreeNodeCount();
+    }
+};
+
+void VoxelTree::reaverageVoxelColors(VoxelNode *startNode) {
+    // if our tree is a reaveraging tree, then we do this, otherwise we don't do anything
+    if (_shouldReaverage) {
+        ReaverageVisitor visitor;
+        visitNodesPostOrder(startNode, visitor);
     }
 }
 
@@ -745,23 +786,131 @@ void VoxelTree::loadVoxelsFile(const char* fileName, bool wantColorRandomizer) {
     }
 }
 
-VoxelNode* VoxelTree::getVoxelAt(float x, float y, float z, float s) const {
-    unsigned char* octalCode = pointToVoxel(x,y,z,s,0,0,0);
-    VoxelNode* node = nodeForOctalCode(rootNode, octalCode, NULL);
-    if (*node->getOctalCode() != *octalCode) {
-        node = NULL;
+VoxelSubtreeVersion VoxelTree::getSubtreeVersion(VoxelNode* node) const {
+    uint64_t now = usecTimestampNow();
+    SubtreeVersion& subtreeVersion = _subtreeVersions[VoxelSubtreeVersions::keyForOctalCode(node->getOctalCode())];
+    if (subtreeVersion.version == NO_SUBTREE_VERSION || node->getLastChanged() >= subtreeVersion.computedAt) {
+        subtreeVersion.version = VoxelSubtreeVersions::computeVersion(node);
+        subtreeVersion.computedAt = now;
     }
-    delete[] octalCode; // cleanup memory
-    return node;
+    return subtreeVersion.version;
+}
+
+VoxelNode* VoxelTree::getVoxelAt(float x, float y, float z, float s) const {
+    return getVoxelAt(pointToVoxelCoordinates(x, y, z, s));
 }
 
 void VoxelTree::createVoxel(float x, float y, float z, float s,
                             unsigned char red, unsigned char green, unsigned char blue, bool destructive) {
-    unsigned char* voxelData = pointToVoxel(x,y,z,s,red,green,blue);
-    this->readCodeColorBufferToTree(voxelData, destructive);
-    delete[] voxelData;
+    createVoxel(pointToVoxelCoordinates(x, y, z, s, red, green, blue), destructive);
 }
 
+// the child a voxel is under, going down from the given depth, with the x, y and z bits in the same places as in an
+// octal code
+static inline int childIndexForVoxel(const VoxelCoordinates& voxel, int depth) {
+    int shift = voxel.level - depth - 1;
+    return (((voxel.x >> shift) & 1) << 2) | (((voxel.y >> shift) & 1) << 1) | ((voxel.z >> shift) & 1);
+}
+
+VoxelNode* VoxelTree::getVoxelAt(const VoxelCoordinates& voxel) const {
+    VoxelNode* node = rootNode;
+    for (int depth = 0; node && depth < voxel.level; depth++) {
+        node = node->getChildAtIndex(childIndexForVoxel(voxel, depth));
+    }
+    return node;
+}
+
+void VoxelTree::createVoxel(const VoxelCoordinates& voxel, bool destructive) {
+    createVoxels(&voxel, 1, destructive);
+}
+
+void VoxelTree::createVoxels(const VoxelCoordinates* voxels, int count, bool destructive) {
+    // the nodes from the root down to the last voxel, which of their children the path takes, and whether anything under
+    // them has changed since the path reached them
+    VoxelNode* path[MAX_VOXEL_COORDINATES_LEVEL + 1];
+    int pathChildIndexes[MAX_VOXEL_COORDINATES_LEVEL];
+    bool pathChanged[MAX_VOXEL_COORDINATES_LEVEL + 1];
+    int pathDepth = 0;
+    path[0] = rootNode;
+    pathChanged[0] = false;
+
+    for (int i = 0; i < count; i++) {
+        const VoxelCoordinates& voxel = voxels[i];
+        int level = voxel.level;
+
+        // keep what this voxel's path has in common with the last one's...
+        int sharedDepth = 0;
+        while (sharedDepth < pathDepth && sharedDepth < level &&
+               pathChildIndexes[sharedDepth] == childIndexForVoxel(voxel, sharedDepth)) {
+            sharedDepth++;
+        }
+
+        // ...letting the nodes below that know they've changed, as readCodeColorBufferToTree() does when unwinding
+        for (; pathDepth > sharedDepth; pathDepth--) {
+            if (pathChanged[pathDepth]) {
+                path[pathDepth]->handleSubtreeChanged(this);
+            }
+        }
+
+        // and go the rest of the way down, creating the branches that don't exist
+        for (; pathDepth < level; pathDepth++) {
+            int childIndex = childIndexForVoxel(voxel, pathDepth);
+            VoxelNode* childNode = path[pathDepth]->getChildAtIndex(childIndex);
+            if (!childNode) {
+                childNode = path[pathDepth]->addChildAtIndex(childIndex);
+            }
+            pathChildIndexes[pathDepth] = childIndex;
+            path[pathDepth + 1] = childNode;
+            pathChanged[pathDepth + 1] = false;
+        }
+
+        unsigned char color[SIZE_OF_COLOR_DATA] = { voxel.red, voxel.green, voxel.blue };
+        if (setVoxelColor(path[pathDepth], color, destructive)) {
+            for (int depth = 0; depth < pathDepth; depth++) {
+                pathChanged[depth] = true;
+            }
+        }
+    }
+
+    for (; pathDepth >= 0; pathDepth--) {
+        if (pathChanged[pathDepth]) {
+            path[pathDepth]->handleSubtreeChanged(this);
+        }
+    }
+}
+
+// true if the highest bit set in first is lower than the highest bit set in second
+static inline bool highestBitIsLower(uint64_t first, uint64_t second) {
+    return first < second && first < (first ^ second);
+}
+
+// Voxels in the order of their octal codes: compared at the deeper of their levels, the first coordinate to differ in the
+// highest bit decides, x before y before z, and a voxel comes before the ones inside it.
+static bool voxelCoordinatesLessThan(const VoxelCoordinates& first, const VoxelCoordinates& second) {
+    int level = std::max(first.level, second.level);
+    uint64_t firstPosition[3] = { (uint64_t)first.x << (level - first.level), (uint64_t)first.y << (level - first.level),
+                                  (uint64_t)first.z << (level - first.level) };
+    uint64_t secondPosition[3] = { (uint64_t)second.x << (level - second.level),
+                                   (uint64_t)second.y << (level - second.level),
+                                   (uint64_t)second.z << (level - second.level) };
+    int deciding = 0;
+    uint64_t decidingDifference = firstPosition[0] ^ secondPosition[0];
+    for (int axis = 1; axis < 3; axis++) {
+        uint64_t difference = firstPosition[axis] ^ secondPosition[axis];
+        if (highestBitIsLower(decidingDifference, difference)) {
+            deciding = axis;
+            decidingDifference = difference;
+        }
+    }
+    if (decidingDifference == 0) {
+        return first.level < second.level;
+    }
+    return firstPosition[deciding] < secondPosition[deciding];
+}
+
+void VoxelTree::sortVoxelCoordinates(VoxelCoordinates* voxels, int count) {
+    std::stable_sort(voxels, voxels + count, voxelCoordinatesLessThan);
+}
 
 void VoxelTree::createLine(glm::vec3 point1, glm::vec3 point2, float unitSize, rgbColor color, bool destructive) {
     glm::vec3 distance = point2 - point1;
@@ -769,9 +918,26 @@ void VoxelTree::createLine(glm::vec3 point1, glm::vec3 point2, float unitSize, r
     int maxItems = std::max(items.x, std::max(items.y, items.z));
     glm::vec3 increment = distance * (1.0f/ maxItems);
     glm::vec3 pointAt = point1;
+    std::vector<VoxelCoordinates> voxels;
     for (int i = 0; i <= maxItems; i++ ) {
         pointAt += increment;
-        createVoxel(pointAt.x, pointAt.y, pointAt.z, unitSize, color[0], color[1], color[2], destructive);
+        voxels.push_back(pointToVoxelCoordinates(pointAt.x, pointAt.y, pointAt.z, unitSize,
+                                                 color[0], color[1], color[2]));
+    }
+    if (!voxels.empty()) {
+        createVoxels(&voxels[0], voxels.size(), destructive);
+    }
+}
+
+// The voxels of a sphere are all the same size, so putting them in tree order doesn't change what gets made of them, and
+// consecutive voxels share most of the path to them
+const size_t SPHERE_VOXELS_PER_BATCH = 65536;
+
+void VoxelTree::createSphereVoxels(std::vector<VoxelCoordinates>& voxels, bool destructive) {
+    if (!voxels.empty()) {
+        sortVoxelCoordinates(&voxels[0], voxels.size());
+        createVoxels(&voxels[0], voxels.size(), destructive);
+        voxels.clear();
     }
 }
 
@@ -821,6 +987,9 @@ void VoxelTree::createSphere(float radius, float xc, float yc, float zc, float v
         thisVoxelSize = voxelSize;
     }
 
+    // the voxels are created in batches, which is quicker than one at a time
+    std::vector<VoxelCoordinates> voxels;
+
     // If you also iterate form the interior of the sphere to the radius, making
     // larger and larger spheres you'd end up with a solid sphere. And lots of voxels!
     bool lastLayer = false;
@@ -892,19 +1061,105 @@ void VoxelTree::createSphere(float radius, float xc, float yc, float zc, float v
                             x = xc + (thisRadius + i * subVoxelScale) * cos(theta) * sin(phi);
                             y = yc + (thisRadius + i * subVoxelScale) * sin(theta) * sin(phi);
                             z = zc + (thisRadius + i * subVoxelScale) * cos(phi);
-                            this->createVoxel(x, y, z, subVoxelScale, red, green, blue, destructive);
+                            voxels.push_back(pointToVoxelCoordinates(x, y, z, subVoxelScale, red, green, blue));
                         }
                         naturalSurfaceRendered = true;
                     }
                 }
                 if (!naturalSurfaceRendered) {
-                    this->createVoxel(x, y, z, thisVoxelSize, red, green, blue, destructive);
+                    voxels.push_back(pointToVoxelCoordinates(x, y, z, thisVoxelSize, red, green, blue));
+                }
+                if (voxels.size() >= SPHERE_VOXELS_PER_BATCH) {
+                    createSphereVoxels(voxels, destructive);
                 }
             }
         }
         thisRadius += thisVoxelSize;
         thisVoxelSize = std::max(voxelSize, thisVoxelSize / 2.0f);
     }
+    createSphereVoxels(voxels, destructive);
+}
+
+class CreateVoxelsFromGridArgs {
+public:
+    const VoxelGrid*    grid;
+    uint64_t            voxelsDone;     // how much of the grid has been done, in voxels at the grid's level
+    uint64_t            voxelsTotal;
+    int                 percentDone;
+};
+
+// how many of the grid's voxels are in the cell at a level
+static uint64_t gridVoxelsInCell(const VoxelGrid& grid, int level, int x, int y, int z) {
+    int shift = grid.getLevel() - level;
+    uint64_t width = std::max(0, std::min((x + 1) << shift, grid.getWidth()) - (x << shift));
+    uint64_t height = std::max(0, std::min((y + 1) << shift, grid.getHeight()) - (y << shift));
+    uint64_t length = std::max(0, std::min((z + 1) << shift, grid.getLength()) - (z << shift));
+    return width * height * length;
+}
+
+bool VoxelTree::createVoxelsFromGrid(const VoxelGrid& grid) {
+    CreateVoxelsFromGridArgs args;
+    args.grid        = &grid;
+    args.voxelsDone  = 0;
+    args.voxelsTotal = std::max((uint64_t)1, gridVoxelsInCell(grid, 0, 0, 0, 0));
+    args.percentDone = 0;
+
+    if (grid.getCell(0, 0, 0, 0) != VoxelGrid::EMPTY_CELL) {
+        createVoxelsFromGridRecursion(rootNode, 0, 0, 0, 0, &args);
+    }
+    return !_stopImport;
+}
+
+void VoxelTree::createVoxelsFromGridRecursion(VoxelNode* node, int level, int x, int y, int z, void* extraData) {
+    CreateVoxelsFromGridArgs* args = (CreateVoxelsFromGridArgs*)extraData;
+    uint32_t cell = args->grid->getCell(level, x, y, z);
+    unsigned char color[SIZE_OF_COLOR_DATA];
+    VoxelGrid::getCellColor(cell, color);
+
+    if (VoxelGrid::isUniformCell(cell)) {
+        // all one color, which takes the place of anything below
+        setVoxelColor(node, color, true);
+
+    } else if (level == args->grid->getLevel()) {
+        // a voxel with only some of its children
+        int children = VoxelGrid::getCellChildren(cell);
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (children & (1 << i)) {
+                VoxelNode* childNode = node->getChildAtIndex(i);
+                if (!childNode) {
+                    childNode = node->addChildAtIndex(i);
+                }
+                setVoxelColor(childNode, color, true);
+            }
+        }
+        node->handleSubtreeChanged(this);
+
+    } else {
+        // a mix, which is worked out child by child
+        for (int i = 0; i < NUMBER_OF_CHILDREN && !_stopImport; i++) {
+            int childX = x * 2 + ((i >> 2) & 1);
+            int childY = y * 2 + ((i >> 1) & 1);
+            int childZ = z * 2 + (i & 1);
+            if (args->grid->getCell(level + 1, childX, childY, childZ) == VoxelGrid::EMPTY_CELL) {
+                args->voxelsDone += gridVoxelsInCell(*args->grid, level + 1, childX, childY, childZ);
+                continue;
+            }
+            VoxelNode* childNode = node->getChildAtIndex(i);
+            if (!childNode) {
+                childNode = node->addChildAtIndex(i);
+            }
+            createVoxelsFromGridRecursion(childNode, level + 1, childX, childY, childZ, args);
+        }
+        node->handleSubtreeChanged(this);
+        return;
+    }
+
+    args->voxelsDone += gridVoxelsInCell(*args->grid, level, x, y, z);
+    int percentDone = (int)(100 * args->voxelsDone / args->voxelsTotal);
+    if (percentDone != args->percentDone) {
+        args->percentDone = percentDone;
+        emit importProgress(percentDone);
+    }
 }
 
 // combines the ray cast arguments into a single object
@@ -912,78 +1167,198 @@ class RayArgs {
 public:
     glm::vec3 origin;
     glm::vec3 direction;
+    glm::vec3 inverseDirection;
     VoxelNode*& node;
     float& distance;
     BoxFace& face;
     bool found;
 };
 
-bool findRayIntersectionOp(VoxelNode* node, void* extraData) {
-    RayArgs* args = static_cast<RayArgs*>(extraData);
-    AABox box = node->getAABox();
-    float distance;
-    BoxFace face;
-    if (!box.findRayIntersection(args->origin, args->direction, distance, face)) {
-        return false;
+// Walks the tree front to back along the ray. The node's midplanes split [enterDistance, exitDistance] into at most
+// four segments, one per child the ray passes through, and we visit those children in the order the ray passes
+// through them. Since children are disjoint, the first colored leaf we hit is the closest one and we stop there.
+// Distances are in voxel units, and are measured along the (unnormalized) direction.
+static bool findRayIntersectionFrontToBack(VoxelNode* node, float enterDistance, float exitDistance, RayArgs& args) {
+    if (node->isLeaf()) {
+        if (!node->isColored()) {
+            return false;
+        }
+        // let the box work out the exact distance and face, so that we match what the box would have told us
+        float distance;
+        BoxFace face;
+        if (!node->getAABox().findRayIntersection(args.origin, args.direction, distance, face)) {
+            return false; // grazed an edge
+        }
+        args.node = node;
+        args.distance = distance * TREE_SCALE;
+        args.face = face;
+        args.found = true;
+        return true;
     }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
+
+    const glm::vec3& center = node->getCenter();
+    const int CHILD_AXIS_BITS[3] = { 4, 2, 1 }; // x, y, z bits of the child index, see copyFirstVertexForCode()
+    float midplaneDistance[3];
+    int childIndex = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (args.direction[axis] == 0.0f) {
+            midplaneDistance[axis] = FLT_MAX; // never crosses this midplane
+            if (args.origin[axis] >= center[axis]) {
+                childIndex |= CHILD_AXIS_BITS[axis];
+            }
+        } else {
+            midplaneDistance[axis] = (center[axis] - args.origin[axis]) * args.inverseDirection[axis];
+            bool onHighSide = args.direction[axis] > 0.0f ? (midplaneDistance[axis] <= enterDistance)
+                                                          : (midplaneDistance[axis] > enterDistance);
+            if (onHighSide) {
+                childIndex |= CHILD_AXIS_BITS[axis];
+            }
+        }
     }
-    distance *= TREE_SCALE;
-    if (node->isColored() && (!args->found || distance < args->distance)) {
-        args->node = node;
-        args->distance = distance;
-        args->face = face;
-        args->found = true;
+
+    // the order the ray crosses the midplanes in is the order it moves between children
+    int crossingAxes[3] = { 0, 1, 2 };
+    for (int i = 1; i < 3; i++) {
+        for (int j = i; j > 0 && midplaneDistance[crossingAxes[j]] < midplaneDistance[crossingAxes[j - 1]]; j--) {
+            std::swap(crossingAxes[j], crossingAxes[j - 1]);
+        }
+    }
+
+    // midplanes behind us are already accounted for in the child we start in
+    int crossing = 0;
+    while (crossing < 3 && midplaneDistance[crossingAxes[crossing]] <= enterDistance) {
+        crossing++;
+    }
+    float segmentStart = enterDistance;
+    while (true) {
+        bool crossesMidplane = crossing < 3 && midplaneDistance[crossingAxes[crossing]] < exitDistance;
+        float segmentEnd = crossesMidplane ? midplaneDistance[crossingAxes[crossing]] : exitDistance;
+        VoxelNode* child = node->getChildAtIndex(childIndex);
+        if (child && findRayIntersectionFrontToBack(child, segmentStart, segmentEnd, args)) {
+            return true;
+        }
+        if (!crossesMidplane) {
+            break; // we've left the node
+        }
+        // a ray through an edge or a corner crosses two or three midplanes at once, and moves across all of them
+        do {
+            childIndex ^= CHILD_AXIS_BITS[crossingAxes[crossing++]];
+        } while (crossing < 3 && midplaneDistance[crossingAxes[crossing]] == segmentEnd);
+        segmentStart = segmentEnd;
     }
     return false;
 }
 
+static bool findRayIntersectionWithArgs(VoxelNode* rootNode, RayArgs& args) {
+    // clip the ray against the root's box
+    const AABox& box = rootNode->getAABox();
+    float enterDistance = 0.0f;
+    float exitDistance = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        if (args.direction[axis] == 0.0f) {
+            if (args.origin[axis] < box.getCorner()[axis] ||
+                    args.origin[axis] > box.getCorner()[axis] + box.getSize()[axis]) {
+                return false;
+            }
+            args.inverseDirection[axis] = 0.0f;
+        } else {
+            args.inverseDirection[axis] = 1.0f / args.direction[axis];
+            float nearDistance = (box.getCorner()[axis] - args.origin[axis]) * args.inverseDirection[axis];
+            float farDistance = (box.getCorner()[axis] + box.getSize()[axis] - args.origin[axis]) * args.inverseDirection[axis];
+            if (nearDistance > farDistance) {
+                std::swap(nearDistance, farDistance);
+            }
+            enterDistance = std::max(enterDistance, nearDistance);
+            exitDistance = std::min(exitDistance, farDistance);
+        }
+    }
+    if (enterDistance > exitDistance) {
+        return false;
+    }
+    return findRayIntersectionFrontToBack(rootNode, enterDistance, exitDistance, args);
+}
+
 bool VoxelTree::findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
                                     VoxelNode*& node, float& distance, BoxFace& face) {
-    RayArgs args = { origin / (float)TREE_SCALE, direction, node, distance, face };
-    recurseTreeWithOperation(findRayIntersectionOp, &args);
-    return args.found;
+    RayArgs args = { origin / (float)TREE_SCALE, direction, glm::vec3(), node, distance, face, false };
+    return findRayIntersectionWithArgs(rootNode, args);
+}
+
+int VoxelTree::findRayIntersections(RayIntersectionQuery* queries, int queryCount) {
+    int hits = 0;
+    for (int i = 0; i < queryCount; i++) {
+        RayIntersectionQuery& query = queries[i];
+        RayArgs args = { query.origin / (float)TREE_SCALE, query.direction, glm::vec3(),
+                         query.node, query.distance, query.face, false };
+        query.found = findRayIntersectionWithArgs(rootNode, args);
+        if (query.found) {
+            hits++;
+        }
+    }
+    return hits;
 }
 
-class SphereArgs {
+class SpherePenetrationVisitor {
 public:
+    SpherePenetrationVisitor(const glm::vec3& center, float radius, glm::vec3& penetration) :
+        center(center), radius(radius), penetration(penetration), found(false) { };
+
+    bool visit(VoxelNode* node) {
+        // coarse check against bounds
+        const AABox& box = node->getAABox();
+        if (!box.expandedContains(center, radius)) {
+            return false;
+        }
+        if (!node->isLeaf()) {
+            return true; // recurse on children
+        }
+        if (node->isColored()) {
+            glm::vec3 nodePenetration;
+            if (box.findSpherePenetration(center, radius, nodePenetration)) {
+                penetration = addPenetrations(penetration, nodePenetration * (float)TREE_SCALE);
+                found = true;
+            }
+        }
+        return false;
+    }
+
     glm::vec3 center;
     float radius;
     glm::vec3& penetration;
     bool found;
 };
 
-bool findSpherePenetrationOp(VoxelNode* node, void* extraData) {
-    SphereArgs* args = static_cast<SphereArgs*>(extraData);
-
-    // coarse check against bounds
-    const AABox& box = node->getAABox();
-    if (!box.expandedContains(args->center, args->radius)) {
-        return false;
-    }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
-    }
-    if (node->isColored()) {
-        glm::vec3 nodePenetration;
-        if (box.findSpherePenetration(args->center, args->radius, nodePenetration)) {
-            args->penetration = addPenetrations(args->penetration, nodePenetration * (float)TREE_SCALE);
-            args->found = true;
-        }
-    }
-    return false;
-}
-
 bool VoxelTree::findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration) {
-    SphereArgs args = { center / (float)TREE_SCALE, radius / TREE_SCALE, penetration };
     penetration = glm::vec3(0.0f, 0.0f, 0.0f);
-    recurseTreeWithOperation(findSpherePenetrationOp, &args);
-    return args.found;
+    SpherePenetrationVisitor visitor(center / (float)TREE_SCALE, radius / TREE_SCALE, penetration);
+    visitNodes(rootNode, visitor);
+    return visitor.found;
 }
 
-class CapsuleArgs {
+class CapsulePenetrationVisitor {
 public:
+    CapsulePenetrationVisitor(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration) :
+        start(start), end(end), radius(radius), penetration(penetration), found(false) { };
+
+    bool visit(VoxelNode* node) {
+        // coarse check against bounds
+        const AABox& box = node->getAABox();
+        if (!box.expandedIntersectsSegment(start, end, radius)) {
+            return false;
+        }
+        if (!node->isLeaf()) {
+            return true; // recurse on children
+        }
+        if (node->isColored()) {
+            glm::vec3 nodePenetration;
+            if (box.findCapsulePenetration(start, end, radius, nodePenetration)) {
+                penetration = addPenetrations(penetration, nodePenetration * (float)TREE_SCALE);
+                found = true;
+            }
+        }
+        return false;
+    }
+
     glm::vec3 start;
     glm::vec3 end;
     float radius;
@@ -991,48 +1366,22 @@ public:
     bool found;
 };
 
-bool findCapsulePenetrationOp(VoxelNode* node, void* extraData) {
-    CapsuleArgs* args = static_cast<CapsuleArgs*>(extraData);
-
-    // coarse check against bounds
-    const AABox& box = node->getAABox();
-    if (!box.expandedIntersectsSegment(args->start, args->end, args->radius)) {
-        return false;
-    }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
-    }
-    if (node->isColored()) {
-        glm::vec3 nodePenetration;
-        if (box.findCapsulePenetration(args->start, args->end, args->radius, nodePenetration)) {
-            args->penetration = addPenetrations(args->penetration, nodePenetration * (float)TREE_SCALE);
-            args->found = true;
-        }
-    }
-    return false;
-}
-
 bool VoxelTree::findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration) {
-    CapsuleArgs args = { start / (float)TREE_SCALE, end / (float)TREE_SCALE, radius / TREE_SCALE, penetration };
     penetration = glm::vec3(0.0f, 0.0f, 0.0f);
-    recurseTreeWithOperation(findCapsulePenetrationOp, &args);
-    return args.found;
+    CapsulePenetrationVisitor visitor(start / (float)TREE_SCALE, end / (float)TREE_SCALE, radius / TREE_SCALE, penetration);
+    visitNodes(rootNode, visitor);
+    return visitor.found;
 }
 
-int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag,
-                                   EncodeBitstreamParams& params) {
+// At any given point in writing the bitstream, the largest minimum we might need to flesh out the current level is 1 byte
+// for child colors + the colors themselves + 2 bytes for child trees. There could be sub trees below this point, which
+// might take many more bytes, but that's ok, because we can always mark our subtrees as not existing and stop the packet
+// at this point, then start up with a new packet for the remaining sub trees.
+const int MAX_LEVEL_BYTES = sizeof(unsigned char) + MAX_CODED_CHILD_COLORS_BYTES + 2 * sizeof(unsigned char);
+const int MAX_SECTION_CODE_BYTES = 128; // more than the 97 bytes of a code with the most sections a code can have
 
-    startEncoding(node);
-    // How many bytes have we written so far at this level;
-    int bytesWritten = 0;
-    
-    // If we're at a node that is out of view, then we can return, because no nodes below us will be in view!
-    if (params.viewFrustum && !node->isInView(*params.viewFrustum)) {
-        doneEncoding(node);
-        return bytesWritten;
-    }
-    
-    // write the octal code
+// writes the octal code that starts a section of the bitstream, chopped if the caller asked for that
+static int writeSectionCode(VoxelNode* node, const EncodeBitstreamParams& params, unsigned char* outputBuffer) {
     int codeLength;
     if (params.chopLevels) {
         unsigned char* newCode = chopOctalCode(node->getOctalCode(), params.chopLevels);
@@ -1048,10 +1397,77 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
         codeLength = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(node->getOctalCode()));
         memcpy(outputBuffer, node->getOctalCode(), codeLength);
     }
+    return codeLength;
+}
 
-    outputBuffer += codeLength; // move the pointer
-    bytesWritten += codeLength; // keep track of byte count
-    availableBytes -= codeLength; // keep track or remaining space
+// writes one level of the bitstream: the colored children mask, their colors, and the child exists masks
+static int writeLevel(VoxelNode* node, unsigned char childrenColoredBits, unsigned char childrenExistInTreeBits,
+                      unsigned char childrenExistInPacketBits, const unsigned char* referenceColor,
+                      const EncodeBitstreamParams& params, unsigned char* levelBuffer) {
+    const int BYTES_PER_COLOR = 3;
+    unsigned char* writeToLevelBuffer = levelBuffer;
+    *writeToLevelBuffer++ = childrenColoredBits;
+
+    if (params.includeColor && params.codeColors) {
+        unsigned char childColors[NUMBER_OF_CHILDREN][BYTES_PER_COLOR];
+        int childColorCount = 0;
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(childrenColoredBits, i)) {
+                memcpy(childColors[childColorCount++], &node->getChildAtIndex(i)->getColor(), BYTES_PER_COLOR);
+            }
+        }
+        if (childColorCount > 0) {
+            writeToLevelBuffer += encodeChildColors(childColors, childColorCount, referenceColor, writeToLevelBuffer);
+        }
+    } else if (params.includeColor) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(childrenColoredBits, i)) {
+                memcpy(writeToLevelBuffer, &node->getChildAtIndex(i)->getColor(), BYTES_PER_COLOR);
+                writeToLevelBuffer += BYTES_PER_COLOR;
+            }
+        }
+    }
+
+    // if the caller wants to include childExistsBits, then include them even if not in view, put them before the
+    // childrenExistInPacketBits, so that the lower code can properly repair the packet exists bits
+    if (params.includeExistsBits) {
+        *writeToLevelBuffer++ = childrenExistInTreeBits;
+    }
+    *writeToLevelBuffer++ = childrenExistInPacketBits;
+    return writeToLevelBuffer - levelBuffer;
+}
+
+int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag,
+                                   EncodeBitstreamParams& params) {
+    VoxelPacketChain packet(outputBuffer, availableBytes);
+    return encodeTreeIntoPackets(node, packet, bag, params);
+}
+
+int VoxelTree::encodeTreeIntoPackets(VoxelNode* node, VoxelPacketChain& packets, VoxelNodeBag& bag,
+                                     EncodeBitstreamParams& params) {
+    startEncoding(node);
+
+    // If we're at a node that is out of view, then we can return, because no nodes below us will be in view!
+    if (params.viewFrustum && !node->isInView(*params.viewFrustum)) {
+        doneEncoding(node);
+        return 0;
+    }
+
+    // write the octal code, in the next packet if this one doesn't have room for it
+    unsigned char sectionCode[MAX_SECTION_CODE_BYTES];
+    int codeLength = writeSectionCode(node, params, sectionCode);
+    if (packets.getAvailable() < codeLength && !startNextPacket(packets, params, codeLength + MAX_LEVEL_BYTES)) {
+        bag.insert(node);
+        if (params.stats) {
+            params.stats->didntFit(node);
+        }
+        doneEncoding(node);
+        return 0;
+    }
+    int bytesBefore = packets.getTotalBytes();
+    packets._sectionRoot = node;
+    packets._sectionStart = packets.getLength();
+    packets.write(sectionCode, codeLength);
 
     int currentEncodeLevel = 0;
     
@@ -1061,7 +1477,7 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
         params.stats->traversed(node);
     }
     
-    int childBytesWritten = encodeTreeBitstreamRecursion(node, outputBuffer, availableBytes, bag, params, currentEncodeLevel);
+    int childBytesWritten = encodeTreeBitstreamRecursion(node, packets, bag, params, currentEncodeLevel);
 
     // if childBytesWritten == 1 then something went wrong... that's not possible
     assert(childBytesWritten != 1);
@@ -1072,20 +1488,95 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
         childBytesWritten = 0;
     }
 
-    // if we wrote child bytes, then return our result of all bytes written
-    if (childBytesWritten) {
-        bytesWritten += childBytesWritten;
-    } else {
-        // otherwise... if we didn't write any child bytes, then pretend like we also didn't write our octal code
-        bytesWritten = 0;
+    // if we didn't write any child bytes to the packet we ended up in, then pretend like we also didn't write our octal
+    // code there
+    if (!childBytesWritten) {
+        packets.setLength(packets._sectionStart);
     }
+    packets._sectionRoot = NULL;
     
     doneEncoding(node);
-    return bytesWritten;
+    return packets.getTotalBytes() - bytesBefore;
 }
 
-int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag,
-                                            EncodeBitstreamParams& params, int& currentEncodeLevel) const {
+// Closes the current packet, and starts the next one with the section's octal code and the levels that are still open,
+// without their colors, so that the encoder can carry on where it was with bytesNeeded more. Returns false if there isn't
+// a next packet, or room in it.
+bool VoxelTree::startNextPacket(VoxelPacketChain& packets, const EncodeBitstreamParams& params, int bytesNeeded) const {
+    unsigned char sectionCode[MAX_SECTION_CODE_BYTES];
+    int codeLength = packets._sectionRoot ? writeSectionCode(packets._sectionRoot, params, sectionCode) : 0;
+    const int REOPENED_LEVEL_BYTES = params.includeExistsBits ? 3 : 2;
+    int reopenedBytes = codeLength + packets._openLevels.size() * REOPENED_LEVEL_BYTES;
+    if (!packets.hasNextPacket() || reopenedBytes + bytesNeeded > packets._packetBytes) {
+        packets._isFull = true;
+        return false;
+    }
+
+    // The children that haven't been started aren't in this packet, and neither is the one that didn't fit. The ones
+    // being written have what they've written so far.
+    unsigned char* packet = packets.getPacket(packets._current);
+    int packetEnd = packets.getLength();
+    int innermostLevel = packets._openLevels.size() - 1;
+    bool removeCurrentChild = true;
+    for (int i = innermostLevel; i >= 0; i--) {
+        VoxelPacketChain::OpenLevel& level = packets._openLevels[i];
+        unsigned char currentChildBit = 1 << (7 - level.currentChild);
+        unsigned char notInPacketBits = level.unfinishedBits;
+        if (removeCurrentChild) {
+            level.slicedBits &= ~currentChildBit;
+        } else {
+            notInPacketBits &= ~currentChildBit;
+            level.sliceSizes[level.currentChild] = packetEnd - level.sliceStarts[level.currentChild];
+        }
+        packet[level.existsInPacketBits] &= ~notInPacketBits;
+        if (params.wantOcclusionCulling) {
+            packets.reshuffleSlices(level);
+        }
+
+        // a level that's left with no colors and no child trees is dropped, like the degenerate child trees are
+        removeCurrentChild = params.includeColor && !params.includeExistsBits && packetEnd - level.levelStart == 2;
+        if (removeCurrentChild) {
+            packetEnd = level.levelStart;
+        }
+    }
+
+    // a section that's only its octal code, or would be, moves to the next packet entirely
+    if (packets._sectionRoot && removeCurrentChild) {
+        packetEnd = packets._sectionStart;
+    }
+    packets.setLength(packetEnd);
+
+    packets.nextPacket();
+    if (packets._sectionRoot) {
+        packets._sectionStart = 0;
+        packets.write(sectionCode, codeLength);
+    }
+    for (int i = 0; i <= innermostLevel; i++) {
+        VoxelPacketChain::OpenLevel& level = packets._openLevels[i];
+        unsigned char reopenedLevel[REOPENED_LEVEL_BYTES];
+        int reopenedLevelBytes = 0;
+        reopenedLevel[reopenedLevelBytes++] = 0; // the colors went in the last packet
+        if (params.includeExistsBits) {
+            reopenedLevel[reopenedLevelBytes++] = level.existsInTreeBits;
+        }
+        reopenedLevel[reopenedLevelBytes++] = level.unfinishedBits;
+
+        level.levelStart = packets.getLength();
+        level.existsInPacketBits = level.levelStart + reopenedLevelBytes - 1;
+        level.colorsInPacket = false;
+        packets.write(reopenedLevel, reopenedLevelBytes);
+
+        // the rest of the child being written carries on right after
+        level.firstSlice = packets.getLength();
+        level.slicedBits = 1 << (7 - level.currentChild);
+        level.sliceStarts[level.currentChild] = level.firstSlice;
+    }
+    return true;
+}
+
+int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, VoxelPacketChain& packets, VoxelNodeBag& bag,
+                                            EncodeBitstreamParams& params, int& currentEncodeLevel,
+                                            const unsigned char* referenceColor) const {
 
     // you can't call this without a valid node
     assert(node);
@@ -1201,23 +1692,10 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
 
     bool keepDiggingDeeper = true; // Assuming we're in view we have a great work ethic, we're always ready for more!
 
-    // At any given point in writing the bitstream, the largest minimum we might need to flesh out the current level
-    // is 1 byte for child colors + 3*NUMBER_OF_CHILDREN bytes for the actual colors + 1 byte for child trees. There could be sub trees
-    // below this point, which might take many more bytes, but that's ok, because we can always mark our subtrees as
-    // not existing and stop the packet at this point, then start up with a new packet for the remaining sub trees.
     unsigned char childrenExistInTreeBits = 0;
     unsigned char childrenExistInPacketBits = 0;
     unsigned char childrenColoredBits = 0;
 
-    const int CHILD_COLOR_MASK_BYTES = sizeof(childrenColoredBits);
-    const int BYTES_PER_COLOR = 3;
-    const int CHILD_TREE_EXISTS_BYTES = sizeof(childrenExistInTreeBits) + sizeof(childrenExistInPacketBits);
-    const int MAX_LEVEL_BYTES = CHILD_COLOR_MASK_BYTES + NUMBER_OF_CHILDREN * BYTES_PER_COLOR + CHILD_TREE_EXISTS_BYTES;
-
-    // Make our local buffer large enough to handle writing at this level in case we need to.
-    unsigned char thisLevelBuffer[MAX_LEVEL_BYTES];
-    unsigned char* writeToThisLevelBuffer = &thisLevelBuffer[0];
-
     int inViewCount = 0;
     int inViewNotLeafCount = 0;
     int inViewWithColorCount = 0;
@@ -1299,10 +1777,26 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
             } else {
                 inViewCount++;
 
+                // let the pager know which subtrees are being looked at, so it can page in the ones that aren't resident
+                if (_pager && params.viewFrustum && *childNode->getOctalCode() == _pager->getIndexDepth()) {
+                    _pager->subtreeVisited(childNode);
+                }
+
+                // receivers with a subtree cache are told the versions of the subtrees they reach, and the ones they
+                // already have aren't sent again, though their colors still are, with the rest of this level
+                bool childIsCached = false;
+                if (params.reachedSubtrees && !childNode->isLeaf() &&
+                        VoxelSubtreeVersions::isVersionedSubtree(childNode->getOctalCode())) {
+                    VoxelSubtreeVersion version = getSubtreeVersion(childNode);
+                    params.reachedSubtrees->setVersion(childNode->getOctalCode(), version);
+                    childIsCached = params.cachedSubtrees &&
+                                    params.cachedSubtrees->getVersion(childNode->getOctalCode()) == version;
+                }
+
                 // track children in view as existing and not a leaf, if they're a leaf,
                 // we don't care about recursing deeper on them, and we don't consider their
                 // subtree to exist
-                if (!(childNode && childNode->isLeaf())) {
+                if (!(childNode && childNode->isLeaf()) && !childIsCached) {
                     childrenExistInPacketBits += (1 << (7 - originalIndex));
                     inViewNotLeafCount++;
                 }
@@ -1395,70 +1889,49 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
             }
         }
     }
-    *writeToThisLevelBuffer = childrenColoredBits;
-    writeToThisLevelBuffer += sizeof(childrenColoredBits); // move the pointer
-    bytesAtThisLevel += sizeof(childrenColoredBits); // keep track of byte count
-    if (params.stats) {
-        params.stats->colorBitsWritten();
-    }
-
-    // write the color data...
-    if (params.includeColor) {
-        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            if (oneAtBit(childrenColoredBits, i)) {
-                VoxelNode* childNode = node->getChildAtIndex(i);
-                memcpy(writeToThisLevelBuffer, &childNode->getColor(), BYTES_PER_COLOR);
-                writeToThisLevelBuffer += BYTES_PER_COLOR; // move the pointer for color
-                bytesAtThisLevel += BYTES_PER_COLOR; // keep track of byte count for color
-
-                // don't need to check childNode here, because we can't get here with no childNode
-                if (params.stats) {
-                    params.stats->colorSent(childNode);
-                }
-
+    // Make our local buffer large enough to handle writing at this level in case we need to.
+    unsigned char thisLevelBuffer[MAX_LEVEL_BYTES];
+    bytesAtThisLevel = writeLevel(node, childrenColoredBits, childrenExistInTreeBits, childrenExistInPacketBits,
+                                  referenceColor, params, thisLevelBuffer);
+    // If we don't have room for this level, then it goes in the next packet, or if there isn't one, in the bag
+    if (packets.getAvailable() < bytesAtThisLevel) {
+        if (!startNextPacket(packets, params, MAX_LEVEL_BYTES)) {
+            bag.insert(node);
+
+            // don't need to check node here, because we can't get here with no node
+            if (params.stats) {
+                params.stats->didntFit(node);
             }
+
+            return 0;
         }
-    }
 
-    // if the caller wants to include childExistsBits, then include them even if not in view, put them before the
-    // childrenExistInPacketBits, so that the lower code can properly repair the packet exists bits
-    if (params.includeExistsBits) {
-        *writeToThisLevelBuffer = childrenExistInTreeBits;
-        writeToThisLevelBuffer += sizeof(childrenExistInTreeBits); // move the pointer
-        bytesAtThisLevel += sizeof(childrenExistInTreeBits); // keep track of byte count
-        if (params.stats) {
-            params.stats->existsBitsWritten();
+        // the level above was reopened without its colors, so there's nothing to code our colors against
+        if (referenceColor && params.includeColor && params.codeColors) {
+            bytesAtThisLevel = writeLevel(node, childrenColoredBits, childrenExistInTreeBits, childrenExistInPacketBits,
+                                          NULL, params, thisLevelBuffer);
         }
     }
+    int levelStart = packets.getLength();
+    packets.write(thisLevelBuffer, bytesAtThisLevel);
 
-    // write the child exist bits
-    *writeToThisLevelBuffer = childrenExistInPacketBits;
-    writeToThisLevelBuffer += sizeof(childrenExistInPacketBits); // move the pointer
-    bytesAtThisLevel += sizeof(childrenExistInPacketBits); // keep track of byte count
+    // only what's actually written counts as sent, levels that go in the bag are counted when they're written later
     if (params.stats) {
+        params.stats->colorBitsWritten();
+        for (int i = 0; params.includeColor && i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(childrenColoredBits, i)) {
+                params.stats->colorSent(node->getChildAtIndex(i));
+            }
+        }
+        if (params.includeExistsBits) {
+            params.stats->existsBitsWritten();
+        }
         params.stats->existsInPacketBitsWritten();
     }
 
     // We only need to keep digging, if there is at least one child that is inView, and not a leaf.
     keepDiggingDeeper = (inViewNotLeafCount > 0);
 
-    // If we have enough room to copy our local results into the buffer, then do so...
-    if (availableBytes >= bytesAtThisLevel) {
-        memcpy(outputBuffer, &thisLevelBuffer[0], bytesAtThisLevel);
-
-        outputBuffer   += bytesAtThisLevel;
-        availableBytes -= bytesAtThisLevel;
-    } else {
-        bag.insert(node);
-
-        // don't need to check node here, because we can't get here with no node
-        if (params.stats) {
-            params.stats->didntFit(node);
-        }
-
-        return 0;
-    }
-
     if (keepDiggingDeeper) {
         // at this point, we need to iterate the children who are in view, even if not colored
         // and we need to determine if there's a deeper tree below them that we care about.
@@ -1469,17 +1942,25 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         // write our childExistsBits as a place holder. Then let each potential tree have a go at it. If they
         // write something, we keep them in the bits, if they don't, we take them out.
         //
-        // we know the last thing we wrote to the outputBuffer was our childrenExistInPacketBits. Let's remember where that was!
-        unsigned char* childExistsPlaceHolder = outputBuffer-sizeof(childrenExistInPacketBits);
+        // The level stays open in the chain while its children are written, so that if a child moves us on to the next
+        // packet, the level can be closed in this packet and reopened in that one, and the place holder along with it.
+        VoxelPacketChain::OpenLevel openLevel;
+        openLevel.existsInTreeBits = childrenExistInTreeBits;
+        openLevel.unfinishedBits = childrenExistInPacketBits;
+        openLevel.currentChild = 0;
+        openLevel.levelStart = levelStart;
+        openLevel.existsInPacketBits = levelStart + bytesAtThisLevel - sizeof(childrenExistInPacketBits);
+        openLevel.colorsInPacket = true;
 
         // we are also going to recurse these child trees in "distance" sorted order, but we need to pack them in the
         // final packet in standard order. So what we're going to do is keep track of how big each subtree was in bytes,
         // and then later reshuffle these sections of our output buffer back into normal order. This allows us to make
         // a single recursive pass in distance sorted order, but retain standard order in our encoded packet
-        int recursiveSliceSizes[NUMBER_OF_CHILDREN];
-        unsigned char* recursiveSliceStarts[NUMBER_OF_CHILDREN];
-        unsigned char* firstRecursiveSlice = outputBuffer;
-        int allSlicesSize = 0;
+        openLevel.slicedBits = 0;
+        openLevel.firstSlice = packets.getLength();
+
+        int levelIndex = packets._openLevels.size();
+        packets._openLevels.push_back(openLevel);
 
         // for each child node in Distance sorted order..., check to see if they exist, are colored, and in view, and if so
         // add them to our distance ordered array of children
@@ -1488,17 +1969,27 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
             int originalIndex = indexOfChildren[indexByDistance];
 
             if (oneAtBit(childrenExistInPacketBits, originalIndex)) {
+                unsigned char childBit = 1 << (7 - originalIndex);
 
-                int thisLevel = currentEncodeLevel;
                 // remember this for reshuffling
-                recursiveSliceStarts[originalIndex] = outputBuffer;
+                VoxelPacketChain::OpenLevel* level = &packets._openLevels[levelIndex];
+                level->currentChild = originalIndex;
+                level->sliceStarts[originalIndex] = packets.getLength();
+                level->slicedBits |= childBit;
 
-                int childTreeBytesOut = encodeTreeBitstreamRecursion(childNode, outputBuffer, availableBytes, bag,
-                                                                     params, thisLevel);
+                // the child's children are coded against the child's color, if the receiver has it
+                const unsigned char* childReferenceColor =
+                    (level->colorsInPacket && oneAtBit(childrenColoredBits, originalIndex)) ? &childNode->getColor()[0] : NULL;
 
-                // remember this for reshuffling
-                recursiveSliceSizes[originalIndex] = childTreeBytesOut;
-                allSlicesSize += childTreeBytesOut;
+                int thisLevel = currentEncodeLevel;
+                int childTreeBytesOut = encodeTreeBitstreamRecursion(childNode, packets, bag, params, thisLevel,
+                                                                     childReferenceColor);
+
+                // the child may have moved us on to the next packet, in which case this level has been reopened there,
+                // and what the child wrote is what it wrote in that packet
+                level = &packets._openLevels[levelIndex];
+                level->unfinishedBits &= ~childBit;
+                unsigned char* packet = packets.getPacket(packets._current);
 
                 // if the child wrote 0 bytes, it means that nothing below exists or was in view, or we ran out of space,
                 // basically, the children below don't contain any info.
@@ -1518,6 +2009,7 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
                 // we can make this act like no bytes out, by just resetting the bytes out in this case
                 if (params.includeColor && !params.includeExistsBits && childTreeBytesOut == 2) {
                     childTreeBytesOut = 0; // this is the degenerate case of a tree with no colors and no child trees
+                    packets.setLength(level->sliceStarts[originalIndex]);
                 }
                 // We used to try to collapse trees that didn't contain any data, but this does appear to create a problem
                 // in detecting node deletion. So, I've commented this out but left it in here as a warning to anyone else
@@ -1527,58 +2019,51 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
                 //    childTreeBytesOut = 0; // this is the degenerate case of a tree with no colors and no child trees
                 //}
 
-                bytesAtThisLevel += childTreeBytesOut;
-                availableBytes -= childTreeBytesOut;
-                outputBuffer += childTreeBytesOut;
+                // remember this for reshuffling
+                level->sliceSizes[originalIndex] = childTreeBytesOut;
 
                 // If we had previously started writing, and if the child DIDN'T write any bytes,
                 // then we want to remove their bit from the childExistsPlaceHolder bitmask
                 if (childTreeBytesOut == 0) {
-                    // remove this child's bit...
-                    childrenExistInPacketBits -= (1 << (7 - originalIndex));
-                    // repair the child exists mask
-                    *childExistsPlaceHolder = childrenExistInPacketBits;
+                    // remove this child's bit, and repair the child exists mask
+                    packet[level->existsInPacketBits] &= ~childBit;
+                    level->slicedBits &= ~childBit;
 
                     // If this is the last of the child exists bits, then we're actually be rolling out the entire tree
-                    if (params.stats && childrenExistInPacketBits == 0) {
+                    if (params.stats && packet[level->existsInPacketBits] == 0) {
                         params.stats->childBitsRemoved(params.includeExistsBits, params.includeColor);
                     }
-                    
-                    // Note: no need to move the pointer, cause we already stored this
                 } // end if (childTreeBytesOut == 0)
             } // end if (oneAtBit(childrenExistInPacketBits, originalIndex))
         } // end for
 
         // reshuffle here...
+        VoxelPacketChain::OpenLevel& level = packets._openLevels[levelIndex];
         if (params.wantOcclusionCulling) {
-            unsigned char tempReshuffleBuffer[MAX_VOXEL_PACKET_SIZE];
-
-            unsigned char* tempBufferTo = &tempReshuffleBuffer[0]; // this is our temporary destination
-
-            // iterate through our childrenExistInPacketBits, these will be the sections of the packet that we copied subTree
-            // details into. Unfortunately, they're in distance sorted order, not original index order. we need to put them
-            // back into original distance order
-            for (int originalIndex = 0; originalIndex < NUMBER_OF_CHILDREN; originalIndex++) {
-                if (oneAtBit(childrenExistInPacketBits, originalIndex)) {
-                    int thisSliceSize = recursiveSliceSizes[originalIndex];
-                    unsigned char* thisSliceStarts = recursiveSliceStarts[originalIndex];
-
-                    memcpy(tempBufferTo, thisSliceStarts, thisSliceSize);
-                    tempBufferTo += thisSliceSize;
-                }
-            }
-
-            // now that all slices are back in the correct order, copy them to the correct output buffer
-            memcpy(firstRecursiveSlice, &tempReshuffleBuffer[0], allSlicesSize);
+            packets.reshuffleSlices(level);
         }
 
-
+        // this level may have been reopened in a later packet, what we've written is what's in this one
+        bytesAtThisLevel = packets.getLength() - level.levelStart;
+        packets._openLevels.pop_back();
     } // end keepDiggingDeeper
 
     return bytesAtThisLevel;
 }
 
 bool VoxelTree::readFromSVOFile(const char* fileName) {
+    if (IndexedSVOFile::isIndexedSVOFile(fileName)) {
+        emit importSize(1.0f, 1.0f, 1.0f);
+        emit importProgress(0);
+        qDebug("loading indexed file %s...\n", fileName);
+
+        IndexedSVOFile indexedFile;
+        bool loaded = indexedFile.open(fileName) && indexedFile.loadAll(this);
+
+        emit importProgress(100);
+        return loaded;
+    }
+
     std::ifstream file(fileName, std::ios::in|std::ios::binary|std::ios::ate);
     if(file.is_open()) {
 
@@ -1607,6 +2092,7 @@ bool VoxelTree::readFromSVOFile(const char* fileName) {
 }
 
 bool VoxelTree::readFromSquareARGB32Pixels(const char* filename) {
+    _stopImport = false;
     emit importSize(1.0f, 1.0f, 1.0f);
     emit importProgress(0);
 
@@ -1620,18 +2106,27 @@ bool VoxelTree::readFromSquareARGB32Pixels(const char* filename) {
 
     int maxSize = std::max(pngImage.width(), pngImage.height());
 
-    int scale = 1;
-    while (maxSize > scale) {scale *= 2;}
-    float size = 1.0f / scale;
+    int level = 0;
+    while (maxSize > (1 << level)) {++level;}
+    int scale = 1 << level;
+
+    // the columns go up to the highest alpha, as far as the top of the tree
+    int maxAlpha = 0;
+    for (int i = 0; i < pngImage.width(); ++i) {
+        for (int j = 0; j < pngImage.height(); ++j) {
+            maxAlpha = std::max(maxAlpha, qAlpha(pngImage.pixel(i, j)));
+        }
+    }
+    int top = std::min(scale - 1, std::max(0, maxAlpha - minAlpha));
+    VoxelGrid grid(level, pngImage.width(), top + 1, pngImage.height());
 
+    uint64_t start = usecTimestampNow();
     QRgb pixel;
     int minNeighborhoodAlpha;
+    int count = 0;
 
     for (int i = 0; i < pngImage.width(); ++i) {
         for (int j = 0; j < pngImage.height(); ++j) {
-            emit importProgress((100 * (i * pngImage.height() + j)) /
-                                (pngImage.width() * pngImage.height()));
-
             pixel = pngImage.pixel(i, j);
             minNeighborhoodAlpha = qAlpha(pixel) - 1;
 
@@ -1650,20 +2145,23 @@ bool VoxelTree::readFromSquareARGB32Pixels(const char* filename) {
 
             while (qAlpha(pixel) > minNeighborhoodAlpha) {
                 ++minNeighborhoodAlpha;
-                createVoxel(i * size,
-                            (minNeighborhoodAlpha - minAlpha) * size,
-                            j * size,
-                            size,
-                            qRed(pixel),
-                            qGreen(pixel),
-                            qBlue(pixel),
-                            true);
+                int y = std::min(top, std::max(0, minNeighborhoodAlpha - minAlpha));
+                grid.setVoxel(i, y, j, qRed(pixel), qGreen(pixel), qBlue(pixel));
+                ++count;
             }
-
         }
     }
 
+    grid.summarize();
+    if (!createVoxelsFromGrid(grid)) {
+        qDebug("[DEBUG] Canceled import of %d voxels.\n", count);
+        _stopImport = false;
+        return true;
+    }
+
     emit importProgress(100);
+    float seconds = (usecTimestampNow() - start) / 1000000.0f;
+    qDebug("Created %d voxels from image import in %f seconds, %f voxels/sec.\n", count, seconds, count / seconds);
     return true;
 }
 
@@ -1671,15 +2169,17 @@ bool VoxelTree::readFromSchematicFile(const char *fileName) {
     _stopImport = false;
     emit importProgress(0);
 
-    std::stringstream ss;
-    int err = retrieveData(std::string(fileName), ss);
-    if (err && ss.get() != TAG_Compound) {
+    // the tags are read in place, so the block arrays are in data
+    std::vector<unsigned char> data;
+    int err = retrieveData(std::string(fileName), data);
+    if (err || data.empty() || data[0] != TAG_Compound) {
         qDebug("[ERROR] Invalid schematic file.\n");
         return false;
     }
 
-    ss.get();
-    TagCompound schematics(ss);
+    TagReader reader(&data[0], data.size());
+    reader.getByte();
+    TagCompound schematics(reader);
     if (!schematics.getBlocksId() || !schematics.getBlocksData()) {
         qDebug("[ERROR] Invalid schematic data.\n");
         return false;
@@ -1688,9 +2188,9 @@ bool VoxelTree::readFromSchematicFile(const char *fileName) {
     int max = (schematics.getWidth() > schematics.getLength()) ? schematics.getWidth() : schematics.getLength();
     max = (max > schematics.getHeight()) ? max : schematics.getHeight();
 
-    int scale = 1;
-    while (max > scale) {scale *= 2;}
-    float size = 1.0f / scale;
+    int level = 0;
+    while (max > (1 << level)) {++level;}
+    float size = 1.0f / (1 << level);
 
     int create = 1;
     int red = 128, green = 128, blue = 128;
@@ -1701,17 +2201,13 @@ bool VoxelTree::readFromSchematicFile(const char *fileName) {
                     size * schematics.getLength());
     emit importProgress(0);
 
+    // the blocks go into a grid, and from there into the tree in one pass from the top
+    uint64_t start = usecTimestampNow();
+    VoxelGrid grid(level, schematics.getWidth(), schematics.getHeight(), schematics.getLength());
+
     for (int y = 0; y < schematics.getHeight(); ++y) {
         for (int z = 0; z < schematics.getLength(); ++z) {
-            emit importProgress((int) 100 * (y * schematics.getLength() + z) / (schematics.getHeight() * schematics.getLength()));
-
             for (int x = 0; x < schematics.getWidth(); ++x) {
-                if (_stopImport) {
-                    qDebug("[DEBUG] Canceled import at %d voxels.\n", count);
-                    _stopImport = false;
-                    return true;
-                }
-
                 int pos  = ((y * schematics.getLength()) + z) * schematics.getWidth() + x;
                 int id   = schematics.getBlocksId()[pos];
                 int data = schematics.getBlocksData()[pos];
@@ -1719,37 +2215,22 @@ bool VoxelTree::readFromSchematicFile(const char *fileName) {
                 create = 1;
                 computeBlockColor(id, data, red, green, blue, create);
 
+                // the children of a block are numbered as in octal codes, with x, y and z from the high bit down
+                const int BOTTOM_HALF_CHILDREN = 0x33;
+                const int STAIR_TOP_CHILDREN[] = { 0xC0, 0x0C, 0x88, 0x44 };
                 switch (create) {
                     case 1:
-                        createVoxel(size * x, size * y, size * z, size, red, green, blue, true);
+                        grid.setVoxel(x, y, z, red, green, blue);
                         ++count;
                         break;
                     case 2:
-                        switch (data) {
-                            case 0:
-                                createVoxel(size * x + size / 2, size * y + size / 2, size * z           , size / 2, red, green, blue, true);
-                                createVoxel(size * x + size / 2, size * y + size / 2, size * z + size / 2, size / 2, red, green, blue, true);
-                                break;
-                            case 1:
-                                createVoxel(size * x           , size * y + size / 2, size * z           , size / 2, red, green, blue, true);
-                                createVoxel(size * x           , size * y + size / 2, size * z + size / 2, size / 2, red, green, blue, true);
-                                break;
-                            case 2:
-                                createVoxel(size * x           , size * y + size / 2, size * z + size / 2, size / 2, red, green, blue, true);
-                                createVoxel(size * x + size / 2, size * y + size / 2, size * z + size / 2, size / 2, red, green, blue, true);
-                                break;
-                            case 3:
-                                createVoxel(size * x           , size * y + size / 2, size * z           , size / 2, red, green, blue, true);
-                                createVoxel(size * x + size / 2, size * y + size / 2, size * z           , size / 2, red, green, blue, true);
-                                break;
-                        }
-                        count += 2;
-                        // There's no break on purpose.
+                        // stairs are a slab with a step on top, unless their data doesn't say where the step is
+                        grid.setPartialVoxel(x, y, z, BOTTOM_HALF_CHILDREN | ((data >= 0 && data < 4) ?
+                                             STAIR_TOP_CHILDREN[data] : 0), red, green, blue);
+                        count += 6;
+                        break;
                     case 3:
-                        createVoxel(size * x           , size * y, size * z           , size / 2, red, green, blue, true);
-                        createVoxel(size * x + size / 2, size * y, size * z           , size / 2, red, green, blue, true);
-                        createVoxel(size * x           , size * y, size * z + size / 2, size / 2, red, green, blue, true);
-                        createVoxel(size * x + size / 2, size * y, size * z + size / 2, size / 2, red, green, blue, true);
+                        grid.setPartialVoxel(x, y, z, BOTTOM_HALF_CHILDREN, red, green, blue);
                         count += 4;
                         break;
                 }
@@ -1757,12 +2238,56 @@ bool VoxelTree::readFromSchematicFile(const char *fileName) {
         }
     }
 
+    grid.summarize();
+    if (!createVoxelsFromGrid(grid)) {
+        qDebug("[DEBUG] Canceled import of %d voxels.\n", count);
+        _stopImport = false;
+        return true;
+    }
+
     emit importProgress(100);
-    qDebug("Created %d voxels from minecraft import.\n", count);
+    float seconds = (usecTimestampNow() - start) / 1000000.0f;
+    qDebug("Created %d voxels from minecraft import in %f seconds, %f voxels/sec.\n", count, seconds, count / seconds);
 
     return true;
 }
 
+// walks the same layout readNodeData() reads: the colored children mask and a color for each, then the mask of the
+// children that follow, and then each of those in turn
+static int getSVONodeDataLength(const unsigned char* nodeData, int bufferSizeBytes) {
+    if (bufferSizeBytes < 1) {
+        return 0;
+    }
+    int bytesRead = sizeof(unsigned char) + SIZE_OF_COLOR_DATA * numberOfOnes(*nodeData);
+    if (bytesRead >= bufferSizeBytes) {
+        return 0;
+    }
+    unsigned char childMask = nodeData[bytesRead];
+    bytesRead += sizeof(childMask);
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (oneAtBit(childMask, i)) {
+            int childBytes = getSVONodeDataLength(nodeData + bytesRead, bufferSizeBytes - bytesRead);
+            if (childBytes == 0) {
+                return 0;
+            }
+            bytesRead += childBytes;
+        }
+    }
+    return bytesRead;
+}
+
+int VoxelTree::getSVOChunkLength(const unsigned char* bitstream, int bufferSizeBytes) {
+    if (bufferSizeBytes < 1) {
+        return 0;
+    }
+    int octalCodeBytes = bytesRequiredForCodeLength(*bitstream);
+    if (octalCodeBytes >= bufferSizeBytes) {
+        return 0;
+    }
+    int nodeDataBytes = getSVONodeDataLength(bitstream + octalCodeBytes, bufferSizeBytes - octalCodeBytes);
+    return nodeDataBytes ? octalCodeBytes + nodeDataBytes : 0;
+}
+
 void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) {
 
     std::ofstream file(fileName, std::ios::out|std::ios::binary);
@@ -1794,58 +2319,128 @@ void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) {
 }
 
 unsigned long VoxelTree::getVoxelCount() {
-    unsigned long nodeCount = 0;
-    recurseTreeWithOperation(countVoxelsOperation, &nodeCount);
-    return nodeCount;
-}
-
-bool VoxelTree::countVoxelsOperation(VoxelNode* node, void* extraData) {
-    (*(unsigned long*)extraData)++;
-    return true; // keep going
+    return rootNode->getSubTreeNodeCount();
 }
 
-void VoxelTree::copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot) {
-    VoxelNodeBag nodeBag;
-    nodeBag.insert(startNode);
-    int chopLevels = 0;
-    if (rebaseToRoot) {
-        chopLevels = numberOfThreeBitSectionsInCode(startNode->getOctalCode());
+class CollectStatsVisitor {
+public:
+    CollectStatsVisitor() : nodeCount(0), leafCount(0), coloredLeafCount(0), coloredVolume(0.0),
+        minimum(FLT_MAX, FLT_MAX, FLT_MAX), maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX) {
+        colorSums[0] = colorSums[1] = colorSums[2] = 0.0;
     }
 
-    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
-    int bytesWritten = 0;
+    bool visit(VoxelNode* node) {
+        nodeCount++;
+        if (!node->isLeaf()) {
+            return true;
+        }
+        leafCount++;
+        if (node->isColored()) {
+            coloredLeafCount++;
+            const AABox& box = node->getAABox();
+            double volume = (double)box.getSize().x * box.getSize().y * box.getSize().z;
+            coloredVolume += volume;
+            for (int i = 0; i < 3; i++) {
+                colorSums[i] += node->getTrueColor()[i] * volume;
+            }
+            minimum = glm::min(minimum, box.getCorner());
+            maximum = glm::max(maximum, box.getCorner() + box.getSize());
+        }
+        return false;
+    }
 
-    while (!nodeBag.isEmpty()) {
-        VoxelNode* subTree = nodeBag.extract();
+    void join(const CollectStatsVisitor& other) {
+        nodeCount += other.nodeCount;
+        leafCount += other.leafCount;
+        coloredLeafCount += other.coloredLeafCount;
+        coloredVolume += other.coloredVolume;
+        for (int i = 0; i < 3; i++) {
+            colorSums[i] += other.colorSums[i];
+        }
+        minimum = glm::min(minimum, other.minimum);
+        maximum = glm::max(maximum, other.maximum);
+    }
 
-        // ask our tree to write a bitsteam
-        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS, chopLevels);
-        bytesWritten = encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
+    unsigned long nodeCount;
+    unsigned long leafCount;
+    unsigned long coloredLeafCount;
+    double coloredVolume;
+    double colorSums[3];
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+};
 
-        // ask destination tree to read the bitstream
-        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
-        destinationTree->readBitstreamToTree(&outputBuffer[0], bytesWritten, args);
+void VoxelTree::collectStats(VoxelTreeStats& stats) {
+    CollectStatsVisitor visitor;
+    visitNodesParallel(rootNode, visitor);
+
+    stats.nodeCount = visitor.nodeCount;
+    stats.leafCount = visitor.leafCount;
+    stats.coloredLeafCount = visitor.coloredLeafCount;
+    stats.coloredVolume = visitor.coloredVolume * TREE_SCALE * TREE_SCALE * TREE_SCALE;
+    if (visitor.coloredLeafCount > 0) {
+        stats.coloredMinimum = visitor.minimum * (float)TREE_SCALE;
+        stats.coloredMaximum = visitor.maximum * (float)TREE_SCALE;
+        for (int i = 0; i < 3; i++) {
+            stats.averageColor[i] = (unsigned char)(visitor.colorSums[i] / visitor.coloredVolume + 0.5);
+        }
+        stats.averageColor[3] = 1;
+    } else {
+        stats.coloredMinimum = stats.coloredMaximum = glm::vec3(0.0f, 0.0f, 0.0f);
     }
 }
 
-void VoxelTree::copyFromTreeIntoSubTree(VoxelTree* sourceTree, VoxelNode* destinationNode) {
-    VoxelNodeBag nodeBag;
-    // If we were given a specific node, start from there, otherwise start from root
-    nodeBag.insert(sourceTree->rootNode);
-
-    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
-    int bytesWritten = 0;
+// Copies everything below the source node to the same places below the destination node, node for node, without going
+// through a bitstream. The copies take their octal codes from their new parents, which is how they get rebased. Where
+// the destination already has a node, it's kept and given the color of the one copied onto it, and the copy carries on
+// below it.
+static bool cloneChildren(const VoxelNode* sourceNode, VoxelNode* destinationNode) {
+    bool changed = false;
+    std::vector<std::pair<const VoxelNode*, VoxelNode*> > stack;
+    stack.push_back(std::make_pair(sourceNode, destinationNode));
+    while (!stack.empty()) {
+        const VoxelNode* source = stack.back().first;
+        VoxelNode* destination = stack.back().second;
+        stack.pop_back();
 
-    while (!nodeBag.isEmpty()) {
-        VoxelNode* subTree = nodeBag.extract();
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            const VoxelNode* sourceChild = source->getChildAtIndex(i);
+            if (!sourceChild) {
+                continue;
+            }
+            VoxelNode* destinationChild = destination->getChildAtIndex(i);
+            if (!destinationChild) {
+                destination->addChildCopyAtIndex(i, sourceChild);
+                changed = true;
+                continue;
+            }
+            if (sourceChild->isColored()) {
+                destinationChild->setColor(sourceChild->getTrueColor());
+                changed = changed || destinationChild->isDirty();
+            }
+            destinationChild->setDensity(sourceChild->getDensity());
+            stack.push_back(std::make_pair(sourceChild, destinationChild));
+        }
+    }
+    return changed;
+}
 
-        // ask our tree to write a bitsteam
-        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
-        bytesWritten = sourceTree->encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
+void VoxelTree::copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot) {
+    VoxelNode* destinationNode = destinationTree->rootNode;
+    if (!rebaseToRoot && *startNode->getOctalCode() > 0) {
+        destinationNode = destinationTree->nodeForOctalCode(destinationTree->rootNode, startNode->getOctalCode(), NULL);
+        if (*destinationNode->getOctalCode() != *startNode->getOctalCode()) {
+            destinationNode = destinationTree->createMissingNode(destinationTree->rootNode, startNode->getOctalCode());
+        }
+    }
+    if (cloneChildren(startNode, destinationNode)) {
+        destinationTree->setDirtyBit();
+    }
+}
 
-        // ask destination tree to read the bitstream
-        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS, destinationNode);
-        readBitstreamToTree(&outputBuffer[0], bytesWritten, args);
+void VoxelTree::copyFromTreeIntoSubTree(VoxelTree* sourceTree, VoxelNode* destinationNode) {
+    if (cloneChildren(sourceTree->rootNode, destinationNode)) {
+        setDirtyBit();
     }
 }
 
@@ -9,7 +9,9 @@
 #ifndef __hifi__VoxelTree__
 #define __hifi__VoxelTree__
 
+#include <map>
 #include <set>
+#include <vector>
 #include <PointerStack.h>
 #include <SimpleMovingAverage.h>
 
@@ -19,9 +21,14 @@
 #include "VoxelNode.h"
 #include "VoxelNodeBag.h"
 #include "VoxelSceneStats.h"
+#include "VoxelSubtreeVersions.h"
 
 #include <QObject>
 
+class VoxelGrid;
+class VoxelPacketChain;
+class VoxelTreePager;
+
 // Callback function, for recuseTreeWithOperation
 typedef bool (*RecurseVoxelTreeOperation)(VoxelNode* node, void* extraData);
 typedef enum {GRADIENT, RANDOM, NATURAL} creationMode;
@@ -34,6 +41,8 @@ const bool COLLAPSE_EMPTY_TREE    = true;
 const bool DONT_COLLAPSE          = false;
 const bool NO_OCCLUSION_CULLING   = false;
 const bool WANT_OCCLUSION_CULLING = true;
+const bool NO_COLOR_CODING        = false;
+const bool WANT_COLOR_CODING      = true; // see VoxelColorCoding.h
 
 const int DONT_CHOP              = 0;
 const int NO_BOUNDARY_ADJUST     = 0;
@@ -44,6 +53,7 @@ const uint64_t IGNORE_LAST_SENT  = 0;
 #define IGNORE_VIEW_FRUSTUM      NULL
 #define IGNORE_COVERAGE_MAP      NULL
 #define IGNORE_JURISDICTION_MAP  NULL
+#define IGNORE_SUBTREE_VERSIONS  NULL
 
 class EncodeBitstreamParams {
 public:
@@ -62,6 +72,9 @@ public:
     VoxelSceneStats*    stats;
     CoverageMap*        map;
     JurisdictionMap*    jurisdictionMap;
+    bool                codeColors;
+    const VoxelSubtreeVersions* cachedSubtrees;  // the receiver has these, so they're left out
+    VoxelSubtreeVersions*       reachedSubtrees; // filled in with the versions of the subtrees that were reached
     
     EncodeBitstreamParams(
         int                 maxEncodeLevel      = INT_MAX, 
@@ -77,7 +90,10 @@ public:
         uint64_t            lastViewFrustumSent = IGNORE_LAST_SENT,
         bool                forceSendScene      = true,
         VoxelSceneStats*    stats               = IGNORE_SCENE_STATS,
-        JurisdictionMap*    jurisdictionMap     = IGNORE_JURISDICTION_MAP) :
+        JurisdictionMap*    jurisdictionMap     = IGNORE_JURISDICTION_MAP,
+        bool                codeColors          = NO_COLOR_CODING,
+        const VoxelSubtreeVersions* cachedSubtrees  = IGNORE_SUBTREE_VERSIONS,
+        VoxelSubtreeVersions*       reachedSubtrees = IGNORE_SUBTREE_VERSIONS) :
             maxEncodeLevel          (maxEncodeLevel),
             maxLevelReached         (0),
             viewFrustum             (viewFrustum),
@@ -92,7 +108,10 @@ public:
             forceSendScene          (forceSendScene),
             stats                   (stats),
             map                     (map),
-            jurisdictionMap         (jurisdictionMap)
+            jurisdictionMap         (jurisdictionMap),
+            codeColors              (codeColors),
+            cachedSubtrees          (cachedSubtrees),
+            reachedSubtrees         (reachedSubtrees)
     {}
 };
 
@@ -102,19 +121,52 @@ public:
     bool                includeExistsBits;
     VoxelNode*          destinationNode;
     uint16_t            sourceID;
+    bool                codeColors;
     
     ReadBitstreamToTreeParams(
         bool                includeColor        = WANT_COLOR, 
         bool                includeExistsBits   = WANT_EXISTS_BITS,
         VoxelNode*          destinationNode     = NULL,
-        uint16_t            sourceID            = UNKNOWN_NODE_ID) :
+        uint16_t            sourceID            = UNKNOWN_NODE_ID,
+        bool                codeColors          = NO_COLOR_CODING) :
             includeColor            (includeColor),
             includeExistsBits       (includeExistsBits),
             destinationNode         (destinationNode),
-            sourceID                (sourceID)
+            sourceID                (sourceID),
+            codeColors              (codeColors)
     {}
 };
 
+/// One ray for VoxelTree::findRayIntersections(). Fill in origin and direction, the rest is filled in for you.
+class RayIntersectionQuery {
+public:
+    glm::vec3   origin;
+    glm::vec3   direction;
+    VoxelNode*  node;
+    float       distance;
+    BoxFace     face;
+    bool        found;
+
+    RayIntersectionQuery(const glm::vec3& origin = glm::vec3(), const glm::vec3& direction = glm::vec3()) :
+        origin(origin), direction(direction), node(NULL), distance(0.0f), face(MIN_X_FACE), found(false) {}
+};
+
+/// Whole tree statistics, see VoxelTree::collectStats()
+class VoxelTreeStats {
+public:
+    unsigned long   nodeCount;
+    unsigned long   leafCount;
+    unsigned long   coloredLeafCount;
+    glm::vec3       coloredMinimum; // bounds of the colored leaves, in meters
+    glm::vec3       coloredMaximum;
+    float           coloredVolume;  // in cubic meters
+    nodeColor       averageColor;   // of the colored leaves, weighted by volume
+
+    VoxelTreeStats() : nodeCount(0), leafCount(0), coloredLeafCount(0), coloredVolume(0.0f) {
+        averageColor[0] = averageColor[1] = averageColor[2] = averageColor[3] = 0;
+    }
+};
+
 class VoxelTree : public QObject {
     Q_OBJECT
 public:
@@ -147,6 +199,20 @@ public:
     VoxelNode* getVoxelAt(float x, float y, float z, float s) const;
     void createVoxel(float x, float y, float z, float s, 
                      unsigned char red, unsigned char green, unsigned char blue, bool destructive = false);
+
+    /// finds and creates voxels by walking straight down to them, no deeper than MAX_VOXEL_COORDINATES_LEVEL
+    VoxelNode* getVoxelAt(const VoxelCoordinates& voxel) const;
+    void createVoxel(const VoxelCoordinates& voxel, bool destructive = false);
+
+    /// Creates the voxels in order, as createVoxel() would one at a time, but starts each from the path down to the one
+    /// before, and brings each node above them up to date once, as the path leaves it. Batches that have been through
+    /// sortVoxelCoordinates() share the most path.
+    void createVoxels(const VoxelCoordinates* voxels, int count, bool destructive = false);
+
+    /// Sorts voxels into the order they're reached walking the tree, keeping the order of voxels at the same place. A voxel
+    /// ends up before the voxels inside it, so sorting a batch that has both can change what createVoxels() makes of it.
+    static void sortVoxelCoordinates(VoxelCoordinates* voxels, int count);
+
     void createLine(glm::vec3 point1, glm::vec3 point2, float unitSize, rgbColor color, bool destructive = false);
     void createSphere(float r,float xc, float yc, float zc, float s, bool solid, 
                       creationMode mode, bool destructive = false, bool debug = false);
@@ -158,6 +224,10 @@ public:
     int encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
                             EncodeBitstreamParams& params) ;
 
+    /// Encodes the subtree into as many of the chain's packets as it takes, in one traversal, see VoxelPacketChain.h.
+    /// Returns the bytes written across all of the packets.
+    int encodeTreeIntoPackets(VoxelNode* node, VoxelPacketChain& packets, VoxelNodeBag& bag, EncodeBitstreamParams& params);
+
     bool isDirty() const { return _isDirty; };
     void clearDirtyBit() { _isDirty = false; };
     void setDirtyBit() { _isDirty = true; };
@@ -165,6 +235,8 @@ public:
 
     bool findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
                              VoxelNode*& node, float& distance, BoxFace& face);
+    /// casts many rays at once, returns the number of rays that hit something
+    int findRayIntersections(RayIntersectionQuery* queries, int queryCount);
 
     bool findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration);
     bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration);
@@ -179,13 +251,36 @@ public:
     bool readFromSquareARGB32Pixels(const char *filename);
     bool readFromSchematicFile(const char* filename);
 
+    /// The length of the first root relative chunk of an SVO file bitstream (WANT_COLOR, NO_EXISTS_BITS), found without
+    /// reading it into a tree, so files can be cut up a chunk at a time. Returns 0 if the chunk runs past the end of the
+    /// buffer.
+    static int getSVOChunkLength(const unsigned char* bitstream, int bufferSizeBytes);
+
+    /// Creates the voxels of a summarized grid from the top down, replacing whatever they overlap. Regions of one color
+    /// become single leaves, and each node is averaged once. Emits importProgress() as it goes, and returns false if
+    /// cancelImport() stops it.
+    bool createVoxelsFromGrid(const VoxelGrid& grid);
+
     unsigned long getVoxelCount();
+    void collectStats(VoxelTreeStats& stats);
 
+    /// Copies the subtree below startNode into the destination tree, either at the same place or moved up to the root.
+    /// The nodes are cloned directly, so colors, averaged colors and subtree counts come across as they are.
     void copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot);
+
+    /// copies everything in the source tree to below destinationNode, with the source's root in destinationNode's place
     void copyFromTreeIntoSubTree(VoxelTree* sourceTree, VoxelNode* destinationNode);
     
     bool getShouldReaverage() const { return _shouldReaverage; }
 
+    /// when set, the encoder tells the pager which of its subtrees are in view, the tree doesn't own the pager
+    void setPager(VoxelTreePager* pager) { _pager = pager; }
+    VoxelTreePager* getPager() const { return _pager; }
+
+    /// The version of the subtree below a node at VERSIONED_SUBTREE_DEPTH, see VoxelSubtreeVersions.h. Versions are kept
+    /// until the node is marked as changed, which edits do for every node above the one they change.
+    VoxelSubtreeVersion getSubtreeVersion(VoxelNode* node) const;
+
     void recurseNodeWithOperation(VoxelNode* node, RecurseVoxelTreeOperation operation, void* extraData);
     void recurseNodeWithOperationDistanceSorted(VoxelNode* node, RecurseVoxelTreeOperation operation, 
                 const glm::vec3& point, void* extraData);
@@ -206,20 +301,32 @@ public slots:
 private:
     void deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraData);
     void readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraData);
+    bool setVoxelColor(VoxelNode* node, const unsigned char* color, bool destructive);
+    void createSphereVoxels(std::vector<VoxelCoordinates>& voxels, bool destructive);
+    void createVoxelsFromGridRecursion(VoxelNode* node, int level, int x, int y, int z, void* extraData);
 
-    int encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
-                                     EncodeBitstreamParams& params, int& currentEncodeLevel) const;
-
-    static bool countVoxelsOperation(VoxelNode* node, void* extraData);
+    int encodeTreeBitstreamRecursion(VoxelNode* node, VoxelPacketChain& packets, VoxelNodeBag& bag,
+                                     EncodeBitstreamParams& params, int& currentEncodeLevel,
+                                     const unsigned char* referenceColor = NULL) const;
+    bool startNextPacket(VoxelPacketChain& packets, const EncodeBitstreamParams& params, int bytesNeeded) const;
 
     VoxelNode* nodeForOctalCode(VoxelNode* ancestorNode, unsigned char* needleCode, VoxelNode** parentOfFoundNode) const;
     VoxelNode* createMissingNode(VoxelNode* lastParentNode, unsigned char* deepestCodeToCreate);
-    int readNodeData(VoxelNode *destinationNode, unsigned char* nodeData, int bufferSizeBytes, ReadBitstreamToTreeParams& args);
+    int readNodeData(VoxelNode *destinationNode, unsigned char* nodeData, int bufferSizeBytes, ReadBitstreamToTreeParams& args,
+                     const unsigned char* referenceColor = NULL);
     
     bool _isDirty;
     unsigned long int _nodesChangedFromBitstream;
+    uint64_t _readBitstreamStarted;
     bool _shouldReaverage;
     bool _stopImport;
+    VoxelTreePager* _pager;
+
+    struct SubtreeVersion {
+        VoxelSubtreeVersion version;
+        uint64_t computedAt;
+    };
+    mutable std::map<uint32_t, SubtreeVersion> _subtreeVersions; // by VoxelSubtreeVersions key
 
     /// Octal Codes of any subtrees currently being encoded. While any of these codes is being encoded, ancestors and 
     /// descendants of them can not be deleted.
@@ -0,0 +1,299 @@
+//
+//  VoxelTreePager.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <QtCore/QDebug>
+
+#include "SharedUtil.h"
+#include "VoxelNode.h"
+#include "VoxelTree.h"
+#include "VoxelTreePager.h"
+
+const int LOAD_LATENCY_SAMPLES = 100;
+
+VoxelTreePager::VoxelTreePager(VoxelTree* tree, int maxResidentSubtrees) :
+    _tree(tree),
+    _filename(NULL),
+    _maxResidentSubtrees(maxResidentSubtrees),
+    _persisting(false),
+    _persistStartedAt(0),
+    _residentCount(0),
+    _residentBytes(0),
+    _faultCount(0),
+    _evictionCount(0),
+    _writeBackCount(0),
+    _lastFaultCount(0),
+    _lastFaultRateTime(usecTimestampNow()),
+    _loadLatency(LOAD_LATENCY_SAMPLES)
+{
+    pthread_mutex_init(&_queueLock, NULL);
+}
+
+VoxelTreePager::~VoxelTreePager() {
+    delete[] _filename;
+    pthread_mutex_destroy(&_queueLock);
+}
+
+bool VoxelTreePager::open(const char* filename) {
+    if (!IndexedSVOFile::isIndexedSVOFile(filename) || !_file.open(filename, true)) {
+        return false;
+    }
+    delete[] _filename;
+    _filename = new char[strlen(filename) + 1];
+    strcpy(_filename, filename);
+
+    syncResidency(usecTimestampNow());
+    qDebug("paging voxels from %s, %d of %d subtrees resident\n", filename, _residentCount, getSubtreeCount());
+    return true;
+}
+
+// a subtree is resident if the tree has anything below its root, and what's resident is taken to match the file as it
+// was at inFileSince, so that later changes are written back
+void VoxelTreePager::syncResidency(uint64_t inFileSince) {
+    bool wasDirty = _tree->isDirty();
+    _file.loadTop(_tree);
+
+    Subtree empty = { false, 0, 0, 0 };
+    uint64_t now = usecTimestampNow();
+    _subtrees.assign(_file.getSubtreeCount(), empty);
+    _residentCount = 0;
+    _residentBytes = 0;
+    for (int i = 0; i < _file.getSubtreeCount(); i++) {
+        VoxelNode* node = _file.getSubtreeNode(_tree, i);
+        bool resident = node && !node->isLeaf();
+        _file.setSubtreeLoaded(i, resident);
+        if (resident) {
+            _subtrees[i].lastUsed = now;
+            _subtrees[i].loadedAt = inFileSince;
+            _residentCount++;
+            _residentBytes += _file.getSubtreeRawBytes(i);
+        }
+    }
+    pthread_mutex_lock(&_queueLock);
+    _loadQueue.clear();
+    pthread_mutex_unlock(&_queueLock);
+
+    if (!wasDirty) {
+        _tree->clearDirtyBit();
+    }
+}
+
+void VoxelTreePager::subtreeVisited(VoxelNode* node) {
+    int subtree = _file.findSubtree(node->getOctalCode());
+    if (subtree == -1) {
+        return;
+    }
+    uint64_t now = usecTimestampNow();
+    pthread_mutex_lock(&_queueLock);
+    Subtree& record = _subtrees[subtree];
+    record.lastUsed = now;
+    if (!_file.isSubtreeLoaded(subtree) && !record.queued) {
+        record.queued = true;
+        record.requestedAt = now;
+        _loadQueue.push_back(subtree);
+        _faultCount++;
+    }
+    pthread_mutex_unlock(&_queueLock);
+}
+
+void VoxelTreePager::makeResident(unsigned char* octalCode) {
+    int subtree = _file.findSubtree(octalCode);
+    if (subtree == -1) {
+        return;
+    }
+    uint64_t now = usecTimestampNow();
+    pthread_mutex_lock(&_queueLock);
+    Subtree& record = _subtrees[subtree];
+    record.lastUsed = now;
+    bool needsLoad = !_file.isSubtreeLoaded(subtree);
+    if (needsLoad) {
+        if (!record.queued) {
+            record.requestedAt = now;
+        }
+        _faultCount++;
+    }
+    pthread_mutex_unlock(&_queueLock);
+
+    if (needsLoad) {
+        loadSubtree(subtree);
+    }
+}
+
+bool VoxelTreePager::loadSubtree(int subtree) {
+    Subtree& record = _subtrees[subtree];
+    bool loaded;
+    if (_file.getSubtreeNode(_tree, subtree)) {
+        // loading makes the tree look edited, but what's loaded is already in the file
+        bool wasDirty = _tree->isDirty();
+        loaded = _file.loadSubtree(_tree, subtree);
+        if (!wasDirty) {
+            _tree->clearDirtyBit();
+        }
+        record.loadedAt = usecTimestampNow();
+    } else {
+        // an edit above the index depth deleted this subtree while it was paged out, so what's in the file is stale,
+        // and whatever ends up here is written back over it on eviction
+        _file.setSubtreeLoaded(subtree, true);
+        loaded = true;
+        record.loadedAt = 0;
+    }
+
+    pthread_mutex_lock(&_queueLock);
+    if (loaded) {
+        uint64_t now = usecTimestampNow();
+        _loadLatency.updateAverage(now - record.requestedAt);
+        record.lastUsed = now;
+        _residentCount++;
+        _residentBytes += _file.getSubtreeRawBytes(subtree);
+    }
+    record.queued = false;
+    pthread_mutex_unlock(&_queueLock);
+    return loaded;
+}
+
+int VoxelTreePager::processLoads(int maxLoads) {
+    int subtreesLoaded = 0;
+    while (subtreesLoaded < maxLoads) {
+        pthread_mutex_lock(&_queueLock);
+        if (_loadQueue.empty()) {
+            pthread_mutex_unlock(&_queueLock);
+            break;
+        }
+        int subtree = _loadQueue.front();
+        _loadQueue.pop_front();
+        pthread_mutex_unlock(&_queueLock);
+
+        if (!_file.isSubtreeLoaded(subtree) && loadSubtree(subtree)) {
+            subtreesLoaded++;
+        }
+    }
+    evictToBudget();
+    return subtreesLoaded;
+}
+
+void VoxelTreePager::evictSubtree(int subtree) {
+    Subtree& record = _subtrees[subtree];
+    VoxelNode* node = _file.getSubtreeNode(_tree, subtree);
+    unsigned long residentBytes = _file.getSubtreeRawBytes(subtree);
+
+    // subtrees that were deleted by edits are written back too, as empty ones
+    if (!node || node->getLastChanged() > record.loadedAt) {
+        if (!_file.rewriteSubtree(_tree, subtree)) {
+            return; // rather keep it than lose the edits
+        }
+        _writeBackCount++;
+    }
+    if (node) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            node->safeDeepDeleteChildAtIndex(i);
+        }
+    }
+    _file.setSubtreeLoaded(subtree, false);
+    _residentCount--;
+    _residentBytes -= std::min(residentBytes, _residentBytes);
+    _evictionCount++;
+}
+
+void VoxelTreePager::evictToBudget() {
+    if (_residentCount <= _maxResidentSubtrees || _persisting) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, int> > leastRecentlyUsed;
+    pthread_mutex_lock(&_queueLock);
+    for (int i = 0; i < (int)_subtrees.size(); i++) {
+        if (_file.isSubtreeLoaded(i)) {
+            leastRecentlyUsed.push_back(std::make_pair(_subtrees[i].lastUsed, i));
+        }
+    }
+    pthread_mutex_unlock(&_queueLock);
+    std::sort(leastRecentlyUsed.begin(), leastRecentlyUsed.end());
+
+    for (int i = 0; i < (int)leastRecentlyUsed.size() && _residentCount > _maxResidentSubtrees; i++) {
+        evictSubtree(leastRecentlyUsed[i].second);
+    }
+}
+
+void VoxelTreePager::beginPersist() {
+    if (!isOpen() || _persisting) {
+        return;
+    }
+    _persistStartedAt = usecTimestampNow();
+    IndexedSVOFile::takeSnapshot(_tree, _persistSnapshot, getIndexDepth(), _file.isCompressed(), &_file);
+    _persisting = true;
+}
+
+// the new file is written next to the current one and swapped in, which also drops the garbage left by write backs
+void VoxelTreePager::getTemporaryFilename(std::vector<char>& temporaryFilename) const {
+    temporaryFilename.resize(strlen(_filename) + sizeof(".tmp"));
+    sprintf(&temporaryFilename[0], "%s.tmp", _filename);
+}
+
+bool VoxelTreePager::writePersistSnapshot() {
+    if (!_persisting) {
+        return false;
+    }
+    std::vector<char> temporaryFilename;
+    getTemporaryFilename(temporaryFilename);
+    bool written = IndexedSVOFile::writeSnapshot(_persistSnapshot, &temporaryFilename[0], _filename);
+    if (!written) {
+        qDebug("VoxelTreePager::writePersistSnapshot() couldn't write %s\n", &temporaryFilename[0]);
+    }
+    _persistSnapshot.clear();
+    return written;
+}
+
+bool VoxelTreePager::finishPersist(bool written) {
+    if (!_persisting) {
+        return false;
+    }
+    _persisting = false;
+    std::vector<char> temporaryFilename;
+    getTemporaryFilename(temporaryFilename);
+    if (!written) {
+        remove(&temporaryFilename[0]);
+        evictToBudget();
+        return false;
+    }
+    _file.close();
+    if (rename(&temporaryFilename[0], _filename) != 0) {
+        qDebug("VoxelTreePager::finishPersist() couldn't replace %s\n", _filename);
+    }
+    if (!_file.open(_filename, true)) {
+        return false;
+    }
+    // The top of the new file is from the snapshot, so it isn't loaded over what's been edited since, and the changes
+    // to resident subtrees since then are written back when they're evicted.
+    _file.setSubtreeLoaded(-1, true);
+    syncResidency(_persistStartedAt);
+    evictToBudget();
+    return true;
+}
+
+int VoxelTreePager::getQueuedCount() {
+    pthread_mutex_lock(&_queueLock);
+    int queuedCount = _loadQueue.size();
+    pthread_mutex_unlock(&_queueLock);
+    return queuedCount;
+}
+
+float VoxelTreePager::getFaultRate() {
+    uint64_t now = usecTimestampNow();
+    float elapsedSeconds = (now - _lastFaultRateTime) / 1000000.0f;
+    float faultRate = (elapsedSeconds > 0.0f) ? (_faultCount - _lastFaultCount) / elapsedSeconds : 0.0f;
+    _lastFaultCount = _faultCount;
+    _lastFaultRateTime = now;
+    return faultRate;
+}
+
+void VoxelTreePager::printStats() {
+    qDebug("pager: %d of %d subtrees resident (%lu bytes), %d queued, %lu faults (%f/sec), %f usecs average load, "
+           "%lu evictions, %lu write backs\n", _residentCount, getSubtreeCount(), _residentBytes, getQueuedCount(),
+           _faultCount, getFaultRate(), getAverageLoadLatency(), _evictionCount, _writeBackCount);
+}
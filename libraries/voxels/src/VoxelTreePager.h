@@ -0,0 +1,121 @@
+//
+//  VoxelTreePager.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Keeps only part of a tree in memory, paging the subtrees of an IndexedSVOFile in and out. Everything above the
+//  file's index depth is always resident, so a subtree that isn't loaded still shows up as a leaf with its averaged
+//  color. When the encoder reaches one of those leaves in a view, it asks the pager for it rather than waiting on the
+//  disk, and processLoads() faults it in from another thread. Once more subtrees are resident than the budget allows,
+//  the ones that have gone unused longest are written back (if they've been edited) and dropped.
+//
+//  The pager doesn't lock the tree itself: encodeTreeBitstream() calls subtreeVisited() with the tree already locked,
+//  and the other methods that touch the tree need the caller to hold the same lock.
+//
+
+#ifndef __hifi__VoxelTreePager__
+#define __hifi__VoxelTreePager__
+
+#include <pthread.h>
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+#include <SimpleMovingAverage.h>
+
+#include "IndexedSVOFile.h"
+
+class VoxelNode;
+class VoxelTree;
+
+class VoxelTreePager {
+public:
+    static const int DEFAULT_MAX_RESIDENT_SUBTREES = 256;
+    static const int DEFAULT_MAX_LOADS_PER_PASS = 8;
+
+    VoxelTreePager(VoxelTree* tree, int maxResidentSubtrees = DEFAULT_MAX_RESIDENT_SUBTREES);
+    ~VoxelTreePager();
+
+    /// Opens an indexed SVO file for paging. Subtrees that the tree already has are treated as resident, and if the tree
+    /// is empty the top of the file is loaded. Returns false if the file isn't an indexed SVO file.
+    bool open(const char* filename);
+    bool isOpen() const { return _file.isOpen(); }
+    int getIndexDepth() const { return _file.getIndexDepth(); }
+
+    /// called by the encoder for the nodes at the index depth that it's about to send, queues them for loading if they
+    /// aren't resident
+    void subtreeVisited(VoxelNode* node);
+
+    /// loads the subtree holding this octal code right away, for edits, which have to be applied to the whole subtree
+    void makeResident(unsigned char* octalCode);
+
+    /// loads some of the queued subtrees and then evicts down to the budget, returns the number loaded
+    int processLoads(int maxLoads = DEFAULT_MAX_LOADS_PER_PASS);
+
+    /// Writes the whole tree out in three steps, so that the tree is only locked while the resident subtrees are
+    /// encoded and while the new file is swapped in, not while it's written. beginPersist() encodes the resident
+    /// subtrees, writePersistSnapshot() writes them without the tree locked, copying the subtrees that aren't resident
+    /// from the current file, and finishPersist() replaces the current file with the new one, if it was written, and
+    /// reopens it. Nothing is evicted in between, as write backs to the current file wouldn't make it into the new one.
+    void beginPersist();
+    bool writePersistSnapshot();
+    bool finishPersist(bool written);
+
+    int getSubtreeCount() const { return _file.getSubtreeCount(); }
+    int getResidentSubtreeCount() const { return _residentCount; }
+    unsigned long getResidentBytes() const { return _residentBytes; }
+    int getQueuedCount();
+    unsigned long getFaultCount() const { return _faultCount; }
+    unsigned long getEvictionCount() const { return _evictionCount; }
+    unsigned long getWriteBackCount() const { return _writeBackCount; }
+
+    /// faults per second since the last call
+    float getFaultRate();
+
+    /// average usecs from a subtree being asked for to it being resident
+    float getAverageLoadLatency() { return _loadLatency.getAverage(); }
+
+    void printStats();
+
+private:
+    // disallow copying of VoxelTreePager objects
+    VoxelTreePager(const VoxelTreePager&);
+    VoxelTreePager& operator= (const VoxelTreePager&);
+
+    struct Subtree {
+        bool        queued;
+        uint64_t    requestedAt;
+        uint64_t    lastUsed;
+        uint64_t    loadedAt;   // anything in the subtree that has changed since then is written back on eviction
+    };
+
+    void syncResidency(uint64_t inFileSince);
+    void getTemporaryFilename(std::vector<char>& temporaryFilename) const;
+    bool loadSubtree(int subtree);
+    void evictSubtree(int subtree);
+    void evictToBudget();
+
+    VoxelTree*              _tree;
+    IndexedSVOFile          _file;
+    char*                   _filename;
+    int                     _maxResidentSubtrees;
+    std::vector<Subtree>    _subtrees;
+    std::deque<int>         _loadQueue;
+    pthread_mutex_t         _queueLock; // protects _loadQueue and the queued and lastUsed fields
+
+    bool                    _persisting;
+    uint64_t                _persistStartedAt;
+    IndexedSVOFile::Snapshot _persistSnapshot;
+
+    int                     _residentCount;
+    unsigned long           _residentBytes;
+    unsigned long           _faultCount;
+    unsigned long           _evictionCount;
+    unsigned long           _writeBackCount;
+    unsigned long           _lastFaultCount;
+    uint64_t                _lastFaultRateTime;
+    SimpleMovingAverage     _loadLatency;
+};
+
+#endif /* defined(__hifi__VoxelTreePager__) */
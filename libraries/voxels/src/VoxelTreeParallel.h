@@ -0,0 +1,95 @@
+//
+//  VoxelTreeParallel.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Parallel version of the visitNodes() walk from VoxelTreeVisitor.h, for whole tree passes that only read the tree
+//  (or only write to the nodes they visit). The calling thread walks the top of the tree down to a split depth, and the
+//  subtrees below that are handed out as tasks to a WorkStealingPool. Each worker walks with its own copy of the
+//  visitor, and the copies are folded back into the caller's visitor with join() when all the subtrees are done, which
+//  is how reductions like counts and bounds are written. So on top of visit(), a parallel visitor must be copyable and
+//  have a
+//
+//      void join(const Visitor& other);
+//
+//  method. The workers' copies are made before the walk starts, so pass in a visitor that hasn't accumulated anything.
+//
+
+#ifndef __hifi__VoxelTreeParallel__
+#define __hifi__VoxelTreeParallel__
+
+#include <vector>
+
+#include <WorkStealingPool.h>
+
+#include "VoxelTreeVisitor.h"
+
+// 8^3 = 512 subtrees at most, plenty to balance the workers without making the top of the walk expensive
+const int DEFAULT_PARALLEL_SPLIT_DEPTH = 3;
+
+template<typename Visitor>
+class ParallelVisit {
+public:
+    std::vector<VoxelNode*> subtrees;
+    std::vector<Visitor> workerVisitors;
+
+    static void visitSubtree(void* context, int taskIndex, int workerIndex) {
+        ParallelVisit* parallelVisit = static_cast<ParallelVisit*>(context);
+        visitNodes(parallelVisit->subtrees[taskIndex], parallelVisit->workerVisitors[workerIndex]);
+    }
+};
+
+/// Walks node and its descendants with visitor, like visitNodes() but splitting the walk across the pool's workers.
+/// Nodes are visited parents before children, but the order between subtrees is not defined.
+template<typename Visitor>
+inline void visitNodesParallel(VoxelNode* node, Visitor& visitor, int splitDepth = DEFAULT_PARALLEL_SPLIT_DEPTH,
+                               WorkStealingPool* pool = NULL) {
+    if (!pool) {
+        pool = WorkStealingPool::getInstance();
+    }
+    if (pool->getWorkerCount() == 1) {
+        visitNodes(node, visitor);
+        return;
+    }
+
+    ParallelVisit<Visitor> parallelVisit;
+    parallelVisit.workerVisitors.assign(pool->getWorkerCount(), visitor);
+
+    // visit the top of the tree here, and collect the nodes at the split depth that we'd descend into
+    if (splitDepth <= 0) {
+        parallelVisit.subtrees.push_back(node);
+    } else if (visitor.visit(node)) {
+        std::vector<VisitFrame> stack(splitDepth);
+        stack[0].node = node;
+        stack[0].nextChild = 0;
+        int stackSize = 1;
+        while (stackSize > 0) {
+            VisitFrame& top = stack[stackSize - 1];
+            VoxelNode* child = NULL;
+            while (!child && top.nextChild < NUMBER_OF_CHILDREN) {
+                child = top.node->getChildAtIndex(top.nextChild++);
+            }
+            if (!child) {
+                stackSize--;
+            } else if (stackSize == splitDepth) {
+                parallelVisit.subtrees.push_back(child);
+            } else if (visitor.visit(child)) {
+                VisitFrame& childFrame = stack[stackSize++];
+                childFrame.node = child;
+                childFrame.nextChild = 0;
+            }
+        }
+    }
+    if (parallelVisit.subtrees.empty()) {
+        return;
+    }
+
+    pool->run(ParallelVisit<Visitor>::visitSubtree, &parallelVisit, parallelVisit.subtrees.size());
+
+    for (int i = 0; i < pool->getWorkerCount(); i++) {
+        visitor.join(parallelVisit.workerVisitors[i]);
+    }
+}
+
+#endif /* defined(__hifi__VoxelTreeParallel__) */
@@ -0,0 +1,163 @@
+//
+//  VoxelTreeVisitor.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Header only tree walkers that take their operation as a template argument instead of a RecurseVoxelTreeOperation
+//  function pointer, so the per node work can be inlined into the walk, and that keep their own explicit stack instead
+//  of recursing. The visitor is any class with a
+//
+//      bool visit(VoxelNode* node);       // return true to descend into node's children
+//
+//  method (and, for visitNodesPostOrder(), a void postVisit(VoxelNode* node) method), and it carries whatever typed
+//  state the walk needs in place of the old void* extraData.
+//
+//  A visit may add or remove children of the node it is visiting (the children are read after it returns), but it
+//  must not touch any other part of the tree.
+//
+
+#ifndef __hifi__VoxelTreeVisitor__
+#define __hifi__VoxelTreeVisitor__
+
+#include <glm/glm.hpp>
+
+#include "VoxelNode.h"
+
+// octal codes store their length in a byte, so the tree can't be deeper than this
+const int MAX_VISIT_DEPTH = 256;
+
+/// A node on the walks' stacks, one per level, with the children that are still to be walked. The children are read
+/// as they're reached rather than when the node is visited, so the stacks only grow with the depth of the tree.
+struct VisitFrame {
+    VoxelNode* node;
+    int nextChild;
+};
+
+/// Pre-order walk of node and its descendants, in the same order as VoxelTree::recurseNodeWithOperation().
+template<typename Visitor>
+inline void visitNodes(VoxelNode* node, Visitor& visitor) {
+    if (!visitor.visit(node)) {
+        return;
+    }
+    VisitFrame stack[MAX_VISIT_DEPTH + 1];
+    stack[0].node = node;
+    stack[0].nextChild = 0;
+    int stackSize = 1;
+    while (stackSize > 0) {
+        VisitFrame& top = stack[stackSize - 1];
+        VoxelNode* child = NULL;
+        while (!child && top.nextChild < NUMBER_OF_CHILDREN) {
+            child = top.node->getChildAtIndex(top.nextChild++);
+        }
+        if (!child) {
+            stackSize--;
+        } else if (visitor.visit(child)) {
+            VisitFrame& childFrame = stack[stackSize++];
+            childFrame.node = child;
+            childFrame.nextChild = 0;
+        }
+    }
+}
+
+/// Walk of node and its descendants that calls visitor.visit() on the way down and visitor.postVisit() on the way back
+/// up, once all of a node's children are done (postVisit() is called whether or not visit() asked to descend).
+template<typename Visitor>
+inline void visitNodesPostOrder(VoxelNode* node, Visitor& visitor) {
+    VisitFrame stack[MAX_VISIT_DEPTH + 1];
+    stack[0].node = node;
+    stack[0].nextChild = visitor.visit(node) ? 0 : NUMBER_OF_CHILDREN;
+    int stackSize = 1;
+    while (stackSize > 0) {
+        VisitFrame& top = stack[stackSize - 1];
+        VoxelNode* child = NULL;
+        while (!child && top.nextChild < NUMBER_OF_CHILDREN) {
+            child = top.node->getChildAtIndex(top.nextChild++);
+        }
+        if (child) {
+            VisitFrame& childFrame = stack[stackSize++];
+            childFrame.node = child;
+            childFrame.nextChild = visitor.visit(child) ? 0 : NUMBER_OF_CHILDREN;
+        } else {
+            visitor.postVisit(top.node);
+            stackSize--;
+        }
+    }
+}
+
+// the child indices of a SortedVisitFrame are packed into its order this many bits apiece
+const int VISIT_ORDER_BITS = 3;
+const unsigned int VISIT_ORDER_MASK = (1 << VISIT_ORDER_BITS) - 1;
+
+/// a VisitFrame whose children are walked in the order they were sorted in when the node was visited
+struct SortedVisitFrame {
+    VoxelNode* node;
+    unsigned int order;
+    int childCount;
+    int nextChild;
+};
+
+// sorts the node's children closest to point first, into the frame
+inline void sortVisitFrame(SortedVisitFrame& frame, VoxelNode* node, const glm::vec3& point) {
+    float distancesToChildren[NUMBER_OF_CHILDREN];
+    frame.node = node;
+    frame.order = 0;
+    frame.childCount = 0;
+    frame.nextChild = 0;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i);
+        if (!child) {
+            continue;
+        }
+        // insertion sort, with the later of two children at the same distance first, as it always has been
+        float distanceSquared = child->distanceSquareToPoint(point);
+        int insertAt = frame.childCount;
+        while (insertAt > 0 && distancesToChildren[insertAt - 1] >= distanceSquared) {
+            distancesToChildren[insertAt] = distancesToChildren[insertAt - 1];
+            insertAt--;
+        }
+        distancesToChildren[insertAt] = distanceSquared;
+        int shift = insertAt * VISIT_ORDER_BITS;
+        unsigned int before = frame.order & ((1u << shift) - 1);
+        unsigned int after = (frame.order >> shift) << (shift + VISIT_ORDER_BITS);
+        frame.order = after | ((unsigned int)i << shift) | before;
+        frame.childCount++;
+    }
+}
+
+/// Pre-order walk of node and its descendants that visits the children of each node closest to point first, in the
+/// same order as VoxelTree::recurseNodeWithOperationDistanceSorted(). point is in voxel units.
+template<typename Visitor>
+inline void visitNodesDistanceSorted(VoxelNode* node, const glm::vec3& point, Visitor& visitor) {
+    if (!visitor.visit(node)) {
+        return;
+    }
+    SortedVisitFrame stack[MAX_VISIT_DEPTH + 1];
+    sortVisitFrame(stack[0], node, point);
+    int stackSize = 1;
+    while (stackSize > 0) {
+        SortedVisitFrame& top = stack[stackSize - 1];
+        VoxelNode* child = NULL;
+        while (!child && top.nextChild < top.childCount) {
+            child = top.node->getChildAtIndex((top.order >> (top.nextChild++ * VISIT_ORDER_BITS)) & VISIT_ORDER_MASK);
+        }
+        if (!child) {
+            stackSize--;
+        } else if (visitor.visit(child)) {
+            sortVisitFrame(stack[stackSize++], child, point);
+        }
+    }
+}
+
+/// Adapts a RecurseVoxelTreeOperation to the visitor walks, for the callers that still use function pointers.
+class FunctionPointerVisitor {
+public:
+    FunctionPointerVisitor(bool (*operation)(VoxelNode*, void*), void* extraData) :
+        _operation(operation), _extraData(extraData) { };
+    bool visit(VoxelNode* node) { return _operation(node, _extraData); };
+private:
+    bool (*_operation)(VoxelNode*, void*);
+    void* _extraData;
+};
+
+#endif /* defined(__hifi__VoxelTreeVisitor__) */
@@ -0,0 +1,236 @@
+//
+//  NetworkTests.cpp
+//  tests
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <vector>
+
+#include <NodeList.h>
+#include <NodeTypes.h>
+#include <PacketBuffer.h>
+#include <PacketQueue.h>
+#include <SharedUtil.h>
+
+#include "NetworkTests.h"
+#include "TestUtil.h"
+
+static sockaddr_in loopbackAddress(unsigned short port) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    return address;
+}
+
+// what a producer pushes: which producer it is, and the sequence number of the packet, as the packet's bytes
+struct SequencedPacket {
+    int producer;
+    int sequence;
+};
+
+struct PacketQueueProducer {
+    PacketQueue* queue;
+    int producer;
+    int packetCount;
+};
+
+static void* pushSequencedPackets(void* args) {
+    PacketQueueProducer* producer = (PacketQueueProducer*)args;
+    sockaddr_in address = loopbackAddress(1024 + producer->producer);
+    for (int i = 0; i < producer->packetCount; i++) {
+        SequencedPacket packet = { producer->producer, i };
+        // every other packet handed in as a buffer, the rest copied in
+        bool pushed;
+        do {
+            if (i % 2 == 0) {
+                PacketBuffer* buffer = PacketBuffer::copyOf((unsigned char*)&packet, sizeof(packet));
+                pushed = producer->queue->push((sockaddr&)address, buffer);
+                buffer->release();
+            } else {
+                pushed = producer->queue->push((sockaddr&)address, (unsigned char*)&packet, sizeof(packet));
+            }
+            if (!pushed) {
+                const uint64_t FULL_QUEUE_WAIT_USECS = 100 * 1000;
+                producer->queue->waitForSpace(FULL_QUEUE_WAIT_USECS);
+            }
+        } while (!pushed);
+    }
+    return NULL;
+}
+
+// producers pushing into a queue small enough to fill, with the packets of each coming out in the order it pushed them
+static void testPacketQueueOrdering() {
+    const int QUEUE_CAPACITY = 64;
+    const int PRODUCER_COUNT = 4;
+    const int PACKETS_PER_PRODUCER = 20000;
+    PacketQueue queue(QUEUE_CAPACITY);
+
+    PacketQueueProducer producers[PRODUCER_COUNT];
+    pthread_t producerThreads[PRODUCER_COUNT];
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        producers[i].queue = &queue;
+        producers[i].producer = i;
+        producers[i].packetCount = PACKETS_PER_PRODUCER;
+        pthread_create(&producerThreads[i], NULL, pushSequencedPackets, &producers[i]);
+    }
+
+    std::vector<int> nextSequences(PRODUCER_COUNT, 0);
+    int packetsToConsume = PRODUCER_COUNT * PACKETS_PER_PRODUCER;
+    int outOfOrder = 0;
+    int wrongAddresses = 0;
+    int badPackets = 0;
+    const uint64_t PACKET_WAIT_USECS = 1000 * 1000;
+    while (packetsToConsume > 0 && queue.waitForPacket(PACKET_WAIT_USECS)) {
+        // take what's there a few packets at a time, the way the receiving threads do
+        int peeked = 0;
+        PacketQueue::Packet* packet;
+        const int MAX_PEEKED_PACKETS = 8;
+        while (peeked < MAX_PEEKED_PACKETS && (packet = queue.peek(peeked)) != NULL) {
+            SequencedPacket sequenced;
+            if (packet->buffer->getLength() != sizeof(sequenced)) {
+                badPackets++;
+            } else {
+                memcpy(&sequenced, packet->buffer->getData(), sizeof(sequenced));
+                if (sequenced.producer < 0 || sequenced.producer >= PRODUCER_COUNT) {
+                    badPackets++;
+                } else {
+                    if (sequenced.sequence != nextSequences[sequenced.producer]) {
+                        outOfOrder++;
+                    }
+                    nextSequences[sequenced.producer] = sequenced.sequence + 1;
+                    sockaddr_in address = loopbackAddress(1024 + sequenced.producer);
+                    if (!socketMatch(&packet->address, (sockaddr*)&address)) {
+                        wrongAddresses++;
+                    }
+                }
+            }
+            peeked++;
+        }
+        queue.pop(peeked);
+        packetsToConsume -= peeked;
+    }
+
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        pthread_join(producerThreads[i], NULL);
+    }
+
+    printf("packet queue: %d packets, %d out of order, %d to wrong addresses, %d bad\n",
+           PRODUCER_COUNT * PACKETS_PER_PRODUCER - packetsToConsume, outOfOrder, wrongAddresses, badPackets);
+    CHECK(packetsToConsume == 0);
+    CHECK(outOfOrder == 0);
+    CHECK(wrongAddresses == 0);
+    CHECK(badPackets == 0);
+    CHECK(queue.size() == 0);
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        CHECK(nextSequences[i] == PACKETS_PER_PRODUCER);
+    }
+}
+
+// the lookups as they used to be done, scanning the list for the alive node
+static Node* referenceNodeWithAddress(NodeList* nodeList, sockaddr* senderAddress) {
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->isAlive() && node->getActiveSocket() && socketMatch(node->getActiveSocket(), senderAddress)) {
+            return &(*node);
+        }
+    }
+    return NULL;
+}
+
+static Node* referenceNodeWithID(NodeList* nodeList, uint16_t nodeID) {
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->isAlive() && node->getNodeID() == nodeID) {
+            return &(*node);
+        }
+    }
+    return NULL;
+}
+
+// nodes spread over many addresses and ports, the way a busy mixer's are
+static sockaddr_in testNodeAddress(int node) {
+    sockaddr_in address = loopbackAddress(1024 + node % 50000);
+    address.sin_addr.s_addr = htonl(0x0a000000 | (node / 50000));
+    return address;
+}
+
+// the number of nodes whose lookups through the indexes don't find what scanning the list does
+static int countIndexMismatches(NodeList* nodeList, int nodeCount) {
+    int mismatches = 0;
+    for (int i = 1; i <= nodeCount; i++) {
+        sockaddr_in address = testNodeAddress(i);
+        if (nodeList->nodeWithAddress((sockaddr*)&address) != referenceNodeWithAddress(nodeList, (sockaddr*)&address) ||
+                nodeList->nodeWithID(i) != referenceNodeWithID(nodeList, i)) {
+            mismatches++;
+        }
+    }
+    NodeList::doneWithNodes();
+    return mismatches;
+}
+
+static void ignoreMessage(QtMsgType type, const QMessageLogContext& context, const QString& message) {
+}
+
+static void testNodeListIndexes() {
+    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AVATAR_MIXER, 0);
+
+    // the list logs every node it adds
+    QtMessageHandler previousHandler = qInstallMessageHandler(ignoreMessage);
+
+    const int NODE_COUNT = 2000;
+    for (int i = 1; i <= NODE_COUNT; i++) {
+        sockaddr_in address = testNodeAddress(i);
+        nodeList->addOrUpdateNode((sockaddr*)&address, (sockaddr*)&address, NODE_TYPE_AGENT, i);
+    }
+    CHECK(nodeList->size() == NODE_COUNT);
+    CHECK(countIndexMismatches(nodeList, NODE_COUNT) == 0);
+
+    // adding them again finds them rather than adding them twice
+    int readded = 0;
+    for (int i = 1; i <= NODE_COUNT; i++) {
+        sockaddr_in address = testNodeAddress(i);
+        Node* node = nodeList->addOrUpdateNode((sockaddr*)&address, (sockaddr*)&address, NODE_TYPE_AGENT, i);
+        if (node != nodeList->nodeWithID(i)) {
+            readded++;
+        }
+    }
+    CHECK(readded == 0);
+    CHECK(nodeList->size() == NODE_COUNT);
+
+    // killed nodes aren't found before they're taken out, or after
+    const int KILLED_NODE_SPACING = 10;
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->getNodeID() % KILLED_NODE_SPACING == 0) {
+            node->setAlive(false);
+        }
+    }
+    NodeList::doneWithNodes();
+    CHECK(countIndexMismatches(nodeList, NODE_COUNT) == 0);
+    nodeList->removeDeadNodes();
+    CHECK(nodeList->getNumAliveNodes() == NODE_COUNT - NODE_COUNT / KILLED_NODE_SPACING);
+    CHECK(countIndexMismatches(nodeList, NODE_COUNT) == 0);
+
+    // and come back when they're added again, in the slots the killed ones left
+    for (int i = KILLED_NODE_SPACING; i <= NODE_COUNT; i += KILLED_NODE_SPACING) {
+        sockaddr_in address = testNodeAddress(i);
+        nodeList->addOrUpdateNode((sockaddr*)&address, (sockaddr*)&address, NODE_TYPE_AGENT, i);
+    }
+    CHECK(nodeList->getNumAliveNodes() == NODE_COUNT);
+    int mismatches = countIndexMismatches(nodeList, NODE_COUNT);
+    CHECK(mismatches == 0);
+
+    nodeList->clear();
+    NodeList::doneWithNodes();
+    qInstallMessageHandler(previousHandler);
+
+    printf("node list indexes: %d nodes, %d mismatches\n", NODE_COUNT, mismatches);
+}
+
+void runNetworkTests() {
+    testPacketQueueOrdering();
+    testNodeListIndexes();
+}
@@ -0,0 +1,14 @@
+//
+//  NetworkTests.h
+//  tests
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#ifndef __tests__NetworkTests__
+#define __tests__NetworkTests__
+
+/// checks the packet queue's ordering and the node list's indexes
+void runNetworkTests();
+
+#endif /* defined(__tests__NetworkTests__) */
@@ -0,0 +1,19 @@
+//
+//  TestUtil.h
+//  tests
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The checks the tests make. A failed check is reported with where it was made, and the test run goes on, so that one
+//  run reports every failure; main() fails if any check did.
+//
+
+#ifndef __tests__TestUtil__
+#define __tests__TestUtil__
+
+#define CHECK(condition) checkCondition((condition), #condition, __FILE__, __LINE__)
+
+/// reports the check if it failed, and returns whether it passed
+bool checkCondition(bool passed, const char* condition, const char* file, int line);
+
+#endif /* defined(__tests__TestUtil__) */
@@ -0,0 +1,359 @@
+//
+//  VoxelTreeTests.cpp
+//  tests
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <SharedUtil.h>
+#include <VoxelTree.h>
+#include <VoxelTreeParallel.h>
+#include <VoxelTreeVisitor.h>
+#include <WorkStealingPool.h>
+
+#include "TestUtil.h"
+#include "VoxelTreeTests.h"
+
+static float randomUnit() {
+    return rand() / (float)RAND_MAX;
+}
+
+// a sphere, and voxels scattered around it at a finer size, so that leaves are at different depths
+static void createTestScene(VoxelTree* tree) {
+    srand(1);
+    const float SPHERE_RADIUS = 0.2f;
+    const float SPHERE_VOXEL_SIZE = 1.0f / 64.0f;
+    tree->createSphere(SPHERE_RADIUS, 0.5f, 0.5f, 0.5f, SPHERE_VOXEL_SIZE, true, NATURAL);
+
+    const int SCATTERED_VOXELS = 1000;
+    const float SCATTERED_VOXEL_SIZE = 1.0f / 128.0f;
+    for (int i = 0; i < SCATTERED_VOXELS; i++) {
+        tree->createVoxel(randomUnit(), randomUnit(), randomUnit(), SCATTERED_VOXEL_SIZE,
+                          randIntInRange(0, 255), randIntInRange(0, 255), randIntInRange(0, 255));
+    }
+    tree->reaverageVoxelColors(tree->rootNode);
+}
+
+// The reference ray cast, visits every intersected subtree and keeps the closest leaf. A box's lower faces count as
+// part of it and its upper faces as part of the next box over, the way the front to back walk splits a node between
+// its children.
+class ReferenceRayArgs {
+public:
+    glm::vec3 origin;
+    glm::vec3 direction;
+    VoxelNode* node;
+    float distance;
+    bool found;
+};
+
+static bool referenceRayPassesThroughBox(const ReferenceRayArgs* args, const AABox& box, float& distance) {
+    float enterDistance = 0.0f;
+    float exitDistance = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        float low = box.getCorner()[axis];
+        float high = low + box.getSize()[axis];
+        if (args->direction[axis] == 0.0f) {
+            if (args->origin[axis] < low || args->origin[axis] >= high) {
+                return false;
+            }
+            continue;
+        }
+        float lowDistance = (low - args->origin[axis]) / args->direction[axis];
+        float highDistance = (high - args->origin[axis]) / args->direction[axis];
+        enterDistance = std::max(enterDistance, std::min(lowDistance, highDistance));
+        exitDistance = std::min(exitDistance, std::max(lowDistance, highDistance));
+    }
+    distance = enterDistance;
+    return enterDistance < exitDistance;
+}
+
+static bool referenceRayIntersectionOperation(VoxelNode* node, void* extraData) {
+    ReferenceRayArgs* args = static_cast<ReferenceRayArgs*>(extraData);
+    float distance;
+    if (!referenceRayPassesThroughBox(args, node->getAABox(), distance)) {
+        return false;
+    }
+    if (!node->isLeaf()) {
+        return true;
+    }
+    distance *= TREE_SCALE;
+    if (node->isColored() && (!args->found || distance < args->distance)) {
+        args->node = node;
+        args->distance = distance;
+        args->found = true;
+    }
+    return false;
+}
+
+static void addRay(std::vector<RayIntersectionQuery>& queries, const glm::vec3& origin, const glm::vec3& direction) {
+    queries.push_back(RayIntersectionQuery(origin * (float)TREE_SCALE, direction));
+}
+
+static void testRayIntersections(VoxelTree* tree) {
+    std::vector<RayIntersectionQuery> queries;
+
+    // rays from anywhere in or around the tree, half of them aimed roughly at the middle of the scene
+    const int RANDOM_RAYS = 5000;
+    for (int i = 0; i < RANDOM_RAYS; i++) {
+        glm::vec3 origin(randomUnit() * 3.0f - 1.0f, randomUnit() * 3.0f - 1.0f, randomUnit() * 3.0f - 1.0f);
+        glm::vec3 direction(randomUnit() - 0.5f, randomUnit() - 0.5f, randomUnit() - 0.5f);
+        if (i % 2 == 0) {
+            direction = glm::vec3(0.5f, 0.5f, 0.5f) + direction * 0.5f - origin;
+        }
+        addRay(queries, origin, direction);
+    }
+
+    // and the edge cases: rays through every point where the children of the top levels meet, along each axis and
+    // diagonally across two or three axes at once, in both directions
+    const int MAX_GRID_LEVEL = 3;
+    for (int level = 1; level <= MAX_GRID_LEVEL; level++) {
+        int gridCells = 1 << level;
+        for (int x = 1; x < gridCells; x++) {
+            for (int y = 1; y < gridCells; y++) {
+                for (int z = 1; z < gridCells; z++) {
+                    glm::vec3 corner(x / (float)gridCells, y / (float)gridCells, z / (float)gridCells);
+                    for (int dx = -1; dx <= 1; dx++) {
+                        for (int dy = -1; dy <= 1; dy++) {
+                            for (int dz = -1; dz <= 1; dz++) {
+                                glm::vec3 direction(dx, dy, dz);
+                                if (direction != glm::vec3(0.0f, 0.0f, 0.0f)) {
+                                    addRay(queries, corner - direction * 2.0f, direction);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    int rayCount = queries.size();
+    tree->findRayIntersections(&queries[0], rayCount);
+
+    int hits = 0;
+    int mismatches = 0;
+    const float DISTANCE_TOLERANCE = 0.001f;
+    for (int i = 0; i < rayCount; i++) {
+        ReferenceRayArgs args = { queries[i].origin / (float)TREE_SCALE, queries[i].direction, NULL, 0.0f, false };
+        tree->recurseTreeWithOperation(referenceRayIntersectionOperation, &args);
+        if (args.found) {
+            hits++;
+        }
+        if (queries[i].found != args.found ||
+                (args.found && fabsf(queries[i].distance - args.distance) > DISTANCE_TOLERANCE * TREE_SCALE)) {
+            mismatches++;
+        }
+    }
+    printf("ray intersections: %d rays, %d hits, %d mismatches\n", rayCount, hits, mismatches);
+    CHECK(hits > 0);
+    CHECK(mismatches == 0);
+}
+
+// The walks as they were before VoxelTreeVisitor.h, recursive with a function pointer operation.
+static void referenceRecurseNodeWithOperation(VoxelNode* node, RecurseVoxelTreeOperation operation, void* extraData) {
+    if (operation(node, extraData)) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* child = node->getChildAtIndex(i);
+            if (child) {
+                referenceRecurseNodeWithOperation(child, operation, extraData);
+            }
+        }
+    }
+}
+
+static void referenceRecurseNodeWithOperationDistanceSorted(VoxelNode* node, RecurseVoxelTreeOperation operation,
+                                                            const glm::vec3& point, void* extraData) {
+    if (operation(node, extraData)) {
+        VoxelNode* sortedChildren[NUMBER_OF_CHILDREN];
+        float distancesToChildren[NUMBER_OF_CHILDREN];
+        int indexOfChildren[NUMBER_OF_CHILDREN];
+        int currentCount = 0;
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* childNode = node->getChildAtIndex(i);
+            if (childNode) {
+                currentCount = insertIntoSortedArrays((void*)childNode, childNode->distanceSquareToPoint(point), i,
+                                                      (void**)&sortedChildren, (float*)&distancesToChildren,
+                                                      (int*)&indexOfChildren, currentCount, NUMBER_OF_CHILDREN);
+            }
+        }
+        for (int i = 0; i < currentCount; i++) {
+            referenceRecurseNodeWithOperationDistanceSorted(sortedChildren[i], operation, point, extraData);
+        }
+    }
+}
+
+static bool recordNodeOperation(VoxelNode* node, void* extraData) {
+    static_cast<std::vector<VoxelNode*>*>(extraData)->push_back(node);
+    return true;
+}
+
+class RecordingVisitor {
+public:
+    bool visit(VoxelNode* node) {
+        nodes.push_back(node);
+        return true;
+    }
+    void join(const RecordingVisitor& other) {
+        nodes.insert(nodes.end(), other.nodes.begin(), other.nodes.end());
+    }
+    std::vector<VoxelNode*> nodes;
+};
+
+static void testTreeWalks(VoxelTree* tree) {
+    std::vector<VoxelNode*> reference;
+    referenceRecurseNodeWithOperation(tree->rootNode, recordNodeOperation, &reference);
+
+    std::vector<VoxelNode*> explicitStack;
+    tree->recurseTreeWithOperation(recordNodeOperation, &explicitStack);
+    CHECK(explicitStack == reference);
+
+    RecordingVisitor visitor;
+    visitNodes(tree->rootNode, visitor);
+    CHECK(visitor.nodes == reference);
+
+    // the parallel walk visits the same nodes, in an order that isn't defined; a pool of its own, so that it splits the
+    // walk however many cores there are
+    const int PARALLEL_WORKERS = 4;
+    WorkStealingPool pool(PARALLEL_WORKERS);
+    RecordingVisitor parallelVisitor;
+    visitNodesParallel(tree->rootNode, parallelVisitor, DEFAULT_PARALLEL_SPLIT_DEPTH, &pool);
+    std::vector<VoxelNode*> sortedReference = reference;
+    std::sort(sortedReference.begin(), sortedReference.end());
+    std::sort(parallelVisitor.nodes.begin(), parallelVisitor.nodes.end());
+    CHECK(parallelVisitor.nodes == sortedReference);
+
+    const glm::vec3 point(0.25f, 0.75f, 0.5f);
+    reference.clear();
+    referenceRecurseNodeWithOperationDistanceSorted(tree->rootNode, recordNodeOperation, point, &reference);
+    RecordingVisitor sortedVisitor;
+    visitNodesDistanceSorted(tree->rootNode, point, sortedVisitor);
+    CHECK(sortedVisitor.nodes == reference);
+
+    printf("tree walks: %d nodes\n", (int)reference.size());
+}
+
+// same shape and colors below both nodes
+static bool sameSubTrees(const VoxelNode* first, const VoxelNode* second) {
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        const VoxelNode* firstChild = first->getChildAtIndex(i);
+        const VoxelNode* secondChild = second->getChildAtIndex(i);
+        if (!firstChild || !secondChild) {
+            if (firstChild != secondChild) {
+                return false;
+            }
+            continue;
+        }
+        if (firstChild->isColored() != secondChild->isColored() ||
+                (firstChild->isColored() && memcmp(firstChild->getTrueColor(), secondChild->getTrueColor(), 3) != 0) ||
+                !sameSubTrees(firstChild, secondChild)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// whether first comes before second, or is the same voxel, walking the tree: the first child index down their paths
+// that differs decides, and a voxel comes before those inside it
+static bool inTreeOrder(const VoxelCoordinates& first, const VoxelCoordinates& second) {
+    int levels = std::min(first.level, second.level);
+    for (int depth = 0; depth < levels; depth++) {
+        int firstShift = first.level - depth - 1;
+        int secondShift = second.level - depth - 1;
+        int firstChild = (((first.x >> firstShift) & 1) << 2) | (((first.y >> firstShift) & 1) << 1) |
+            ((first.z >> firstShift) & 1);
+        int secondChild = (((second.x >> secondShift) & 1) << 2) | (((second.y >> secondShift) & 1) << 1) |
+            ((second.z >> secondShift) & 1);
+        if (firstChild != secondChild) {
+            return firstChild < secondChild;
+        }
+    }
+    return first.level <= second.level;
+}
+
+static void testSortedVoxelCreation() {
+    // a solid ball of voxels in scan order, the way the importers come across them
+    const float BALL_RADIUS = 0.2f;
+    const float BALL_VOXEL_SIZE = 1.0f / 64.0f;
+    std::vector<VoxelDetail> voxels;
+    for (float x = 0.5f - BALL_RADIUS; x < 0.5f + BALL_RADIUS; x += BALL_VOXEL_SIZE) {
+        for (float y = 0.5f - BALL_RADIUS; y < 0.5f + BALL_RADIUS; y += BALL_VOXEL_SIZE) {
+            for (float z = 0.5f - BALL_RADIUS; z < 0.5f + BALL_RADIUS; z += BALL_VOXEL_SIZE) {
+                glm::vec3 offset = glm::vec3(x, y, z) - glm::vec3(0.5f, 0.5f, 0.5f);
+                if (glm::length(offset) < BALL_RADIUS) {
+                    VoxelDetail voxel = { x, y, z, BALL_VOXEL_SIZE, (unsigned char)(x * 255), (unsigned char)(y * 255),
+                                          (unsigned char)(z * 255) };
+                    voxels.push_back(voxel);
+                }
+            }
+        }
+    }
+
+    VoxelTree reference(true);
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        unsigned char* voxelData = pointToVoxel(voxel.x, voxel.y, voxel.z, voxel.s, voxel.red, voxel.green, voxel.blue);
+        reference.readCodeColorBufferToTree(voxelData);
+        delete[] voxelData;
+    }
+
+    std::vector<VoxelCoordinates> coordinates(voxels.size());
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        coordinates[i] = pointToVoxelCoordinates(voxel.x, voxel.y, voxel.z, voxel.s,
+                                                 voxel.red, voxel.green, voxel.blue);
+    }
+
+    VoxelTree single(true);
+    for (size_t i = 0; i < coordinates.size(); i++) {
+        single.createVoxel(coordinates[i]);
+    }
+    CHECK(sameSubTrees(reference.rootNode, single.rootNode));
+
+    VoxelTree batched(true);
+    batched.createVoxels(&coordinates[0], coordinates.size());
+    CHECK(sameSubTrees(reference.rootNode, batched.rootNode));
+
+    VoxelTree::sortVoxelCoordinates(&coordinates[0], coordinates.size());
+    int outOfOrder = 0;
+    for (size_t i = 1; i < coordinates.size(); i++) {
+        if (!inTreeOrder(coordinates[i - 1], coordinates[i])) {
+            outOfOrder++;
+        }
+    }
+    CHECK(outOfOrder == 0);
+
+    VoxelTree sorted(true);
+    sorted.createVoxels(&coordinates[0], coordinates.size());
+    CHECK(sameSubTrees(reference.rootNode, sorted.rootNode));
+
+    // and each voxel is found where it was made
+    int notFound = 0;
+    for (size_t i = 0; i < coordinates.size(); i++) {
+        VoxelNode* node = sorted.getVoxelAt(coordinates[i]);
+        if (!node || !node->isColored() || node->getTrueColor()[0] != coordinates[i].red) {
+            notFound++;
+        }
+    }
+    CHECK(notFound == 0);
+
+    printf("sorted voxel creation: %d voxels, %d out of order, %d not found\n", (int)coordinates.size(), outOfOrder,
+           notFound);
+}
+
+void runVoxelTreeTests() {
+    VoxelTree tree;
+    createTestScene(&tree);
+    printf("test scene has %ld voxels\n", tree.getVoxelCount());
+
+    testRayIntersections(&tree);
+    testTreeWalks(&tree);
+    testSortedVoxelCreation();
+}
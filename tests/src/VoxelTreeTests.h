@@ -0,0 +1,14 @@
+//
+//  VoxelTreeTests.h
+//  tests
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#ifndef __tests__VoxelTreeTests__
+#define __tests__VoxelTreeTests__
+
+/// checks the ray casts, walks and batched voxel creation against the ways they used to be done
+void runVoxelTreeTests();
+
+#endif /* defined(__tests__VoxelTreeTests__) */
@@ -0,0 +1,35 @@
+//
+//  main.cpp
+//  tests
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Checks the voxel tree and networking code against straightforward reference implementations, and exits with a
+//  failure if any check fails.
+//
+
+#include <cstdio>
+
+#include "NetworkTests.h"
+#include "TestUtil.h"
+#include "VoxelTreeTests.h"
+
+static int checksMade = 0;
+static int checksFailed = 0;
+
+bool checkCondition(bool passed, const char* condition, const char* file, int line) {
+    checksMade++;
+    if (!passed) {
+        checksFailed++;
+        printf("%s:%d: check failed: %s\n", file, line, condition);
+    }
+    return passed;
+}
+
+int main(int argc, const char* argv[]) {
+    runVoxelTreeTests();
+    runNetworkTests();
+
+    printf("%d checks, %d failed\n", checksMade, checksFailed);
+    return checksFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,850 @@
+//
+//  NetworkBenchmarks.cpp
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include <EventLoop.h>
+#include <NetworkPacket.h>
+#include <NodeList.h>
+#include <NodeTypes.h>
+#include <PacketBuffer.h>
+#include <PacketQueue.h>
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+#include <UDPReceiveBatch.h>
+#include <UDPSendBatch.h>
+#include <UDPSocket.h>
+#include <VoxelConstants.h>
+
+#include "NetworkBenchmarks.h"
+
+static sockaddr_in loopbackAddress(unsigned short port) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    return address;
+}
+
+static void drainSocket(UDPSocket& socket) {
+    unsigned char packet[MAX_BUFFER_LENGTH_BYTES];
+    ssize_t receivedBytes = 0;
+    socket.setBlocking(false);
+    while (socket.receive(packet, &receivedBytes)) {
+    }
+    socket.setBlocking(true);
+}
+
+static void printSendRate(const char* name, int packets, int sendCalls, clock_t start) {
+    float cpuSeconds = (clock() - start) / (float)CLOCKS_PER_SEC;
+    printf("%-32s %d packets, %d system calls, %f msecs of cpu, %f packets/sec per core\n", name, packets, sendCalls,
+           cpuSeconds * 1000.0f, cpuSeconds > 0.0f ? packets / cpuSeconds : 0.0f);
+}
+
+void benchmarkUDPSend(int packetCount) {
+    const int RECEIVER_COUNT = 8;
+    const int PACKETS_PER_DESTINATION_RUN = 16;
+    UDPSocket sender(0);
+    UDPSocket* receivers[RECEIVER_COUNT];
+    sockaddr_in receiverAddresses[RECEIVER_COUNT];
+    for (int i = 0; i < RECEIVER_COUNT; i++) {
+        receivers[i] = new UDPSocket(0);
+        receiverAddresses[i] = loopbackAddress(receivers[i]->getListeningPort());
+    }
+    unsigned char packet[MAX_VOXEL_PACKET_SIZE];
+    int numBytesPacketHeader = populateTypeAndVersion(packet, PACKET_TYPE_VOXEL_DATA);
+    for (int i = numBytesPacketHeader; i < MAX_VOXEL_PACKET_SIZE; i++) {
+        packet[i] = rand();
+    }
+
+    // the receivers aren't read while the packets are timed, so loopback drops whatever overflows their buffers, which
+    // leaves just the cost of sending
+    clock_t start = clock();
+    for (int i = 0; i < packetCount; i++) {
+        sender.send((sockaddr*)&receiverAddresses[i % RECEIVER_COUNT], packet, sizeof(packet));
+    }
+    printSendRate("sendto() per packet:", packetCount, packetCount, start);
+
+    UDPSendBatch batch(&sender);
+    batch.setSegmentation(false);
+    start = clock();
+    for (int i = 0; i < packetCount; i++) {
+        batch.queue((sockaddr*)&receiverAddresses[i % RECEIVER_COUNT], packet, sizeof(packet));
+    }
+    batch.flush();
+    printSendRate("sendmmsg() batches:", batch.getPacketsSent(), batch.getSendCalls(), start);
+
+    UDPSendBatch segmentedBatch(&sender);
+    start = clock();
+    for (int i = 0; i < packetCount; i++) {
+        int receiver = (i / PACKETS_PER_DESTINATION_RUN) % RECEIVER_COUNT;
+        segmentedBatch.queue((sockaddr*)&receiverAddresses[receiver], packet, sizeof(packet));
+    }
+    segmentedBatch.flush();
+    printSendRate(segmentedBatch.getSegmentation() ? "segmented runs per destination:" : "runs per destination:",
+                  segmentedBatch.getPacketsSent(), segmentedBatch.getSendCalls(), start);
+
+    // a run that ends in a shorter packet, then one to another receiver, all have to arrive as they were queued
+    for (int i = 0; i < RECEIVER_COUNT; i++) {
+        drainSocket(*receivers[i]);
+    }
+    const int CHECK_PACKETS = 12;
+    const int SHORT_PACKET_BYTES = 700;
+    UDPSendBatch checkBatch(&sender);
+    for (int i = 0; i < CHECK_PACKETS; i++) {
+        packet[numBytesPacketHeader] = i;
+        int receiver = (i == CHECK_PACKETS - 1) ? 1 : 0;
+        int packetBytes = (i == CHECK_PACKETS - 2) ? SHORT_PACKET_BYTES : sizeof(packet);
+        checkBatch.queue((sockaddr*)&receiverAddresses[receiver], packet, packetBytes);
+    }
+    checkBatch.flush();
+    bool intact = true;
+    for (int i = 0; i < CHECK_PACKETS; i++) {
+        unsigned char receivedPacket[MAX_BUFFER_LENGTH_BYTES];
+        ssize_t receivedBytes = 0;
+        int receiver = (i == CHECK_PACKETS - 1) ? 1 : 0;
+        int packetBytes = (i == CHECK_PACKETS - 2) ? SHORT_PACKET_BYTES : sizeof(packet);
+        packet[numBytesPacketHeader] = i;
+        intact = intact && receivers[receiver]->receive(receivedPacket, &receivedBytes) &&
+            receivedBytes == packetBytes && memcmp(receivedPacket, packet, packetBytes) == 0;
+    }
+    printf("%d packets in %lu system calls, %s\n", CHECK_PACKETS, checkBatch.getSendCalls(),
+           intact ? "received intact" : "NOT RECEIVED INTACT");
+
+    for (int i = 0; i < RECEIVER_COUNT; i++) {
+        delete receivers[i];
+    }
+}
+
+void benchmarkUDPReceive(int packetCount) {
+    const int PACKETS_PER_BURST = 64;
+    const int OVERFLOW_BURST_PACKETS = 4096;
+    UDPSocket sender(0);
+    UDPSocket receiver(0);
+    sockaddr_in receiverAddress = loopbackAddress(receiver.getListeningPort());
+    unsigned char packet[MAX_VOXEL_PACKET_SIZE];
+    populateTypeAndVersion(packet, PACKET_TYPE_VOXEL_DATA);
+    UDPSendBatch sendBatch(&sender);
+
+    // bursts small enough for any receive buffer, each drained before the next is sent, timing only the receiving
+    receiver.setBlocking(false);
+    unsigned char receivedPacket[MAX_BUFFER_LENGTH_BYTES];
+    ssize_t receivedBytes = 0;
+    sockaddr senderAddress;
+    clock_t elapsed = 0;
+    int received = 0;
+    int calls = 0;
+    for (int sent = 0; sent < packetCount; sent += PACKETS_PER_BURST) {
+        for (int i = 0; i < PACKETS_PER_BURST; i++) {
+            sendBatch.queue((sockaddr*)&receiverAddress, packet, sizeof(packet));
+        }
+        sendBatch.flush();
+        clock_t start = clock();
+        while (calls++, receiver.receive(&senderAddress, receivedPacket, &receivedBytes)) {
+            received++;
+        }
+        elapsed += clock() - start;
+    }
+    float cpuSeconds = elapsed / (float)CLOCKS_PER_SEC;
+    printf("%-32s %d packets, %d system calls, %f msecs of cpu, %f packets/sec per core\n", "recvfrom() per packet:",
+           received, calls, cpuSeconds * 1000.0f, cpuSeconds > 0.0f ? received / cpuSeconds : 0.0f);
+
+    UDPReceiveBatch receiveBatch;
+    elapsed = 0;
+    received = 0;
+    calls = 0;
+    for (int sent = 0; sent < packetCount; sent += PACKETS_PER_BURST) {
+        for (int i = 0; i < PACKETS_PER_BURST; i++) {
+            sendBatch.queue((sockaddr*)&receiverAddress, packet, sizeof(packet));
+        }
+        sendBatch.flush();
+        clock_t start = clock();
+        int packetsReceived;
+        while (calls++, (packetsReceived = receiver.receiveBatch(receiveBatch)) > 0) {
+            received += packetsReceived;
+        }
+        elapsed += clock() - start;
+    }
+    cpuSeconds = elapsed / (float)CLOCKS_PER_SEC;
+    printf("%-32s %d packets, %d batches, %f msecs of cpu, %f packets/sec per core\n", "receiveBatch():",
+           received, calls, cpuSeconds * 1000.0f, cpuSeconds > 0.0f ? received / cpuSeconds : 0.0f);
+
+    // a burst bigger than the receive buffer, with the default buffer and then with what the servers ask for
+    for (int pass = 0; pass < 2; pass++) {
+        UDPSocket burstReceiver(0);
+        if (pass == 1) {
+            burstReceiver.setReceiveBufferSize(DEFAULT_SERVER_RECEIVE_BUFFER_BYTES);
+        }
+        burstReceiver.setBlocking(false);
+        sockaddr_in burstAddress = loopbackAddress(burstReceiver.getListeningPort());
+        for (int i = 0; i < OVERFLOW_BURST_PACKETS; i++) {
+            sendBatch.queue((sockaddr*)&burstAddress, packet, sizeof(packet));
+        }
+        sendBatch.flush();
+        while (burstReceiver.receiveBatch(receiveBatch) > 0) {
+        }
+        // the kernel reports its drops along with the packets that arrive after them
+        sendBatch.queue((sockaddr*)&burstAddress, packet, sizeof(packet));
+        sendBatch.flush();
+        while (burstReceiver.receiveBatch(receiveBatch) > 0) {
+        }
+        printf("%-32s %d byte buffer, %d sent, %lu received, %lu dropped\n",
+               pass == 0 ? "burst, default buffer:" : "burst, server buffer:", burstReceiver.getReceiveBufferSize(),
+               OVERFLOW_BURST_PACKETS + 1, burstReceiver.getPacketsReceived(), burstReceiver.getPacketsDropped());
+    }
+}
+
+// an audio mixer frame, which is what the servers' old sleep loops were paced to
+const uint64_t BENCHMARK_FRAME_USECS = 5805;
+const uint64_t BENCHMARK_PACKET_INTERVAL_USECS = 1000;
+
+static uint64_t threadCPUUsecs() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// lateness, or latency, over a run
+struct BenchmarkDelays {
+    BenchmarkDelays() : count(0), total(0), maximum(0) { }
+
+    void add(uint64_t delay) {
+        count++;
+        total += delay;
+        maximum = std::max(maximum, delay);
+    }
+
+    void print(const char* label) const {
+        printf("%-32s %d samples, %f usecs mean, %llu usecs max\n", label, count,
+               count > 0 ? total / (float)count : 0.0f, (unsigned long long)maximum);
+    }
+
+    int count;
+    uint64_t total;
+    uint64_t maximum;
+};
+
+struct BenchmarkPacketSender {
+    unsigned short port;
+    int packetCount;
+};
+
+// sends packets stamped with the time they were sent, a millisecond or so apart, the way clients trickle in
+static void* sendStampedPackets(void* args) {
+    BenchmarkPacketSender* sender = (BenchmarkPacketSender*)args;
+    UDPSocket socket(0);
+    sockaddr_in address = loopbackAddress(sender->port);
+    unsigned char packet[MAX_PACKET_HEADER_BYTES + sizeof(uint64_t)];
+    int numBytesPacketHeader = populateTypeAndVersion(packet, PACKET_TYPE_PING);
+    for (int i = 0; i < sender->packetCount; i++) {
+        usleep(BENCHMARK_PACKET_INTERVAL_USECS / 2 + rand() % BENCHMARK_PACKET_INTERVAL_USECS);
+        uint64_t sentAt = EventLoop::monotonicUsecs();
+        memcpy(packet + numBytesPacketHeader, &sentAt, sizeof(sentAt));
+        socket.send((sockaddr*)&address, packet, numBytesPacketHeader + sizeof(sentAt));
+    }
+    return NULL;
+}
+
+static void addStampedPacketDelays(UDPSocket* socket, UDPReceiveBatch* receiveBatch, BenchmarkDelays* delays) {
+    int packetCount = socket->receiveBatch(*receiveBatch);
+    uint64_t now = EventLoop::monotonicUsecs();
+    for (int i = 0; i < packetCount; i++) {
+        uint64_t sentAt;
+        memcpy(&sentAt, receiveBatch->getPacketData(i) + numBytesForPacketHeader(receiveBatch->getPacketData(i)),
+               sizeof(sentAt));
+        delays->add(now - sentAt);
+    }
+}
+
+// what the event loop's callbacks share during a run
+struct EventLoopBenchmark {
+    EventLoop* eventLoop;
+    UDPSocket* socket;
+    UDPReceiveBatch* receiveBatch;
+    uint64_t nextFrameTime;
+    int framesLeft;
+    BenchmarkDelays frameLateness;
+    BenchmarkDelays packetLatency;
+};
+
+static void benchmarkFrame(void* context) {
+    EventLoopBenchmark* benchmark = (EventLoopBenchmark*)context;
+    benchmark->frameLateness.add(EventLoop::monotonicUsecs() - benchmark->nextFrameTime);
+    benchmark->nextFrameTime += BENCHMARK_FRAME_USECS;
+    if (--benchmark->framesLeft == 0) {
+        benchmark->eventLoop->stop();
+    }
+}
+
+static void benchmarkPackets(void* context) {
+    EventLoopBenchmark* benchmark = (EventLoopBenchmark*)context;
+    addStampedPacketDelays(benchmark->socket, benchmark->receiveBatch, &benchmark->packetLatency);
+}
+
+struct BenchmarkPost {
+    BenchmarkDelays* delays;
+    uint64_t postedAt;
+};
+
+struct BenchmarkPoster {
+    EventLoop* eventLoop;
+    std::vector<BenchmarkPost>* posts;
+};
+
+static void recordPost(void* context) {
+    BenchmarkPost* post = (BenchmarkPost*)context;
+    post->delays->add(EventLoop::monotonicUsecs() - post->postedAt);
+}
+
+static void stopEventLoop(void* context) {
+    ((EventLoop*)context)->stop();
+}
+
+static void* postFromThread(void* args) {
+    BenchmarkPoster* poster = (BenchmarkPoster*)args;
+    for (size_t i = 0; i < poster->posts->size(); i++) {
+        usleep(BENCHMARK_PACKET_INTERVAL_USECS);
+        (*poster->posts)[i].postedAt = EventLoop::monotonicUsecs();
+        poster->eventLoop->post(recordPost, &(*poster->posts)[i]);
+    }
+    poster->eventLoop->post(stopEventLoop, poster->eventLoop);
+    return NULL;
+}
+
+void benchmarkEventLoop(int frames) {
+    int packetCount = frames * BENCHMARK_FRAME_USECS / BENCHMARK_PACKET_INTERVAL_USECS;
+    UDPReceiveBatch receiveBatch;
+
+    // the old audio mixer loop: a frame's work, everything that arrived since the last one, then sleep to the next
+    {
+        UDPSocket receiver(0);
+        receiver.setBlocking(false);
+        BenchmarkPacketSender sender = { receiver.getListeningPort(), packetCount };
+        pthread_t senderThread;
+        pthread_create(&senderThread, NULL, sendStampedPackets, &sender);
+
+        BenchmarkDelays frameLateness;
+        BenchmarkDelays packetLatency;
+        uint64_t startCPU = threadCPUUsecs();
+        uint64_t startTime = EventLoop::monotonicUsecs();
+        for (int frame = 0; frame < frames; frame++) {
+            frameLateness.add(EventLoop::monotonicUsecs() - (startTime + frame * BENCHMARK_FRAME_USECS));
+            while (receiver.receiveBatch(receiveBatch) > 0) {
+                uint64_t now = EventLoop::monotonicUsecs();
+                for (int i = 0; i < receiveBatch.getPacketCount(); i++) {
+                    uint64_t sentAt;
+                    memcpy(&sentAt, receiveBatch.getPacketData(i) +
+                           numBytesForPacketHeader(receiveBatch.getPacketData(i)), sizeof(sentAt));
+                    packetLatency.add(now - sentAt);
+                }
+            }
+            int64_t usecToSleep = startTime + (frame + 1) * BENCHMARK_FRAME_USECS - EventLoop::monotonicUsecs();
+            if (usecToSleep > 0) {
+                usleep(usecToSleep);
+            }
+        }
+        uint64_t elapsed = EventLoop::monotonicUsecs() - startTime;
+        uint64_t cpuUsecs = threadCPUUsecs() - startCPU;
+        pthread_join(senderThread, NULL);
+
+        printf("sleep loop: %d wake ups in %f secs, %f msecs of cpu\n", frames, elapsed / 1000000.0f,
+               cpuUsecs / 1000.0f);
+        frameLateness.print("  frame lateness:");
+        packetLatency.print("  packet latency:");
+    }
+
+    // the same frames on an EventLoop timer, with packets read as soon as they arrive
+    {
+        UDPSocket receiver(0);
+        EventLoop eventLoop;
+        EventLoopBenchmark benchmark;
+        benchmark.eventLoop = &eventLoop;
+        benchmark.socket = &receiver;
+        benchmark.receiveBatch = &receiveBatch;
+        benchmark.framesLeft = frames;
+        eventLoop.watchSocket(&receiver, benchmarkPackets, &benchmark);
+
+        BenchmarkPacketSender sender = { receiver.getListeningPort(), packetCount };
+        pthread_t senderThread;
+        pthread_create(&senderThread, NULL, sendStampedPackets, &sender);
+
+        uint64_t startCPU = threadCPUUsecs();
+        uint64_t startTime = EventLoop::monotonicUsecs();
+        benchmark.nextFrameTime = startTime;
+        eventLoop.addTimer(BENCHMARK_FRAME_USECS, benchmarkFrame, &benchmark, true);
+        eventLoop.run();
+        uint64_t elapsed = EventLoop::monotonicUsecs() - startTime;
+        uint64_t cpuUsecs = threadCPUUsecs() - startCPU;
+        pthread_join(senderThread, NULL);
+
+        printf("event loop: %lu wake ups in %f secs, %f msecs of cpu\n", eventLoop.getWakeUps(), elapsed / 1000000.0f,
+               cpuUsecs / 1000.0f);
+        benchmark.frameLateness.print("  frame lateness:");
+        benchmark.packetLatency.print("  packet latency:");
+    }
+
+    // an idle server, which the old loops woke every frame for, and an event loop only for its domain server check ins
+    {
+        UDPSocket receiver(0);
+        EventLoop eventLoop;
+        EventLoopBenchmark benchmark;
+        benchmark.eventLoop = &eventLoop;
+        benchmark.socket = &receiver;
+        benchmark.receiveBatch = &receiveBatch;
+        benchmark.framesLeft = 1;
+        eventLoop.watchSocket(&receiver, benchmarkPackets, &benchmark);
+
+        uint64_t startCPU = threadCPUUsecs();
+        uint64_t startTime = EventLoop::monotonicUsecs();
+        benchmark.nextFrameTime = startTime + frames * BENCHMARK_FRAME_USECS;
+        eventLoop.addTimer(frames * BENCHMARK_FRAME_USECS, benchmarkFrame, &benchmark);
+        eventLoop.run();
+        printf("idle event loop: %lu wake ups in %f secs, %f msecs of cpu\n", eventLoop.getWakeUps(),
+               (EventLoop::monotonicUsecs() - startTime) / 1000000.0f, (threadCPUUsecs() - startCPU) / 1000.0f);
+    }
+
+    // work handed to the loop's thread from another one
+    {
+        EventLoop eventLoop;
+        BenchmarkDelays postLatency;
+        BenchmarkPost post = { &postLatency, 0 };
+        std::vector<BenchmarkPost> posts(packetCount, post);
+        BenchmarkPoster poster = { &eventLoop, &posts };
+        pthread_t posterThread;
+        pthread_create(&posterThread, NULL, postFromThread, &poster);
+        eventLoop.run();
+        pthread_join(posterThread, NULL);
+        postLatency.print("post() latency:");
+    }
+}
+
+// the way ReceivedPacketProcessor and PacketSender used to queue packets: copied into a vector under a lock, erased
+// from the front, and polled for at 60fps
+struct VectorPacketQueue {
+    pthread_mutex_t lock;
+    std::vector<NetworkPacket> packets;
+};
+
+// what a queue benchmark's producer and consumer threads share
+struct PacketQueueBenchmark {
+    PacketQueue* queue;
+    VectorPacketQueue* vectorQueue;
+    int packetsPerProducer;
+    bool paced;
+    int packetsToConsume;
+    BenchmarkDelays latency;
+};
+
+static void pushStampedPacket(PacketQueueBenchmark* benchmark, const sockaddr& address, unsigned char* packet,
+                              int numBytesPacketHeader) {
+    uint64_t queuedAt = EventLoop::monotonicUsecs();
+    memcpy(packet + numBytesPacketHeader, &queuedAt, sizeof(queuedAt));
+    ssize_t packetLength = numBytesPacketHeader + sizeof(queuedAt);
+    if (benchmark->queue) {
+        while (!benchmark->queue->push(address, packet, packetLength)) {
+            const uint64_t FULL_QUEUE_WAIT_USECS = 100 * 1000;
+            benchmark->queue->waitForSpace(FULL_QUEUE_WAIT_USECS);
+        }
+    } else {
+        NetworkPacket networkPacket(const_cast<sockaddr&>(address), packet, packetLength);
+        pthread_mutex_lock(&benchmark->vectorQueue->lock);
+        benchmark->vectorQueue->packets.push_back(networkPacket);
+        pthread_mutex_unlock(&benchmark->vectorQueue->lock);
+    }
+}
+
+static void* producePackets(void* args) {
+    PacketQueueBenchmark* benchmark = (PacketQueueBenchmark*)args;
+    sockaddr_in address = loopbackAddress(0);
+    unsigned char packet[MAX_PACKET_SIZE];
+    int numBytesPacketHeader = populateTypeAndVersion(packet, PACKET_TYPE_SET_VOXEL);
+    for (int i = 0; i < benchmark->packetsPerProducer; i++) {
+        if (benchmark->paced) {
+            usleep(BENCHMARK_PACKET_INTERVAL_USECS / 2 + rand() % BENCHMARK_PACKET_INTERVAL_USECS);
+        }
+        pushStampedPacket(benchmark, (sockaddr&)address, packet, numBytesPacketHeader);
+    }
+    return NULL;
+}
+
+static void consumeStampedPacket(PacketQueueBenchmark* benchmark, unsigned char* packetData) {
+    uint64_t queuedAt;
+    memcpy(&queuedAt, packetData + numBytesForPacketHeader(packetData), sizeof(queuedAt));
+    benchmark->latency.add(EventLoop::monotonicUsecs() - queuedAt);
+    benchmark->packetsToConsume--;
+}
+
+static void* consumePackets(void* args) {
+    PacketQueueBenchmark* benchmark = (PacketQueueBenchmark*)args;
+    const uint64_t RECEIVED_THREAD_SLEEP_INTERVAL = (1000 * 1000) / 60;
+    while (benchmark->packetsToConsume > 0) {
+        if (benchmark->queue) {
+            benchmark->queue->waitForPacket(RECEIVED_THREAD_SLEEP_INTERVAL);
+            PacketQueue::Packet* packet;
+            while ((packet = benchmark->queue->peek()) != NULL) {
+                consumeStampedPacket(benchmark, packet->buffer->getData());
+                benchmark->queue->pop();
+            }
+        } else {
+            VectorPacketQueue* vectorQueue = benchmark->vectorQueue;
+            pthread_mutex_lock(&vectorQueue->lock);
+            bool empty = vectorQueue->packets.empty();
+            pthread_mutex_unlock(&vectorQueue->lock);
+            if (empty) {
+                usleep(RECEIVED_THREAD_SLEEP_INTERVAL);
+            }
+            while (true) {
+                pthread_mutex_lock(&vectorQueue->lock);
+                if (vectorQueue->packets.empty()) {
+                    pthread_mutex_unlock(&vectorQueue->lock);
+                    break;
+                }
+                NetworkPacket packet = vectorQueue->packets.front();
+                vectorQueue->packets.erase(vectorQueue->packets.begin());
+                pthread_mutex_unlock(&vectorQueue->lock);
+                consumeStampedPacket(benchmark, packet.getData());
+            }
+        }
+    }
+    return NULL;
+}
+
+static void runPacketQueueBenchmark(const char* label, bool useRing, int producerCount, int packetsPerProducer,
+                                    bool paced) {
+    PacketQueue queue;
+    VectorPacketQueue vectorQueue;
+    pthread_mutex_init(&vectorQueue.lock, NULL);
+
+    PacketQueueBenchmark benchmark;
+    benchmark.queue = useRing ? &queue : NULL;
+    benchmark.vectorQueue = &vectorQueue;
+    benchmark.packetsPerProducer = packetsPerProducer;
+    benchmark.paced = paced;
+    benchmark.packetsToConsume = producerCount * packetsPerProducer;
+
+    uint64_t start = EventLoop::monotonicUsecs();
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, consumePackets, &benchmark);
+    std::vector<pthread_t> producers(producerCount);
+    for (int i = 0; i < producerCount; i++) {
+        pthread_create(&producers[i], NULL, producePackets, &benchmark);
+    }
+    for (int i = 0; i < producerCount; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    pthread_join(consumer, NULL);
+    uint64_t elapsed = EventLoop::monotonicUsecs() - start;
+    pthread_mutex_destroy(&vectorQueue.lock);
+
+    benchmark.latency.print(label);
+    if (!paced) {
+        printf("%-32s %f packets/sec\n", "", benchmark.latency.count / (elapsed / 1000000.0f));
+    }
+}
+
+void benchmarkPacketQueue(int packetCount) {
+    // a packet every millisecond or so, the way edits trickle in, for how long each waits to be processed
+    const int PACED_PACKETS = 1000;
+    runPacketQueueBenchmark("vector, paced:", false, 1, PACED_PACKETS, true);
+    runPacketQueueBenchmark("PacketQueue, paced:", true, 1, PACED_PACKETS, true);
+
+    // producers pushing as fast as they can, for how many packets a second get through
+    const int PRODUCERS = 2;
+    runPacketQueueBenchmark("vector, flooded:", false, PRODUCERS, packetCount / PRODUCERS, false);
+    runPacketQueueBenchmark("PacketQueue, flooded:", true, PRODUCERS, packetCount / PRODUCERS, false);
+}
+
+// forwards bursts of packets from a loopback socket through a PacketQueue to a send batch, the way the voxel server's
+// packets go from its socket to a processing thread and back out, either copying them at each step or handing their
+// buffers along
+static void runPacketBufferBenchmark(const char* label, bool handBuffersOn, int packetCount) {
+    const int PACKETS_PER_BURST = 64;
+    UDPSocket sender(0);
+    UDPSocket receiver(0);
+    UDPSocket sink(0);
+    receiver.setBlocking(false);
+    sockaddr_in receiverAddress = loopbackAddress(receiver.getListeningPort());
+    sockaddr_in sinkAddress = loopbackAddress(sink.getListeningPort());
+    unsigned char packet[MAX_VOXEL_PACKET_SIZE];
+    populateTypeAndVersion(packet, PACKET_TYPE_VOXEL_DATA);
+
+    UDPSendBatch burstBatch(&sender);
+    UDPReceiveBatch receiveBatch;
+    PacketQueue queue;
+    UDPSendBatch forwardBatch(&receiver);
+    unsigned long heapAllocations = PacketBuffer::getHeapAllocations();
+    unsigned long poolAllocations = PacketBuffer::getPoolAllocations();
+    clock_t elapsed = 0;
+    int forwarded = 0;
+    for (int sent = 0; sent < packetCount; sent += PACKETS_PER_BURST) {
+        for (int i = 0; i < PACKETS_PER_BURST; i++) {
+            burstBatch.queue((sockaddr*)&receiverAddress, packet, sizeof(packet));
+        }
+        burstBatch.flush();
+        clock_t start = clock();
+        int packetsReceived;
+        while ((packetsReceived = receiver.receiveBatch(receiveBatch)) > 0) {
+            for (int i = 0; i < packetsReceived; i++) {
+                sockaddr& senderAddress = *receiveBatch.getSenderAddress(i);
+                if (handBuffersOn) {
+                    PacketBuffer* buffer = receiveBatch.takePacket(i);
+                    queue.push(senderAddress, buffer);
+                    buffer->release();
+                } else {
+                    queue.push(senderAddress, receiveBatch.getPacketData(i), receiveBatch.getPacketLength(i));
+                }
+            }
+            PacketQueue::Packet* queued;
+            while ((queued = queue.peek()) != NULL) {
+                if (handBuffersOn) {
+                    forwardBatch.queue((sockaddr*)&sinkAddress, queued->buffer);
+                } else {
+                    forwardBatch.queue((sockaddr*)&sinkAddress, queued->buffer->getData(), queued->buffer->getLength());
+                }
+                queue.pop();
+                forwarded++;
+            }
+            forwardBatch.flush();
+        }
+        elapsed += clock() - start;
+    }
+    float cpuSeconds = elapsed / (float)CLOCKS_PER_SEC;
+    unsigned long copies = queue.getPacketsCopied() + forwardBatch.getPacketsCopied();
+    printf("%-32s %d packets, %f copies per packet, %f msecs of cpu, %f packets/sec per core\n", label, forwarded,
+           forwarded > 0 ? copies / (float)forwarded : 0.0f, cpuSeconds * 1000.0f,
+           cpuSeconds > 0.0f ? forwarded / cpuSeconds : 0.0f);
+    printf("%-32s %lu buffers from the heap, %lu from the pool\n", "",
+           PacketBuffer::getHeapAllocations() - heapAllocations, PacketBuffer::getPoolAllocations() - poolAllocations);
+}
+
+void benchmarkPacketBuffers(int packetCount) {
+    runPacketBufferBenchmark("copied at each step:", false, packetCount);
+    runPacketBufferBenchmark("PacketBuffers handed on:", true, packetCount);
+}
+
+// the lookups the way NodeList used to make them, by going over every node
+static Node* referenceNodeWithAddress(NodeList* nodeList, sockaddr* senderAddress) {
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->getActiveSocket() && socketMatch(node->getActiveSocket(), senderAddress)) {
+            return &(*node);
+        }
+    }
+    return NULL;
+}
+
+static Node* referenceNodeWithID(NodeList* nodeList, uint16_t nodeID) {
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->getNodeID() == nodeID) {
+            return &(*node);
+        }
+    }
+    return NULL;
+}
+
+static Node* referenceNodeWithSockets(NodeList* nodeList, sockaddr* publicSocket, sockaddr* localSocket, char type) {
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        if (node->matches(publicSocket, localSocket, type)) {
+            return &(*node);
+        }
+    }
+    return NULL;
+}
+
+// what the threads going over and killing nodes while the list changes share
+struct NodeListBenchmark {
+    NodeList* nodeList;
+    int nodeCount;
+    volatile bool stop;
+    int passes;
+    long nodesVisited;
+    int badNodes;
+    int nodesKilled;
+};
+
+static void* iterateNodeList(void* args) {
+    NodeListBenchmark* benchmark = (NodeListBenchmark*)args;
+    while (!benchmark->stop) {
+        for (NodeList::iterator node = benchmark->nodeList->begin(); node != benchmark->nodeList->end(); node++) {
+            if (node->getNodeID() == UNKNOWN_NODE_ID || node->getNodeID() > benchmark->nodeCount) {
+                benchmark->badNodes++;
+            }
+            benchmark->nodesVisited++;
+        }
+        benchmark->passes++;
+        NodeList::doneWithNodes();
+    }
+    return NULL;
+}
+
+// kills every tenth node as it's reached, the way silent nodes are
+static void* killNodes(void* args) {
+    NodeListBenchmark* benchmark = (NodeListBenchmark*)args;
+    const int KILLED_NODE_SPACING = 10;
+    while (!benchmark->stop) {
+        for (NodeList::iterator node = benchmark->nodeList->begin(); node != benchmark->nodeList->end(); node++) {
+            if (node->getNodeID() % KILLED_NODE_SPACING == 0) {
+                node->setAlive(false);
+                benchmark->nodesKilled++;
+            }
+        }
+        NodeList::doneWithNodes();
+        usleep(BENCHMARK_PACKET_INTERVAL_USECS);
+    }
+    return NULL;
+}
+
+static sockaddr_in benchmarkNodeAddress(int node) {
+    sockaddr_in address = loopbackAddress(1024 + node % 50000);
+    address.sin_addr.s_addr = htonl(0x0a000000 | (node / 50000));
+    return address;
+}
+
+static void ignoreMessage(QtMsgType type, const QMessageLogContext& context, const QString& message) {
+}
+
+void benchmarkNodeList(int nodeCount) {
+    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AVATAR_MIXER, 0);
+
+    // the list logs every node it adds
+    qInstallMessageHandler(ignoreMessage);
+
+    // nodes added the way the mixers add them, with one address for both sockets, while other threads go over them
+    NodeListBenchmark benchmark;
+    benchmark.nodeList = nodeList;
+    benchmark.nodeCount = nodeCount;
+    benchmark.stop = false;
+    benchmark.passes = 0;
+    benchmark.nodesVisited = 0;
+    benchmark.badNodes = 0;
+    benchmark.nodesKilled = 0;
+    pthread_t iterator;
+    pthread_t killer;
+    pthread_create(&iterator, NULL, iterateNodeList, &benchmark);
+    pthread_create(&killer, NULL, killNodes, &benchmark);
+
+    uint64_t start = usecTimestampNow();
+    for (int i = 1; i <= nodeCount; i++) {
+        sockaddr_in address = benchmarkNodeAddress(i);
+        nodeList->addOrUpdateNode((sockaddr*)&address, (sockaddr*)&address, NODE_TYPE_AGENT, i);
+    }
+    float msecs = (usecTimestampNow() - start) / 1000.0f;
+    printf("%-32s %d nodes, %f msecs\n", "addOrUpdateNode(), new:", nodeList->size(), msecs);
+
+    // then every node looked up by each, the way every received packet is
+    const char* lookupNames[] = { "nodeWithAddress()", "nodeWithID()", "addOrUpdateNode(), existing" };
+    int mismatches = 0;
+    for (int lookup = 0; lookup < 3; lookup++) {
+        float referenceMsecs = 0.0f;
+        for (int pass = 0; pass < 2; pass++) {
+            start = usecTimestampNow();
+            int found = 0;
+            for (int i = 1; i <= nodeCount; i++) {
+                sockaddr_in address = benchmarkNodeAddress(i);
+                Node* node;
+                if (lookup == 0) {
+                    node = pass == 0 ? referenceNodeWithAddress(nodeList, (sockaddr*)&address)
+                                     : nodeList->nodeWithAddress((sockaddr*)&address);
+                } else if (lookup == 1) {
+                    node = pass == 0 ? referenceNodeWithID(nodeList, i) : nodeList->nodeWithID(i);
+                } else {
+                    node = pass == 0 ? referenceNodeWithSockets(nodeList, (sockaddr*)&address, (sockaddr*)&address,
+                                                                NODE_TYPE_AGENT)
+                                     : nodeList->addOrUpdateNode((sockaddr*)&address, (sockaddr*)&address,
+                                                                 NODE_TYPE_AGENT, i);
+                }
+                if (node) {
+                    found++;
+                    if (node->getNodeID() != i) {
+                        mismatches++;
+                    }
+                }
+            }
+            msecs = (usecTimestampNow() - start) / 1000.0f;
+            if (pass == 0) {
+                referenceMsecs = msecs;
+                printf("%-32s %d found, %f usecs per lookup scanning\n", lookupNames[lookup], found,
+                       msecs * 1000.0f / nodeCount);
+            } else {
+                printf("%-32s %d found, %f usecs per lookup indexed, %fx faster\n", "", found,
+                       msecs * 1000.0f / nodeCount, msecs > 0.0f ? referenceMsecs / msecs : 0.0f);
+            }
+        }
+    }
+
+    benchmark.stop = true;
+    pthread_join(iterator, NULL);
+    pthread_join(killer, NULL);
+
+    // with the killing stopped, the index and a scan have to agree on every node
+    for (int i = 1; i <= nodeCount; i++) {
+        sockaddr_in address = benchmarkNodeAddress(i);
+        if (nodeList->nodeWithAddress((sockaddr*)&address) != referenceNodeWithAddress(nodeList, (sockaddr*)&address) ||
+                nodeList->nodeWithID(i) != referenceNodeWithID(nodeList, i)) {
+            mismatches++;
+        }
+    }
+    printf("%-32s %d passes over %ld nodes, %d kills, %d bad nodes, lookups %s\n", "meanwhile on other threads:",
+           benchmark.passes, benchmark.nodesVisited, benchmark.nodesKilled, benchmark.badNodes,
+           mismatches == 0 ? "match the scans" : "DON'T MATCH THE SCANS");
+
+    // clearing while a pass is under way leaves the nodes it's going over in place for it
+    benchmark.stop = false;
+    pthread_create(&iterator, NULL, iterateNodeList, &benchmark);
+    usleep(BENCHMARK_PACKET_INTERVAL_USECS);
+    NodeList::doneWithNodes();
+    nodeList->clear();
+    usleep(BENCHMARK_PACKET_INTERVAL_USECS);
+    benchmark.stop = true;
+    pthread_join(iterator, NULL);
+    sockaddr_in firstAddress = benchmarkNodeAddress(1);
+    printf("%-32s %d nodes left, %s\n", "cleared during a pass:", nodeList->getNumAliveNodes(),
+           (benchmark.badNodes == 0 && !nodeList->nodeWithID(1) && !nodeList->nodeWithAddress((sockaddr*)&firstAddress))
+               ? "none found" : "NODES STILL FOUND");
+
+    // nodes joining and leaving, many times more of them over time than the list holds at once, which the slots of
+    // the ones that left have to make room for, taken out by the silent node pass or by the join that finds the list
+    // full
+    const int CHURN_JOINS = MAX_NUM_NODES * 3;
+    const int MAX_CHURN_NODE_ID = 60000;
+    benchmark.stop = false;
+    benchmark.nodeCount = MAX_CHURN_NODE_ID;
+    pthread_create(&iterator, NULL, iterateNodeList, &benchmark);
+    int joins = 0;
+    int refusedJoins = 0;
+    start = usecTimestampNow();
+    for (int round = 0; joins < CHURN_JOINS; round++) {
+        for (int i = 0; i < nodeCount && joins < CHURN_JOINS; i++, joins++) {
+            sockaddr_in address = benchmarkNodeAddress(nodeCount + joins + 1);
+            if (!nodeList->addOrUpdateNode((sockaddr*)&address, (sockaddr*)&address, NODE_TYPE_AGENT,
+                                           joins % MAX_CHURN_NODE_ID + 1)) {
+                refusedJoins++;
+            }
+        }
+        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+            node->setAlive(false);
+        }
+        NodeList::doneWithNodes();
+        if (round % 2 == 0) {
+            nodeList->removeDeadNodes();
+        }
+    }
+    msecs = (usecTimestampNow() - start) / 1000.0f;
+    benchmark.stop = true;
+    pthread_join(iterator, NULL);
+    printf("%-32s %d joins, %d refused, %d bad nodes, %f msecs\n", "joined and left:", joins, refusedJoins,
+           benchmark.badNodes, msecs);
+
+    qInstallMessageHandler(sharedMessageHandler);
+}
@@ -0,0 +1,42 @@
+//
+//  NetworkBenchmarks.h
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Timing runs for the shared networking code: UDP batching, the EventLoop, PacketQueue, PacketBuffer and NodeList.
+//  They don't need a voxel scene, and each compares against the way the servers did the same work before.
+//
+
+#ifndef __hifi__NetworkBenchmarks__
+#define __hifi__NetworkBenchmarks__
+
+/// sends voxel sized packets to a few sockets over loopback a sendto() at a time, in sendmmsg() batches and in segmented
+/// runs to each destination, and compares the packets per second each manages on a core
+void benchmarkUDPSend(int packetCount);
+
+/// drains bursts of packets from a loopback socket a recvfrom() at a time and in batches, and compares the packets per
+/// second each manages on a core, then overflows the default and the servers' receive buffers and counts the drops
+void benchmarkUDPReceive(int packetCount);
+
+/// runs frames of an audio mixer's length the way the servers' sleep loops did and on an EventLoop, with packets
+/// trickling in from another thread, and compares how late the frames run, how long packets wait to be read and how
+/// often each wakes, then times an idle EventLoop and work posted to one from another thread
+void benchmarkEventLoop(int frames);
+
+/// passes packets from producer threads to a consumer the way ReceivedPacketProcessor and PacketSender used to, through
+/// a locked vector polled at 60fps, and through a PacketQueue, and compares how long paced packets wait to be processed
+/// and how many a second a flood of them gets through
+void benchmarkPacketQueue(int packetCount);
+
+/// forwards packets from a loopback socket through a PacketQueue and back out of a send batch, copying them at each
+/// step the way the servers used to and handing their PacketBuffers along instead, and compares the copies made per
+/// packet, the buffers allocated from the heap and the pool, and the packets per second each manages on a core
+void benchmarkPacketBuffers(int packetCount);
+
+/// adds nodes to a NodeList while other threads go over and kill them, then looks every node up by address, by ID and
+/// through addOrUpdateNode() by scanning the list the way NodeList used to and through its indexes, and checks that
+/// they agree, then clears the list while a pass is going over it
+void benchmarkNodeList(int nodeCount);
+
+#endif /* defined(__hifi__NetworkBenchmarks__) */
@@ -0,0 +1,117 @@
+//
+//  SVOShardWriter.cpp
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <QtCore/QDebug>
+
+#include "SVOShardWriter.h"
+
+SVOShardWriter::SVOShardWriter(int maxQueuedBytes) :
+    _running(false),
+    _queuedBytes(0),
+    _maxQueuedBytes(maxQueuedBytes),
+    _closing(false),
+    _failed(false),
+    _bytesWritten(0)
+{
+    pthread_mutex_init(&_queueLock, NULL);
+    pthread_cond_init(&_queueChanged, NULL);
+}
+
+SVOShardWriter::~SVOShardWriter() {
+    close();
+    pthread_cond_destroy(&_queueChanged);
+    pthread_mutex_destroy(&_queueLock);
+}
+
+bool SVOShardWriter::open(const char* filename) {
+    close();
+    _file.open(filename, std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!_file.is_open()) {
+        qDebug("SVOShardWriter::open() couldn't create %s\n", filename);
+        return false;
+    }
+    _closing = false;
+    _failed = false;
+    _bytesWritten = 0;
+    if (pthread_create(&_thread, NULL, writerEntry, this) != 0) {
+        qDebug("SVOShardWriter::open() couldn't start the writer for %s\n", filename);
+        _file.close();
+        return false;
+    }
+    _running = true;
+    return true;
+}
+
+void SVOShardWriter::write(std::vector<unsigned char>& block) {
+    if (block.empty()) {
+        return;
+    }
+    std::vector<unsigned char>* queuedBlock = new std::vector<unsigned char>();
+    queuedBlock->swap(block);
+
+    pthread_mutex_lock(&_queueLock);
+    // a block bigger than the whole queue still gets through once the queue is empty
+    while (_queuedBytes > 0 && _queuedBytes + (int)queuedBlock->size() > _maxQueuedBytes) {
+        pthread_cond_wait(&_queueChanged, &_queueLock);
+    }
+    _queue.push_back(queuedBlock);
+    _queuedBytes += queuedBlock->size();
+    pthread_cond_broadcast(&_queueChanged);
+    pthread_mutex_unlock(&_queueLock);
+}
+
+bool SVOShardWriter::close() {
+    if (!_running) {
+        return !_failed;
+    }
+    pthread_mutex_lock(&_queueLock);
+    _closing = true;
+    pthread_cond_broadcast(&_queueChanged);
+    pthread_mutex_unlock(&_queueLock);
+
+    pthread_join(_thread, NULL);
+    _running = false;
+
+    _file.close();
+    if (_file.fail()) {
+        _failed = true;
+    }
+    return !_failed;
+}
+
+void* SVOShardWriter::writerEntry(void* arg) {
+    static_cast<SVOShardWriter*>(arg)->writeQueuedBlocks();
+    return NULL;
+}
+
+void SVOShardWriter::writeQueuedBlocks() {
+    pthread_mutex_lock(&_queueLock);
+    while (true) {
+        if (_queue.empty()) {
+            if (_closing) {
+                break;
+            }
+            pthread_cond_wait(&_queueChanged, &_queueLock);
+            continue;
+        }
+        std::vector<unsigned char>* block = _queue.front();
+        _queue.pop_front();
+
+        // write without the lock, so more can be queued in the meantime, and only then make room for it
+        pthread_mutex_unlock(&_queueLock);
+        _file.write((const char*)&(*block)[0], block->size());
+        bool failed = !_file;
+        pthread_mutex_lock(&_queueLock);
+
+        _failed = _failed || failed;
+        _bytesWritten += block->size();
+        _queuedBytes -= block->size();
+        delete block;
+        pthread_cond_broadcast(&_queueChanged);
+    }
+    pthread_mutex_unlock(&_queueLock);
+}
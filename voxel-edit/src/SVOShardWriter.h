@@ -0,0 +1,61 @@
+//
+//  SVOShardWriter.h
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Writes an SVO file on a thread of its own. Any thread can hand it blocks of whole bitstream chunks, which are
+//  written in the order they're handed over. Only so many bytes can be waiting at once, after which write() holds the
+//  caller up until the disk catches up, so a fast reader can't fill memory with a slow output.
+//
+
+#ifndef __hifi__SVOShardWriter__
+#define __hifi__SVOShardWriter__
+
+#include <pthread.h>
+#include <deque>
+#include <fstream>
+#include <vector>
+
+class SVOShardWriter {
+public:
+    static const int DEFAULT_MAX_QUEUED_BYTES = 8 * 1024 * 1024;
+
+    SVOShardWriter(int maxQueuedBytes = DEFAULT_MAX_QUEUED_BYTES);
+    ~SVOShardWriter();
+
+    /// creates the file and starts the writer thread
+    bool open(const char* filename);
+    bool isOpen() const { return _running; }
+
+    /// queues the block for writing, taking its contents and leaving it empty
+    void write(std::vector<unsigned char>& block);
+
+    /// writes out whatever is still queued and stops the writer thread, returns false if anything failed to be written
+    bool close();
+
+    unsigned long getBytesWritten() const { return _bytesWritten; }
+
+private:
+    // disallow copying of SVOShardWriter objects
+    SVOShardWriter(const SVOShardWriter&);
+    SVOShardWriter& operator= (const SVOShardWriter&);
+
+    static void* writerEntry(void* arg);
+    void writeQueuedBlocks();
+
+    std::ofstream                               _file;
+    pthread_t                                   _thread;
+    bool                                        _running;
+
+    pthread_mutex_t                             _queueLock; // protects everything below
+    pthread_cond_t                              _queueChanged;
+    std::deque<std::vector<unsigned char>*>     _queue;
+    int                                         _queuedBytes;
+    int                                         _maxQueuedBytes;
+    bool                                        _closing;
+    bool                                        _failed;
+    unsigned long                               _bytesWritten;
+};
+
+#endif /* defined(__hifi__SVOShardWriter__) */
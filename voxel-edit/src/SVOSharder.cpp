@@ -0,0 +1,515 @@
+//
+//  SVOSharder.cpp
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <zlib.h>
+
+#include <QtCore/QDebug>
+
+#include <IndexedSVOFile.h>
+#include <JurisdictionMap.h>
+#include <OctalCode.h>
+#include <SharedUtil.h>
+#include <VoxelNodeBag.h>
+#include <VoxelTree.h>
+#include <WorkStealingPool.h>
+
+#include "SVOShardWriter.h"
+#include "SVOSharder.h"
+
+// old style files are cut into pieces of about this much for the workers
+const uint64_t PLAIN_PIECE_BYTES = 4 * 1024 * 1024;
+
+// what a worker reads at a time, it grows if a single chunk doesn't fit
+const int CHUNK_WINDOW_BYTES = 256 * 1024;
+
+// what a worker collects for a region before handing it to the region's writer
+const int REGION_BLOCK_BYTES = 256 * 1024;
+
+// Reads a run of whole chunks from a file a window at a time, inflating it first if it's compressed. Every reader has
+// its own file handle, so the workers don't have to take turns seeking.
+class ChunkReader {
+public:
+    ChunkReader(const char* filename, uint64_t offset, uint64_t storedBytes, uint64_t rawBytes);
+    ~ChunkReader();
+
+    /// the next whole chunk, which stays valid until the next call, or false at the end or if the file is bad
+    bool nextChunk(const unsigned char*& chunk, int& chunkBytes);
+
+    bool hasFailed() const { return _failed; }
+
+    /// the uncompressed bytes of the chunks returned so far
+    uint64_t getBytesRead() const { return _bytesRead; }
+
+private:
+    bool readMore();
+
+    std::ifstream               _file;
+    bool                        _compressed;
+    z_stream                    _stream;
+    uint64_t                    _storedBytesLeft;
+    uint64_t                    _rawBytesLeft;
+    std::vector<unsigned char>  _input;     // compressed bytes waiting to be inflated
+    std::vector<unsigned char>  _window;
+    int                         _windowStart;
+    int                         _windowEnd;
+    uint64_t                    _bytesRead;
+    bool                        _failed;
+};
+
+ChunkReader::ChunkReader(const char* filename, uint64_t offset, uint64_t storedBytes, uint64_t rawBytes) :
+    _file(filename, std::ios::in|std::ios::binary),
+    _compressed(storedBytes != rawBytes),
+    _storedBytesLeft(storedBytes),
+    _rawBytesLeft(rawBytes),
+    _window(CHUNK_WINDOW_BYTES),
+    _windowStart(0),
+    _windowEnd(0),
+    _bytesRead(0),
+    _failed(false)
+{
+    memset(&_stream, 0, sizeof(_stream));
+    if (!_file.is_open()) {
+        _failed = true;
+        return;
+    }
+    _file.seekg((std::streamoff)offset, std::ios::beg);
+    if (_compressed) {
+        _input.resize(CHUNK_WINDOW_BYTES);
+        _failed = (inflateInit(&_stream) != Z_OK);
+    }
+}
+
+ChunkReader::~ChunkReader() {
+    if (_compressed) {
+        inflateEnd(&_stream);
+    }
+}
+
+bool ChunkReader::nextChunk(const unsigned char*& chunk, int& chunkBytes) {
+    while (!_failed) {
+        int available = _windowEnd - _windowStart;
+        chunkBytes = available ? VoxelTree::getSVOChunkLength(&_window[_windowStart], available) : 0;
+        if (chunkBytes > 0) {
+            chunk = &_window[_windowStart];
+            _windowStart += chunkBytes;
+            _bytesRead += chunkBytes;
+            return true;
+        }
+        if (_rawBytesLeft == 0) {
+            if (available > 0) {
+                qDebug("ChunkReader::nextChunk() the last %d bytes aren't a whole chunk\n", available);
+                _failed = true;
+            }
+            return false;
+        }
+
+        // move the partial chunk to the front, and make room if it fills the window on its own
+        if (_windowStart > 0) {
+            memmove(&_window[0], &_window[_windowStart], available);
+            _windowStart = 0;
+            _windowEnd = available;
+        }
+        if (_windowEnd == (int)_window.size()) {
+            _window.resize(_window.size() * 2);
+        }
+        _failed = !readMore();
+    }
+    return false;
+}
+
+bool ChunkReader::readMore() {
+    // the window is never more than an int, so neither is what fits in it
+    uint32_t room = (uint32_t)std::min((uint64_t)(_window.size() - _windowEnd), _rawBytesLeft);
+    if (!_compressed) {
+        _file.read((char*)&_window[_windowEnd], room);
+        if (!_file) {
+            qDebug("ChunkReader::readMore() the file is truncated\n");
+            return false;
+        }
+        _windowEnd += room;
+        _rawBytesLeft -= room;
+        return true;
+    }
+
+    if (_stream.avail_in == 0) {
+        uint32_t inputBytes = (uint32_t)std::min((uint64_t)_input.size(), _storedBytesLeft);
+        if (inputBytes == 0) {
+            qDebug("ChunkReader::readMore() the compressed chunk ends early\n");
+            return false;
+        }
+        _file.read((char*)&_input[0], inputBytes);
+        if (!_file) {
+            qDebug("ChunkReader::readMore() the file is truncated\n");
+            return false;
+        }
+        _storedBytesLeft -= inputBytes;
+        _stream.next_in = &_input[0];
+        _stream.avail_in = inputBytes;
+    }
+    _stream.next_out = &_window[_windowEnd];
+    _stream.avail_out = room;
+    int result = inflate(&_stream, Z_NO_FLUSH);
+    uint32_t inflatedBytes = room - _stream.avail_out;
+    _windowEnd += inflatedBytes;
+    _rawBytesLeft -= inflatedBytes;
+    if ((result != Z_OK && result != Z_STREAM_END) || (result == Z_STREAM_END && _rawBytesLeft > 0)) {
+        qDebug("ChunkReader::readMore() the compressed chunk is corrupt\n");
+        return false;
+    }
+    return true;
+}
+
+// encodes the subtree the way VoxelTree::writeToSVOFile() does, onto the end of the block
+static void appendSubtreeBitstream(VoxelTree* tree, VoxelNode* node, std::vector<unsigned char>& block) {
+    VoxelNodeBag nodeBag;
+    nodeBag.insert(node);
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    while (!nodeBag.isEmpty()) {
+        VoxelNode* subTree = nodeBag.extract();
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        int bytesWritten = tree->encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
+        block.insert(block.end(), &outputBuffer[0], &outputBuffer[0] + bytesWritten);
+    }
+}
+
+// The node for the octal code, if the tree has it, along with the nodes above it from the root down. Unlike
+// VoxelTree::getVoxelAt(), this doesn't need the code to be shallow enough for float coordinates.
+static VoxelNode* findNodeWithPath(VoxelTree* tree, unsigned char* octalCode, std::vector<VoxelNode*>& path) {
+    VoxelNode* node = tree->rootNode;
+    path.clear();
+    int sections = numberOfThreeBitSectionsInCode(octalCode);
+    for (int section = 0; node && section < sections; section++) {
+        path.push_back(node);
+        node = node->getChildAtIndex(getOctalCodeSectionValue(octalCode, section));
+    }
+    return node;
+}
+
+SVOSharder::SVOSharder(const JurisdictionMap* jurisdiction) :
+    _chunksCopied(0),
+    _chunksSplit(0),
+    _bytesRead(0)
+{
+    if (jurisdiction) {
+        for (int i = 0; i < jurisdiction->getEndNodeCount(); i++) {
+            unsigned char* endNode = jurisdiction->getEndNodeOctalCode(i);
+            _endNodes.push_back(std::vector<unsigned char>(endNode, endNode + bytesRequiredForCodeLength(*endNode)));
+        }
+    }
+}
+
+SVOSharder::~SVOSharder() {
+}
+
+bool SVOSharder::addInput(const char* filename, const std::vector<SVOShardWriter*>& writers) {
+    Input input;
+    input.filename = filename;
+    input.writers = writers;
+    input.writers.resize(getRegionCount(), NULL);
+    _inputs.push_back(input);
+    int inputIndex = _inputs.size() - 1;
+
+    if (!IndexedSVOFile::isIndexedSVOFile(filename)) {
+        return addPlainPieces(inputIndex);
+    }
+
+    // the chunks of an indexed file are already cut up, the top of the tree and then every subtree
+    IndexedSVOFile indexedFile;
+    if (!indexedFile.open(filename)) {
+        return false;
+    }
+    for (int subtree = -1; subtree < indexedFile.getSubtreeCount(); subtree++) {
+        if (indexedFile.getSubtreeRawBytes(subtree) > 0) {
+            Piece piece = { inputIndex, indexedFile.getSubtreeOffset(subtree), indexedFile.getSubtreeStoredBytes(subtree),
+                            indexedFile.getSubtreeRawBytes(subtree) };
+            _pieces.push_back(piece);
+        }
+    }
+    return true;
+}
+
+// Finds where the chunks of an old style file start, which takes a pass through the whole file, though only over the
+// bytes and not into a tree.
+bool SVOSharder::addPlainPieces(int input) {
+    const char* filename = _inputs[input].filename.c_str();
+    std::ifstream file(filename, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open()) {
+        qDebug("SVOSharder::addInput() couldn't open %s\n", filename);
+        return false;
+    }
+    std::streamoff fileBytes = file.tellg();
+    file.close();
+    if (fileBytes < 0) {
+        qDebug("SVOSharder::addInput() couldn't find the size of %s\n", filename);
+        return false;
+    }
+
+    ChunkReader reader(filename, 0, fileBytes, fileBytes);
+    const unsigned char* chunk;
+    int chunkBytes;
+    uint64_t pieceStart = 0;
+    while (reader.nextChunk(chunk, chunkBytes)) {
+        uint64_t pieceBytes = reader.getBytesRead() - pieceStart;
+        if (pieceBytes >= PLAIN_PIECE_BYTES) {
+            Piece piece = { input, pieceStart, pieceBytes, pieceBytes };
+            _pieces.push_back(piece);
+            pieceStart += pieceBytes;
+        }
+    }
+    uint64_t pieceBytes = reader.getBytesRead() - pieceStart;
+    if (pieceBytes > 0) {
+        Piece piece = { input, pieceStart, pieceBytes, pieceBytes };
+        _pieces.push_back(piece);
+    }
+    if (reader.hasFailed()) {
+        qDebug("SVOSharder::addInput() %s ends partway through a chunk, the rest of it is left out\n", filename);
+    }
+    return true;
+}
+
+bool SVOSharder::run(WorkStealingPool* pool) {
+    if (!pool) {
+        pool = WorkStealingPool::getInstance();
+    }
+    _workers.resize(pool->getWorkerCount());
+    for (size_t i = 0; i < _workers.size(); i++) {
+        Worker& worker = _workers[i];
+        worker.scratchTree = new VoxelTree();
+        worker.regionBlocks.resize(getRegionCount());
+        worker.chunksCopied = 0;
+        worker.chunksSplit = 0;
+        worker.bytesRead = 0;
+        worker.failed = false;
+    }
+
+    if (!_pieces.empty()) {
+        pool->run(routePiece, this, _pieces.size());
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < _workers.size(); i++) {
+        Worker& worker = _workers[i];
+        _chunksCopied += worker.chunksCopied;
+        _chunksSplit += worker.chunksSplit;
+        _bytesRead += worker.bytesRead;
+        failed = failed || worker.failed;
+        delete worker.scratchTree;
+    }
+    _workers.clear();
+    _pieces.clear();
+    _inputs.clear();
+    return !failed;
+}
+
+void SVOSharder::routePiece(void* context, int taskIndex, int workerIndex) {
+    SVOSharder* sharder = static_cast<SVOSharder*>(context);
+    const Piece& piece = sharder->_pieces[taskIndex];
+    const Input& input = sharder->_inputs[piece.input];
+    Worker& worker = sharder->_workers[workerIndex];
+
+    ChunkReader reader(input.filename.c_str(), piece.offset, piece.storedBytes, piece.rawBytes);
+    const unsigned char* chunk;
+    int chunkBytes;
+    while (reader.nextChunk(chunk, chunkBytes)) {
+        sharder->routeChunk(input, worker, chunk, chunkBytes);
+    }
+    worker.failed = worker.failed || reader.hasFailed();
+    worker.bytesRead += piece.storedBytes;
+
+    // the blocks are for this input's writers, so they can't wait for the next piece
+    sharder->flushWorker(input, worker, true);
+}
+
+int SVOSharder::findRegion(unsigned char* octalCode, bool& reachesEndNode) const {
+    reachesEndNode = false;
+    for (size_t i = 0; i < _endNodes.size(); i++) {
+        unsigned char* endNode = const_cast<unsigned char*>(&_endNodes[i][0]);
+        if (isAncestorOf(endNode, octalCode)) {
+            reachesEndNode = false;
+            return i + 1;
+        }
+        if (isAncestorOf(octalCode, endNode)) {
+            reachesEndNode = true;
+        }
+    }
+    return ROOT_REGION;
+}
+
+void SVOSharder::routeChunk(const Input& input, Worker& worker, const unsigned char* chunk, int chunkBytes) {
+    bool reachesEndNode;
+    int region = findRegion(const_cast<unsigned char*>(chunk), reachesEndNode);
+    if (reachesEndNode) {
+        splitChunk(input, worker, chunk, chunkBytes);
+        worker.chunksSplit++;
+    } else {
+        addToRegion(input, worker, region, chunk, chunkBytes);
+        worker.chunksCopied++;
+    }
+}
+
+// Reads a chunk that reaches across end nodes into the worker's scratch tree, and encodes what's below each end node for
+// that end node's region, and what's left for the root's.
+void SVOSharder::splitChunk(const Input& input, Worker& worker, const unsigned char* chunk, int chunkBytes) {
+    VoxelTree* tree = worker.scratchTree;
+    tree->eraseAllVoxels();
+    ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+    tree->readBitstreamToTree(const_cast<unsigned char*>(chunk), chunkBytes, args);
+
+    unsigned char* chunkCode = const_cast<unsigned char*>(chunk);
+    std::vector<VoxelNode*> path;
+    for (size_t i = 0; i < _endNodes.size(); i++) {
+        unsigned char* endNode = &_endNodes[i][0];
+        if (!isAncestorOf(chunkCode, endNode)) {
+            continue;
+        }
+        VoxelNode* endNodeNode = findNodeWithPath(tree, endNode, path);
+        if (!endNodeNode) {
+            continue;
+        }
+        if (input.writers[i + 1] && !endNodeNode->isLeaf()) {
+            appendSubtreeBitstream(tree, endNodeNode, worker.regionBlocks[i + 1]);
+        }
+
+        // take the end node out the way deleteVoxelCodeFromTree() with COLLAPSE_EMPTY_TREE would, but without breaking
+        // up a leaf above it, which in a chunk only means the rest of that leaf's subtree is in another chunk
+        for (int level = path.size() - 1; level >= 0; level--) {
+            VoxelNode* parent = path[level];
+            parent->deleteChildAtIndex(getOctalCodeSectionValue(endNode, level));
+            if (parent->getChildCount() > 0 || parent == tree->rootNode) {
+                break;
+            }
+        }
+    }
+    if (input.writers[ROOT_REGION] && !tree->rootNode->isLeaf()) {
+        appendSubtreeBitstream(tree, tree->rootNode, worker.regionBlocks[ROOT_REGION]);
+    }
+    flushWorker(input, worker, false);
+}
+
+void SVOSharder::addToRegion(const Input& input, Worker& worker, int region, const unsigned char* data, int bytes) {
+    if (!input.writers[region]) {
+        return;
+    }
+    std::vector<unsigned char>& block = worker.regionBlocks[region];
+    block.insert(block.end(), data, data + bytes);
+    if ((int)block.size() >= REGION_BLOCK_BYTES) {
+        input.writers[region]->write(block);
+    }
+}
+
+void SVOSharder::flushWorker(const Input& input, Worker& worker, bool all) {
+    for (int region = 0; region < getRegionCount(); region++) {
+        std::vector<unsigned char>& block = worker.regionBlocks[region];
+        if (!input.writers[region]) {
+            block.clear();
+        } else if (all || (int)block.size() >= REGION_BLOCK_BYTES) {
+            input.writers[region]->write(block);
+        }
+    }
+}
+
+// The voxel server sends that voxels don't exist for regions that have nothing in them, even outside its jurisdiction,
+// so each end node's shard gets tiny voxels in the corners of the root (which assumes end nodes among the root's
+// children, like the demo dinner's), and the root's shard gets one in the middle of each end node.
+static void writePlaceholderVoxels(const JurisdictionMap& jurisdiction, const std::vector<SVOShardWriter*>& writers) {
+    const float verySmall = 0.015625;
+    VoxelTree rootTree;
+    for (int i = 0; i < jurisdiction.getEndNodeCount(); i++) {
+        unsigned char* endNodeCode = jurisdiction.getEndNodeOctalCode(i);
+
+        VoxelTree endNodeTree;
+        for (int corner = 0; corner < NUMBER_OF_CHILDREN; corner++) {
+            endNodeTree.createVoxel((corner >> 2) & 1, (corner >> 1) & 1, corner & 1, verySmall, 1, 1, 1, true);
+        }
+        endNodeTree.deleteVoxelCodeFromTree(endNodeCode, COLLAPSE_EMPTY_TREE);
+        std::vector<unsigned char> block;
+        appendSubtreeBitstream(&endNodeTree, endNodeTree.rootNode, block);
+        writers[i + 1]->write(block);
+
+        VoxelPositionSize endNodeDetails;
+        voxelDetailsForCode(endNodeCode, endNodeDetails);
+        rootTree.createVoxel(endNodeDetails.x + endNodeDetails.s * 0.5, endNodeDetails.y + endNodeDetails.s * 0.5,
+                             endNodeDetails.z + endNodeDetails.s * 0.5, endNodeDetails.s * verySmall, 1, 1, 1, true);
+    }
+    std::vector<unsigned char> block;
+    appendSubtreeBitstream(&rootTree, rootTree.rootNode, block);
+    writers[SVOSharder::ROOT_REGION]->write(block);
+}
+
+static bool closeWriters(std::vector<SVOShardWriter*>& writers) {
+    bool closed = true;
+    for (size_t i = 0; i < writers.size(); i++) {
+        if (writers[i]) {
+            closed = writers[i]->close() && closed;
+            delete writers[i];
+        }
+    }
+    writers.clear();
+    return closed;
+}
+
+bool SVOSharder::split(const char* inputFile, const JurisdictionMap& jurisdiction) {
+    uint64_t start = usecTimestampNow();
+    SVOSharder sharder(&jurisdiction);
+    std::vector<SVOShardWriter*> writers(sharder.getRegionCount());
+    bool success = true;
+    char outputFileName[512];
+    for (int region = 0; region < sharder.getRegionCount(); region++) {
+        if (region == ROOT_REGION) {
+            snprintf(outputFileName, sizeof(outputFileName), "splitROOT%s", inputFile);
+        } else {
+            snprintf(outputFileName, sizeof(outputFileName), "splitENDNODE%d%s", region - 1, inputFile);
+        }
+        printf("outputFile: %s\n", outputFileName);
+        writers[region] = new SVOShardWriter();
+        success = writers[region]->open(outputFileName) && success;
+    }
+
+    success = success && sharder.addInput(inputFile, writers) && sharder.run();
+    if (success) {
+        writePlaceholderVoxels(jurisdiction, writers);
+    }
+    success = closeWriters(writers) && success;
+
+    printf("split %s in %f msecs, %lu chunks copied as they were and %lu split\n", inputFile,
+           (usecTimestampNow() - start) / 1000.0f, sharder.getChunksCopied(), sharder.getChunksSplit());
+    return success;
+}
+
+bool SVOSharder::merge(const std::vector<std::string>& inputFiles, const char* outputFile,
+                       const JurisdictionMap* jurisdiction) {
+    uint64_t start = usecTimestampNow();
+    SVOSharder sharder(jurisdiction);
+    if (jurisdiction && (int)inputFiles.size() != sharder.getRegionCount()) {
+        printf("merging a jurisdiction with %d end nodes takes %d inputs, the root's first\n",
+               sharder.getRegionCount() - 1, sharder.getRegionCount());
+        return false;
+    }
+    std::vector<SVOShardWriter*> writers(1, new SVOShardWriter());
+    bool success = writers[0]->open(outputFile);
+
+    for (size_t i = 0; success && i < inputFiles.size(); i++) {
+        std::vector<SVOShardWriter*> inputWriters(sharder.getRegionCount(), NULL);
+        if (jurisdiction) {
+            inputWriters[i] = writers[0];
+        } else {
+            inputWriters[ROOT_REGION] = writers[0];
+        }
+        success = sharder.addInput(inputFiles[i].c_str(), inputWriters);
+    }
+    success = success && sharder.run();
+    success = closeWriters(writers) && success;
+
+    printf("merged %d files into %s in %f msecs, %lu chunks copied as they were and %lu split\n", (int)inputFiles.size(),
+           outputFile, (usecTimestampNow() - start) / 1000.0f, sharder.getChunksCopied(), sharder.getChunksSplit());
+    return success;
+}
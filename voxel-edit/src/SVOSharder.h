@@ -0,0 +1,110 @@
+//
+//  SVOSharder.h
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Splits SVO files between the servers of a jurisdiction, and merges the pieces back together, without ever loading
+//  a whole tree. An SVO file is a run of root relative chunks, and any run of them is a valid SVO file in its own
+//  right, so a chunk that lies entirely in one region (the root of the jurisdiction, which is everything outside its end
+//  nodes, or one of the end nodes) is copied to that region's output as it is. Only the few chunks near the top of the
+//  tree that reach across an end node are read into a tree and encoded again a region at a time.
+//
+//  The inputs are cut into pieces at chunk boundaries (the subtrees of an indexed file, or a few megabytes of an old
+//  style one) that a WorkStealingPool routes in parallel, each worker streaming its piece through a small window and
+//  batching what it finds for the regions' SVOShardWriters. Memory stays the same however big the files are. Chunks
+//  reach the outputs in whatever order the workers get to them, which doesn't change what they read back as, since
+//  every node's color is in just one chunk.
+//
+
+#ifndef __hifi__SVOSharder__
+#define __hifi__SVOSharder__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class JurisdictionMap;
+class SVOShardWriter;
+class VoxelTree;
+class WorkStealingPool;
+
+class SVOSharder {
+public:
+    static const int ROOT_REGION = 0;
+
+    /// Writes splitROOT<inputFile>, everything outside the end nodes, and splitENDNODE<i><inputFile> for each end node,
+    /// along with the placeholder voxels that --splitSVO has always added for the voxel server.
+    static bool split(const char* inputFile, const JurisdictionMap& jurisdiction);
+
+    /// Writes the inputs out as one SVO file. With a jurisdiction, the first input is the root's shard and the rest are
+    /// the end nodes' in order, and each only contributes its own region, which leaves out the placeholder voxels.
+    /// Without one, the inputs are combined as they are.
+    static bool merge(const std::vector<std::string>& inputFiles, const char* outputFile,
+                      const JurisdictionMap* jurisdiction);
+
+    /// region ROOT_REGION and then one for each of the jurisdiction's end nodes, or just ROOT_REGION without one
+    SVOSharder(const JurisdictionMap* jurisdiction);
+    ~SVOSharder();
+
+    int getRegionCount() const { return _endNodes.size() + 1; }
+
+    /// Queues an old style or indexed SVO file to be routed to writers, one for each region. A region whose writer is
+    /// NULL is dropped. Returns false if the file can't be read.
+    bool addInput(const char* filename, const std::vector<SVOShardWriter*>& writers);
+
+    /// routes everything queued, returns false if any of it couldn't be read
+    bool run(WorkStealingPool* pool = NULL);
+
+    unsigned long getChunksCopied() const { return _chunksCopied; }
+    unsigned long getChunksSplit() const { return _chunksSplit; }
+    uint64_t getBytesRead() const { return _bytesRead; }
+
+private:
+    // disallow copying of SVOSharder objects
+    SVOSharder(const SVOSharder&);
+    SVOSharder& operator= (const SVOSharder&);
+
+    /// a run of whole chunks in one of the inputs, compressed if storedBytes isn't rawBytes
+    struct Piece {
+        int         input;
+        uint64_t    offset;
+        uint64_t    storedBytes;
+        uint64_t    rawBytes;
+    };
+
+    struct Input {
+        std::string                     filename;
+        std::vector<SVOShardWriter*>    writers;
+    };
+
+    /// what each worker has found for each region, but not yet handed to the writers
+    struct Worker {
+        VoxelTree*                                  scratchTree;
+        std::vector<std::vector<unsigned char> >    regionBlocks;
+        unsigned long                               chunksCopied;
+        unsigned long                               chunksSplit;
+        uint64_t                                    bytesRead;
+        bool                                        failed;
+    };
+
+    static void routePiece(void* context, int taskIndex, int workerIndex);
+
+    bool addPlainPieces(int input);
+    int findRegion(unsigned char* octalCode, bool& reachesEndNode) const;
+    void routeChunk(const Input& input, Worker& worker, const unsigned char* chunk, int chunkBytes);
+    void splitChunk(const Input& input, Worker& worker, const unsigned char* chunk, int chunkBytes);
+    void addToRegion(const Input& input, Worker& worker, int region, const unsigned char* data, int bytes);
+    void flushWorker(const Input& input, Worker& worker, bool all);
+
+    std::vector<std::vector<unsigned char> >    _endNodes;
+    std::vector<Input>                          _inputs;
+    std::vector<Piece>                          _pieces;
+    std::vector<Worker>                         _workers;
+
+    unsigned long                               _chunksCopied;
+    unsigned long                               _chunksSplit;
+    uint64_t                                    _bytesRead;
+};
+
+#endif /* defined(__hifi__SVOSharder__) */
@@ -0,0 +1,1300 @@
+//
+//  VoxelBenchmarks.cpp
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <zlib.h>
+
+#include <IndexedSVOFile.h>
+#include <JurisdictionMap.h>
+#include <LinearVoxelTree.h>
+#include <OctalCode.h>
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+#include <Tags.h>
+#include <VoxelPacketChain.h>
+#include <VoxelSceneStats.h>
+#include <VoxelTreeParallel.h>
+#include <VoxelTreeVisitor.h>
+
+#include "SVOSharder.h"
+#include "VoxelBenchmarks.h"
+
+static float randomUnit() {
+    return rand() / (float)RAND_MAX;
+}
+
+void printVoxelTreeStats(const VoxelTreeStats& stats) {
+    printf("%ld nodes, %ld leaves, %ld colored leaves\n", stats.nodeCount, stats.leafCount, stats.coloredLeafCount);
+    printf("colored bounds (%f, %f, %f) to (%f, %f, %f) meters, %f cubic meters, average color %d, %d, %d\n",
+           stats.coloredMinimum.x, stats.coloredMinimum.y, stats.coloredMinimum.z,
+           stats.coloredMaximum.x, stats.coloredMaximum.y, stats.coloredMaximum.z, stats.coloredVolume,
+           stats.averageColor[0], stats.averageColor[1], stats.averageColor[2]);
+}
+
+void createBenchmarkScene(VoxelTree* tree) {
+    if (!tree->rootNode->isLeaf()) {
+        return; // already have a scene
+    }
+    printf("creating benchmark scene...\n");
+    uint64_t start = usecTimestampNow();
+
+    // a solid sphere with a noisy surface, plus a scattering of small voxels so rays have things to miss
+    const float SPHERE_RADIUS = 0.2f;
+    const float SPHERE_VOXEL_SIZE = 1.0f / 256.0f;
+    tree->createSphere(SPHERE_RADIUS, 0.5f, 0.5f, 0.5f, SPHERE_VOXEL_SIZE, true, NATURAL);
+
+    const int SCATTERED_VOXELS = 10000;
+    const float SCATTERED_VOXEL_SIZE = 1.0f / 512.0f;
+    for (int i = 0; i < SCATTERED_VOXELS; i++) {
+        tree->createVoxel(randomUnit(), randomUnit(), randomUnit(), SCATTERED_VOXEL_SIZE,
+                          randIntInRange(0, 255), randIntInRange(0, 255), randIntInRange(0, 255));
+    }
+    tree->reaverageVoxelColors(tree->rootNode);
+
+    uint64_t end = usecTimestampNow();
+    printf("benchmark scene has %ld voxels, took %f seconds to create\n", tree->getVoxelCount(), (end - start) / 1000000.0f);
+}
+
+// The reference ray cast, visits every intersected subtree and keeps the closest leaf. A box's lower faces count as part
+// of it and its upper faces as part of the next box over, the way the front to back walk splits a node between its
+// children, so that a ray along an edge or through a corner hits the one box it passes through and not the ones it
+// only touches.
+class ReferenceRayArgs {
+public:
+    glm::vec3 origin;
+    glm::vec3 direction;
+    VoxelNode* node;
+    float distance;
+    bool found;
+};
+
+static bool referenceRayPassesThroughBox(const ReferenceRayArgs* args, const AABox& box, float& distance) {
+    float enterDistance = 0.0f;
+    float exitDistance = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        float low = box.getCorner()[axis];
+        float high = low + box.getSize()[axis];
+        if (args->direction[axis] == 0.0f) {
+            if (args->origin[axis] < low || args->origin[axis] >= high) {
+                return false;
+            }
+            continue;
+        }
+        float lowDistance = (low - args->origin[axis]) / args->direction[axis];
+        float highDistance = (high - args->origin[axis]) / args->direction[axis];
+        enterDistance = std::max(enterDistance, std::min(lowDistance, highDistance));
+        exitDistance = std::min(exitDistance, std::max(lowDistance, highDistance));
+    }
+    distance = enterDistance;
+    return enterDistance < exitDistance;
+}
+
+static bool referenceRayIntersectionOperation(VoxelNode* node, void* extraData) {
+    ReferenceRayArgs* args = static_cast<ReferenceRayArgs*>(extraData);
+    float distance;
+    if (!referenceRayPassesThroughBox(args, node->getAABox(), distance)) {
+        return false;
+    }
+    if (!node->isLeaf()) {
+        return true;
+    }
+    distance *= TREE_SCALE;
+    if (node->isColored() && (!args->found || distance < args->distance)) {
+        args->node = node;
+        args->distance = distance;
+        args->found = true;
+    }
+    return false;
+}
+
+void benchmarkRayIntersections(VoxelTree* tree, int rayCount) {
+    printf("casting %d rays...\n", rayCount);
+    srand(1);
+
+    // rays start anywhere in or around the tree, half of them aimed roughly at the middle of the scene, and some of
+    // them axis aligned since those are the edge cases
+    RayIntersectionQuery* queries = new RayIntersectionQuery[rayCount];
+    for (int i = 0; i < rayCount; i++) {
+        glm::vec3 origin(randomUnit() * 3.0f - 1.0f, randomUnit() * 3.0f - 1.0f, randomUnit() * 3.0f - 1.0f);
+        glm::vec3 direction(randomUnit() - 0.5f, randomUnit() - 0.5f, randomUnit() - 0.5f);
+        if (i % 2 == 0) {
+            direction = glm::vec3(0.5f, 0.5f, 0.5f) + direction * 0.5f - origin;
+        }
+        const int AXIS_ALIGNED_EVERY = 8;
+        if (i % AXIS_ALIGNED_EVERY == 0) {
+            direction.x = direction.z = 0.0f;
+        }
+
+        // and some pass exactly through a point where children meet, along an axis, or diagonally across two or three
+        // axes at once, since those cross more than one midplane at the same distance
+        const int THROUGH_CORNERS_EVERY = 8;
+        if (i % THROUGH_CORNERS_EVERY == 1) {
+            int gridCells = 1 << randIntInRange(1, 8);
+            glm::vec3 corner(randIntInRange(1, gridCells - 1), randIntInRange(1, gridCells - 1),
+                             randIntInRange(1, gridCells - 1));
+            corner /= (float)gridCells;
+            int crossedAxes = randIntInRange(1, 3);
+            int firstAxis = randIntInRange(0, 2);
+            direction = glm::vec3(0.0f, 0.0f, 0.0f);
+            for (int axis = 0; axis < crossedAxes; axis++) {
+                direction[(firstAxis + axis) % 3] = randIntInRange(0, 1) ? 1.0f : -1.0f;
+            }
+            origin = corner - direction * 2.0f;
+        }
+        queries[i] = RayIntersectionQuery(origin * (float)TREE_SCALE, direction);
+    }
+
+    uint64_t start = usecTimestampNow();
+    int referenceHits = 0;
+    float* referenceDistances = new float[rayCount];
+    for (int i = 0; i < rayCount; i++) {
+        ReferenceRayArgs args = { queries[i].origin / (float)TREE_SCALE, queries[i].direction, NULL, 0.0f, false };
+        tree->recurseTreeWithOperation(referenceRayIntersectionOperation, &args);
+        referenceDistances[i] = args.found ? args.distance : -1.0f;
+        if (args.found) {
+            referenceHits++;
+        }
+    }
+    uint64_t referenceEnd = usecTimestampNow();
+
+    int hits = tree->findRayIntersections(queries, rayCount);
+    uint64_t end = usecTimestampNow();
+
+    int mismatches = 0;
+    const float DISTANCE_TOLERANCE = 0.001f;
+    for (int i = 0; i < rayCount; i++) {
+        float distance = queries[i].found ? queries[i].distance : -1.0f;
+        if (fabsf(distance - referenceDistances[i]) > DISTANCE_TOLERANCE * TREE_SCALE) {
+            mismatches++;
+        }
+    }
+
+    printf("reference:    %d hits in %f msecs (%f usecs/ray)\n", referenceHits, (referenceEnd - start) / 1000.0f,
+           (referenceEnd - start) / (float)rayCount);
+    printf("front to back: %d hits in %f msecs (%f usecs/ray)\n", hits, (end - referenceEnd) / 1000.0f,
+           (end - referenceEnd) / (float)rayCount);
+    printf("mismatches: %d\n", mismatches);
+
+    delete[] referenceDistances;
+    delete[] queries;
+}
+
+// The walks as they were before VoxelTreeVisitor.h, recursive with a function pointer operation.
+static void referenceRecurseNodeWithOperation(VoxelNode* node, RecurseVoxelTreeOperation operation, void* extraData) {
+    if (operation(node, extraData)) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* child = node->getChildAtIndex(i);
+            if (child) {
+                referenceRecurseNodeWithOperation(child, operation, extraData);
+            }
+        }
+    }
+}
+
+static void referenceRecurseNodeWithOperationDistanceSorted(VoxelNode* node, RecurseVoxelTreeOperation operation,
+                                                            const glm::vec3& point, void* extraData) {
+    if (operation(node, extraData)) {
+        VoxelNode* sortedChildren[NUMBER_OF_CHILDREN];
+        float distancesToChildren[NUMBER_OF_CHILDREN];
+        int indexOfChildren[NUMBER_OF_CHILDREN];
+        int currentCount = 0;
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* childNode = node->getChildAtIndex(i);
+            if (childNode) {
+                currentCount = insertIntoSortedArrays((void*)childNode, childNode->distanceSquareToPoint(point), i,
+                                                      (void**)&sortedChildren, (float*)&distancesToChildren,
+                                                      (int*)&indexOfChildren, currentCount, NUMBER_OF_CHILDREN);
+            }
+        }
+        for (int i = 0; i < currentCount; i++) {
+            referenceRecurseNodeWithOperationDistanceSorted(sortedChildren[i], operation, point, extraData);
+        }
+    }
+}
+
+// the walk work: counts colored nodes and hashes the visit order, so that walks visiting in different orders disagree
+class WalkArgs {
+public:
+    unsigned long coloredCount;
+    unsigned long orderHash;
+};
+
+static bool walkOperation(VoxelNode* node, void* extraData) {
+    WalkArgs* args = static_cast<WalkArgs*>(extraData);
+    if (node->isColored()) {
+        args->coloredCount++;
+    }
+    args->orderHash = args->orderHash * 31 + node->getHandleSlot();
+    return true;
+}
+
+class WalkVisitor {
+public:
+    WalkVisitor() : coloredCount(0), orderHash(0) { };
+    bool visit(VoxelNode* node) {
+        if (node->isColored()) {
+            coloredCount++;
+        }
+        orderHash = orderHash * 31 + node->getHandleSlot();
+        return true;
+    }
+    void join(const WalkVisitor& other) {
+        coloredCount += other.coloredCount;
+        orderHash = 0; // the order between subtrees isn't defined
+    }
+    unsigned long coloredCount;
+    unsigned long orderHash;
+};
+
+static void printWalkResult(const char* name, unsigned long coloredCount, unsigned long orderHash,
+                            uint64_t elapsed, int passes) {
+    printf("%-32s %ld colored, order hash %lx, %f msecs/walk\n", name, coloredCount, orderHash,
+           elapsed / 1000.0f / passes);
+}
+
+void benchmarkTreeWalks(VoxelTree* tree, int passes) {
+    printf("walking %ld nodes %d times...\n", tree->getVoxelCount(), passes);
+    WalkArgs args = { 0, 0 };
+
+    uint64_t start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        args.coloredCount = args.orderHash = 0;
+        referenceRecurseNodeWithOperation(tree->rootNode, walkOperation, &args);
+    }
+    printWalkResult("recursive function pointer:", args.coloredCount, args.orderHash, usecTimestampNow() - start, passes);
+
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        args.coloredCount = args.orderHash = 0;
+        tree->recurseTreeWithOperation(walkOperation, &args);
+    }
+    printWalkResult("explicit stack function pointer:", args.coloredCount, args.orderHash, usecTimestampNow() - start,
+                    passes);
+
+    WalkVisitor visitor;
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        visitor = WalkVisitor();
+        visitNodes(tree->rootNode, visitor);
+    }
+    printWalkResult("visitor:", visitor.coloredCount, visitor.orderHash, usecTimestampNow() - start, passes);
+
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        visitor = WalkVisitor();
+        visitNodesParallel(tree->rootNode, visitor);
+    }
+    printWalkResult("parallel visitor:", visitor.coloredCount, visitor.orderHash, usecTimestampNow() - start, passes);
+    printf("%d workers, %ld steals\n", WorkStealingPool::getInstance()->getWorkerCount(),
+           WorkStealingPool::getInstance()->getStealCount());
+
+    VoxelTreeStats stats;
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        tree->collectStats(stats);
+    }
+    printf("%-32s %f msecs/walk\n", "parallel collectStats():", (usecTimestampNow() - start) / 1000.0f / passes);
+    printVoxelTreeStats(stats);
+
+    const glm::vec3 point(0.25f, 0.75f, 0.5f);
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        args.coloredCount = args.orderHash = 0;
+        referenceRecurseNodeWithOperationDistanceSorted(tree->rootNode, walkOperation, point, &args);
+    }
+    printWalkResult("recursive distance sorted:", args.coloredCount, args.orderHash, usecTimestampNow() - start, passes);
+
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        visitor = WalkVisitor();
+        visitNodesDistanceSorted(tree->rootNode, point, visitor);
+    }
+    printWalkResult("visitor distance sorted:", visitor.coloredCount, visitor.orderHash, usecTimestampNow() - start,
+                    passes);
+}
+
+class LeafScanVisitor {
+public:
+    LeafScanVisitor() : coloredLeafCount(0), colorSum(0) { };
+    bool visit(VoxelNode* node) {
+        if (node->isLeaf() && node->isColored()) {
+            coloredLeafCount++;
+            colorSum += node->getTrueColor()[0] + node->getTrueColor()[1] + node->getTrueColor()[2];
+        }
+        return true;
+    }
+    unsigned long coloredLeafCount;
+    unsigned long colorSum;
+};
+
+// the nodes of a LinearVoxelTree level are in key order, so whole tree scans are straight runs through memory
+static void scanLinearTree(const LinearVoxelTree& linearTree, unsigned long& coloredLeafCount, unsigned long& colorSum) {
+    coloredLeafCount = colorSum = 0;
+    for (int level = 0; level < linearTree.getDepth(); level++) {
+        unsigned long nodeCount = linearTree.getNodeCount(level);
+        for (uint32_t i = 0; i < nodeCount; i++) {
+            const unsigned char* color = linearTree.getColor(level, i);
+            if (color[3] && !linearTree.getChildMask(level, i)) {
+                coloredLeafCount++;
+                colorSum += color[0] + color[1] + color[2];
+            }
+        }
+    }
+}
+
+static bool sameLinearTrees(const LinearVoxelTree& first, const LinearVoxelTree& second) {
+    if (first.getDepth() != second.getDepth()) {
+        return false;
+    }
+    for (int level = 0; level < first.getDepth(); level++) {
+        if (first.getNodeCount(level) != second.getNodeCount(level)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < first.getNodeCount(level); i++) {
+            if (first.getKey(level, i) != second.getKey(level, i) ||
+                memcmp(first.getColor(level, i), second.getColor(level, i), sizeof(nodeColor)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void benchmarkLinearTree(VoxelTree* tree, int passes) {
+    uint64_t start = usecTimestampNow();
+    LinearVoxelTree linearTree;
+    if (!linearTree.build(tree->rootNode)) {
+        printf("tree is too deep to pack into a linear tree\n");
+        return;
+    }
+    printf("packed %ld nodes into %d levels in %f msecs, %ld bytes\n", linearTree.getNodeCount(), linearTree.getDepth(),
+           (usecTimestampNow() - start) / 1000.0f, linearTree.getMemoryUsage());
+
+    LeafScanVisitor visitor;
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        visitor = LeafScanVisitor();
+        visitNodes(tree->rootNode, visitor);
+    }
+    printf("%-32s %ld colored leaves, color sum %ld, %f msecs/scan\n", "pointer tree scan:", visitor.coloredLeafCount,
+           visitor.colorSum, (usecTimestampNow() - start) / 1000.0f / passes);
+
+    unsigned long coloredLeafCount = 0;
+    unsigned long colorSum = 0;
+    start = usecTimestampNow();
+    for (int i = 0; i < passes; i++) {
+        scanLinearTree(linearTree, coloredLeafCount, colorSum);
+    }
+    printf("%-32s %ld colored leaves, color sum %ld, %f msecs/scan\n", "linear tree scan:", coloredLeafCount, colorSum,
+           (usecTimestampNow() - start) / 1000.0f / passes);
+
+    // look up voxels from the deepest level, so both trees have to go all the way down
+    const int LOOKUP_COUNT = 100000;
+    int deepestLevel = linearTree.getDepth() - 1;
+    float voxelSize = 1.0f / (1 << deepestLevel);
+    std::vector<glm::vec3> positions;
+    for (int i = 0; i < LOOKUP_COUNT; i++) {
+        uint64_t key = linearTree.getKey(deepestLevel, randIntInRange(0, linearTree.getNodeCount(deepestLevel) - 1));
+        glm::vec3 position;
+        for (int level = 0; level < deepestLevel; level++) {
+            int branch = (key >> (3 * level)) & 7;
+            float scale = voxelSize * (1 << level);
+            position += glm::vec3((branch & 4) ? scale : 0.0f, (branch & 2) ? scale : 0.0f, (branch & 1) ? scale : 0.0f);
+        }
+        positions.push_back(position);
+    }
+    int found = 0;
+    start = usecTimestampNow();
+    for (int i = 0; i < LOOKUP_COUNT; i++) {
+        if (tree->getVoxelAt(positions[i].x, positions[i].y, positions[i].z, voxelSize)) {
+            found++;
+        }
+    }
+    printf("%-32s %d of %d found, %f usecs/lookup\n", "pointer tree getVoxelAt():", found, LOOKUP_COUNT,
+           (usecTimestampNow() - start) / (float)LOOKUP_COUNT);
+    found = 0;
+    start = usecTimestampNow();
+    for (int i = 0; i < LOOKUP_COUNT; i++) {
+        nodeColor color;
+        if (linearTree.getVoxelAt(positions[i].x, positions[i].y, positions[i].z, voxelSize, color)) {
+            found++;
+        }
+    }
+    printf("%-32s %d of %d found, %f usecs/lookup\n", "linear tree getVoxelAt():", found, LOOKUP_COUNT,
+           (usecTimestampNow() - start) / (float)LOOKUP_COUNT);
+
+    const char* TREE_SVO_FILE = "benchmarkTree.svo";
+    const char* LINEAR_SVO_FILE = "benchmarkLinearTree.svo";
+    start = usecTimestampNow();
+    tree->writeToSVOFile(TREE_SVO_FILE);
+    printf("%-32s %f msecs\n", "pointer tree encode:", (usecTimestampNow() - start) / 1000.0f);
+    start = usecTimestampNow();
+    linearTree.writeToSVOFile(LINEAR_SVO_FILE);
+    printf("%-32s %f msecs\n", "linear tree encode:", (usecTimestampNow() - start) / 1000.0f);
+
+    // both files have to load back into the same voxels
+    LinearVoxelTree fromTreeFile;
+    LinearVoxelTree fromLinearFile;
+    start = usecTimestampNow();
+    fromLinearFile.readFromSVOFile(LINEAR_SVO_FILE);
+    printf("%-32s %f msecs\n", "linear tree decode:", (usecTimestampNow() - start) / 1000.0f);
+    fromTreeFile.readFromSVOFile(TREE_SVO_FILE);
+    printf("encoded files %s\n", sameLinearTrees(fromTreeFile, fromLinearFile) ? "match" : "DON'T MATCH");
+}
+
+struct PacketEncodeResult {
+    unsigned long packets;
+    unsigned long bytes;
+    float msecs;
+};
+
+// fills packets the way the voxel server does, and reads each one into the destination tree as the client would
+static PacketEncodeResult encodeTreeIntoPackets(VoxelTree* tree, bool codeColors, VoxelTree* destinationTree,
+                                                VoxelSceneStats* stats) {
+    PacketEncodeResult result = { 0, 0, 0.0f };
+    unsigned char packet[MAX_VOXEL_PACKET_SIZE];
+    unsigned char chunk[MAX_VOXEL_PACKET_SIZE];
+    int numBytesPacketHeader = populateTypeAndVersion(packet, PACKET_TYPE_VOXEL_DATA);
+    int packetLength = numBytesPacketHeader;
+    uint64_t encodeUsecs = 0;
+
+    VoxelNodeBag bag;
+    bag.insert(tree->rootNode);
+    while (!bag.isEmpty() || packetLength > numBytesPacketHeader) {
+        int chunkLength = 0;
+        if (!bag.isEmpty()) {
+            EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, WANT_EXISTS_BITS, DONT_CHOP,
+                                         false, IGNORE_VIEW_FRUSTUM, NO_OCCLUSION_CULLING, IGNORE_COVERAGE_MAP,
+                                         NO_BOUNDARY_ADJUST, IGNORE_LAST_SENT, true, stats,
+                                         IGNORE_JURISDICTION_MAP, codeColors);
+            uint64_t start = usecTimestampNow();
+            chunkLength = tree->encodeTreeBitstream(bag.extract(), chunk, MAX_VOXEL_PACKET_SIZE - numBytesPacketHeader,
+                                                    bag, params);
+            encodeUsecs += usecTimestampNow() - start;
+        }
+        if (packetLength + chunkLength > MAX_VOXEL_PACKET_SIZE || (bag.isEmpty() && chunkLength == 0)) {
+            ReadBitstreamToTreeParams args(WANT_COLOR, WANT_EXISTS_BITS, NULL, UNKNOWN_NODE_ID, codeColors);
+            destinationTree->readBitstreamToTree(packet + numBytesPacketHeader, packetLength - numBytesPacketHeader, args);
+            result.packets++;
+            result.bytes += packetLength;
+            packetLength = numBytesPacketHeader;
+        }
+        memcpy(packet + packetLength, chunk, chunkLength);
+        packetLength += chunkLength;
+    }
+    result.msecs = encodeUsecs / 1000.0f;
+    return result;
+}
+
+// the same, but encoding into a chain of packetsPerInterval packets for each pass of the server's send loop
+static PacketEncodeResult encodeTreeIntoPacketChain(VoxelTree* tree, int packetsPerInterval, VoxelTree* destinationTree,
+                                                    VoxelSceneStats* stats) {
+    PacketEncodeResult result = { 0, 0, 0.0f };
+    unsigned char header[MAX_VOXEL_PACKET_SIZE];
+    int numBytesPacketHeader = populateTypeAndVersion(header, PACKET_TYPE_VOXEL_DATA);
+    VoxelPacketChain packets(MAX_VOXEL_PACKET_SIZE - numBytesPacketHeader);
+    uint64_t encodeUsecs = 0;
+
+    VoxelNodeBag bag;
+    bag.insert(tree->rootNode);
+    while (!bag.isEmpty()) {
+        packets.reset(packetsPerInterval, MAX_VOXEL_PACKET_SIZE - numBytesPacketHeader);
+        uint64_t start = usecTimestampNow();
+        while (!bag.isEmpty() && !packets.isFull()) {
+            EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, WANT_EXISTS_BITS, DONT_CHOP,
+                                         false, IGNORE_VIEW_FRUSTUM, NO_OCCLUSION_CULLING, IGNORE_COVERAGE_MAP,
+                                         NO_BOUNDARY_ADJUST, IGNORE_LAST_SENT, true, stats);
+            tree->encodeTreeIntoPackets(bag.extract(), packets, bag, params);
+        }
+        encodeUsecs += usecTimestampNow() - start;
+
+        for (int i = 0; i < packets.getPacketCount(); i++) {
+            if (packets.getPacketLength(i) > 0) {
+                ReadBitstreamToTreeParams args(WANT_COLOR, WANT_EXISTS_BITS, NULL, UNKNOWN_NODE_ID);
+                destinationTree->readBitstreamToTree(packets.getPacket(i), packets.getPacketLength(i), args);
+                result.packets++;
+                result.bytes += numBytesPacketHeader + packets.getPacketLength(i);
+            }
+        }
+    }
+    result.msecs = encodeUsecs / 1000.0f;
+    return result;
+}
+
+void benchmarkPacketChain(VoxelTree* tree, int packetsPerInterval) {
+    VoxelTree baggedTree;
+    VoxelTree chainedTree;
+    VoxelSceneStats baggedStats;
+    VoxelSceneStats chainedStats;
+    baggedStats.sceneStarted(true, false, tree->rootNode, IGNORE_JURISDICTION_MAP);
+    chainedStats.sceneStarted(true, false, tree->rootNode, IGNORE_JURISDICTION_MAP);
+    PacketEncodeResult bagged = encodeTreeIntoPackets(tree, NO_COLOR_CODING, &baggedTree, &baggedStats);
+    PacketEncodeResult chained = encodeTreeIntoPacketChain(tree, packetsPerInterval, &chainedTree, &chainedStats);
+    printf("%-32s %ld packets, %ld bytes, %f traversed/voxel sent, %f msecs to encode\n", "re-bagging on overflow:",
+           bagged.packets, bagged.bytes, baggedStats.getTraversedPerVoxelSent(), bagged.msecs);
+    printf("%-32s %ld packets, %ld bytes, %f traversed/voxel sent, %f msecs to encode\n", "packet chain:",
+           chained.packets, chained.bytes, chainedStats.getTraversedPerVoxelSent(), chained.msecs);
+
+    LeafScanVisitor baggedVisitor;
+    LeafScanVisitor chainedVisitor;
+    visitNodes(baggedTree.rootNode, baggedVisitor);
+    visitNodes(chainedTree.rootNode, chainedVisitor);
+    bool match = baggedVisitor.coloredLeafCount == chainedVisitor.coloredLeafCount &&
+                 baggedVisitor.colorSum == chainedVisitor.colorSum &&
+                 baggedTree.rootNode->getSubTreeNodeCount() == chainedTree.rootNode->getSubTreeNodeCount();
+    printf("decoded trees %s\n", match ? "match" : "DON'T MATCH");
+}
+
+void benchmarkColorCoding(VoxelTree* tree) {
+    LeafScanVisitor visitor;
+    visitNodes(tree->rootNode, visitor);
+    unsigned long voxels = visitor.coloredLeafCount;
+
+    VoxelTree plainTree;
+    VoxelTree codedTree;
+    PacketEncodeResult plain = encodeTreeIntoPackets(tree, NO_COLOR_CODING, &plainTree, IGNORE_SCENE_STATS);
+    PacketEncodeResult coded = encodeTreeIntoPackets(tree, WANT_COLOR_CODING, &codedTree, IGNORE_SCENE_STATS);
+    printf("%-32s %ld packets, %ld bytes, %f bytes/voxel, %f msecs to encode\n", "plain colors:", plain.packets,
+           plain.bytes, plain.bytes / (float)voxels, plain.msecs);
+    printf("%-32s %ld packets, %ld bytes, %f bytes/voxel, %f msecs to encode\n", "coded colors:", coded.packets,
+           coded.bytes, coded.bytes / (float)voxels, coded.msecs);
+
+    // both have to read back into the same voxels
+    LeafScanVisitor plainVisitor;
+    LeafScanVisitor codedVisitor;
+    visitNodes(plainTree.rootNode, plainVisitor);
+    visitNodes(codedTree.rootNode, codedVisitor);
+    bool match = plainVisitor.coloredLeafCount == codedVisitor.coloredLeafCount &&
+                 plainVisitor.colorSum == codedVisitor.colorSum &&
+                 plainTree.rootNode->getSubTreeNodeCount() == codedTree.rootNode->getSubTreeNodeCount();
+    printf("%ld colored voxels, decoded trees %s\n", voxels, match ? "match" : "DON'T MATCH");
+}
+
+// the reference count, a walk of the whole subtree
+class CountSubtreeVisitor {
+public:
+    CountSubtreeVisitor() : nodeCount(0), leafNodeCount(0) { }
+    bool visit(VoxelNode* node) {
+        nodeCount++;
+        if (node->isLeaf()) {
+            leafNodeCount++;
+        }
+        return true;
+    }
+    unsigned long nodeCount;
+    unsigned long leafNodeCount;
+};
+
+static bool countsMatchReference(VoxelTree* tree, float& referenceMsecs) {
+    uint64_t start = usecTimestampNow();
+    CountSubtreeVisitor visitor;
+    visitNodes(tree->rootNode, visitor);
+    referenceMsecs = (usecTimestampNow() - start) / 1000.0f;
+    return visitor.nodeCount == tree->rootNode->getSubTreeNodeCount() &&
+           visitor.leafNodeCount == tree->rootNode->getSubTreeLeafNodeCount() &&
+           tree->rootNode->hasConsistentSubTreeNodeCounts();
+}
+
+void benchmarkSubtreeCounts(VoxelTree* tree, int edits) {
+    float referenceMsecs;
+    bool match = countsMatchReference(tree, referenceMsecs);
+    printf("%-32s %ld nodes, %ld leaves, counts %s\n", "scene:", tree->rootNode->getSubTreeNodeCount(),
+           tree->rootNode->getSubTreeLeafNodeCount(), match ? "match" : "DON'T MATCH");
+    printf("%-32s %f msecs\n", "full recount:", referenceMsecs);
+
+    // small edits at random levels, which the counts have to follow up the tree as they happen
+    uint64_t start = usecTimestampNow();
+    for (int i = 0; i < edits; i++) {
+        float size = 1.0f / (1 << randIntInRange(4, 9));
+        float x = floorf(randomUnit() / size) * size;
+        float y = floorf(randomUnit() / size) * size;
+        float z = floorf(randomUnit() / size) * size;
+        if (randIntInRange(0, 1)) {
+            tree->createVoxel(x, y, z, size, randIntInRange(0, 255), randIntInRange(0, 255), randIntInRange(0, 255));
+        } else {
+            tree->deleteVoxelAt(x, y, z, size);
+        }
+    }
+    tree->reaverageVoxelColors(tree->rootNode);
+    printf("%-32s %f msecs for %d edits\n", "edits:", (usecTimestampNow() - start) / 1000.0f, edits);
+
+    match = countsMatchReference(tree, referenceMsecs);
+    printf("%-32s %ld nodes, %ld leaves, counts %s\n", "after edits:", tree->rootNode->getSubTreeNodeCount(),
+           tree->rootNode->getSubTreeLeafNodeCount(), match ? "match" : "DON'T MATCH");
+
+    // and a copy read back from a bitstream
+    VoxelTree copy;
+    VoxelNodeBag bag;
+    bag.insert(tree->rootNode);
+    unsigned char buffer[MAX_VOXEL_PACKET_SIZE];
+    while (!bag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        int bytesWritten = tree->encodeTreeBitstream(bag.extract(), buffer, sizeof(buffer), bag, params);
+        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+        copy.readBitstreamToTree(buffer, bytesWritten, args);
+    }
+    match = countsMatchReference(&copy, referenceMsecs);
+    printf("%-32s %ld nodes, %ld leaves, counts %s\n", "decoded copy:", copy.rootNode->getSubTreeNodeCount(),
+           copy.rootNode->getSubTreeLeafNodeCount(), match ? "match" : "DON'T MATCH");
+}
+
+// the copy as it used to be done, encoding the subtree into packets and reading them back into the destination tree
+static void referenceCopySubTree(VoxelTree* tree, VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot) {
+    VoxelNodeBag nodeBag;
+    nodeBag.insert(startNode);
+    int chopLevels = rebaseToRoot ? numberOfThreeBitSectionsInCode(startNode->getOctalCode()) : 0;
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    while (!nodeBag.isEmpty()) {
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS, chopLevels);
+        int bytesWritten = tree->encodeTreeBitstream(nodeBag.extract(), outputBuffer, sizeof(outputBuffer), nodeBag,
+                                                     params);
+        ReadBitstreamToTreeParams args(WANT_COLOR, NO_EXISTS_BITS);
+        destinationTree->readBitstreamToTree(outputBuffer, bytesWritten, args);
+    }
+}
+
+// same shape and colors below both nodes
+static bool sameSubTrees(const VoxelNode* first, const VoxelNode* second) {
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        const VoxelNode* firstChild = first->getChildAtIndex(i);
+        const VoxelNode* secondChild = second->getChildAtIndex(i);
+        if (!firstChild || !secondChild) {
+            if (firstChild != secondChild) {
+                return false;
+            }
+            continue;
+        }
+        if (firstChild->isColored() != secondChild->isColored() ||
+                (firstChild->isColored() && memcmp(firstChild->getTrueColor(), secondChild->getTrueColor(), 3) != 0) ||
+                !sameSubTrees(firstChild, secondChild)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printCopyResult(const char* name, VoxelTree* copy, float msecs) {
+    printf("%-32s %ld nodes, %f msecs, counts %s\n", name, copy->getVoxelCount(), msecs,
+           copy->rootNode->hasConsistentSubTreeNodeCounts() ? "match" : "DON'T MATCH");
+}
+
+void benchmarkSubtreeCopy(VoxelTree* tree) {
+    // a copy isn't much of a benchmark unless it's millions of voxels
+    const unsigned long MIN_COPIED_VOXELS = 2000000;
+    VoxelTree largeTree(true);
+    if (tree->getVoxelCount() < MIN_COPIED_VOXELS) {
+        printf("creating a larger scene to copy...\n");
+        const float SPHERE_RADIUS = 0.2f;
+        const float SPHERE_VOXEL_SIZE = 1.0f / 512.0f;
+        largeTree.createSphere(SPHERE_RADIUS, 0.5f, 0.5f, 0.5f, SPHERE_VOXEL_SIZE, true, NATURAL);
+        largeTree.reaverageVoxelColors(largeTree.rootNode);
+        tree = &largeTree;
+    }
+    printf("copying %ld voxels...\n", tree->getVoxelCount());
+
+    VoxelTree referenceCopy;
+    uint64_t start = usecTimestampNow();
+    referenceCopySubTree(tree, tree->rootNode, &referenceCopy, false);
+    printCopyResult("bitstream copy:", &referenceCopy, (usecTimestampNow() - start) / 1000.0f);
+
+    VoxelTree copy;
+    start = usecTimestampNow();
+    tree->copySubTreeIntoNewTree(tree->rootNode, &copy, false);
+    printCopyResult("cloned copy:", &copy, (usecTimestampNow() - start) / 1000.0f);
+    printf("copies %s\n", sameSubTrees(referenceCopy.rootNode, copy.rootNode) ? "match" : "DON'T MATCH");
+
+    // the largest of the root's subtrees, moved up to the root the way the clipboard has it
+    VoxelNode* largestChild = NULL;
+    int largestChildIndex = 0;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = tree->rootNode->getChildAtIndex(i);
+        if (child && (!largestChild || child->getSubTreeNodeCount() > largestChild->getSubTreeNodeCount())) {
+            largestChild = child;
+            largestChildIndex = i;
+        }
+    }
+    if (!largestChild) {
+        return;
+    }
+    VoxelTree referenceRebased;
+    start = usecTimestampNow();
+    referenceCopySubTree(tree, largestChild, &referenceRebased, true);
+    printCopyResult("bitstream copy to root:", &referenceRebased, (usecTimestampNow() - start) / 1000.0f);
+
+    VoxelTree rebased;
+    start = usecTimestampNow();
+    tree->copySubTreeIntoNewTree(largestChild, &rebased, true);
+    printCopyResult("cloned copy to root:", &rebased, (usecTimestampNow() - start) / 1000.0f);
+    printf("copies %s\n", sameSubTrees(referenceRebased.rootNode, rebased.rootNode) ? "match" : "DON'T MATCH");
+
+    // and pasted back where it came from
+    VoxelTree pasted;
+    VoxelNode* pasteNode = pasted.rootNode->addChildAtIndex(largestChildIndex);
+    start = usecTimestampNow();
+    pasted.copyFromTreeIntoSubTree(&rebased, pasteNode);
+    printCopyResult("cloned paste:", &pasted, (usecTimestampNow() - start) / 1000.0f);
+    printf("paste %s\n", sameSubTrees(largestChild, pasteNode) ? "matches" : "DOESN'T MATCH");
+}
+
+class LeafDetailVisitor {
+public:
+    LeafDetailVisitor(std::vector<VoxelDetail>& details) : details(details) { }
+    bool visit(VoxelNode* node) {
+        if (node->isLeaf()) {
+            const glm::vec3& corner = node->getCorner();
+            VoxelDetail detail = { corner.x, corner.y, corner.z, node->getScale(), 0, 0, 0 };
+            details.push_back(detail);
+        }
+        return true;
+    }
+    std::vector<VoxelDetail>& details;
+};
+
+// the lookup as it used to be done, building the voxel's octal code and following it down
+static VoxelNode* referenceGetVoxelAt(VoxelTree* tree, const VoxelDetail& voxel) {
+    unsigned char* octalCode = pointToVoxel(voxel.x, voxel.y, voxel.z, voxel.s);
+    int codeLength = numberOfThreeBitSectionsInCode(octalCode);
+    VoxelNode* node = tree->rootNode;
+    while (node && numberOfThreeBitSectionsInCode(node->getOctalCode()) < codeLength) {
+        node = node->getChildAtIndex(branchIndexWithDescendant(node->getOctalCode(), octalCode));
+    }
+    delete[] octalCode;
+    return node;
+}
+
+void benchmarkVoxelCoordinates(VoxelTree* tree) {
+    // a solid ball of voxels in scan order, the way the importers come across them
+    const float BALL_RADIUS = 0.2f;
+    const float BALL_VOXEL_SIZE = 1.0f / 256.0f;
+    std::vector<VoxelDetail> voxels;
+    for (float x = 0.5f - BALL_RADIUS; x < 0.5f + BALL_RADIUS; x += BALL_VOXEL_SIZE) {
+        for (float y = 0.5f - BALL_RADIUS; y < 0.5f + BALL_RADIUS; y += BALL_VOXEL_SIZE) {
+            for (float z = 0.5f - BALL_RADIUS; z < 0.5f + BALL_RADIUS; z += BALL_VOXEL_SIZE) {
+                glm::vec3 offset = glm::vec3(x, y, z) - glm::vec3(0.5f, 0.5f, 0.5f);
+                if (glm::length(offset) < BALL_RADIUS) {
+                    VoxelDetail voxel = { x, y, z, BALL_VOXEL_SIZE, (unsigned char)(x * 255), (unsigned char)(y * 255),
+                                          (unsigned char)(z * 255) };
+                    voxels.push_back(voxel);
+                }
+            }
+        }
+    }
+    printf("creating %d voxels...\n", (int)voxels.size());
+
+    VoxelTree reference(true);
+    uint64_t start = usecTimestampNow();
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        unsigned char* voxelData = pointToVoxel(voxel.x, voxel.y, voxel.z, voxel.s, voxel.red, voxel.green, voxel.blue);
+        reference.readCodeColorBufferToTree(voxelData);
+        delete[] voxelData;
+    }
+    printCopyResult("octal codes:", &reference, (usecTimestampNow() - start) / 1000.0f);
+
+    VoxelTree single(true);
+    start = usecTimestampNow();
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        single.createVoxel(voxel.x, voxel.y, voxel.z, voxel.s, voxel.red, voxel.green, voxel.blue);
+    }
+    printCopyResult("coordinates:", &single, (usecTimestampNow() - start) / 1000.0f);
+    printf("trees %s\n", sameSubTrees(reference.rootNode, single.rootNode) ? "match" : "DON'T MATCH");
+
+    VoxelTree batched(true);
+    start = usecTimestampNow();
+    std::vector<VoxelCoordinates> coordinates(voxels.size());
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        coordinates[i] = pointToVoxelCoordinates(voxel.x, voxel.y, voxel.z, voxel.s, voxel.red, voxel.green, voxel.blue);
+    }
+    batched.createVoxels(&coordinates[0], coordinates.size());
+    printCopyResult("batch in scan order:", &batched, (usecTimestampNow() - start) / 1000.0f);
+    printf("trees %s\n", sameSubTrees(reference.rootNode, batched.rootNode) ? "match" : "DON'T MATCH");
+
+    VoxelTree sorted(true);
+    start = usecTimestampNow();
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        coordinates[i] = pointToVoxelCoordinates(voxel.x, voxel.y, voxel.z, voxel.s, voxel.red, voxel.green, voxel.blue);
+    }
+    VoxelTree::sortVoxelCoordinates(&coordinates[0], coordinates.size());
+    sorted.createVoxels(&coordinates[0], coordinates.size());
+    printCopyResult("batch in tree order:", &sorted, (usecTimestampNow() - start) / 1000.0f);
+    printf("trees %s\n", sameSubTrees(reference.rootNode, sorted.rootNode) ? "match" : "DON'T MATCH");
+
+    // and finding them all again, in the scene as well as the ball
+    voxels.clear();
+    LeafDetailVisitor leaves(voxels);
+    visitNodes(tree->rootNode, leaves);
+    printf("finding %d voxels...\n", (int)voxels.size());
+
+    start = usecTimestampNow();
+    int referenceFound = 0;
+    for (size_t i = 0; i < voxels.size(); i++) {
+        referenceFound += (referenceGetVoxelAt(tree, voxels[i]) != NULL);
+    }
+    printf("%-32s %d found, %f msecs\n", "octal codes:", referenceFound, (usecTimestampNow() - start) / 1000.0f);
+
+    start = usecTimestampNow();
+    int found = 0;
+    for (size_t i = 0; i < voxels.size(); i++) {
+        const VoxelDetail& voxel = voxels[i];
+        found += (tree->getVoxelAt(voxel.x, voxel.y, voxel.z, voxel.s) != NULL);
+    }
+    printf("%-32s %d found, %f msecs\n", "coordinates:", found, (usecTimestampNow() - start) / 1000.0f);
+
+    bool sameVoxels = true;
+    for (size_t i = 0; i < voxels.size() && sameVoxels; i++) {
+        const VoxelDetail& voxel = voxels[i];
+        sameVoxels = tree->getVoxelAt(voxel.x, voxel.y, voxel.z, voxel.s) == referenceGetVoxelAt(tree, voxel);
+    }
+    printf("voxels found %s\n", sameVoxels ? "match" : "DON'T MATCH");
+}
+
+static void writeSchematicShort(gzFile file, int value) {
+    gzputc(file, (value >> 8) & 0xFF);
+    gzputc(file, value & 0xFF);
+}
+
+static void writeSchematicInt(gzFile file, int value) {
+    writeSchematicShort(file, value >> 16);
+    writeSchematicShort(file, value);
+}
+
+static void writeSchematicTagStart(gzFile file, int tagId, const char* name) {
+    gzputc(file, tagId);
+    writeSchematicShort(file, strlen(name));
+    gzwrite(file, name, strlen(name));
+}
+
+// a gzipped schematic of rolling terrain, laid out the way MCEdit saves them
+static void writeBenchmarkSchematic(const char* fileName, int width, int height, int length) {
+    gzFile file = gzopen(fileName, "wb");
+    writeSchematicTagStart(file, TAG_Compound, "Schematic");
+    writeSchematicTagStart(file, TAG_Short, "Width");
+    writeSchematicShort(file, width);
+    writeSchematicTagStart(file, TAG_Short, "Height");
+    writeSchematicShort(file, height);
+    writeSchematicTagStart(file, TAG_Short, "Length");
+    writeSchematicShort(file, length);
+    writeSchematicTagStart(file, TAG_String, "Materials");
+    writeSchematicShort(file, strlen("Alpha"));
+    gzwrite(file, "Alpha", strlen("Alpha"));
+    writeSchematicTagStart(file, TAG_List, "Entities");
+    gzputc(file, TAG_Compound);
+    writeSchematicInt(file, 0);
+
+    std::vector<char> blocks(width * height * length);
+    std::vector<char> blocksData(blocks.size());
+    for (int y = 0; y < height; y++) {
+        for (int z = 0; z < length; z++) {
+            for (int x = 0; x < width; x++) {
+                int position = (y * length + z) * width + x;
+                int surface = height / 2 + (int)(height / 4 * sinf(x * 0.05f) * cosf(z * 0.07f));
+                if (y < surface - 3) {
+                    blocks[position] = (rand() % 50 == 0) ? 56 : 1;
+                } else if (y < surface) {
+                    blocks[position] = 3;
+                } else if (y == surface) {
+                    blocks[position] = (rand() % 20 == 0) ? 35 : 2;
+                    blocksData[position] = rand() % 16;
+                } else if (y == surface + 1 && rand() % 50 == 0) {
+                    // and the odd slab or stair, which are made of half size voxels
+                    blocks[position] = (rand() % 2 == 0) ? 44 : 53;
+                    blocksData[position] = rand() % 4;
+                }
+            }
+        }
+    }
+    writeSchematicTagStart(file, TAG_Byte_Array, "Blocks");
+    writeSchematicInt(file, blocks.size());
+    gzwrite(file, &blocks[0], blocks.size());
+    writeSchematicTagStart(file, TAG_Byte_Array, "Data");
+    writeSchematicInt(file, blocksData.size());
+    gzwrite(file, &blocksData[0], blocksData.size());
+    gzputc(file, TAG_End);
+    gzclose(file);
+}
+
+// The schematic reading as it used to be done: the file read a byte at a time, inflated into a buffer that grows by
+// half the file size at a time, pushed through a stringstream, and the arrays copied out of that.
+struct ReferenceSchematic {
+    int width;
+    int height;
+    int length;
+    std::vector<char> blocks;
+    std::vector<char> blocksData;
+};
+
+static bool referenceReadSchematicData(const char* fileName, std::stringstream& ss) {
+    std::ifstream file(fileName, std::ios::binary);
+    std::string gzipedBytes;
+    while (!file.eof()) {
+        gzipedBytes += (char)file.get();
+    }
+    unsigned int uncompLength = gzipedBytes.size();
+    unsigned int halfLength = gzipedBytes.size() / 2;
+    char* uncomp = (char*)calloc(sizeof(char), uncompLength);
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    strm.next_in = (Bytef*)gzipedBytes.c_str();
+    strm.avail_in = gzipedBytes.size();
+    inflateInit2(&strm, 16 + MAX_WBITS);
+    int err = Z_OK;
+    while (err == Z_OK) {
+        if (strm.total_out >= uncompLength) {
+            char* uncomp2 = (char*)calloc(sizeof(char), uncompLength + halfLength);
+            memcpy(uncomp2, uncomp, uncompLength);
+            uncompLength += halfLength;
+            free(uncomp);
+            uncomp = uncomp2;
+        }
+        strm.next_out = (Bytef*)(uncomp + strm.total_out);
+        strm.avail_out = uncompLength - strm.total_out;
+        err = inflate(&strm, Z_SYNC_FLUSH);
+    }
+    inflateEnd(&strm);
+    for (size_t i = 0; i < strm.total_out; i++) {
+        ss << uncomp[i];
+    }
+    free(uncomp);
+    return err == Z_STREAM_END;
+}
+
+static int referenceReadSchematicInt(std::stringstream& ss, int bytes) {
+    int value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = value << 8 | ss.get();
+    }
+    return value;
+}
+
+static void referenceReadSchematicTag(std::stringstream& ss, int tagId, const std::string& name,
+                                      ReferenceSchematic& schematic) {
+    const int TAG_SIZES[] = { 0, 1, 2, 4, 8, 4, 8 };
+    if (tagId <= TAG_Double) {
+        int value = referenceReadSchematicInt(ss, TAG_SIZES[tagId]);
+        if (tagId == TAG_Short) {
+            if (name == "Width") {
+                schematic.width = value;
+            } else if (name == "Height") {
+                schematic.height = value;
+            } else if (name == "Length") {
+                schematic.length = value;
+            }
+        }
+    } else if (tagId == TAG_Byte_Array || tagId == TAG_Int_Array) {
+        int size = referenceReadSchematicInt(ss, 4) * (tagId == TAG_Int_Array ? 4 : 1);
+        std::vector<char> data(size);
+        for (int i = 0; i < size; i++) {
+            data[i] = ss.get();
+        }
+        if (name == "Blocks") {
+            schematic.blocks.swap(data);
+        } else if (name == "Data") {
+            schematic.blocksData.swap(data);
+        }
+    } else if (tagId == TAG_String) {
+        ss.seekg(referenceReadSchematicInt(ss, 2), ss.cur);
+    } else if (tagId == TAG_List) {
+        int listTagId = ss.get();
+        int size = referenceReadSchematicInt(ss, 4);
+        for (int i = 0; i < size; i++) {
+            referenceReadSchematicTag(ss, listTagId, std::string(), schematic);
+        }
+    } else if (tagId == TAG_Compound) {
+        int childTagId;
+        while ((childTagId = ss.get()) != TAG_End && childTagId != EOF) {
+            std::string childName;
+            int nameSize = referenceReadSchematicInt(ss, 2);
+            for (int i = 0; i < nameSize; i++) {
+                childName += ss.get();
+            }
+            referenceReadSchematicTag(ss, childTagId, childName, schematic);
+        }
+    }
+}
+
+void benchmarkSchematicReading(const char* fileName) {
+    const char* GENERATED_SCHEMATIC_FILE = "benchmarkSchematic.schematic";
+    if (!fileName) {
+        const int SCHEMATIC_WIDTH = 256;
+        const int SCHEMATIC_HEIGHT = 128;
+        const int SCHEMATIC_LENGTH = 256;
+        printf("writing a %dx%dx%d schematic...\n", SCHEMATIC_WIDTH, SCHEMATIC_HEIGHT, SCHEMATIC_LENGTH);
+        writeBenchmarkSchematic(GENERATED_SCHEMATIC_FILE, SCHEMATIC_WIDTH, SCHEMATIC_HEIGHT, SCHEMATIC_LENGTH);
+        fileName = GENERATED_SCHEMATIC_FILE;
+    }
+
+    uint64_t start = usecTimestampNow();
+    std::stringstream ss;
+    ReferenceSchematic reference = { 0, 0, 0 };
+    bool referenceRead = referenceReadSchematicData(fileName, ss);
+    float inflateMsecs = (usecTimestampNow() - start) / 1000.0f;
+    ss.get();
+    ss.seekg(referenceReadSchematicInt(ss, 2), ss.cur);
+    referenceReadSchematicTag(ss, TAG_Compound, std::string(), reference);
+    printf("%-32s %dx%dx%d, %f msecs to inflate, %f msecs in all\n", "stringstream:", reference.width,
+           reference.height, reference.length, inflateMsecs, (usecTimestampNow() - start) / 1000.0f);
+
+    start = usecTimestampNow();
+    std::vector<unsigned char> data;
+    int err = retrieveData(fileName, data);
+    inflateMsecs = (usecTimestampNow() - start) / 1000.0f;
+    if (err || data.empty() || data[0] != TAG_Compound) {
+        printf("couldn't read %s\n", fileName);
+        return;
+    }
+    TagReader reader(&data[0], data.size());
+    reader.getByte();
+    TagCompound schematic(reader);
+    printf("%-32s %dx%dx%d, %f msecs to inflate, %f msecs in all\n", "in place:", schematic.getWidth(),
+           schematic.getHeight(), schematic.getLength(), inflateMsecs, (usecTimestampNow() - start) / 1000.0f);
+
+    size_t blockCount = (size_t)schematic.getWidth() * schematic.getHeight() * schematic.getLength();
+    bool match = referenceRead && schematic.getBlocksId() && schematic.getBlocksData() &&
+                 reference.width == schematic.getWidth() && reference.height == schematic.getHeight() &&
+                 reference.length == schematic.getLength() && reference.blocks.size() >= blockCount &&
+                 reference.blocksData.size() >= blockCount &&
+                 memcmp(&reference.blocks[0], schematic.getBlocksId(), blockCount) == 0 &&
+                 memcmp(&reference.blocksData[0], schematic.getBlocksData(), blockCount) == 0;
+    printf("%lu bytes of tags, blocks %s\n", (unsigned long)data.size(), match ? "match" : "DON'T MATCH");
+}
+
+// the import as it used to be done, a createVoxel() for every block, or every half of one in slabs and stairs
+static int referenceImportSchematic(VoxelTree* tree, const char* fileName) {
+    std::vector<unsigned char> data;
+    if (retrieveData(fileName, data) || data.empty()) {
+        return 0;
+    }
+    TagReader reader(&data[0], data.size());
+    reader.getByte();
+    TagCompound schematics(reader);
+    if (!schematics.getBlocksId() || !schematics.getBlocksData()) {
+        return 0;
+    }
+    int max = std::max(schematics.getWidth(), std::max(schematics.getHeight(), schematics.getLength()));
+    int scale = 1;
+    while (max > scale) {
+        scale *= 2;
+    }
+    float size = 1.0f / scale;
+    float half = size / 2;
+    int count = 0;
+    for (int y = 0; y < schematics.getHeight(); ++y) {
+        for (int z = 0; z < schematics.getLength(); ++z) {
+            for (int x = 0; x < schematics.getWidth(); ++x) {
+                int pos = ((y * schematics.getLength()) + z) * schematics.getWidth() + x;
+                int data = schematics.getBlocksData()[pos];
+                int create = 1;
+                int red, green, blue;
+                computeBlockColor(schematics.getBlocksId()[pos], data, red, green, blue, create);
+                if (create == 1) {
+                    tree->createVoxel(size * x, size * y, size * z, size, red, green, blue, true);
+                    count++;
+                    continue;
+                }
+                if (create == 2) {
+                    float stepX[] = { half, 0.0f, 0.0f, 0.0f };
+                    float stepZ[] = { 0.0f, 0.0f, half, 0.0f };
+                    float otherStepX[] = { half, 0.0f, half, half };
+                    float otherStepZ[] = { half, half, half, 0.0f };
+                    if (data >= 0 && data < 4) {
+                        tree->createVoxel(size * x + stepX[data], size * y + half, size * z + stepZ[data], half,
+                                          red, green, blue, true);
+                        tree->createVoxel(size * x + otherStepX[data], size * y + half, size * z + otherStepZ[data], half,
+                                          red, green, blue, true);
+                    }
+                    count += 2;
+                }
+                if (create == 2 || create == 3) {
+                    for (int i = 0; i < 4; i++) {
+                        tree->createVoxel(size * x + (i & 1) * half, size * y, size * z + (i >> 1) * half, half,
+                                          red, green, blue, true);
+                    }
+                    count += 4;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// true if every leaf of one tree is either in the other with the same color, or filled by leaves of its color there
+static bool nodeIsFilledWithColor(const VoxelNode* node, const unsigned char* color) {
+    if (node->isLeaf()) {
+        return node->isColored() && memcmp(node->getTrueColor(), color, 3) == 0;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (!node->getChildAtIndex(i) || !nodeIsFilledWithColor(node->getChildAtIndex(i), color)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sameVoxelsFilled(const VoxelNode* first, const VoxelNode* second) {
+    if (first->isLeaf() || second->isLeaf()) {
+        const VoxelNode* leaf = first->isLeaf() ? first : second;
+        const VoxelNode* other = first->isLeaf() ? second : first;
+        return leaf->isColored() ? nodeIsFilledWithColor(other, leaf->getTrueColor()) :
+                                   (other->isLeaf() && !other->isColored());
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        const VoxelNode* firstChild = first->getChildAtIndex(i);
+        const VoxelNode* secondChild = second->getChildAtIndex(i);
+        if ((firstChild || secondChild) &&
+                (!firstChild || !secondChild || !sameVoxelsFilled(firstChild, secondChild))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void benchmarkSchematicImport(const char* fileName) {
+    const char* GENERATED_SCHEMATIC_FILE = "benchmarkSchematic.schematic";
+    if (!fileName) {
+        const int SCHEMATIC_WIDTH = 256;
+        const int SCHEMATIC_HEIGHT = 128;
+        const int SCHEMATIC_LENGTH = 256;
+        printf("writing a %dx%dx%d schematic...\n", SCHEMATIC_WIDTH, SCHEMATIC_HEIGHT, SCHEMATIC_LENGTH);
+        writeBenchmarkSchematic(GENERATED_SCHEMATIC_FILE, SCHEMATIC_WIDTH, SCHEMATIC_HEIGHT, SCHEMATIC_LENGTH);
+        fileName = GENERATED_SCHEMATIC_FILE;
+    }
+
+    VoxelTree reference(true);
+    uint64_t start = usecTimestampNow();
+    int count = referenceImportSchematic(&reference, fileName);
+    float seconds = (usecTimestampNow() - start) / 1000000.0f;
+    printf("%-32s %ld nodes, %f msecs, %f voxels/sec\n", "createVoxel() per block:", reference.getVoxelCount(),
+           seconds * 1000.0f, count / seconds);
+
+    VoxelTree imported(true);
+    start = usecTimestampNow();
+    imported.readFromSchematicFile(fileName);
+    seconds = (usecTimestampNow() - start) / 1000000.0f;
+    printf("%-32s %ld nodes, %f msecs, %f voxels/sec\n", "built from the top down:", imported.getVoxelCount(),
+           seconds * 1000.0f, count / seconds);
+    printf("%d voxels, filled the same %s, counts %s\n", count,
+           sameVoxelsFilled(reference.rootNode, imported.rootNode) ? "yes" : "NO",
+           imported.rootNode->hasConsistentSubTreeNodeCounts() ? "match" : "DON'T MATCH");
+}
+
+// the split as --splitSVO used to do it, with the whole tree loaded and each end node copied out of it in turn
+static void referenceSplitSVO(const char* fileName, const JurisdictionMap& jurisdiction) {
+    char outputFileName[512];
+    VoxelTree rootSVO;
+    rootSVO.readFromSVOFile(fileName);
+    const float verySmall = 0.015625;
+    for (int i = 0; i < jurisdiction.getEndNodeCount(); i++) {
+        unsigned char* endNodeCode = jurisdiction.getEndNodeOctalCode(i);
+        VoxelPositionSize endNodeDetails;
+        voxelDetailsForCode(endNodeCode, endNodeDetails);
+
+        VoxelTree endNodeTree;
+        for (int corner = 0; corner < NUMBER_OF_CHILDREN; corner++) {
+            endNodeTree.createVoxel((corner >> 2) & 1, (corner >> 1) & 1, corner & 1, verySmall, 1, 1, 1, true);
+        }
+        endNodeTree.deleteVoxelCodeFromTree(endNodeCode, COLLAPSE_EMPTY_TREE);
+        VoxelNode* endNode = rootSVO.getVoxelAt(endNodeDetails.x, endNodeDetails.y, endNodeDetails.z, endNodeDetails.s);
+        if (endNode) {
+            rootSVO.copySubTreeIntoNewTree(endNode, &endNodeTree, false);
+        }
+        snprintf(outputFileName, sizeof(outputFileName), "referenceENDNODE%d%s", i, fileName);
+        endNodeTree.writeToSVOFile(outputFileName);
+
+        rootSVO.deleteVoxelCodeFromTree(endNodeCode, COLLAPSE_EMPTY_TREE);
+        rootSVO.createVoxel(endNodeDetails.x + endNodeDetails.s * 0.5, endNodeDetails.y + endNodeDetails.s * 0.5,
+                            endNodeDetails.z + endNodeDetails.s * 0.5, endNodeDetails.s * verySmall, 1, 1, 1, true);
+    }
+    snprintf(outputFileName, sizeof(outputFileName), "referenceROOT%s", fileName);
+    rootSVO.writeToSVOFile(outputFileName);
+}
+
+static bool sameSVOFiles(const char* firstFileName, const char* secondFileName) {
+    VoxelTree first;
+    VoxelTree second;
+    return first.readFromSVOFile(firstFileName) && second.readFromSVOFile(secondFileName) &&
+        sameSubTrees(first.rootNode, second.rootNode);
+}
+
+static bool sameShards(const char* referenceFileName, const char* fileName, int endNodeCount) {
+    char referenceShard[512];
+    char shard[512];
+    bool same = true;
+    for (int i = -1; i < endNodeCount; i++) {
+        if (i == -1) {
+            snprintf(referenceShard, sizeof(referenceShard), "referenceROOT%s", referenceFileName);
+            snprintf(shard, sizeof(shard), "splitROOT%s", fileName);
+        } else {
+            snprintf(referenceShard, sizeof(referenceShard), "referenceENDNODE%d%s", i, referenceFileName);
+            snprintf(shard, sizeof(shard), "splitENDNODE%d%s", i, fileName);
+        }
+        same = sameSVOFiles(referenceShard, shard) && same;
+    }
+    return same;
+}
+
+void benchmarkSVOSplit(VoxelTree* tree) {
+    const char* SPLIT_FILE = "benchmarkSplit.svo";
+    const char* INDEXED_SPLIT_FILE = "benchmarkSplitIndexed.svo";
+    const char* MERGED_FILE = "benchmarkSplitMerged.svo";
+    tree->writeToSVOFile(SPLIT_FILE);
+    IndexedSVOFile::write(tree, INDEXED_SPLIT_FILE);
+
+    // every other one of the root's children gets a server of its own, and the root keeps the rest
+    unsigned char* rootCode = new unsigned char[1];
+    *rootCode = 0;
+    std::vector<unsigned char*> endNodes;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i += 2) {
+        endNodes.push_back(childOctalCode(rootCode, i));
+    }
+    unsigned char* jurisdictionRootCode = new unsigned char[1];
+    *jurisdictionRootCode = 0;
+    JurisdictionMap jurisdiction(jurisdictionRootCode, endNodes);
+    delete[] rootCode;
+
+    uint64_t start = usecTimestampNow();
+    referenceSplitSVO(SPLIT_FILE, jurisdiction);
+    printf("%-32s %f msecs\n", "split from the whole tree:", (usecTimestampNow() - start) / 1000.0f);
+
+    start = usecTimestampNow();
+    SVOSharder::split(SPLIT_FILE, jurisdiction);
+    float msecs = (usecTimestampNow() - start) / 1000.0f;
+    printf("%-32s %f msecs, shards %s\n", "streamed split:", msecs,
+           sameShards(SPLIT_FILE, SPLIT_FILE, endNodes.size()) ? "match" : "DON'T MATCH");
+
+    start = usecTimestampNow();
+    SVOSharder::split(INDEXED_SPLIT_FILE, jurisdiction);
+    msecs = (usecTimestampNow() - start) / 1000.0f;
+    printf("%-32s %f msecs, shards %s\n", "streamed split of indexed file:", msecs,
+           sameShards(SPLIT_FILE, INDEXED_SPLIT_FILE, endNodes.size()) ? "match" : "DON'T MATCH");
+
+    std::vector<std::string> shards;
+    char shard[512];
+    snprintf(shard, sizeof(shard), "splitROOT%s", SPLIT_FILE);
+    shards.push_back(shard);
+    for (size_t i = 0; i < endNodes.size(); i++) {
+        snprintf(shard, sizeof(shard), "splitENDNODE%d%s", (int)i, SPLIT_FILE);
+        shards.push_back(shard);
+    }
+    start = usecTimestampNow();
+    SVOSharder::merge(shards, MERGED_FILE, &jurisdiction);
+    msecs = (usecTimestampNow() - start) / 1000.0f;
+    printf("%-32s %f msecs, %s the original\n", "streamed merge:", msecs,
+           sameSVOFiles(SPLIT_FILE, MERGED_FILE) ? "matches" : "DOESN'T MATCH");
+}
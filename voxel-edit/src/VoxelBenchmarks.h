@@ -0,0 +1,58 @@
+//
+//  VoxelBenchmarks.h
+//  Voxel Edit
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Timing runs for VoxelTree operations against a loaded SVO or a generated dense scene. Each benchmark also checks
+//  its results against a straightforward reference implementation, and prints both timings.
+//
+
+#ifndef __hifi__VoxelBenchmarks__
+#define __hifi__VoxelBenchmarks__
+
+#include <VoxelTree.h>
+
+void printVoxelTreeStats(const VoxelTreeStats& stats);
+
+/// fills the tree with a dense scene suitable for benchmarking, if it isn't already populated from an SVO
+void createBenchmarkScene(VoxelTree* tree);
+
+void benchmarkRayIntersections(VoxelTree* tree, int rayCount);
+
+/// times the old recursive function pointer walks against the VoxelTreeVisitor.h walks
+void benchmarkTreeWalks(VoxelTree* tree, int passes);
+
+/// times leaf scans, lookups and SVO encoding on the pointer tree against the same on a LinearVoxelTree
+void benchmarkLinearTree(VoxelTree* tree, int passes);
+
+/// encodes the whole tree into voxel packets with plain and with coded colors, and compares the bytes per voxel
+void benchmarkColorCoding(VoxelTree* tree);
+
+/// encodes the whole tree the way the voxel server used to, re-bagging whatever doesn't fit in a packet, and again into
+/// a VoxelPacketChain of packetsPerInterval packets at a time, and compares how much of the tree each traverses
+void benchmarkPacketChain(VoxelTree* tree, int packetsPerInterval);
+
+/// checks the subtree counts the nodes keep against a recount, before and after random edits, and times the recount
+void benchmarkSubtreeCounts(VoxelTree* tree, int edits);
+
+/// times copySubTreeIntoNewTree() and copyFromTreeIntoSubTree() against copying through a bitstream, on millions of voxels
+void benchmarkSubtreeCopy(VoxelTree* tree);
+
+/// creates a ball of voxels through octal codes, through coordinates one at a time and as a batch, and finds the scene's
+/// voxels both ways
+void benchmarkVoxelCoordinates(VoxelTree* tree);
+
+/// reads a schematic the way the importer used to, through a stringstream, and in place, and compares the blocks; one
+/// is generated if no file is given
+void benchmarkSchematicReading(const char* fileName);
+
+/// imports a schematic a voxel at a time, the way it used to be, and through a VoxelGrid, and checks that the same space
+/// is filled; one is generated if no file is given
+void benchmarkSchematicImport(const char* fileName);
+
+/// splits the tree between some of the root's children the way --splitSVO used to, by loading it whole, and through an
+/// SVOSharder from an old style and an indexed file, checks that the shards match, and merges them back together
+void benchmarkSVOSplit(VoxelTree* tree);
+
+#endif /* defined(__hifi__VoxelBenchmarks__) */
@@ -10,6 +10,11 @@
 #include <SharedUtil.h>
 #include <SceneUtils.h>
 #include <JurisdictionMap.h>
+#include <IndexedSVOFile.h>
+
+#include "NetworkBenchmarks.h"
+#include "SVOSharder.h"
+#include "VoxelBenchmarks.h"
 
 VoxelTree myTree;
 
@@ -55,6 +60,72 @@ void voxelTutorial(VoxelTree * tree) {
     }
 }
 
+// A timing run that voxel-edit makes when its option is passed, with the benchmark scene and a count, the scene alone,
+// the option's value (a file to use in place of a generated one) or just a count.
+struct Benchmark {
+    typedef void (*SceneCountFunction)(VoxelTree* tree, int count);
+    typedef void (*SceneFunction)(VoxelTree* tree);
+    typedef void (*FileFunction)(const char* fileName);
+    typedef void (*CountFunction)(int count);
+
+    Benchmark(const char* option, SceneCountFunction function, int count) :
+        option(option), sceneCountFunction(function), sceneFunction(NULL), fileFunction(NULL), countFunction(NULL),
+        count(count) { }
+    Benchmark(const char* option, SceneFunction function) :
+        option(option), sceneCountFunction(NULL), sceneFunction(function), fileFunction(NULL), countFunction(NULL),
+        count(0) { }
+    Benchmark(const char* option, FileFunction function) :
+        option(option), sceneCountFunction(NULL), sceneFunction(NULL), fileFunction(function), countFunction(NULL),
+        count(0) { }
+    Benchmark(const char* option, CountFunction function, int count) :
+        option(option), sceneCountFunction(NULL), sceneFunction(NULL), fileFunction(NULL), countFunction(function),
+        count(count) { }
+
+    bool needsScene() const { return sceneCountFunction || sceneFunction; }
+
+    void run(VoxelTree* scene, const char* optionValue) const {
+        if (sceneCountFunction) {
+            sceneCountFunction(scene, count);
+        } else if (sceneFunction) {
+            sceneFunction(scene);
+        } else if (fileFunction) {
+            fileFunction(optionValue);
+        } else {
+            countFunction(count);
+        }
+    }
+
+    const char* option;
+    SceneCountFunction sceneCountFunction;
+    SceneFunction sceneFunction;
+    FileFunction fileFunction;
+    CountFunction countFunction;
+    int count;
+};
+
+const Benchmark BENCHMARKS[] = {
+    // the shared networking code's
+    Benchmark("--benchmarkUDPSend", benchmarkUDPSend, 200000),
+    Benchmark("--benchmarkUDPReceive", benchmarkUDPReceive, 200000),
+    Benchmark("--benchmarkEventLoop", benchmarkEventLoop, 500),
+    Benchmark("--benchmarkPacketQueue", benchmarkPacketQueue, 20000),
+    Benchmark("--benchmarkPacketBuffers", benchmarkPacketBuffers, 200000),
+    Benchmark("--benchmarkNodeList", benchmarkNodeList, 10000),
+
+    // VoxelTree's
+    Benchmark("--benchmarkRays", benchmarkRayIntersections, 100000),
+    Benchmark("--benchmarkWalks", benchmarkTreeWalks, 20),
+    Benchmark("--benchmarkLinear", benchmarkLinearTree, 20),
+    Benchmark("--benchmarkColorCoding", benchmarkColorCoding),
+    Benchmark("--benchmarkPacketChain", benchmarkPacketChain, 10),
+    Benchmark("--benchmarkSubtreeCounts", benchmarkSubtreeCounts, 100000),
+    Benchmark("--benchmarkSubtreeCopy", benchmarkSubtreeCopy),
+    Benchmark("--benchmarkCoordinates", benchmarkVoxelCoordinates),
+    Benchmark("--benchmarkSchematic", benchmarkSchematicReading),
+    Benchmark("--benchmarkImport", benchmarkSchematicImport),
+    Benchmark("--benchmarkSplit", benchmarkSVOSplit)
+};
+
 int main(int argc, const char * argv[])
 {
     qInstallMessageHandler(sharedMessageHandler);
@@ -68,14 +139,9 @@ int main(int argc, const char * argv[])
     const char* splitJurisdictionRoot = getCmdOption(argc, argv, SPLIT_JURISDICTION_ROOT);
     const char* splitJurisdictionEndNodes = getCmdOption(argc, argv, SPLIT_JURISDICTION_ENDNODES);
     if (splitSVOFile && splitJurisdictionRoot && splitJurisdictionEndNodes) {
-        char outputFileName[512];
-
         printf("splitSVOFile: %s Jurisdictions Root: %s EndNodes: %s\n", 
                 splitSVOFile, splitJurisdictionRoot, splitJurisdictionEndNodes);
 
-        VoxelTree rootSVO;
-
-        rootSVO.readFromSVOFile(splitSVOFile);
         JurisdictionMap jurisdiction(splitJurisdictionRoot, splitJurisdictionEndNodes);
     
         printf("Jurisdiction Root Octcode: ");
@@ -83,73 +149,109 @@ int main(int argc, const char * argv[])
 
         printf("Jurisdiction End Nodes: %d \n", jurisdiction.getEndNodeCount());
         for (int i = 0; i < jurisdiction.getEndNodeCount(); i++) {
-            unsigned char* endNodeCode = jurisdiction.getEndNodeOctalCode(i);
             printf("End Node: %d ", i);
-            printOctalCode(endNodeCode);
-
-            // get the endNode details
-            VoxelPositionSize endNodeDetails;
-            voxelDetailsForCode(endNodeCode, endNodeDetails);
-
-            // Now, create a split SVO for the EndNode.
-            // copy the EndNode into a temporary tree
-            VoxelTree endNodeTree;
-
-            // create a small voxels at corners of the endNode Tree, this will is a hack
-            // to work around a bug in voxel server that will send Voxel not exists
-            // for regions that don't contain anything even if they're not in the
-            // jurisdiction of the server
-            // This hack assumes the end nodes for demo dinner since it only guarantees
-            // nodes in the 8 child voxels of the main root voxel 
-            const float verySmall = 0.015625;
-            endNodeTree.createVoxel(0.0, 0.0, 0.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(1.0, 0.0, 0.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(0.0, 1.0, 0.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(0.0, 0.0, 1.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(1.0, 1.0, 1.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(1.0, 1.0, 0.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(0.0, 1.0, 1.0, verySmall, 1, 1, 1, true);
-            endNodeTree.createVoxel(1.0, 0.0, 1.0, verySmall, 1, 1, 1, true);
-
-            // Delete the voxel for the EndNode from the temporary tree, so we can
-            // import our endNode content into it...
-            endNodeTree.deleteVoxelCodeFromTree(endNodeCode, COLLAPSE_EMPTY_TREE);
-
-            VoxelNode* endNode = rootSVO.getVoxelAt(endNodeDetails.x, 
-                                                    endNodeDetails.y, 
-                                                    endNodeDetails.z, 
-                                                    endNodeDetails.s);
-
-            rootSVO.copySubTreeIntoNewTree(endNode, &endNodeTree, false);
-
-            sprintf(outputFileName, "splitENDNODE%d%s", i, splitSVOFile);
-            printf("outputFile: %s\n", outputFileName);
-            endNodeTree.writeToSVOFile(outputFileName);
-        
-            // Delete the voxel for the EndNode from the root tree...
-            rootSVO.deleteVoxelCodeFromTree(endNodeCode, COLLAPSE_EMPTY_TREE);
-        
-            // create a small voxel in center of each EndNode, this will is a hack
-            // to work around a bug in voxel server that will send Voxel not exists
-            // for regions that don't contain anything even if they're not in the
-            // jurisdiction of the server
-            float x = endNodeDetails.x + endNodeDetails.s * 0.5;
-            float y = endNodeDetails.y + endNodeDetails.s * 0.5;
-            float z = endNodeDetails.z + endNodeDetails.s * 0.5;
-            float s = endNodeDetails.s * verySmall;
-        
-            rootSVO.createVoxel(x, y, z, s, 1, 1, 1, true);
-        
+            printOctalCode(jurisdiction.getEndNodeOctalCode(i));
         }
 
-        sprintf(outputFileName, "splitROOT%s", splitSVOFile);
-        printf("outputFile: %s\n", outputFileName);
-        rootSVO.writeToSVOFile(outputFileName);
-    
+        if (!SVOSharder::split(splitSVOFile, jurisdiction)) {
+            printf("couldn't split %s\n", splitSVOFile);
+            return 1;
+        }
         printf("exiting now\n");
         return 0;
     }
 
+    // Merges shard SVOs back into one. Given the jurisdiction they were split with, the first input is the root's shard
+    // and the rest are the end nodes' in order, and the placeholder voxels the split added are left out.
+    const char* MERGE_SVO = "--mergeSVO";
+    const char* MERGE_INPUTS = "--mergeInputs";
+    const char* mergeSVOFile = getCmdOption(argc, argv, MERGE_SVO);
+    const char* mergeInputs = getCmdOption(argc, argv, MERGE_INPUTS);
+    if (mergeSVOFile && mergeInputs) {
+        std::vector<std::string> inputFiles;
+        std::string inputList(mergeInputs);
+        size_t inputStart = 0;
+        while (inputStart <= inputList.size()) {
+            size_t inputEnd = inputList.find(',', inputStart);
+            if (inputEnd == std::string::npos) {
+                inputEnd = inputList.size();
+            }
+            if (inputEnd > inputStart) {
+                inputFiles.push_back(inputList.substr(inputStart, inputEnd - inputStart));
+            }
+            inputStart = inputEnd + 1;
+        }
+
+        JurisdictionMap* jurisdiction = NULL;
+        if (splitJurisdictionRoot && splitJurisdictionEndNodes) {
+            jurisdiction = new JurisdictionMap(splitJurisdictionRoot, splitJurisdictionEndNodes);
+        }
+        bool merged = SVOSharder::merge(inputFiles, mergeSVOFile, jurisdiction);
+        delete jurisdiction;
+        if (!merged) {
+            printf("couldn't merge into %s\n", mergeSVOFile);
+            return 1;
+        }
+        return 0;
+    }
+
+    // Converts between old style SVO files and indexed ones, in whichever direction the input file needs
+    const char* CONVERT_SVO = "--convertSVO";
+    const char* CONVERT_OUTPUT = "--convertOutput";
+    const char* CONVERT_INDEX_DEPTH = "--indexDepth";
+    const char* CONVERT_UNCOMPRESSED = "--uncompressed";
+    const char* convertSVOFile = getCmdOption(argc, argv, CONVERT_SVO);
+    const char* convertOutputFile = getCmdOption(argc, argv, CONVERT_OUTPUT);
+    if (convertSVOFile && convertOutputFile) {
+        VoxelTree tree;
+        if (!tree.readFromSVOFile(convertSVOFile)) {
+            printf("couldn't read %s\n", convertSVOFile);
+            return 1;
+        }
+        if (IndexedSVOFile::isIndexedSVOFile(convertSVOFile)) {
+            tree.writeToSVOFile(convertOutputFile);
+        } else {
+            const char* indexDepthOption = getCmdOption(argc, argv, CONVERT_INDEX_DEPTH);
+            int indexDepth = indexDepthOption ? atoi(indexDepthOption) : IndexedSVOFile::DEFAULT_INDEX_DEPTH;
+            bool compress = !cmdOptionExists(argc, argv, CONVERT_UNCOMPRESSED);
+            if (!IndexedSVOFile::write(&tree, convertOutputFile, indexDepth, compress)) {
+                printf("couldn't write %s\n", convertOutputFile);
+                return 1;
+            }
+            IndexedSVOFile indexedFile;
+            if (indexedFile.open(convertOutputFile)) {
+                printf("wrote %d subtrees at depth %d\n", indexedFile.getSubtreeCount(), indexedFile.getIndexDepth());
+            }
+        }
+        return 0;
+    }
+
+    // Runs whichever benchmarks were asked for, building the voxel scene for the first one that needs it from either
+    // the SVO passed in with --benchmarkSVO or a generated dense scene
+    const char* BENCHMARK_SVO = "--benchmarkSVO";
+    bool ranBenchmarks = false;
+    bool sceneCreated = false;
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+        const Benchmark& benchmark = BENCHMARKS[i];
+        if (!cmdOptionExists(argc, argv, benchmark.option)) {
+            continue;
+        }
+        if (benchmark.needsScene() && !sceneCreated) {
+            const char* benchmarkSVOFile = getCmdOption(argc, argv, BENCHMARK_SVO);
+            if (benchmarkSVOFile) {
+                myTree.readFromSVOFile(benchmarkSVOFile);
+            }
+            createBenchmarkScene(&myTree);
+            sceneCreated = true;
+        }
+        printf("Running %s...\n", benchmark.option);
+        benchmark.run(&myTree, getCmdOption(argc, argv, benchmark.option));
+        ranBenchmarks = true;
+    }
+    if (ranBenchmarks) {
+        return 0;
+    }
+
     const char* DONT_CREATE_FILE = "--dontCreateSceneFile";
     bool dontCreateFile = cmdOptionExists(argc, argv, DONT_CREATE_FILE);
 
@@ -178,8 +280,10 @@ int main(int argc, const char * argv[])
             addSurfaceScene(&myTree);
         }
 
-        unsigned long nodeCount = myTree.getVoxelCount();
-        printf("Nodes after adding scenes: %ld nodes\n", nodeCount);
+        VoxelTreeStats stats;
+        myTree.collectStats(stats);
+        printf("Nodes after adding scenes: %ld nodes\n", stats.nodeCount);
+        printVoxelTreeStats(stats);
 
         myTree.writeToSVOFile("voxels.svo");
 
@@ -12,10 +12,13 @@
 #include <cstring>
 #include <cstdio>
 #include "VoxelSendThread.h"
+#include "VoxelServer.h"
 
 VoxelNodeData::VoxelNodeData(Node* owningNode) :
     AvatarData(owningNode),
+    packetCompressor(::voxelCompressionLevel),
     _viewSent(false),
+    _voxelPacketBuffer(PacketBuffer::allocate()),
     _voxelPacketAvailableBytes(MAX_VOXEL_PACKET_SIZE),
     _maxSearchLevel(1),
     _maxLevelReachedInLastSearch(1),
@@ -23,9 +26,10 @@ VoxelNodeData::VoxelNodeData(Node* owningNode) :
     _viewFrustumChanging(false),
     _viewFrustumJustStoppedChanging(true),
     _currentPacketIsColor(true),
+    _currentPacketIsColorCoded(false),
     _voxelSendThread(NULL)
 {
-    _voxelPacket = new unsigned char[MAX_VOXEL_PACKET_SIZE];
+    _voxelPacket = _voxelPacketBuffer->getData();
     _voxelPacketAt = _voxelPacket;
     resetVoxelPacket();
     
@@ -37,16 +41,32 @@ VoxelNodeData::VoxelNodeData(Node* owningNode) :
 
 
 void VoxelNodeData::resetVoxelPacket() {
+    // the last packet may still be waiting to go out, in which case this one is written into a new buffer
+    if (_voxelPacketBuffer->isShared()) {
+        _voxelPacketBuffer->release();
+        _voxelPacketBuffer = PacketBuffer::allocate();
+        _voxelPacket = _voxelPacketBuffer->getData();
+    }
+
     // If we're moving, and the client asked for low res, then we force monochrome, otherwise, use 
     // the clients requested color state.    
     _currentPacketIsColor = (LOW_RES_MONO && getWantLowResMoving() && _viewFrustumChanging) ? false : getWantColor();
+    _currentPacketIsColorCoded = _currentPacketIsColor && getWantColorCoding();
     PACKET_TYPE voxelPacketType = _currentPacketIsColor ? PACKET_TYPE_VOXEL_DATA : PACKET_TYPE_VOXEL_DATA_MONOCHROME;
+    if (_currentPacketIsColorCoded) {
+        voxelPacketType = PACKET_TYPE_VOXEL_DATA_CODED_COLORS;
+    }
     int numBytesPacketHeader = populateTypeAndVersion(_voxelPacket, voxelPacketType);
     _voxelPacketAt = _voxelPacket + numBytesPacketHeader;
     _voxelPacketAvailableBytes = MAX_VOXEL_PACKET_SIZE - numBytesPacketHeader;
     _voxelPacketWaiting = false;
 }
 
+PacketBuffer* VoxelNodeData::getPacketBuffer() {
+    _voxelPacketBuffer->setLength(getPacketLength());
+    return _voxelPacketBuffer;
+}
+
 void VoxelNodeData::writeToPacket(unsigned char* buffer, int bytes) {
     memcpy(_voxelPacketAt, buffer, bytes);
     _voxelPacketAvailableBytes -= bytes;
@@ -55,7 +75,7 @@ void VoxelNodeData::writeToPacket(unsigned char* buffer, int bytes) {
 }
 
 VoxelNodeData::~VoxelNodeData() {
-    delete[] _voxelPacket;
+    _voxelPacketBuffer->release();
 
     _voxelSendThread->terminate();
     delete _voxelSendThread;
@@ -11,12 +11,15 @@
 
 #include <iostream>
 #include <NodeData.h>
+#include <PacketBuffer.h>
 #include <AvatarData.h>
 
 #include <CoverageMap.h>
 #include <VoxelConstants.h>
 #include <VoxelNodeBag.h>
+#include <VoxelPacketCompressor.h>
 #include <VoxelSceneStats.h>
+#include <VoxelSubtreeVersions.h>
 
 class VoxelSendThread;
 
@@ -30,6 +33,9 @@ public:
     void writeToPacket(unsigned char* buffer, int bytes); // writes to end of packet
 
     const unsigned char* getPacket() const { return _voxelPacket; }
+    /// the packet in its buffer, so it can be sent without copying; the next resetVoxelPacket() starts a new buffer
+    /// if the send still holds this one
+    PacketBuffer* getPacketBuffer();
     int getPacketLength() const { return (MAX_VOXEL_PACKET_SIZE - _voxelPacketAvailableBytes); }
     bool isPacketWaiting() const { return _voxelPacketWaiting; }
     int getAvailable() const { return _voxelPacketAvailableBytes; }
@@ -62,14 +68,22 @@ public:
     void      setLastTimeBagEmpty(uint64_t lastTimeBagEmpty)  { _lastTimeBagEmpty = lastTimeBagEmpty; };
 
     bool getCurrentPacketIsColor() const { return _currentPacketIsColor; };
+    bool getCurrentPacketIsColorCoded() const { return _currentPacketIsColorCoded; };
     
     VoxelSceneStats stats;
+    VoxelPacketCompressor packetCompressor;
+
+    // for clients with a voxel cache, see VoxelSubtreeVersions.h
+    VoxelSubtreeVersions cachedSubtrees;    // what the client has cached, only changed with the tree lock held
+    VoxelSubtreeVersions reachedSubtrees;   // what the encoder reached in the client's view, until it's announced
+    VoxelSubtreeVersions announcedSubtrees; // what's been announced since the view last changed
     
 private:
     VoxelNodeData(const VoxelNodeData &);
     VoxelNodeData& operator= (const VoxelNodeData&);
     
     bool _viewSent;
+    PacketBuffer* _voxelPacketBuffer;
     unsigned char* _voxelPacket;
     unsigned char* _voxelPacketAt;
     int _voxelPacketAvailableBytes;
@@ -82,6 +96,7 @@ private:
     bool _viewFrustumChanging;
     bool _viewFrustumJustStoppedChanging;
     bool _currentPacketIsColor;
+    bool _currentPacketIsColorCoded;
 
     VoxelSendThread* _voxelSendThread;
 };
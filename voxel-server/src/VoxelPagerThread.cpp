@@ -0,0 +1,38 @@
+//
+//  VoxelPagerThread.cpp
+//  voxel-server
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Threaded or non-threaded paging of voxel subtrees in from disk
+//
+
+#include <SharedUtil.h>
+
+#include "VoxelPagerThread.h"
+#include "VoxelServer.h"
+
+VoxelPagerThread::VoxelPagerThread(VoxelTreePager* pager, int pagingInterval) :
+    _pager(pager),
+    _pagingInterval(pagingInterval),
+    _lastStatsPrinted(usecTimestampNow()) {
+}
+
+bool VoxelPagerThread::process() {
+    // don't sleep if there's more waiting than one pass loads, so a client moving into a new area is caught up quickly
+    if (_pager->getQueuedCount() <= VoxelTreePager::DEFAULT_MAX_LOADS_PER_PASS) {
+        usleep(_pagingInterval);
+    }
+
+    pthread_mutex_lock(&::treeLock);
+    _pager->processLoads();
+    pthread_mutex_unlock(&::treeLock);
+
+    uint64_t now = usecTimestampNow();
+    if (::displayVoxelStats && now - _lastStatsPrinted > STATS_INTERVAL_USECS) {
+        _pager->printStats();
+        _lastStatsPrinted = now;
+    }
+
+    return isStillRunning();  // keep running till they terminate us
+}
@@ -0,0 +1,33 @@
+//
+//  VoxelPagerThread.h
+//  voxel-server
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Threaded or non-threaded paging of voxel subtrees in from disk
+//
+
+#ifndef __voxel_server__VoxelPagerThread__
+#define __voxel_server__VoxelPagerThread__
+
+#include <GenericThread.h>
+#include <VoxelTreePager.h>
+
+/// Loads the subtrees the send threads have asked the pager for, and evicts the least recently used ones once the pager
+/// is over its budget. Holds the tree lock while it does either.
+class VoxelPagerThread : public virtual GenericThread {
+public:
+    static const int DEFAULT_PAGING_INTERVAL_USECS = 10 * 1000;
+    static const int STATS_INTERVAL_USECS = 10 * 1000 * 1000;
+
+    VoxelPagerThread(VoxelTreePager* pager, int pagingInterval = DEFAULT_PAGING_INTERVAL_USECS);
+protected:
+    /// Implements generic processing behavior for this thread.
+    virtual bool process();
+private:
+    VoxelTreePager* _pager;
+    int _pagingInterval;
+    uint64_t _lastStatsPrinted;
+};
+
+#endif // __voxel_server__VoxelPagerThread__
@@ -25,13 +25,51 @@ bool VoxelPersistThread::process() {
     usleep(_persistInterval * MSECS_TO_USECS);
 
 
-    // check the dirty bit and persist here...
-    if (_tree->isDirty()) {
-        printf("saving voxels to file %s...\n",_filename);
+    // when paging, the pager encodes the subtrees it has loaded while we hold the tree lock, then writes them out and
+    // copies the rest from the file it pages from without it, and only swaps the new file in with the lock held again
+    if (::voxelTreePager) {
+        pthread_mutex_lock(&::treeLock);
+        if (!_tree->isDirty()) {
+            pthread_mutex_unlock(&::treeLock);
+            return isStillRunning();
+        }
+        printf("saving paged voxels to file %s...\n", _filename);
+        ::voxelTreePager->beginPersist();
+        _tree->clearDirtyBit();
+        pthread_mutex_unlock(&::treeLock);
+
+        bool written = ::voxelTreePager->writePersistSnapshot();
+
+        pthread_mutex_lock(&::treeLock);
+        if (!::voxelTreePager->finishPersist(written)) {
+            _tree->setDirtyBit(); // try again next time
+        }
+        pthread_mutex_unlock(&::treeLock);
+        printf("DONE saving paged voxels to file...\n");
+        return isStillRunning();
+    }
+
+    // check the dirty bit and persist here... we pack the tree into a linear snapshot while holding the tree lock,
+    // then encode and write the file from the snapshot so edits and senders aren't held up by the file IO
+    pthread_mutex_lock(&::treeLock);
+    if (!_tree->isDirty()) {
+        pthread_mutex_unlock(&::treeLock);
+        return isStillRunning();
+    }
+    printf("saving voxels to file %s...\n",_filename);
+    bool haveSnapshot = _snapshot.build(_tree->rootNode);
+    if (!haveSnapshot) {
+        // too deep to pack, write it straight from the tree
         _tree->writeToSVOFile(_filename);
-        _tree->clearDirtyBit(); // tree is clean after saving
-        printf("DONE saving voxels to file...\n");
     }
+    _tree->clearDirtyBit(); // tree is clean after saving
+    pthread_mutex_unlock(&::treeLock);
+
+    if (haveSnapshot) {
+        _snapshot.writeToSVOFile(_filename);
+        _snapshot.clear();
+    }
+    printf("DONE saving voxels to file...\n");
 
     return isStillRunning();  // keep running till they terminate us
 }
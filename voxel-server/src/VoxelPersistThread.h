@@ -12,6 +12,7 @@
 #define __voxel_server__VoxelPersistThread__
 
 #include <GenericThread.h>
+#include <LinearVoxelTree.h>
 #include <NetworkPacket.h>
 #include <VoxelTree.h>
 
@@ -28,6 +29,7 @@ private:
     VoxelTree* _tree;
     const char* _filename;
     int _persistInterval;
+    LinearVoxelTree _snapshot;
 };
 
 #endif // __voxel_server__VoxelPersistThread__
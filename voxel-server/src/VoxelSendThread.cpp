@@ -8,6 +8,8 @@
 //  Threaded or non-threaded voxel packet sender
 //
 
+#include <algorithm>
+
 #include <NodeList.h>
 #include <SharedUtil.h>
 #include <PacketHeaders.h>
@@ -16,7 +18,11 @@
 #include "VoxelServer.h"
 
 VoxelSendThread::VoxelSendThread(uint16_t nodeID) :
-    _nodeID(nodeID) {
+    _nodeID(nodeID),
+    _packetChain(MAX_VOXEL_PACKET_SIZE - populateTypeAndVersion(_tempOutputBuffer, PACKET_TYPE_VOXEL_DATA)),
+    _sendBatch(NodeList::getInstance()->getNodeSocket()) {
+    // the batch is queued with the tree locked, so it holds the whole interval and is only sent once that's let go
+    _sendBatch.setGrowWhenFull(true);
 }
 
 bool VoxelSendThread::process() {
@@ -36,6 +42,9 @@ bool VoxelSendThread::process() {
             printf("nodeData->updateCurrentViewFrustum() changed=%s\n", debug::valueOf(viewFrustumChanged));
         }
         deepestLevelVoxelDistributor(node, nodeData, viewFrustumChanged);
+
+        // the interval's packets go out together, once the tree lock is let go
+        _sendBatch.flush();
     }
     
     // dynamically sleep until we need to fire off the next set of voxels
@@ -54,6 +63,18 @@ bool VoxelSendThread::process() {
 
 
 void VoxelSendThread::handlePacketSend(Node* node, VoxelNodeData* nodeData, int& trueBytesSent, int& truePacketsSent) {
+    const unsigned char* voxelPacket = nodeData->getPacket();
+    int voxelPacketLength = nodeData->getPacketLength();
+
+    // clients that asked for it get the packet compressed, unless compressing doesn't make it any smaller
+    if (nodeData->getWantCompression() && ::voxelCompressionLevel > 0) {
+        int compressedPacketLength = nodeData->packetCompressor.compress(voxelPacket, voxelPacketLength,
+                                                                         _compressedPacket);
+        if (compressedPacketLength) {
+            voxelPacket = _compressedPacket;
+            voxelPacketLength = compressedPacketLength;
+        }
+    }
 
     // If we've got a stats message ready to send, then see if we can piggyback them together
     if (nodeData->stats.isReadyToSend()) {
@@ -62,32 +83,64 @@ void VoxelSendThread::handlePacketSend(Node* node, VoxelNodeData* nodeData, int&
         int statsMessageLength = nodeData->stats.getStatsMessageLength();
 
         // If the size of the stats message and the voxel message will fit in a packet, then piggyback them
-        if (nodeData->getPacketLength() + statsMessageLength < MAX_PACKET_SIZE) {
+        if (voxelPacketLength + statsMessageLength < MAX_PACKET_SIZE) {
 
             // copy voxel message to back of stats message
-            memcpy(statsMessage + statsMessageLength, nodeData->getPacket(), nodeData->getPacketLength());
-            statsMessageLength += nodeData->getPacketLength();
+            memcpy(statsMessage + statsMessageLength, voxelPacket, voxelPacketLength);
+            statsMessageLength += voxelPacketLength;
 
             // actually send it
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(), statsMessage, statsMessageLength);
+            _sendBatch.queue(node->getActiveSocket(), statsMessage, statsMessageLength);
         } else {
             // not enough room in the packet, send two packets
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(), statsMessage, statsMessageLength);
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(),
-                                            nodeData->getPacket(), nodeData->getPacketLength());
+            _sendBatch.queue(node->getActiveSocket(), statsMessage, statsMessageLength);
+            _sendBatch.queue(node->getActiveSocket(), voxelPacket, voxelPacketLength);
         }
+    } else if (voxelPacket == nodeData->getPacket()) {
+        // just send the voxel packet, straight from the buffer it was written into
+        _sendBatch.queue(node->getActiveSocket(), nodeData->getPacketBuffer());
     } else {
-        // just send the voxel packet
-        NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(),
-                                        nodeData->getPacket(), nodeData->getPacketLength());
+        // the compressed packet is in our scratch buffer, which the next one overwrites, so that's copied
+        _sendBatch.queue(node->getActiveSocket(), voxelPacket, voxelPacketLength);
     }
     // remember to track our stats
-    nodeData->stats.packetSent(nodeData->getPacketLength());
-    trueBytesSent += nodeData->getPacketLength();
+    nodeData->stats.packetSent(voxelPacketLength);
+    trueBytesSent += voxelPacketLength;
     truePacketsSent++;
     nodeData->resetVoxelPacket();
 }
 
+// Clients with a voxel cache are told the versions of the subtrees reached in their view. The versions of subtrees they
+// already have go out right away, since those were left out and the client has to restore them from its cache. The
+// others wait until the whole scene has been sent, so that the client can check it has all of a subtree before caching it.
+void VoxelSendThread::sendSubtreeVersions(Node* node, VoxelNodeData* nodeData, bool sceneSent, int& trueBytesSent,
+                                          int& truePacketsSent) {
+    VoxelSubtreeVersions versionsToSend;
+    VoxelSubtreeVersions stillReached;
+    for (VoxelSubtreeVersions::const_iterator it = nodeData->reachedSubtrees.begin();
+            it != nodeData->reachedSubtrees.end(); it++) {
+        if (nodeData->announcedSubtrees.getVersionForKey(it->first) == it->second) {
+            continue;
+        }
+        if (sceneSent || nodeData->cachedSubtrees.getVersionForKey(it->first) == it->second) {
+            versionsToSend.setVersionForKey(it->first, it->second);
+            nodeData->announcedSubtrees.setVersionForKey(it->first, it->second);
+        } else {
+            stillReached.setVersionForKey(it->first, it->second);
+        }
+    }
+    nodeData->reachedSubtrees.swap(stillReached);
+
+    VoxelSubtreeVersions::const_iterator position = versionsToSend.begin();
+    while (position != versionsToSend.end()) {
+        int packetLength = versionsToSend.writeToPacket(_tempOutputBuffer, MAX_VOXEL_PACKET_SIZE,
+                                                        PACKET_TYPE_VOXEL_SUBTREE_VERSIONS, position);
+        _sendBatch.queue(node->getActiveSocket(), _tempOutputBuffer, packetLength);
+        trueBytesSent += packetLength;
+        truePacketsSent++;
+    }
+}
+
 /// Version of voxel distributor that sends the deepest LOD level at once
 void VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nodeData, bool viewFrustumChanged) {
 
@@ -104,10 +157,12 @@ void VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* no
     //     If we're moving, and the client asked for low res, then we force monochrome, otherwise, use 
     //     the clients requested color state.
     bool wantColor = LOW_RES_MONO && nodeData->getWantLowResMoving() && viewFrustumChanged ? false : nodeData->getWantColor();
+    bool wantColorCoding = wantColor && nodeData->getWantColorCoding();
 
     // If we have a packet waiting, and our desired want color, doesn't match the current waiting packets color
-    // then let's just send that waiting packet.    
-    if (wantColor != nodeData->getCurrentPacketIsColor()) {
+    // then let's just send that waiting packet. The same goes for the packet's color coding.
+    if (wantColor != nodeData->getCurrentPacketIsColor() ||
+            wantColorCoding != nodeData->getCurrentPacketIsColorCoded()) {
     
         if (nodeData->isPacketWaiting()) {
             if (::debugVoxelSending) {
@@ -179,14 +234,19 @@ void VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* no
         
         if (::displayVoxelStats) {
             nodeData->stats.printDebugDetails();
+            if (nodeData->getWantCompression()) {
+                nodeData->packetCompressor.printStats();
+            }
         }
         
         // start tracking our stats
         bool isFullScene = (!viewFrustumChanged || !nodeData->getWantDelta()) && nodeData->getViewFrustumJustStoppedChanging();
         
-        // If we're starting a full scene, then definitely we want to empty the nodeBag
+        // If we're starting a full scene, then definitely we want to empty the nodeBag, and the client may have dropped
+        // subtrees that it was told about, so it's told again
         if (isFullScene) {
             nodeData->nodeBag.deleteAll();
+            nodeData->announcedSubtrees.clear();
         }
         nodeData->stats.sceneStarted(isFullScene, viewFrustumChanged, ::serverTree.rootNode, ::jurisdiction);
 
@@ -196,64 +256,70 @@ void VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* no
 
     // If we have something in our nodeBag, then turn them into packets and send them out...
     if (!nodeData->nodeBag.isEmpty()) {
-        int bytesWritten = 0;
-        int packetsSentThisInterval = 0;
         uint64_t start = usecTimestampNow();
 
         bool shouldSendEnvironments = ::sendEnvironments && shouldDo(ENVIRONMENT_SEND_INTERVAL_USECS, VOXEL_SEND_INTERVAL_USECS);
-        while (packetsSentThisInterval < PACKETS_PER_CLIENT_PER_INTERVAL - (shouldSendEnvironments ? 1 : 0)) {        
+        int packetsThisInterval = std::max(PACKETS_PER_CLIENT_PER_INTERVAL - (shouldSendEnvironments ? 1 : 0), 1);
+
+        // the first packet of the chain fills out the one that's waiting to be sent
+        _packetChain.reset(packetsThisInterval, nodeData->getAvailable());
+
+        bool wantOcclusionCulling = nodeData->getWantOcclusionCulling();
+        CoverageMap* coverageMap = wantOcclusionCulling ? &nodeData->map : IGNORE_COVERAGE_MAP;
+        int boundaryLevelAdjust = viewFrustumChanged && nodeData->getWantLowResMoving() 
+                                  ? LOW_RES_MOVING_ADJUST : NO_BOUNDARY_ADJUST;
+
+        bool isFullScene = (!viewFrustumChanged || !nodeData->getWantDelta()) && 
+                         nodeData->getViewFrustumJustStoppedChanging();
+        bool wantVoxelCache = nodeData->getWantVoxelCache();
+        
+        EncodeBitstreamParams params(INT_MAX, &nodeData->getCurrentViewFrustum(), wantColor, 
+                                     WANT_EXISTS_BITS, DONT_CHOP, wantDelta, lastViewFrustum,
+                                     wantOcclusionCulling, coverageMap, boundaryLevelAdjust,
+                                     nodeData->getLastTimeBagEmpty(),
+                                     isFullScene, &nodeData->stats, ::jurisdiction, wantColorCoding,
+                                     wantVoxelCache ? &nodeData->cachedSubtrees : IGNORE_SUBTREE_VERSIONS,
+                                     wantVoxelCache ? &nodeData->reachedSubtrees : IGNORE_SUBTREE_VERSIONS);
+
+        // Each subtree is encoded across as many packets of the chain as it takes, so only what's left once the last
+        // packet is full goes back in the bag.
+        nodeData->stats.encodeStarted();
+        while (!nodeData->nodeBag.isEmpty() && !_packetChain.isFull()) {
             // Check to see if we're taking too long, and if so bail early...
             uint64_t now = usecTimestampNow();
             long elapsedUsec = (now - start);
-            long elapsedUsecPerPacket = (truePacketsSent == 0) ? 0 : (elapsedUsec / truePacketsSent);
+            long elapsedUsecPerPacket = elapsedUsec / _packetChain.getPacketCount();
             long usecRemaining = (VOXEL_SEND_INTERVAL_USECS - elapsedUsec);
             
             if (elapsedUsecPerPacket + SENDING_TIME_TO_SPARE > usecRemaining) {
                 if (::debugVoxelSending) {
                     printf("packetLoop() usecRemaining=%ld bailing early took %ld usecs to generate %d bytes in %d packets (%ld usec avg), %d nodes still to send\n",
-                            usecRemaining, elapsedUsec, trueBytesSent, truePacketsSent, elapsedUsecPerPacket,
-                            nodeData->nodeBag.count());
+                            usecRemaining, elapsedUsec, _packetChain.getTotalBytes(), _packetChain.getPacketCount(),
+                            elapsedUsecPerPacket, nodeData->nodeBag.count());
                 }
                 break;
-            }            
-            
-            if (!nodeData->nodeBag.isEmpty()) {
-                VoxelNode* subTree = nodeData->nodeBag.extract();
-                bool wantOcclusionCulling = nodeData->getWantOcclusionCulling();
-                CoverageMap* coverageMap = wantOcclusionCulling ? &nodeData->map : IGNORE_COVERAGE_MAP;
-                int boundaryLevelAdjust = viewFrustumChanged && nodeData->getWantLowResMoving() 
-                                          ? LOW_RES_MOVING_ADJUST : NO_BOUNDARY_ADJUST;
-
-                bool isFullScene = (!viewFrustumChanged || !nodeData->getWantDelta()) && 
-                                 nodeData->getViewFrustumJustStoppedChanging();
-                
-                EncodeBitstreamParams params(INT_MAX, &nodeData->getCurrentViewFrustum(), wantColor, 
-                                             WANT_EXISTS_BITS, DONT_CHOP, wantDelta, lastViewFrustum,
-                                             wantOcclusionCulling, coverageMap, boundaryLevelAdjust,
-                                             nodeData->getLastTimeBagEmpty(),
-                                             isFullScene, &nodeData->stats, ::jurisdiction);
-                      
-                nodeData->stats.encodeStarted();
-                bytesWritten = serverTree.encodeTreeBitstream(subTree, _tempOutputBuffer, MAX_VOXEL_PACKET_SIZE - 1,
-                                                              nodeData->nodeBag, params);
-                nodeData->stats.encodeStopped();
-
-                if (nodeData->getAvailable() >= bytesWritten) {
-                    nodeData->writeToPacket(_tempOutputBuffer, bytesWritten);
-                } else {
-                    handlePacketSend(node, nodeData, trueBytesSent, truePacketsSent);
-                    packetsSentThisInterval++;
-                    nodeData->resetVoxelPacket();
-                    nodeData->writeToPacket(_tempOutputBuffer, bytesWritten);
-                }
-            } else {
-                if (nodeData->isPacketWaiting()) {
-                    handlePacketSend(node, nodeData, trueBytesSent, truePacketsSent);
-                    nodeData->resetVoxelPacket();
-                }
-                packetsSentThisInterval = PACKETS_PER_CLIENT_PER_INTERVAL; // done for now, no nodes left
+            }
+
+            serverTree.encodeTreeIntoPackets(nodeData->nodeBag.extract(), _packetChain, nodeData->nodeBag, params);
+        }
+        nodeData->stats.encodeStopped();
+
+        // All but the last packet of the chain are full. The last one waits for the next interval if there's room left in
+        // it and more of the scene still to send.
+        for (int i = 0; i < _packetChain.getPacketCount(); i++) {
+            if (_packetChain.getPacketLength(i) > 0) {
+                nodeData->writeToPacket(_packetChain.getPacket(i), _packetChain.getPacketLength(i));
+            }
+            bool isLastPacket = (i == _packetChain.getPacketCount() - 1);
+            if (nodeData->isPacketWaiting() &&
+                    (!isLastPacket || _packetChain.isFull() || nodeData->nodeBag.isEmpty())) {
+                handlePacketSend(node, nodeData, trueBytesSent, truePacketsSent);
             }
         }
+        if (nodeData->getWantVoxelCache()) {
+            sendSubtreeVersions(node, nodeData, nodeData->nodeBag.isEmpty(), trueBytesSent, truePacketsSent);
+        }
+
         // send the environment packet
         if (shouldSendEnvironments) {
             int numBytesPacketHeader = populateTypeAndVersion(_tempOutputBuffer, PACKET_TYPE_ENVIRONMENT_DATA);
@@ -264,7 +330,7 @@ void VoxelSendThread::deepestLevelVoxelDistributor(Node* node, VoxelNodeData* no
                 envPacketLength += environmentData[i].getBroadcastData(_tempOutputBuffer + envPacketLength);
             }
             
-            NodeList::getInstance()->getNodeSocket()->send(node->getActiveSocket(), _tempOutputBuffer, envPacketLength);
+            _sendBatch.queue(node->getActiveSocket(), _tempOutputBuffer, envPacketLength);
             trueBytesSent += envPacketLength;
             truePacketsSent++;
         }
@@ -13,8 +13,10 @@
 
 #include <GenericThread.h>
 #include <NetworkPacket.h>
+#include <UDPSendBatch.h>
 #include <VoxelTree.h>
 #include <VoxelNodeBag.h>
+#include <VoxelPacketChain.h>
 #include "VoxelNodeData.h"
 
 /// Threaded processor for sending voxel packets to a single client
@@ -29,9 +31,14 @@ private:
     uint16_t _nodeID;
 
     void handlePacketSend(Node* node, VoxelNodeData* nodeData, int& trueBytesSent, int& truePacketsSent);
+    void sendSubtreeVersions(Node* node, VoxelNodeData* nodeData, bool sceneSent, int& trueBytesSent,
+                             int& truePacketsSent);
     void deepestLevelVoxelDistributor(Node* node, VoxelNodeData* nodeData, bool viewFrustumChanged);
     
     unsigned char _tempOutputBuffer[MAX_VOXEL_PACKET_SIZE];
+    unsigned char _compressedPacket[VoxelPacketCompressor::MAX_COMPRESSED_PACKET_SIZE];
+    VoxelPacketChain _packetChain;
+    UDPSendBatch _sendBatch;
 };
 
 #endif // __voxel_server__VoxelSendThread__
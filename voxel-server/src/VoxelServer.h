@@ -14,6 +14,7 @@
 #include <EnvironmentData.h>
 #include <JurisdictionSender.h>
 #include <VoxelTree.h>
+#include <VoxelTreePager.h>
 
 #include "VoxelServerPacketProcessor.h"
 
@@ -35,6 +36,7 @@ extern const char* LOCAL_VOXELS_PERSIST_FILE;
 extern const char* VOXELS_PERSIST_FILE;
 extern char voxelPersistFilename[MAX_FILENAME_LENGTH];
 extern int PACKETS_PER_CLIENT_PER_INTERVAL;
+extern int voxelCompressionLevel; // zlib level for clients that want compressed packets, 0 to never compress
 
 extern VoxelTree serverTree; // this IS a reaveraging tree 
 extern bool wantVoxelPersist;
@@ -52,6 +54,7 @@ extern JurisdictionMap* jurisdiction;
 extern JurisdictionSender* jurisdictionSender;
 extern VoxelServerPacketProcessor* voxelServerPacketProcessor;
 extern pthread_mutex_t treeLock;
+extern VoxelTreePager* voxelTreePager; // NULL unless the tree is being paged in from disk
 
 
 
@@ -11,6 +11,7 @@
 #include <PacketHeaders.h>
 #include <PerfStat.h>
 
+#include "VoxelNodeData.h"
 #include "VoxelServer.h"
 #include "VoxelServerPacketProcessor.h"
 
@@ -57,7 +58,13 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
                 delete[] vertices;
             }
         
+            pthread_mutex_lock(&::treeLock);
+            if (::voxelTreePager) {
+                // edits have to be applied to the whole subtree, so it can be written back
+                ::voxelTreePager->makeResident(voxelData);
+            }
             serverTree.readCodeColorBufferToTree(voxelData, destructive);
+            pthread_mutex_unlock(&::treeLock);
             // skip to next
             voxelData += voxelDataSize;
             atByte += voxelDataSize;
@@ -73,6 +80,14 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
 
         // Send these bits off to the VoxelTree class to process them
         pthread_mutex_lock(&::treeLock);
+        if (::voxelTreePager) {
+            int atByte = numBytesPacketHeader + sizeof(unsigned short int);
+            while (atByte < packetLength) {
+                unsigned char* voxelCode = &packetData[atByte];
+                ::voxelTreePager->makeResident(voxelCode);
+                atByte += bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(voxelCode)) + SIZE_OF_COLOR_DATA;
+            }
+        }
         ::serverTree.processRemoveVoxelBitstream((unsigned char*)packetData, packetLength);
         pthread_mutex_unlock(&::treeLock);
 
@@ -81,6 +96,17 @@ void VoxelServerPacketProcessor::processPacket(sockaddr& senderAddress, unsigned
         if (node) {
             node->setLastHeardMicrostamp(usecTimestampNow());
         }
+    } else if (packetData[0] == PACKET_TYPE_VOXEL_CACHED_SUBTREES) {
+
+        // clients with a voxel cache tell us what they have, so that we can leave it out of what we send them
+        Node* node = NodeList::getInstance()->nodeWithAddress(&senderAddress);
+        if (node && node->getLinkedData()) {
+            VoxelNodeData* nodeData = (VoxelNodeData*) node->getLinkedData();
+            pthread_mutex_lock(&::treeLock);
+            nodeData->cachedSubtrees.readFromPacket(packetData, packetLength);
+            pthread_mutex_unlock(&::treeLock);
+            node->setLastHeardMicrostamp(usecTimestampNow());
+        }
     } else if (packetData[0] == PACKET_TYPE_Z_COMMAND) {
 
         // the Z command is a special command that allows the sender to send the voxel server high level semantic
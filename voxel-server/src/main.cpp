@@ -6,16 +6,21 @@
 //  Copyright (c) 2012 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 
+#include <EventLoop.h>
 #include <OctalCode.h>
 #include <NodeList.h>
 #include <NodeTypes.h>
+#include <UDPReceiveBatch.h>
 #include <EnvironmentData.h>
 #include <VoxelTree.h>
+#include <IndexedSVOFile.h>
+#include <VoxelPacketCompressor.h>
 #include "VoxelNodeData.h"
 #include <SharedUtil.h>
 #include <PacketHeaders.h>
@@ -24,6 +29,7 @@
 #include <JurisdictionSender.h>
 
 #include "NodeWatcher.h"
+#include "VoxelPagerThread.h"
 #include "VoxelPersistThread.h"
 #include "VoxelSendThread.h"
 #include "VoxelServerPacketProcessor.h"
@@ -43,6 +49,7 @@ const char* LOCAL_VOXELS_PERSIST_FILE = "resources/voxels.svo";
 const char* VOXELS_PERSIST_FILE = "/etc/highfidelity/voxel-server/resources/voxels.svo";
 char voxelPersistFilename[MAX_FILENAME_LENGTH];
 int PACKETS_PER_CLIENT_PER_INTERVAL = 10;
+int voxelCompressionLevel = VoxelPacketCompressor::DEFAULT_COMPRESSION_LEVEL;
 VoxelTree serverTree(true); // this IS a reaveraging tree 
 bool wantVoxelPersist = true;
 bool wantLocalDomain = false;
@@ -59,6 +66,8 @@ JurisdictionMap* jurisdiction = NULL;
 JurisdictionSender* jurisdictionSender = NULL;
 VoxelServerPacketProcessor* voxelServerPacketProcessor = NULL;
 VoxelPersistThread* voxelPersistThread = NULL;
+VoxelTreePager* voxelTreePager = NULL;
+VoxelPagerThread* voxelPagerThread = NULL;
 pthread_mutex_t treeLock;
 NodeWatcher nodeWatcher; // used to cleanup AGENT data when agents are killed
 
@@ -68,6 +77,59 @@ void attachVoxelNodeDataToNode(Node* newNode) {
     }
 }
 
+void checkInWithDomainServer(void* context) {
+    NodeList::getInstance()->sendDomainServerCheckIn();
+}
+
+// handles everything that has arrived since the last batch, the context being the UDPReceiveBatch to read it into
+void processReceivedPackets(void* context) {
+    UDPReceiveBatch* receiveBatch = (UDPReceiveBatch*)context;
+    int packetCount = NodeList::getInstance()->getNodeSocket()->receiveBatch(*receiveBatch);
+    for (int i = 0; i < packetCount; i++) {
+        unsigned char* packetData = receiveBatch->getPacketData(i);
+        ssize_t packetLength = receiveBatch->getPacketLength(i);
+        sockaddr& senderAddress = *receiveBatch->getSenderAddress(i);
+        if (packetVersionMatch(packetData)) {
+
+            int numBytesPacketHeader = numBytesForPacketHeader(packetData);
+
+            if (packetData[0] == PACKET_TYPE_HEAD_DATA) {
+                // If we got a PACKET_TYPE_HEAD_DATA, then we're talking to an NODE_TYPE_AVATAR, and we
+                // need to make sure we have it in our nodeList.
+                uint16_t nodeID = 0;
+                unpackNodeId(packetData + numBytesPacketHeader, &nodeID);
+                Node* node = NodeList::getInstance()->addOrUpdateNode(&senderAddress,
+                                                       &senderAddress,
+                                                       NODE_TYPE_AGENT,
+                                                       nodeID);
+
+                // a full node list has no room for it, in which case the packet is dropped
+                if (node) {
+                    NodeList::getInstance()->updateNodeWithData(node, packetData, packetLength);
+                }
+            } else if (packetData[0] == PACKET_TYPE_PING) {
+                // If the packet is a ping, let processNodeData handle it.
+                NodeList::getInstance()->processNodeData(&senderAddress, packetData, packetLength);
+            } else if (packetData[0] == PACKET_TYPE_DOMAIN) {
+                NodeList::getInstance()->processNodeData(&senderAddress, packetData, packetLength);
+            } else if (packetData[0] == PACKET_TYPE_VOXEL_JURISDICTION_REQUEST) {
+                if (::jurisdictionSender) {
+                    PacketBuffer* packet = receiveBatch->takePacket(i);
+                    ::jurisdictionSender->queueReceivedPacket(senderAddress, packet);
+                    packet->release();
+                }
+            } else if (::voxelServerPacketProcessor) {
+                // the processor gets the packet in the buffer it was received into, rather than a copy of it
+                PacketBuffer* packet = receiveBatch->takePacket(i);
+                ::voxelServerPacketProcessor->queueReceivedPacket(senderAddress, packet);
+                packet->release();
+            } else {
+                printf("unknown packet ignored... packetData[0]=%c\n", packetData[0]);
+            }
+        }
+    }
+}
+
 int main(int argc, const char * argv[]) {
     pthread_mutex_init(&::treeLock, NULL);
     
@@ -152,6 +214,9 @@ int main(int argc, const char * argv[]) {
     nodeList->linkedDataCreateCallback = &attachVoxelNodeDataToNode;
     nodeList->startSilentNodeRemovalThread();
     
+    // Check to see if the user passed in a command line option for the size of the socket's receive buffer
+    nodeList->getNodeSocket()->setServerReceiveBufferSize(argc, argv);
+    
     srand((unsigned)time(0));
     
     const char* DISPLAY_VOXEL_STATS = "--displayVoxelStats";
@@ -190,10 +255,52 @@ int main(int argc, const char * argv[]) {
             strcpy(voxelPersistFilename, ::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE);
         }
 
+        // with a budget of resident subtrees, only the top of the tree is loaded, and the rest is paged in as it's seen
+        const char* MAX_RESIDENT_SUBTREES = "--maxResidentSubtrees";
+        const char* maxResidentSubtreesParameter = getCmdOption(argc, argv, MAX_RESIDENT_SUBTREES);
+        if (maxResidentSubtreesParameter) {
+            int maxResidentSubtrees = atoi(maxResidentSubtreesParameter);
+            if (maxResidentSubtrees < 1) {
+                maxResidentSubtrees = VoxelTreePager::DEFAULT_MAX_RESIDENT_SUBTREES;
+            }
+            printf("maxResidentSubtrees=%d\n", maxResidentSubtrees);
+
+            // old style files are loaded whole once, and written back out in the indexed format that can be paged
+            FILE* persistFile = fopen(::voxelPersistFilename, "rb");
+            if (persistFile) {
+                fclose(persistFile);
+                if (!IndexedSVOFile::isIndexedSVOFile(::voxelPersistFilename)) {
+                    printf("converting %s to an indexed SVO file...\n", ::voxelPersistFilename);
+                    ::serverTree.readFromSVOFile(::voxelPersistFilename);
+                    ::serverTree.reaverageVoxelColors(::serverTree.rootNode);
+                    IndexedSVOFile::write(&::serverTree, ::voxelPersistFilename);
+                }
+            } else {
+                IndexedSVOFile::write(&::serverTree, ::voxelPersistFilename);
+            }
+
+            ::voxelTreePager = new VoxelTreePager(&::serverTree, maxResidentSubtrees);
+            if (!::voxelTreePager->open(::voxelPersistFilename)) {
+                printf("couldn't page voxels from %s, loading them all instead\n", ::voxelPersistFilename);
+                delete ::voxelTreePager;
+                ::voxelTreePager = NULL;
+            }
+        }
+
         printf("loading voxels from file: %s...\n", voxelPersistFilename);
 
-        persistantFileRead = ::serverTree.readFromSVOFile(::voxelPersistFilename);
-        if (persistantFileRead) {
+        if (::voxelTreePager) {
+            // the indexed file was written from a reaveraged tree, so there's no need to reaverage the top of it
+            persistantFileRead = true;
+            ::serverTree.setPager(::voxelTreePager);
+            ::voxelPagerThread = new VoxelPagerThread(::voxelTreePager);
+            if (::voxelPagerThread) {
+                ::voxelPagerThread->initialize(true);
+            }
+        } else {
+            persistantFileRead = ::serverTree.readFromSVOFile(::voxelPersistFilename);
+        }
+        if (persistantFileRead && !::voxelTreePager) {
             PerformanceWarning warn(::shouldShowAnimationDebug,
                                     "persistVoxelsWhenDirty() - reaverageVoxelColors()", ::shouldShowAnimationDebug);
             
@@ -235,6 +342,14 @@ int main(int argc, const char * argv[]) {
         printf("packetsPerSecond=%s PACKETS_PER_CLIENT_PER_INTERVAL=%d\n", packetsPerSecond, PACKETS_PER_CLIENT_PER_INTERVAL);
     }
     
+    // Check to see if the user passed in a command line option for the compression of packets to clients that want it
+    const char* VOXEL_COMPRESSION_LEVEL = "--voxelCompressionLevel";
+    const char* voxelCompressionLevelParameter = getCmdOption(argc, argv, VOXEL_COMPRESSION_LEVEL);
+    if (voxelCompressionLevelParameter) {
+        ::voxelCompressionLevel = std::max(0, std::min(atoi(voxelCompressionLevelParameter), 9));
+        printf("voxelCompressionLevel=%d\n", ::voxelCompressionLevel);
+    }
+
     // for now, initialize the environments with fixed values
     environmentData[1].setID(1);
     environmentData[1].setGravity(1.0f);
@@ -248,12 +363,7 @@ int main(int argc, const char * argv[]) {
     environmentData[2].setAtmosphereOuterRadius(0.1875f * TREE_SCALE * 1.05f);
     environmentData[2].setScatteringWavelengths(glm::vec3(0.475f, 0.570f, 0.650f)); // swaps red and blue
 
-    sockaddr senderAddress;
-    
-    unsigned char *packetData = new unsigned char[MAX_PACKET_SIZE];
-    ssize_t packetLength;
-    
-    timeval lastDomainServerCheckIn = {};
+    UDPReceiveBatch receiveBatch;
 
     // set up our jurisdiction broadcaster...
     ::jurisdictionSender = new JurisdictionSender(::jurisdiction);
@@ -267,47 +377,11 @@ int main(int argc, const char * argv[]) {
         ::voxelServerPacketProcessor->initialize(true);
     }
 
-    // loop to send to nodes requesting data
-    while (true) {
-
-        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
-        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
-            gettimeofday(&lastDomainServerCheckIn, NULL);
-            NodeList::getInstance()->sendDomainServerCheckIn();
-        }
-        
-        if (nodeList->getNodeSocket()->receive(&senderAddress, packetData, &packetLength) &&
-            packetVersionMatch(packetData)) {
-
-            int numBytesPacketHeader = numBytesForPacketHeader(packetData);
-
-            if (packetData[0] == PACKET_TYPE_HEAD_DATA) {
-                // If we got a PACKET_TYPE_HEAD_DATA, then we're talking to an NODE_TYPE_AVATAR, and we
-                // need to make sure we have it in our nodeList.
-                uint16_t nodeID = 0;
-                unpackNodeId(packetData + numBytesPacketHeader, &nodeID);
-                Node* node = NodeList::getInstance()->addOrUpdateNode(&senderAddress,
-                                                       &senderAddress,
-                                                       NODE_TYPE_AGENT,
-                                                       nodeID);
-
-                NodeList::getInstance()->updateNodeWithData(node, packetData, packetLength);
-            } else if (packetData[0] == PACKET_TYPE_PING) {
-                // If the packet is a ping, let processNodeData handle it.
-                NodeList::getInstance()->processNodeData(&senderAddress, packetData, packetLength);
-            } else if (packetData[0] == PACKET_TYPE_DOMAIN) {
-                NodeList::getInstance()->processNodeData(&senderAddress, packetData, packetLength);
-            } else if (packetData[0] == PACKET_TYPE_VOXEL_JURISDICTION_REQUEST) {
-                if (::jurisdictionSender) {
-                    ::jurisdictionSender->queueReceivedPacket(senderAddress, packetData, packetLength);
-                }
-            } else if (::voxelServerPacketProcessor) {
-                ::voxelServerPacketProcessor->queueReceivedPacket(senderAddress, packetData, packetLength);
-            } else {
-                printf("unknown packet ignored... packetData[0]=%c\n", packetData[0]);
-            }
-        }
-    }
+    // handle packets as they arrive, waking otherwise only to check in with the domain server
+    EventLoop eventLoop;
+    eventLoop.addTimer(DOMAIN_SERVER_CHECK_IN_USECS, checkInWithDomainServer, NULL, true);
+    eventLoop.watchSocket(nodeList->getNodeSocket(), processReceivedPackets, &receiveBatch);
+    eventLoop.run();
     
     if (::jurisdiction) {
         delete ::jurisdiction;
@@ -327,6 +401,16 @@ int main(int argc, const char * argv[]) {
         ::voxelPersistThread->terminate();
         delete ::voxelPersistThread;
     }
+
+    if (::voxelPagerThread) {
+        ::voxelPagerThread->terminate();
+        delete ::voxelPagerThread;
+    }
+
+    if (::voxelTreePager) {
+        ::serverTree.setPager(NULL);
+        delete ::voxelTreePager;
+    }
     
     // tell our NodeList we're done with notifications
     nodeList->removeHook(&nodeWatcher);